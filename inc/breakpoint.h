@@ -19,10 +19,34 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-/* Ensure that uint8_t is defined */
-#ifndef UINT8_T
-typedef unsigned char uint8_t
-#endif
+#ifndef BREAKPOINT_H
+#define BREAKPOINT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "condition.h"
+
+/* Longest code a fast tracepoint overwrites: its jump, and the rest
+ * of the last instruction the jump lands in.
+ */
+#define FAST_PATCH_MAX          (5 + 15 - 1)
+
+/*
+ * The part of a fast tracepoint that lives in the debugee, see
+ * inc/fast_trace.h.
+ */
+struct fast_tracepoint {
+    /* Page holding the trampoline the jump goes to */
+    unsigned long   tramp;
+
+    /* Code replaced by the jump */
+    uint8_t         saved[FAST_PATCH_MAX];
+    unsigned int    len;
+
+    /* Records drained from the ring so far */
+    unsigned long   hits;
+};
 
 /*                                                                                                                                        
  * This structure represents a single breakpoint.
@@ -42,12 +66,86 @@ struct breakpoint {
      * list. 
      */
     unsigned int    number;
+
+    /* Relocated copy of the instruction under the breakpoint, used
+     * to resume without removing the INT3 (see inc/displaced.h).
+     */
+    void            *displaced;
+    int             displaced_state;
+
+    /* Only stop when this holds, NULL to always stop */
+    struct condition *condition;
+
+    /* BREAKPOINT_INT3, or BREAKPOINT_FAST for a tracepoint that logs
+     * the registers without stopping. `fast` is only set for those.
+     */
+    int             kind;
+    struct fast_tracepoint *fast;
+
+    /* Internal breakpoint of `next`, `finish` or `until`, deleted as
+     * soon as the debugee stops. The TEMP_* frames it stops in.
+     */
+    int             temporary;
+
+    /* INT3 of a block of the coverage, deleted when the block first
+     * runs. It is only in the table by address, and has no number.
+     */
+    int             coverage;
+};
+
+/* Values of `kind` */
+#define BREAKPOINT_INT3         0
+#define BREAKPOINT_FAST         1
+
+/* Flags of `temporary` */
+#define TEMP_FRAME              1   /* in the frame stepped in, or outer */
+#define TEMP_RETURN             2   /* once that frame returned */
+
+/* Values of `displaced_state` */
+#define DISPLACED_NONE          0   /* not relocated yet */
+#define DISPLACED_READY         1   /* `displaced` holds the copy */
+#define DISPLACED_UNSUPPORTED   2   /* cannot be relocated */
+
+/*
+ * This structure represents a single watchpoint: a range of memory
+ * the debugee stops on accessing. Watchpoints are kept in a list of
+ * their own and numbered separately from breakpoints.
+ */
+struct watchpoint {
+    unsigned int    number;
+    void            *addr;
+    size_t          len;
+    int             type;
+
+    /* Whether it is programmed in the debugee */
+    int             enabled;
+
+    /* Deleted by the user, only kept to replay the stops at it */
+    int             deleted;
+
+    /* Debug registers it takes, one bit per register (see
+     * inc/debugreg.h)
+     */
+    unsigned int    slots;
+
+    /* Content of the range when the debugee last stopped at the
+     * watchpoint, and before that. Only for WATCH_WRITE.
+     */
+    uint8_t         *value;
+    uint8_t         *old_value;
+
+    struct sl_list_node entry;
 };
 
+/* Values of `type` */
+#define WATCH_WRITE             0
+#define WATCH_ACCESS            1   /* reads and writes */
+#define WATCH_EXEC              2
+
 /**
  * Sets the `enabled` flag of the breakpoint structure
  */
-void inline __set_breakpoint_enabled(struct breakpoint *bp)
+static inline void __set_breakpoint_enabled(struct breakpoint *bp)
 {
     bp->enabled = 1;
 }
@@ -55,25 +153,26 @@ void inline __set_breakpoint_enabled(struct breakpoint *bp)
 /**
  * Unsets the `enabled` flag of the breakpoint structure
  */
-void inline __unset_breakpoint_enabled(struct breakpoint *bp)
+static inline void __unset_breakpoint_enabled(struct breakpoint *bp)
 {
     bp->enabled = 0;
 }
 
 /**
- * Enables the breakpoint by setting the `enabled` flag
+ * Check whether the breakpoint is currently enabled
  */
-void breakpoint_enable(struct breakpoint *bp)
+int breakpoint_is_enabled(struct breakpoint *bp)
 {
-    __set_breakpoint_enabled(bp);
+    return bp->enabled;
 }
 
 /**
- * Disables the breakpoint by unsetting the `enabled` flag
+ * Check whether the breakpoint is an INT3 written in the debugee,
+ * i.e whether the debugee can stop at it.
  */
-void breakpoint_disable(struct breakpoint *bp)
+int breakpoint_has_int3(struct breakpoint *bp)
 {
-    __unset_breakpoint_enabled(bp);
+    return bp->enabled && bp->kind == BREAKPOINT_INT3;
 }
 
 /**/
@@ -89,3 +188,5 @@ uint8_t breakpoint_get_saved_data(struct breakpoint *bp)
 {
     return bp->saved_data;
 }
+
+#endif /* BREAKPOINT_H */
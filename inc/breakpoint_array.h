@@ -19,7 +19,10 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include <breakpoint.h>
+#ifndef BREAKPOINT_ARRAY_H
+#define BREAKPOINT_ARRAY_H
+
+#include "breakpoint.h"
 
 // Error codes
 #define ENOBP   -1      // No breakpoint set
@@ -27,8 +30,9 @@
 #define MAX_BREAKPOINTS_PER_LIST    128
 
 /*
- * This structure represents a linked list node entry which
- * stores an array of breakpoint pointers.
+ * This structure represents an array of breakpoint pointers. The
+ * arrays of the debugger are numbered by `pos`, and those that are not
+ * full are linked through `entry`.
  */
 struct breakpoint_array {
     struct breakpoint * array[MAX_BREAKPOINTS_PER_LIST];
@@ -37,6 +41,7 @@ struct breakpoint_array {
 
     /* Lowest free index.*/
     int                 lf_idx;
+    unsigned int        pos;
     struct sl_list_node entry;
 };
 
@@ -62,6 +67,8 @@ int __breakpoint_array_next_free(struct breakpoint_array *bpa)
     for (i = 0; i < MAX_BREAKPOINTS_PER_LIST; i++)
         if (bpa->array[i] == NULL)
             return i;   
+
+    return ENOBP;
 }
 
 /**
@@ -97,6 +104,30 @@ int breakpoint_array_add_breakpoint(struct breakpoint_array *bpa,
     return idx;
 }
 
+/**
+ * Add a breakpoint pointer to the breakpoint array at the free index
+ * `idx`, e.g for a copy of a breakpoint to keep its number.
+ *
+ * @param bpa - Pointer to the `breakpoint_array` structure
+ * @param idx - index in the array, which must be free
+ * @param bp  - Pointer to the breakpoint to store in array
+ */
+void breakpoint_array_set_breakpoint(struct breakpoint_array *bpa,
+        unsigned int idx, struct breakpoint *bp)
+{
+    if (idx >= MAX_BREAKPOINTS_PER_LIST || bpa->array[idx] != NULL)
+        return;
+
+    bpa->array[idx] = bp;
+
+    bpa->count++;
+    if (bpa->count == MAX_BREAKPOINTS_PER_LIST)
+        bpa->full = 1;
+
+    if ((int)idx == bpa->lf_idx)
+        bpa->lf_idx = __breakpoint_array_next_free(bpa);
+}
+
 /**
  * Delete a breakpoint pointer at the index `idx` from the array 
  *
@@ -106,14 +137,18 @@ int breakpoint_array_add_breakpoint(struct breakpoint_array *bpa,
  * @param bpa - pointer to breakpoint array
  * @param idx - index of breakpoint in the array
  */
-void breakpoint_array_del_breakpoint(struct breakpoint *bpa, 
+void breakpoint_array_del_breakpoint(struct breakpoint_array *bpa, 
         unsigned int idx)
 {
-    if (!bpa->count || bpa->idx >= MAX_BREAKPOINTS_PER_LIST)
+    if (!bpa->count || idx >= MAX_BREAKPOINTS_PER_LIST)
         return;
         
+    if (bpa->array[idx] == NULL)
+        return;
+
     bpa->array[idx] = NULL;
     bpa->count--;
+    bpa->full = 0;
     bpa->lf_idx = __breakpoint_array_next_free(bpa);
 }
 
@@ -163,3 +198,5 @@ struct breakpoint *breakpoint_array_get_breakpoint(struct breakpoint_array *bpa,
 
     return bpa->array[idx];
 }
+
+#endif /* BREAKPOINT_ARRAY_H */
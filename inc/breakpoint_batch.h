@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Breakpoints enabled or disabled together.
+ *
+ * Writing an INT3 takes a read of the code it replaces and a write,
+ * which adds up when thousands of breakpoints are written at once, for
+ * a coverage or when the memory of the debugee is replaced. The edits
+ * of a batch are sorted by address, and those of a page done with one
+ * read of the code between the first and the last of them, and one
+ * write of it patched.
+ *
+ * Fast tracepoints replace more than a byte, and are enabled and
+ * disabled one by one when the batch is committed.
+ *
+ * Memory Allocation: the batch owns its array of edits, not the
+ * breakpoints.
+ */
+
+#ifndef BREAKPOINT_BATCH_H
+#define BREAKPOINT_BATCH_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "breakpoint.h"
+#include "debugger.h"
+#include "fast_trace.h"
+#include "memory.h"
+
+/* Values of `op` */
+#define BATCH_ENABLE    0   /* save the code, write an INT3 */
+#define BATCH_DISABLE   1   /* write the saved code back */
+#define BATCH_REWRITE   2   /* write the INT3 again, the code is kept */
+
+struct breakpoint_edit {
+    struct breakpoint * bp;
+    int                 op;
+};
+
+struct breakpoint_batch {
+    struct breakpoint_edit *edits;
+    unsigned long       count;
+    unsigned long       alloc;
+};
+
+/**
+ * Initialize an empty batch.
+ */
+void breakpoint_batch_init(struct breakpoint_batch *batch)
+{
+    batch->edits = NULL;
+    batch->count = 0;
+    batch->alloc = 0;
+}
+
+/**
+ * Free the edits of a batch, which are dropped if not committed.
+ */
+void breakpoint_batch_destroy(struct breakpoint_batch *batch)
+{
+    free(batch->edits);
+    breakpoint_batch_init(batch);
+}
+
+/**
+ * Add an edit of breakpoint `bp` to a batch. Enabling a breakpoint that
+ * is enabled, and disabling one that is not, do nothing.
+ *
+ * @param op - one of BATCH_*
+ * @return   - 0 on success, -1 if out of memory
+ */
+int breakpoint_batch_add(struct breakpoint_batch *batch,
+        struct breakpoint *bp, int op)
+{
+    struct breakpoint_edit *edits;
+
+    if ((op == BATCH_ENABLE) == breakpoint_is_enabled(bp) ||
+            (op == BATCH_REWRITE && !breakpoint_has_int3(bp)))
+        return 0;
+
+    if (batch->count == batch->alloc) {
+        batch->alloc = batch->alloc ? batch->alloc * 2 : 64;
+        edits = realloc(batch->edits, batch->alloc * sizeof(*edits));
+        if (edits == NULL)
+            return -1;
+        batch->edits = edits;
+    }
+    batch->edits[batch->count].bp = bp;
+    batch->edits[batch->count].op = op;
+    batch->count++;
+    return 0;
+}
+
+static int __breakpoint_edit_compare(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)((const struct breakpoint_edit *)a)->bp->addr;
+    uintptr_t y = (uintptr_t)((const struct breakpoint_edit *)b)->bp->addr;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Do `n` edits of INT3s on a page, sorted by address, with a single
+ * write.
+ *
+ * @return - 0 on success, -1 if the code couldn't be read or written
+ */
+static int __breakpoint_batch_page(struct debugger *dbg,
+        struct breakpoint_edit *edits, unsigned long n)
+{
+    unsigned long lo = (unsigned long)edits[0].bp->addr, i, off;
+    size_t len = (unsigned long)edits[n - 1].bp->addr - lo + 1;
+    uint8_t code[PAGE_SIZE];
+
+    /* The code between the breakpoints is written back as it is */
+    if ((len > 1 || edits[0].op == BATCH_ENABLE) &&
+            read_memory(dbg, (void *)lo, code, len) != (ssize_t)len)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        off = (unsigned long)edits[i].bp->addr - lo;
+        if (edits[i].op == BATCH_DISABLE) {
+            code[off] = breakpoint_get_saved_data(edits[i].bp);
+            continue;
+        }
+        if (edits[i].op == BATCH_ENABLE)
+            breakpoint_save_data(edits[i].bp, code[off]);
+        code[off] = 0xcc;
+    }
+    if (patch_code(dbg, (void *)lo, code, len) != (ssize_t)len)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (edits[i].op == BATCH_ENABLE)
+            __set_breakpoint_enabled(edits[i].bp);
+        else if (edits[i].op == BATCH_DISABLE)
+            __unset_breakpoint_enabled(edits[i].bp);
+    }
+    return 0;
+}
+
+/**
+ * Do the edits of a batch, which is then empty. Breakpoints that could
+ * not be written are left as they were.
+ *
+ * @return - the number of breakpoints left as they were
+ */
+unsigned long breakpoint_batch_commit(struct debugger *dbg,
+        struct breakpoint_batch *batch)
+{
+    struct breakpoint_edit *edits = batch->edits;
+    unsigned long i, j, n = 0, failed = 0;
+    unsigned long page;
+
+    /* Fast tracepoints first, the edits of INT3s are moved to the front */
+    for (i = 0; i < batch->count; i++) {
+        if (edits[i].bp->kind != BREAKPOINT_FAST) {
+            edits[n++] = edits[i];
+            continue;
+        }
+        if (edits[i].op == BATCH_DISABLE)
+            fast_trace_disable(dbg, edits[i].bp);
+        else if (edits[i].op == BATCH_ENABLE &&
+                fast_trace_enable(dbg, edits[i].bp) < 0)
+            failed++;
+    }
+
+    qsort(edits, n, sizeof(*edits), __breakpoint_edit_compare);
+    for (i = 0; i < n; i = j) {
+        page = (unsigned long)edits[i].bp->addr & PAGE_MASK;
+        for (j = i + 1; j < n &&
+                ((unsigned long)edits[j].bp->addr & PAGE_MASK) == page; j++)
+            ;
+        if (__breakpoint_batch_page(dbg, edits + i, j - i) < 0) {
+            printf("Cannot %s memory at %p: %s\n",
+                    edits[i].op == BATCH_DISABLE ? "restore" : "access",
+                    edits[i].bp->addr, strerror(errno));
+            failed += j - i;
+        }
+    }
+
+    batch->count = 0;
+    return failed;
+}
+
+#endif /* BREAKPOINT_BATCH_H */
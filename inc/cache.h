@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * On-disk cache of the indexes built from a program, e.g of its symbols.
+ *
+ * A cache file is named after the build-id of the program, in
+ * $XDG_CACHE_HOME/retrobugr, or ~/.cache/retrobugr. It is laid out as:
+ *
+ *   struct cache_header
+ *   section data, each aligned to CACHE_ALIGN
+ *
+ * Sections are the arrays of the indexes as they are in memory, so that
+ * a reader maps the file and uses them in place. An empty section is
+ * one the program has no index for. Files are written to a temporary
+ * name and renamed, readers never see a partial file.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC         "RBCACHE"
+#define CACHE_VERSION       1
+#define CACHE_ALIGN         8
+
+/* Bytes of a build-id that name the file, longer ones are cut */
+#define CACHE_ID_MAX        32
+
+/* Sections of a cache file */
+#define CACHE_SYMS_STATIC   0   /* struct symbol of .symtab */
+#define CACHE_NAMES_STATIC  1   /* struct symbol_name of .symtab */
+#define CACHE_SYMS_DYNAMIC  2
+#define CACHE_NAMES_DYNAMIC 3
+#define CACHE_SECTIONS      4
+
+struct cache_header {
+    char                magic[8];
+    uint32_t            version;
+    uint32_t            id_len;
+    uint8_t             id[CACHE_ID_MAX];
+
+    /* Size of the program, a cheap check against build-id clashes */
+    uint64_t            file_size;
+
+    struct {
+        uint64_t        offset;
+        uint64_t        size;
+    } sections[CACHE_SECTIONS];
+};
+
+struct cache {
+    const uint8_t       *map;
+    size_t              size;
+    const struct cache_header *hdr;
+};
+
+/*
+ * Put the path of the cache file of build-id `id` in `path`, and
+ * create the cache directory if `create` is set.
+ *
+ * @return - 0 on success, -1 if there is no home directory
+ */
+static int __cache_path(const uint8_t *id, unsigned int id_len, int create,
+        char *path)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    unsigned int i;
+    int len;
+
+    if (base != NULL && base[0] == '/') {
+        len = snprintf(path, PATH_MAX, "%s/retrobugr/", base);
+    } else if (home != NULL && home[0] == '/') {
+        len = snprintf(path, PATH_MAX, "%s/.cache", home);
+        if (create && len < PATH_MAX)
+            mkdir(path, 0700);
+        len = snprintf(path, PATH_MAX, "%s/.cache/retrobugr/", home);
+    } else {
+        return -1;
+    }
+    if (len < 0 || len + 2 * CACHE_ID_MAX >= PATH_MAX)
+        return -1;
+    if (create) {
+        path[len - 1] = '\0';
+        mkdir(path, 0700);
+        path[len - 1] = '/';
+    }
+
+    for (i = 0; i < id_len; i++)
+        len += sprintf(path + len, "%02x", id[i]);
+    return 0;
+}
+
+/**
+ * Open the cache of the program of build-id `id`.
+ *
+ * @param id_len    - length of the build-id, at most CACHE_ID_MAX
+ * @param file_size - size of the program
+ * @return          - the cache, or NULL if there is none or it is not
+ *                    one of this program
+ */
+struct cache *cache_open(const uint8_t *id, unsigned int id_len,
+        unsigned long file_size)
+{
+    const struct cache_header *hdr;
+    char path[PATH_MAX];
+    struct cache *cache;
+    struct stat st;
+    int fd, i;
+
+    if (__cache_path(id, id_len, 0, path) < 0)
+        return NULL;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 ||
+            (size_t)st.st_size < sizeof(struct cache_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        close(fd);
+        return NULL;
+    }
+    cache->size = st.st_size;
+    cache->map = mmap(NULL, cache->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cache->map == MAP_FAILED) {
+        free(cache);
+        return NULL;
+    }
+
+    hdr = (const struct cache_header *)cache->map;
+    if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+            hdr->version != CACHE_VERSION || hdr->id_len != id_len ||
+            memcmp(hdr->id, id, id_len) != 0 ||
+            hdr->file_size != file_size)
+        goto invalid;
+    for (i = 0; i < CACHE_SECTIONS; i++) {
+        if (hdr->sections[i].offset % CACHE_ALIGN != 0 ||
+                hdr->sections[i].offset > cache->size ||
+                hdr->sections[i].size >
+                cache->size - hdr->sections[i].offset)
+            goto invalid;
+    }
+    cache->hdr = hdr;
+    return cache;
+
+invalid:
+    munmap((void *)cache->map, cache->size);
+    free(cache);
+    return NULL;
+}
+
+/**
+ * Get section `sec` of a cache, used in place.
+ *
+ * @param size - where to store the size of the section
+ * @return     - the section, or NULL if it is empty
+ */
+const void *cache_section(struct cache *cache, unsigned int sec,
+        unsigned long *size)
+{
+    *size = cache->hdr->sections[sec].size;
+    if (*size == 0)
+        return NULL;
+    return cache->map + cache->hdr->sections[sec].offset;
+}
+
+/**
+ * Close a cache opened with `cache_open()`. The sections are not
+ * valid anymore.
+ */
+void cache_close(struct cache *cache)
+{
+    munmap((void *)cache->map, cache->size);
+    free(cache);
+}
+
+/*
+ * Write all of `len` bytes of `buf` at `offset`.
+ */
+static int __cache_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = pwrite(fd, buf, len, offset);
+        if (n <= 0)
+            return -1;
+        buf = (const uint8_t *)buf + n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * Write the cache of the program of build-id `id`, replacing the one
+ * it may have.
+ *
+ * @param id_len    - length of the build-id, at most CACHE_ID_MAX
+ * @param file_size - size of the program
+ * @param data      - the CACHE_SECTIONS sections, NULL if empty
+ * @param sizes     - size of each section
+ * @return          - 0 on success, -1 on error
+ */
+int cache_write(const uint8_t *id, unsigned int id_len,
+        unsigned long file_size, const void *const *data,
+        const unsigned long *sizes)
+{
+    char path[PATH_MAX], tmp[PATH_MAX + 16];
+    struct cache_header hdr;
+    uint64_t offset;
+    int fd, i;
+
+    if (__cache_path(id, id_len, 1, path) < 0)
+        return -1;
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    hdr.version = CACHE_VERSION;
+    hdr.id_len = id_len;
+    memcpy(hdr.id, id, id_len);
+    hdr.file_size = file_size;
+
+    offset = (sizeof(hdr) + CACHE_ALIGN - 1) & ~(CACHE_ALIGN - 1UL);
+    for (i = 0; i < CACHE_SECTIONS; i++) {
+        if (data[i] == NULL || sizes[i] == 0)
+            continue;
+        hdr.sections[i].offset = offset;
+        hdr.sections[i].size = sizes[i];
+        if (__cache_pwrite(fd, data[i], sizes[i], offset) < 0)
+            goto fail;
+        offset = (offset + sizes[i] + CACHE_ALIGN - 1) &
+            ~(CACHE_ALIGN - 1UL);
+    }
+
+    if (__cache_pwrite(fd, &hdr, sizeof(hdr), 0) < 0)
+        goto fail;
+    if (close(fd) < 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+
+fail:
+    close(fd);
+    unlink(tmp);
+    return -1;
+}
+
+#endif /* CACHE_H */
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checkpoints of the debugee.
+ *
+ * A checkpoint is a copy-on-write fork of the stopped debugee, parked
+ * under ptrace and never resumed. Going back to a checkpoint forks the
+ * parked process once more, so that a checkpoint can be restarted from
+ * any number of times.
+ *
+ * The debugger keeps at most MAX_CHECKPOINTS of them in a ring, the
+ * oldest checkpoint being evicted when a new one is taken.
+ *
+ * Checkpoints also record the tick of the debugee's history they were
+ * taken at (see inc/history.h), so that reverse execution can start
+ * replaying from the closest one.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "breakpoint.h"
+#include "history.h"
+
+#define MAX_CHECKPOINTS     16
+
+/* Stops of the debugee between two automatic checkpoints */
+#define CHECKPOINT_INTERVAL 32
+
+/*
+ * A breakpoint that was written into the debugee when the checkpoint
+ * was taken. Needed to put the right code back on restart, since the
+ * breakpoints may have changed since. `len` is 1 for an INT3, and the
+ * length of the jump for a fast tracepoint.
+ */
+struct checkpoint_bp {
+    void            *addr;
+    uint8_t         saved[FAST_PATCH_MAX];
+    unsigned int    len;
+};
+
+/*
+ * This structure represents a single checkpoint.
+ */
+struct checkpoint {
+    /* Returned to the user, unique for the whole session */
+    unsigned int            number;
+
+    /* The parked copy of the debugee */
+    pid_t                   pid;
+    struct user_regs_struct regs;
+    int                     pending_signal;
+
+    /* Position in the history, TICK_NONE if not in it anymore */
+    unsigned long           tick;
+
+    struct checkpoint_bp    *bps;
+    unsigned int            nbps;
+
+    /* Time it took to take the checkpoint, in microseconds */
+    double                  cost_us;
+};
+
+/*
+ * The bounded pool of checkpoints. `first` is the index of the oldest
+ * checkpoint in `ring`.
+ */
+struct checkpoint_pool {
+    struct checkpoint       ring[MAX_CHECKPOINTS];
+    unsigned int            first;
+    unsigned int            count;
+    unsigned int            next_number;
+};
+
+/**
+ * Initialize an empty checkpoint pool.
+ */
+void checkpoint_pool_init(struct checkpoint_pool *pool)
+{
+    pool->first = 0;
+    pool->count = 0;
+    pool->next_number = 1;
+}
+
+/**
+ * Get the i-th oldest checkpoint of the pool.
+ *
+ * @param pool - pointer to the checkpoint pool
+ * @param i    - position, 0 being the oldest checkpoint
+ */
+struct checkpoint *checkpoint_pool_nth(struct checkpoint_pool *pool,
+        unsigned int i)
+{
+    if (i >= pool->count)
+        return NULL;
+
+    return &pool->ring[(pool->first + i) % MAX_CHECKPOINTS];
+}
+
+/**
+ * Find the checkpoint number `number`.
+ *
+ * @return - the checkpoint, or NULL if it does not exist (anymore)
+ */
+struct checkpoint *checkpoint_pool_get(struct checkpoint_pool *pool,
+        unsigned int number)
+{
+    struct checkpoint *ckpt;
+    unsigned int i;
+
+    for (i = 0; i < pool->count; i++) {
+        ckpt = checkpoint_pool_nth(pool, i);
+        if (ckpt->number == number)
+            return ckpt;
+    }
+    return NULL;
+}
+
+/**
+ * Find the latest checkpoint taken at or before `tick` of the history.
+ *
+ * @return - the checkpoint, or NULL if there is none
+ */
+struct checkpoint *checkpoint_pool_before(struct checkpoint_pool *pool,
+        unsigned long tick)
+{
+    struct checkpoint *ckpt, *best = NULL;
+    unsigned int i;
+
+    for (i = 0; i < pool->count; i++) {
+        ckpt = checkpoint_pool_nth(pool, i);
+        if (ckpt->tick == TICK_NONE || ckpt->tick > tick)
+            continue;
+        if (best == NULL || ckpt->tick > best->tick)
+            best = ckpt;
+    }
+    return best;
+}
+
+/**
+ * Find the earliest checkpoint that is part of the history.
+ *
+ * @return - the checkpoint, or NULL if there is none
+ */
+struct checkpoint *checkpoint_pool_earliest(struct checkpoint_pool *pool)
+{
+    struct checkpoint *ckpt, *best = NULL;
+    unsigned int i;
+
+    for (i = 0; i < pool->count; i++) {
+        ckpt = checkpoint_pool_nth(pool, i);
+        if (ckpt->tick == TICK_NONE)
+            continue;
+        if (best == NULL || ckpt->tick < best->tick)
+            best = ckpt;
+    }
+    return best;
+}
+
+/**
+ * Take the checkpoints taken at or after `tick` out of the history,
+ * because the history from there on was truncated. They can still be
+ * restarted.
+ */
+void checkpoint_pool_detach(struct checkpoint_pool *pool, unsigned long tick)
+{
+    struct checkpoint *ckpt;
+    unsigned int i;
+
+    for (i = 0; i < pool->count; i++) {
+        ckpt = checkpoint_pool_nth(pool, i);
+        if (ckpt->tick != TICK_NONE && ckpt->tick >= tick)
+            ckpt->tick = TICK_NONE;
+    }
+}
+
+/**
+ * Check whether adding a checkpoint would evict the oldest one.
+ */
+int checkpoint_pool_full(struct checkpoint_pool *pool)
+{
+    return pool->count == MAX_CHECKPOINTS;
+}
+
+/**
+ * Remove the oldest checkpoint from the pool.
+ *
+ * Note that the caller is responsible for getting rid of the process
+ * of the checkpoint, and must do so before calling this function.
+ */
+void checkpoint_pool_drop_oldest(struct checkpoint_pool *pool)
+{
+    struct checkpoint *ckpt = checkpoint_pool_nth(pool, 0);
+
+    if (ckpt == NULL)
+        return;
+
+    free(ckpt->bps);
+    pool->first = (pool->first + 1) % MAX_CHECKPOINTS;
+    pool->count--;
+}
+
+/**
+ * Reserve the slot of a new checkpoint and attribute it a number.
+ *
+ * Note that the caller is responsible for checking that the pool is
+ * not full prior to calling this function.
+ */
+struct checkpoint *checkpoint_pool_add(struct checkpoint_pool *pool)
+{
+    struct checkpoint *ckpt;
+
+    ckpt = &pool->ring[(pool->first + pool->count) % MAX_CHECKPOINTS];
+    pool->count++;
+
+    ckpt->number = pool->next_number++;
+    ckpt->bps = NULL;
+    ckpt->nbps = 0;
+    ckpt->tick = TICK_NONE;
+    return ckpt;
+}
+
+/**
+ * Give back the slot of the newest checkpoint, e.g because taking
+ * it failed. Its number is not reused.
+ */
+void checkpoint_pool_drop_newest(struct checkpoint_pool *pool)
+{
+    struct checkpoint *ckpt = checkpoint_pool_nth(pool, pool->count - 1);
+
+    if (ckpt == NULL)
+        return;
+
+    free(ckpt->bps);
+    pool->count--;
+}
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,696 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Breakpoint conditions.
+ *
+ * A condition is a C like expression over the registers and memory of
+ * the debugee, e.g
+ *
+ *   $rdi == 3 && *(int *)($rsp + 8) > 100
+ *
+ * Registers are written `$rax`, `$pc`..., `*(type *)addr` reads memory
+ * where type is char, short, int, long, optionally unsigned, or one of
+ * the <stdint.h> types, and a plain `*addr` reads 8 bytes. Values are 64
+ * bit signed integers.
+ *
+ * Conditions are compiled once into a stack based bytecode, since they
+ * may be evaluated millions of times before they hold. Constant sub
+ * expressions are folded, and the memory loads at constant addresses
+ * are gathered so that they are all done by a single read_memory_v()
+ * before the bytecode runs. Memory is read the way the debugger reads
+ * it elsewhere (see inc/memory.h). `&&` and `||` skip their right operand, and
+ * its memory loads, when the left one decides.
+ */
+
+#ifndef CONDITION_H
+#define CONDITION_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct debugger;
+
+/*
+ * How conditions read the memory of the debugee: read_memory_v() of
+ * inc/memory.h, which includes this file through inc/breakpoint.h.
+ */
+typedef int (*cond_read_t)(struct debugger *dbg, const struct iovec *local,
+        const struct iovec *remote, unsigned int n);
+
+/* Limits of a compiled condition */
+#define COND_STACK_MAX      32
+#define COND_MAX_LOADS      32
+#define COND_MAX_LEN        0xffff
+
+/* Opcodes, followed by their operands */
+#define COND_PUSH       0   /* 8 byte value */
+#define COND_REG        1   /* 1 byte register index */
+#define COND_LOAD       2   /* 1 byte type, address on the stack */
+#define COND_LOADC      3   /* 1 byte index in `loads` */
+#define COND_NEG        4
+#define COND_NOT        5
+#define COND_LNOT       6
+#define COND_BOOL       7
+#define COND_ANDJ       8   /* 2 byte offset, jump if false */
+#define COND_ORJ        9   /* 2 byte offset, jump if true */
+#define COND_ADD        10
+#define COND_SUB        11
+#define COND_MUL        12
+#define COND_DIV        13
+#define COND_MOD        14
+#define COND_AND        15
+#define COND_OR         16
+#define COND_XOR        17
+#define COND_SHL        18
+#define COND_SHR        19
+#define COND_EQ         20
+#define COND_NE         21
+#define COND_LT         22
+#define COND_LE         23
+#define COND_GT         24
+#define COND_GE         25
+
+/* A load type is its size, with COND_SIGNED for signed types */
+#define COND_SIGNED     0x80
+#define COND_SIZE(t)    ((t) & 0x0f)
+
+/*
+ * A memory load at a constant address.
+ */
+struct cond_load {
+    uint64_t            addr;
+    uint8_t             type;
+};
+
+struct condition {
+    /* As typed by the user */
+    char                *text;
+
+    uint8_t             *code;
+    size_t              len;
+
+    struct cond_load    loads[COND_MAX_LOADS];
+    unsigned int        nloads;
+};
+
+struct __cond_parser {
+    const char          *p;
+    struct condition    *c;
+    size_t              capacity;
+    int                 depth;
+    char                *err;
+    size_t              errlen;
+};
+
+static const struct {
+    const char          *name;
+    int                 index;
+} __cond_regs[] = {
+#define COND_REG_ENTRY(r) { #r, offsetof(struct user_regs_struct, r) / 8 }
+    COND_REG_ENTRY(rax), COND_REG_ENTRY(rbx), COND_REG_ENTRY(rcx),
+    COND_REG_ENTRY(rdx), COND_REG_ENTRY(rsi), COND_REG_ENTRY(rdi),
+    COND_REG_ENTRY(rbp), COND_REG_ENTRY(rsp), COND_REG_ENTRY(r8),
+    COND_REG_ENTRY(r9), COND_REG_ENTRY(r10), COND_REG_ENTRY(r11),
+    COND_REG_ENTRY(r12), COND_REG_ENTRY(r13), COND_REG_ENTRY(r14),
+    COND_REG_ENTRY(r15), COND_REG_ENTRY(rip), COND_REG_ENTRY(eflags),
+    COND_REG_ENTRY(orig_rax), COND_REG_ENTRY(fs_base),
+    COND_REG_ENTRY(gs_base),
+    { "pc", offsetof(struct user_regs_struct, rip) / 8 },
+    { "sp", offsetof(struct user_regs_struct, rsp) / 8 },
+    { "fp", offsetof(struct user_regs_struct, rbp) / 8 },
+#undef COND_REG_ENTRY
+};
+
+static const struct {
+    const char          *name;
+    uint8_t             type;
+} __cond_types[] = {
+    { "char", 1 | COND_SIGNED },    { "unsigned char", 1 },
+    { "short", 2 | COND_SIGNED },   { "unsigned short", 2 },
+    { "int", 4 | COND_SIGNED },     { "unsigned int", 4 },
+    { "unsigned", 4 },
+    { "long", 8 | COND_SIGNED },    { "unsigned long", 8 },
+    { "int8_t", 1 | COND_SIGNED },  { "uint8_t", 1 },
+    { "int16_t", 2 | COND_SIGNED }, { "uint16_t", 2 },
+    { "int32_t", 4 | COND_SIGNED }, { "uint32_t", 4 },
+    { "int64_t", 8 | COND_SIGNED }, { "uint64_t", 8 },
+};
+
+/* Binary operators, longest first so that "<=" is not taken for "<" */
+static const struct {
+    const char          *op;
+    int                 prec;
+    uint8_t             code;
+} __cond_binops[] = {
+    { "||", 1, COND_ORJ },  { "&&", 2, COND_ANDJ },
+    { "==", 6, COND_EQ },   { "!=", 6, COND_NE },
+    { "<=", 7, COND_LE },   { ">=", 7, COND_GE },
+    { "<<", 8, COND_SHL },  { ">>", 8, COND_SHR },
+    { "|", 3, COND_OR },    { "^", 4, COND_XOR },
+    { "&", 5, COND_AND },   { "<", 7, COND_LT },
+    { ">", 7, COND_GT },    { "+", 9, COND_ADD },
+    { "-", 9, COND_SUB },   { "*", 10, COND_MUL },
+    { "/", 10, COND_DIV },  { "%", 10, COND_MOD },
+};
+
+#define COND_ARRAY_SIZE(a)  (sizeof(a) / sizeof((a)[0]))
+
+static int __cond_error(struct __cond_parser *ps, const char *what)
+{
+    if (ps->err[0] == '\0')
+        snprintf(ps->err, ps->errlen, "%s near `%.16s'", what, ps->p);
+    return -1;
+}
+
+static void __cond_skip_spaces(struct __cond_parser *ps)
+{
+    while (isspace((unsigned char)*ps->p))
+        ps->p++;
+}
+
+/*
+ * Consume `s` if the input continues with it.
+ */
+static int __cond_accept(struct __cond_parser *ps, const char *s)
+{
+    __cond_skip_spaces(ps);
+    if (strncmp(ps->p, s, strlen(s)) != 0)
+        return 0;
+    ps->p += strlen(s);
+    return 1;
+}
+
+static int __cond_emit(struct __cond_parser *ps, uint8_t op,
+        const void *arg, size_t len, int depth)
+{
+    struct condition *c = ps->c;
+    uint8_t *tmp;
+
+    if (c->len + 1 + len > COND_MAX_LEN)
+        return __cond_error(ps, "Condition too long");
+
+    if (c->len + 1 + len > ps->capacity) {
+        tmp = realloc(c->code, ps->capacity * 2 + 1 + len);
+        if (tmp == NULL)
+            return __cond_error(ps, "Out of memory");
+        c->code = tmp;
+        ps->capacity = ps->capacity * 2 + 1 + len;
+    }
+
+    c->code[c->len++] = op;
+    memcpy(c->code + c->len, arg, len);
+    c->len += len;
+
+    ps->depth += depth;
+    if (ps->depth > COND_STACK_MAX)
+        return __cond_error(ps, "Condition too complex");
+    return 0;
+}
+
+/*
+ * Check whether the code from `start` to `end` only pushes a constant.
+ */
+static int __cond_is_const(struct __cond_parser *ps, size_t start,
+        size_t end, int64_t *value)
+{
+    if (end - start != 1 + sizeof(*value) ||
+            ps->c->code[start] != COND_PUSH)
+        return 0;
+    memcpy(value, ps->c->code + start + 1, sizeof(*value));
+    return 1;
+}
+
+/*
+ * Replace the code from `start` on by a push of `value`.
+ */
+static int __cond_fold(struct __cond_parser *ps, size_t start,
+        int64_t value, int popped)
+{
+    ps->c->len = start;
+    ps->depth -= popped;
+    return __cond_emit(ps, COND_PUSH, &value, sizeof(value), 1);
+}
+
+/*
+ * Apply unary or binary operator `op` to values of the stack, `b` being
+ * unused for unary ones.
+ *
+ * @return - 0 on success, -1 on division by zero
+ */
+static inline int __cond_apply(uint8_t op, int64_t a, int64_t b,
+        int64_t *r)
+{
+    switch (op) {
+    case COND_NEG:  *r = -(uint64_t)a; break;
+    case COND_NOT:  *r = ~a; break;
+    case COND_LNOT: *r = !a; break;
+    case COND_BOOL: *r = !!a; break;
+    case COND_ADD:  *r = (uint64_t)a + b; break;
+    case COND_SUB:  *r = (uint64_t)a - b; break;
+    case COND_MUL:  *r = (uint64_t)a * b; break;
+    case COND_DIV:
+    case COND_MOD:
+        if (b == 0 || (a == INT64_MIN && b == -1))
+            return -1;
+        *r = op == COND_DIV ? a / b : a % b;
+        break;
+    case COND_AND:  *r = a & b; break;
+    case COND_OR:   *r = a | b; break;
+    case COND_XOR:  *r = a ^ b; break;
+    case COND_SHL:  *r = (uint64_t)a << (b & 63); break;
+    case COND_SHR:  *r = (uint64_t)a >> (b & 63); break;
+    case COND_EQ:   *r = a == b; break;
+    case COND_NE:   *r = a != b; break;
+    case COND_LT:   *r = a < b; break;
+    case COND_LE:   *r = a <= b; break;
+    case COND_GT:   *r = a > b; break;
+    case COND_GE:   *r = a >= b; break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Emit unary operator `op` for the operand compiled from `start` on.
+ */
+static int __cond_unop(struct __cond_parser *ps, uint8_t op, size_t start)
+{
+    int64_t a, r;
+
+    if (__cond_is_const(ps, start, ps->c->len, &a) &&
+            __cond_apply(op, a, 0, &r) == 0)
+        return __cond_fold(ps, start, r, 1);
+    return __cond_emit(ps, op, NULL, 0, 0);
+}
+
+static int __cond_expr(struct __cond_parser *ps, int min_prec);
+static int __cond_unary(struct __cond_parser *ps);
+
+/*
+ * Parse the `type *)` of a cast, the opening parenthesis being consumed.
+ *
+ * @return - the load type, 0 if this is not a cast
+ */
+static uint8_t __cond_cast(struct __cond_parser *ps)
+{
+    const char *start = ps->p, *end;
+    char name[32];
+    unsigned int i, n = 0;
+
+    __cond_skip_spaces(ps);
+    for (end = ps->p; isalnum((unsigned char)*end) || *end == '_' ||
+            *end == ' '; end++)
+        ;
+    while (end > ps->p && end[-1] == ' ')
+        end--;
+
+    if (end - ps->p >= (long)sizeof(name))
+        return 0;
+    for (; ps->p < end; ps->p++)
+        if (*ps->p != ' ' || name[n - 1] != ' ')
+            name[n++] = *ps->p;
+    name[n] = '\0';
+
+    for (i = 0; i < COND_ARRAY_SIZE(__cond_types); i++) {
+        if (strcmp(name, __cond_types[i].name) == 0 &&
+                __cond_accept(ps, "*") && __cond_accept(ps, ")"))
+            return __cond_types[i].type;
+    }
+
+    ps->p = start;
+    return 0;
+}
+
+/*
+ * Parse a memory load, the `*` being consumed.
+ */
+static int __cond_load(struct __cond_parser *ps)
+{
+    struct condition *c = ps->c;
+    const char *p = ps->p;
+    uint8_t type = 0, idx;
+    size_t start;
+    int64_t addr;
+
+    if (__cond_accept(ps, "(")) {
+        type = __cond_cast(ps);
+        if (type == 0)
+            ps->p = p;
+    }
+    if (type == 0)
+        type = 8 | COND_SIGNED;
+
+    start = c->len;
+    if (__cond_unary(ps) < 0)
+        return -1;
+
+    if (!__cond_is_const(ps, start, c->len, &addr) ||
+            c->nloads == COND_MAX_LOADS)
+        return __cond_emit(ps, COND_LOAD, &type, 1, 0);
+
+    /* Done before the bytecode runs, together with the other ones */
+    idx = c->nloads++;
+    c->loads[idx].addr = addr;
+    c->loads[idx].type = type;
+    c->len = start;
+    ps->depth--;
+    return __cond_emit(ps, COND_LOADC, &idx, 1, 1);
+}
+
+static int __cond_primary(struct __cond_parser *ps)
+{
+    unsigned int i;
+    uint8_t index;
+    int64_t value;
+    size_t len;
+    char *end;
+
+    __cond_skip_spaces(ps);
+
+    if (__cond_accept(ps, "(")) {
+        if (__cond_expr(ps, 1) < 0)
+            return -1;
+        if (!__cond_accept(ps, ")"))
+            return __cond_error(ps, "Missing )");
+        return 0;
+    }
+
+    if (*ps->p == '$') {
+        ps->p++;
+        for (i = 0; i < COND_ARRAY_SIZE(__cond_regs); i++) {
+            len = strlen(__cond_regs[i].name);
+            if (strncmp(ps->p, __cond_regs[i].name, len) == 0 &&
+                    !isalnum((unsigned char)ps->p[len])) {
+                ps->p += len;
+                index = __cond_regs[i].index;
+                return __cond_emit(ps, COND_REG, &index, 1, 1);
+            }
+        }
+        return __cond_error(ps, "Unknown register");
+    }
+
+    if (isdigit((unsigned char)*ps->p)) {
+        value = strtoull(ps->p, &end, 0);
+        ps->p = end;
+        return __cond_emit(ps, COND_PUSH, &value, sizeof(value), 1);
+    }
+
+    return __cond_error(ps, "Syntax error");
+}
+
+static int __cond_unary(struct __cond_parser *ps)
+{
+    static const struct {
+        const char  *op;
+        uint8_t     code;
+    } unops[] = { { "-", COND_NEG }, { "~", COND_NOT }, { "!", COND_LNOT } };
+    unsigned int i;
+    size_t start;
+
+    for (i = 0; i < COND_ARRAY_SIZE(unops); i++) {
+        if (__cond_accept(ps, unops[i].op)) {
+            start = ps->c->len;
+            if (__cond_unary(ps) < 0)
+                return -1;
+            return __cond_unop(ps, unops[i].code, start);
+        }
+    }
+
+    if (__cond_accept(ps, "*"))
+        return __cond_load(ps);
+    return __cond_primary(ps);
+}
+
+/*
+ * Precedence climbing: parse operands and the binary operators binding
+ * at least as tight as `min_prec`.
+ */
+static int __cond_expr(struct __cond_parser *ps, int min_prec)
+{
+    struct condition *c = ps->c;
+    size_t start = c->len, rhs, jump;
+    unsigned int i;
+    int64_t a, b, r;
+    uint16_t off;
+
+    if (__cond_unary(ps) < 0)
+        return -1;
+
+    for (;;) {
+        __cond_skip_spaces(ps);
+        for (i = 0; i < COND_ARRAY_SIZE(__cond_binops); i++)
+            if (strncmp(ps->p, __cond_binops[i].op,
+                        strlen(__cond_binops[i].op)) == 0)
+                break;
+        if (i == COND_ARRAY_SIZE(__cond_binops) ||
+                __cond_binops[i].prec < min_prec)
+            return 0;
+        ps->p += strlen(__cond_binops[i].op);
+
+        if (__cond_binops[i].code == COND_ANDJ ||
+                __cond_binops[i].code == COND_ORJ) {
+            off = 0;
+            jump = c->len;
+            if (__cond_emit(ps, __cond_binops[i].code, &off, sizeof(off),
+                        -1) < 0 ||
+                    __cond_expr(ps, __cond_binops[i].prec + 1) < 0 ||
+                    __cond_emit(ps, COND_BOOL, NULL, 0, 0) < 0)
+                return -1;
+            off = c->len - (jump + 1 + sizeof(off));
+            memcpy(c->code + jump + 1, &off, sizeof(off));
+            continue;
+        }
+
+        rhs = c->len;
+        if (__cond_expr(ps, __cond_binops[i].prec + 1) < 0)
+            return -1;
+
+        if (__cond_is_const(ps, start, rhs, &a) &&
+                __cond_is_const(ps, rhs, c->len, &b) &&
+                __cond_apply(__cond_binops[i].code, a, b, &r) == 0) {
+            if (__cond_fold(ps, start, r, 2) < 0)
+                return -1;
+            continue;
+        }
+        if (__cond_emit(ps, __cond_binops[i].code, NULL, 0, -1) < 0)
+            return -1;
+    }
+}
+
+/**
+ * Free a condition returned by `condition_compile()`.
+ */
+void condition_free(struct condition *c)
+{
+    if (c == NULL)
+        return;
+    free(c->text);
+    free(c->code);
+    free(c);
+}
+
+/**
+ * Compile the condition `text`.
+ *
+ * @param text   - the expression
+ * @param err    - where to store what is wrong with the expression
+ * @param errlen - size of `err`
+ * @return       - the compiled condition, or NULL on error
+ */
+struct condition *condition_compile(const char *text, char *err,
+        size_t errlen)
+{
+    struct __cond_parser ps;
+    struct condition *c;
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL || (c->text = strdup(text)) == NULL) {
+        free(c);
+        snprintf(err, errlen, "Out of memory");
+        return NULL;
+    }
+
+    memset(&ps, 0, sizeof(ps));
+    ps.p = text;
+    ps.c = c;
+    ps.err = err;
+    ps.errlen = errlen;
+    err[0] = '\0';
+
+    if (__cond_expr(&ps, 1) < 0 || (__cond_skip_spaces(&ps), *ps.p != '\0')) {
+        __cond_error(&ps, "Syntax error");
+        condition_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+/*
+ * Widen a value of load type `type` read from memory.
+ */
+static inline int64_t __cond_extend(uint64_t raw, uint8_t type)
+{
+    unsigned int bits = COND_SIZE(type) * 8;
+
+    if (bits == 64)
+        return raw;
+    raw &= (1ULL << bits) - 1;
+    if ((type & COND_SIGNED) && (raw >> (bits - 1)))
+        raw |= ~0ULL << bits;
+    return raw;
+}
+
+/*
+ * Read a value of load type `type` at `addr` in the debugee.
+ */
+static int __cond_read(cond_read_t reader, struct debugger *dbg,
+        uint64_t addr, uint8_t type, int64_t *value)
+{
+    struct iovec local, remote;
+    uint64_t raw = 0;
+
+    local.iov_base = &raw;
+    local.iov_len = COND_SIZE(type);
+    remote.iov_base = (void *)(uintptr_t)addr;
+    remote.iov_len = local.iov_len;
+    if (reader(dbg, &local, &remote, 1) < 0)
+        return -1;
+
+    *value = __cond_extend(raw, type);
+    return 0;
+}
+
+/*
+ * Do the loads at constant addresses of `c`, all at once.
+ *
+ * @return - 0 on success, -1 if one of them failed, in which case they
+ *           are done one by one when needed
+ */
+static int __cond_fetch(struct condition *c, cond_read_t reader,
+        struct debugger *dbg, int64_t *values)
+{
+    struct iovec local[COND_MAX_LOADS], remote[COND_MAX_LOADS];
+    uint64_t raw[COND_MAX_LOADS] = { 0 };
+    unsigned int i;
+
+    for (i = 0; i < c->nloads; i++) {
+        local[i].iov_base = &raw[i];
+        local[i].iov_len = COND_SIZE(c->loads[i].type);
+        remote[i].iov_base = (void *)(uintptr_t)c->loads[i].addr;
+        remote[i].iov_len = local[i].iov_len;
+    }
+
+    if (reader(dbg, local, remote, c->nloads) < 0)
+        return -1;
+
+    for (i = 0; i < c->nloads; i++)
+        values[i] = __cond_extend(raw[i], c->loads[i].type);
+    return 0;
+}
+
+/**
+ * Evaluate condition `c` in the stopped debugee.
+ *
+ * @param c      - the compiled condition
+ * @param regs   - registers of the stopped thread
+ * @param reader - how to read memory, read_memory_v() of inc/memory.h
+ * @param dbg    - the debugger, for memory loads
+ * @param result - where to store the value of the condition
+ * @return       - 0 on success, -1 if memory could not be read or on
+ *                 division by zero
+ */
+int condition_eval(struct condition *c, const struct user_regs_struct *regs,
+        cond_read_t reader, struct debugger *dbg, int64_t *result)
+{
+    int64_t stack[COND_STACK_MAX], values[COND_MAX_LOADS], *sp = stack;
+    const uint8_t *pc = c->code, *end = c->code + c->len;
+    const uint64_t *r = (const uint64_t *)regs;
+    struct cond_load *load;
+    int fetched = 0;
+    uint16_t off;
+    uint8_t op;
+
+    /* A load that fails may well be skipped by `&&` or `||` */
+    if (c->nloads > 0)
+        fetched = __cond_fetch(c, reader, dbg, values) == 0;
+
+    while (pc < end) {
+        switch (op = *pc++) {
+        case COND_PUSH:
+            memcpy(sp++, pc, sizeof(*sp));
+            pc += sizeof(*sp);
+            break;
+        case COND_REG:
+            *sp++ = r[*pc++];
+            break;
+        case COND_LOADC:
+            load = &c->loads[*pc];
+            if (!fetched &&
+                    __cond_read(reader, dbg, load->addr, load->type,
+                        &values[*pc]) < 0)
+                return -1;
+            *sp++ = values[*pc++];
+            break;
+        case COND_LOAD:
+            if (__cond_read(reader, dbg, sp[-1], *pc++, &sp[-1]) < 0)
+                return -1;
+            break;
+        case COND_NEG:
+        case COND_NOT:
+        case COND_LNOT:
+        case COND_BOOL:
+            __cond_apply(op, sp[-1], 0, &sp[-1]);
+            break;
+        case COND_ANDJ:
+        case COND_ORJ:
+            memcpy(&off, pc, sizeof(off));
+            pc += sizeof(off);
+            if ((op == COND_ANDJ) == (sp[-1] == 0)) {
+                sp[-1] = op == COND_ORJ;
+                pc += off;
+            }
+            else {
+                sp--;
+            }
+            break;
+        default:
+            sp--;
+            if (__cond_apply(op, sp[-1], sp[0], &sp[-1]) < 0)
+                return -1;
+            break;
+        }
+    }
+
+    *result = sp[-1];
+    return 0;
+}
+
+#endif /* CONDITION_H */
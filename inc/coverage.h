@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Basic block coverage of the program of the debugee.
+ *
+ * The blocks are found in the code of the program as it is in its file:
+ * every function of the symbol table is decoded from start to end, and
+ * a block starts at the function, at the targets of its direct jumps,
+ * and after its jumps and returns. Calls don't end a block. The debugger
+ * puts an INT3 at the start of every block, and takes it out for good
+ * the first time the block runs, so that the program soon runs at full
+ * speed: what coverage costs is bounded by the number of blocks.
+ *
+ * The blocks run are written when the program exits, to a file laid
+ * out as:
+ *
+ *   struct coverage_header
+ *   uint64_t blocks[count]
+ *   uint8_t  bitmap[(count + 7) / 8]
+ *
+ * where `blocks` are the addresses of the blocks in the file of the
+ * program, sorted, so that the bitmaps of runs of a PIE can be merged,
+ * and bit `i % 8` of `bitmap[i / 8]` is set if block `i` ran.
+ *
+ * Memory Allocation: the coverage owns its arrays.
+ */
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "symbols.h"
+#include "x86_decode.h"
+
+#define COVERAGE_MAGIC      "RBCOVER"
+#define COVERAGE_VERSION    1
+
+struct coverage_header {
+    char                magic[8];
+    uint32_t            version;
+    uint32_t            reserved;
+    uint64_t            count;
+    uint64_t            hit;
+};
+
+struct coverage {
+    /* Where the blocks run are written */
+    char *              path;
+
+    /* Starts of the blocks in the file of the program, sorted, and
+     * how much the program is moved by */
+    unsigned long *     blocks;
+    unsigned long       count;
+    unsigned long       bias;
+
+    uint8_t *           bitmap;
+    unsigned long       hit;
+};
+
+/* Marks of the bytes of a function, see `__coverage_function()` */
+#define COVERAGE_INSN       0x1     /* an instruction starts there */
+#define COVERAGE_BLOCK      0x2     /* a block may start there */
+
+/*
+ * Add a block at `addr` to the blocks of `cov`.
+ *
+ * @param alloc - where the number of blocks allocated is kept
+ * @return      - 0 on success, -1 if out of memory
+ */
+static int __coverage_add(struct coverage *cov, unsigned long addr,
+        unsigned long *alloc)
+{
+    unsigned long *blocks;
+
+    if (cov->count == *alloc) {
+        *alloc = *alloc ? *alloc * 2 : 1024;
+        blocks = realloc(cov->blocks, *alloc * sizeof(*blocks));
+        if (blocks == NULL)
+            return -1;
+        cov->blocks = blocks;
+    }
+    cov->blocks[cov->count++] = addr;
+    return 0;
+}
+
+/*
+ * Find the blocks of the function at `addr` in the file, whose `size`
+ * bytes of code are `code`. The code is decoded one instruction after
+ * the other, and stops being looked at where it can't be decoded. Jump
+ * targets that are not the start of a decoded instruction are left
+ * out: an INT3 there would break the instruction.
+ *
+ * @param marks - `size` bytes to mark the function with
+ * @return      - 0 on success, -1 if out of memory
+ */
+static int __coverage_function(struct coverage *cov, const uint8_t *code,
+        unsigned long addr, unsigned long size, uint8_t *marks,
+        unsigned long *alloc)
+{
+    unsigned long pc, target;
+    struct x86_insn insn;
+
+    memset(marks, 0, size);
+    marks[0] = COVERAGE_BLOCK;
+
+    for (pc = 0; pc < size; pc += insn.len) {
+        if (x86_decode(code + pc, size - pc, &insn) < 0)
+            break;
+        marks[pc] |= COVERAGE_INSN;
+
+        switch (insn.kind) {
+        case X86_INSN_JMP_REL:
+        case X86_INSN_JCC_REL:
+        case X86_INSN_LOOP_REL:
+            target = x86_branch_target(code + pc, &insn, addr + pc) - addr;
+            if (target < size)
+                marks[target] |= COVERAGE_BLOCK;
+            /* Fall through */
+        case X86_INSN_JMP_IND:
+        case X86_INSN_RET:
+            if (pc + insn.len < size)
+                marks[pc + insn.len] |= COVERAGE_BLOCK;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (pc = 0; pc < size; pc++) {
+        if (marks[pc] == (COVERAGE_INSN | COVERAGE_BLOCK) &&
+                __coverage_add(cov, addr + pc, alloc) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int __coverage_compare(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a;
+    unsigned long y = *(const unsigned long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Find the basic blocks of a program.
+ *
+ * @param text  - the code of the program, its .text section
+ * @param start - address of `text` in the file
+ * @param size  - size of `text`
+ * @param syms  - its functions, with their addresses in the file and
+ *                sizes. Other symbols are left out if they are not in
+ *                `text`, and so are those of no size, such as the ones
+ *                of the start files.
+ * @param nsyms - number of symbols
+ * @param bias  - how much the program is moved by
+ * @param path  - where to write the blocks run
+ * @return      - the blocks, none run yet, or NULL if out of memory
+ */
+struct coverage *coverage_alloc(const uint8_t *text, unsigned long start,
+        unsigned long size, const struct symbol *syms, unsigned long nsyms,
+        unsigned long bias, const char *path)
+{
+    unsigned long i, n, off, len, alloc = 0, max = 0;
+    struct coverage *cov;
+    uint8_t *marks;
+
+    cov = calloc(1, sizeof(*cov));
+    if (cov == NULL)
+        return NULL;
+    cov->bias = bias;
+    cov->path = strdup(path);
+
+    for (i = 0; i < nsyms; i++)
+        if (syms[i].size > max)
+            max = syms[i].size;
+    marks = malloc(max + 1);
+    if (cov->path == NULL || marks == NULL)
+        goto fail;
+
+    for (i = 0; i < nsyms; i++) {
+        off = syms[i].addr - start;
+        len = syms[i].size;
+        if (syms[i].addr < start || off >= size || len == 0)
+            continue;
+        if (len > size - off)
+            len = size - off;
+        if (__coverage_function(cov, text + off, syms[i].addr, len, marks,
+                    &alloc) < 0)
+            goto fail;
+    }
+    free(marks);
+    marks = NULL;
+
+    /* Aliases have the same blocks */
+    qsort(cov->blocks, cov->count, sizeof(*cov->blocks), __coverage_compare);
+    for (i = 0, n = 0; i < cov->count; i++)
+        if (n == 0 || cov->blocks[i] != cov->blocks[n - 1])
+            cov->blocks[n++] = cov->blocks[i];
+    cov->count = n;
+
+    cov->bitmap = calloc((cov->count + 7) / 8 + 1, 1);
+    if (cov->bitmap == NULL)
+        goto fail;
+    return cov;
+
+fail:
+    free(marks);
+    free(cov->blocks);
+    free(cov->path);
+    free(cov);
+    return NULL;
+}
+
+/**
+ * Free the blocks of `cov`.
+ */
+void coverage_free(struct coverage *cov)
+{
+    free(cov->blocks);
+    free(cov->bitmap);
+    free(cov->path);
+    free(cov);
+}
+
+/**
+ * Find the block that starts at `addr` in the running program.
+ *
+ * @return - its number, or -1 if no block starts there
+ */
+long coverage_block(struct coverage *cov, unsigned long addr)
+{
+    unsigned long lo = 0, hi = cov->count, mid;
+
+    addr -= cov->bias;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (cov->blocks[mid] < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < cov->count && cov->blocks[lo] == addr ? (long)lo : -1;
+}
+
+/**
+ * Check whether the block at `addr` in the running program ran.
+ *
+ * @return - 1 if it did, 0 if not, -1 if no block starts there
+ */
+int coverage_ran(struct coverage *cov, unsigned long addr)
+{
+    long i = coverage_block(cov, addr);
+
+    if (i < 0)
+        return -1;
+    return (cov->bitmap[i / 8] >> (i % 8)) & 1;
+}
+
+/**
+ * Take note that the block at `addr` in the running program ran, if a
+ * block starts there.
+ */
+void coverage_mark(struct coverage *cov, unsigned long addr)
+{
+    long i = coverage_block(cov, addr);
+
+    if (i < 0 || (cov->bitmap[i / 8] & (1 << (i % 8))))
+        return;
+    cov->bitmap[i / 8] |= 1 << (i % 8);
+    cov->hit++;
+}
+
+/**
+ * Write the blocks of `cov` and the ones that ran to its file.
+ *
+ * @return - 0 on success, -1 on error
+ */
+int coverage_write(struct coverage *cov)
+{
+    struct coverage_header hdr;
+    size_t size = (cov->count + 7) / 8;
+    uint64_t *blocks;
+    unsigned long i;
+    int fd, ret = 0;
+
+    blocks = malloc(cov->count * sizeof(*blocks) + 1);
+    if (blocks == NULL)
+        return -1;
+    for (i = 0; i < cov->count; i++)
+        blocks[i] = cov->blocks[i];
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, COVERAGE_MAGIC, sizeof(COVERAGE_MAGIC));
+    hdr.version = COVERAGE_VERSION;
+    hdr.count = cov->count;
+    hdr.hit = cov->hit;
+
+    fd = open(cov->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 ||
+            write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+            write(fd, blocks, cov->count * sizeof(*blocks)) !=
+                (ssize_t)(cov->count * sizeof(*blocks)) ||
+            write(fd, cov->bitmap, size) != (ssize_t)size)
+        ret = -1;
+    if (fd >= 0 && close(fd) < 0)
+        ret = -1;
+    free(blocks);
+    return ret;
+}
+
+#endif /* COVERAGE_H */
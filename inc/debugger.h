@@ -1,3 +1,47 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <sys/user.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "breakpoint.h"
+#include "breakpoint_array.h"
+#include "checkpoint.h"
+#include "coverage.h"
+#include "decode_cache.h"
+#include "debugreg.h"
+#include "event_loop.h"
+#include "process.h"
+#include "snapshot.h"
+#include "stop_cache.h"
+#include "symbols.h"
+#include "thread.h"
+#include "trace.h"
+#include "watch_index.h"
+#include "write_index.h"
+#include "hash_table.h"
+
+struct fast_trace;
+
+/* Most internal breakpoints of a `next`, `finish` or `until` */
+#define STEP_MAX_BPS    256
+
+/*
+ * The internal breakpoints set by `next`, `finish` or `until`, and the
+ * frame of the thread they are for: its canonical frame address (the
+ * stack pointer before the call), 0 if unknown, and its return address.
+ */
+struct step {
+    pid_t               tid;
+    unsigned long       cfa;
+    unsigned long       ret;
+    unsigned int        bps[STEP_MAX_BPS];
+    unsigned int        nbps;
+};
+
 /* 
  * This is a fundamental structure which represents the actual
  * debugger. This structure must be properly allocated and in-
@@ -5,21 +49,152 @@
  */
 struct debugger {
     char *              dbge_path;
+
+    /* The current thread of the debugee, see inc/thread.h */
     pid_t               dbge_pid;
+    struct thread_table threads;
+
+    /* Whether only the thread that stops does, see inc/thread.h */
+    int                 non_stop;
+
+    /* Whether the debugee runs on its own after `continue`, its stop
+     * being waited for by the event loop. `skipped` counts the hits
+     * of the breakpoints whose condition did not hold meanwhile, by
+     * address.
+     */
+    int                 running;
+    struct hash_table   skipped;
+    struct event_loop   loop;
+
+    /* Processes traced, the one that has the focus and whose state
+     * the fields below are, and whether the focus goes to the child
+     * when it forks, see inc/process.h.
+     */
+    struct process_table procs;
+    struct process *    process;
+    int                 follow_fork;
     
-    /* This is the `head` of the  breakpoint array linked
-     * list. This list contains all the breakpoint_array
-     * structures which house the `breakpoint * array[]`.
+    /* The breakpoint_array structures which house the
+     * `breakpoint * array[]`, by position, and the list of
+     * those that are not full, where breakpoints are added.
+     */
+    struct breakpoint_array **bpa;
+    unsigned int        bpa_count;
+    unsigned int        bpa_cap;
+    struct sl_list_node bpa_free;
+
+    /* Index of the breakpoints stored in `bpa`, keyed by
+     * breakpoint address. This is what the SIGTRAP handler
+     * uses to map RIP-1 back to a breakpoint.
      */
-    struct sl_list_node bpa_list;
+    struct hash_table   bp_table;
+
+    /* /proc/<pid>/mem, opened on demand by inc/memory.h */
+    int                 mem_fd;
+
+    /* Pages of code of the debugee, see inc/decode_cache.h */
+    struct decode_cache decode;
+
+    /* Registers of the stopped debugee, see inc/registers.h. The
+     * x87 and SSE state is only fetched when asked for.
+     */
+    struct user_regs_struct regs;
+    int                 regs_state;
+    struct user_fpregs_struct fpregs;
+    int                 fpregs_state;
+
+    /* Memory read since the debugee stopped, see inc/stop_cache.h */
+    struct stop_cache   stop;
+
+    /* The breakpoint the debugee is stopped at, if any. RIP has
+     * been rewound to the breakpoint address.
+     */
+    struct breakpoint * stopped_bp;
+
+    /* Signal that stopped the debugee, passed on when it resumes */
+    int                 pending_signal;
+
+    /* Scratch areas and free slots for displaced stepping,
+     * see inc/displaced.h.
+     */
+    struct sl_list_node dstep_areas;
+    struct sl_list_node dstep_free;
+
+    /* Watchpoints in number order, and the next number */
+    struct sl_list_node watchpoints;
+    unsigned int        watch_number;
+
+    /* Debug registers of the debugee: the watchpoint each one is
+     * programmed for, NULL if free, and the value of DR7.
+     */
+    struct watchpoint * dr_watch[DR_SLOTS];
+    unsigned long       dr7;
+
+    /* Watchpoints that did not fit in the debug registers, and the
+     * one whose fault was just stepped over, see `__watch_fault()`.
+     */
+    struct watch_index  soft_watch;
+    struct watchpoint * soft_hit;
+
+    /* Fork based checkpoints of the debugee */
+    struct checkpoint_pool checkpoints;
+
+    /* How the debugee got where it is. `history.count` is the
+     * logical clock of the debugee: the number of stops since
+     * it started, see inc/history.h.
+     */
+    struct history      history;
+
+    /* Where recordings wrote to memory, see `last-write` */
+    struct write_index  writes;
+
+    /* The last snapshot saved or restored, base of the next one. The
+     * soft-dirty bits of `snapshot_pid` were cleared then and tell
+     * what changed since, if it is still the debugee.
+     */
+    struct snapshot *   snapshot;
+    pid_t               snapshot_pid;
+
+    /* Ring the fast tracepoints log into, NULL until the first one
+     * is set, see inc/fast_trace.h.
+     */
+    struct fast_trace * ftrace;
+
+    /* Trace file opened with `trace open`, or NULL */
+    struct trace_reader *trace;
+
+    /* Whether PTRACE_SINGLEBLOCK really stops on branches only */
+    int                 block_step;
+
+    /* Symbols of the program of the debugee, NULL if it has none */
+    struct symbol_index *symbols;
+
+    /* Blocks of the program being covered until it exits, NULL if
+     * none, see `coverage`.
+     */
+    struct coverage *   coverage;
+
+    /* Internal breakpoints of the command the debugee runs for */
+    struct step         step;
 };
 
+/* Values of `block_step`. Virtual machines commonly ignore the branch
+ * trap flag, and PTRACE_SINGLEBLOCK then silently single steps. */
+#define BLOCK_STEP_UNKNOWN  0
+#define BLOCK_STEP_WORKS    1
+#define BLOCK_STEP_BROKEN   2
+
+/* Values of `regs_state` */
+#define REGS_INVALID    0   /* not fetched since the last stop */
+#define REGS_CLEAN      1   /* same as in the debugee */
+#define REGS_DIRTY      2   /* modified, not yet written back */
+
 /*
  * Allocate a breakpoint_array structure.
  */
 struct breakpoint_array *debugger_bpa_alloc() 
 {
-    return (struct breakpoint_array *)malloc(sizeof(
+    return (struct breakpoint_array *)calloc(1, sizeof(
                 struct breakpoint_array));
 }
 
@@ -49,6 +224,31 @@ struct debugger *debugger_alloc(void)
  */
 void debugger_free(struct debugger *dbg)
 {
+    unsigned int i;
+
+    for (i = 0; i < dbg->bpa_count; i++)
+        debugger_bpa_free(dbg->bpa[i]);
+    free(dbg->bpa);
+    hash_table_destroy(&dbg->bp_table);
+    history_destroy(&dbg->history);
+    write_index_destroy(&dbg->writes);
+    watch_index_destroy(&dbg->soft_watch);
+    thread_table_destroy(&dbg->threads);
+    hash_table_destroy(&dbg->skipped);
+    process_table_destroy(&dbg->procs);
+    decode_cache_destroy(&dbg->decode);
+    stop_cache_destroy(&dbg->stop);
+    event_loop_destroy(&dbg->loop);
+    if (dbg->trace != NULL)
+        trace_reader_close(dbg->trace);
+    if (dbg->snapshot != NULL)
+        snapshot_close(dbg->snapshot);
+    if (dbg->symbols != NULL)
+        symbol_index_close(dbg->symbols);
+    if (dbg->coverage != NULL)
+        coverage_free(dbg->coverage);
+    if (dbg->mem_fd >= 0)
+        close(dbg->mem_fd);
     free(dbg);
 }
 
@@ -59,32 +259,234 @@ void debugger_free(struct debugger *dbg)
  * @param dbg       - pointer to the to a `struct debugger`
  * @param dbge_path - Debugee's path
  * @param dbge_pid  - Debugee's pid
+ * @return          - 0 on success, -1 on allocation failure
  */
-void debugger_init(struct debugger *dbg, char *dbge_path, 
+int debugger_init(struct debugger *dbg, char *dbge_path, 
         pid_t dbge_pid)
 {
     dbg->dbge_path = dbge_path;
     dbg->dbge_pid  = dbge_pid;
-    sl_list_init(&dbg->bpa_list);
+    dbg->mem_fd    = -1;
+    dbg->regs_state = REGS_INVALID;
+    dbg->fpregs_state = REGS_INVALID;
+    stop_cache_init(&dbg->stop);
+    dbg->stopped_bp = NULL;
+    dbg->pending_signal = 0;
+    dbg->non_stop = 0;
+    dbg->running = 0;
+    dbg->follow_fork = FOLLOW_FORK_PARENT;
+    event_loop_clear(&dbg->loop);
+    dbg->bpa = NULL;
+    dbg->bpa_count = 0;
+    dbg->bpa_cap = 0;
+    sl_list_init(&dbg->bpa_free);
+    sl_list_init(&dbg->dstep_areas);
+    sl_list_init(&dbg->dstep_free);
+    sl_list_init(&dbg->watchpoints);
+    dbg->watch_number = 1;
+    memset(dbg->dr_watch, 0, sizeof(dbg->dr_watch));
+    dbg->dr7 = 0;
+    dbg->soft_hit = NULL;
+    checkpoint_pool_init(&dbg->checkpoints);
+    history_init(&dbg->history);
+    dbg->snapshot = NULL;
+    dbg->symbols = NULL;
+    dbg->coverage = NULL;
+    dbg->snapshot_pid = 0;
+    dbg->ftrace = NULL;
+    dbg->trace = NULL;
+    dbg->block_step = BLOCK_STEP_UNKNOWN;
+    dbg->step.nbps = 0;
+
+    if (write_index_init(&dbg->writes) < 0 ||
+            watch_index_init(&dbg->soft_watch) < 0 ||
+            thread_table_init(&dbg->threads, dbge_pid) < 0 ||
+            hash_table_init(&dbg->skipped, 0) < 0 ||
+            process_table_init(&dbg->procs) < 0 ||
+            decode_cache_init(&dbg->decode) < 0)
+        return -1;
+
+    dbg->process = process_add(&dbg->procs, dbge_pid, PROCESS_FOCUSED);
+    if (dbg->process == NULL)
+        return -1;
+    dbg->procs.reported = dbge_pid;
+    dbg->procs.history = dbge_pid;
+    return hash_table_init(&dbg->bp_table, MAX_BREAKPOINTS_PER_LIST);
 }
 
 /*
- * Insert a breakpoint into the debugger's breakpoint list.
+ * Find the breakpoint array which stores the breakpoint number
+ * `bpn`. Breakpoint numbers start at 1 and are made of the position
+ * of the array in `bpa` and the index within that array.
+ *
+ * @param dbg - pointer to debugger structure 
+ * @param bpn - breakpoint number
+ * @param idx - where to store the index within the returned array
+ */
+struct breakpoint_array *__debugger_bpa_for_number(struct debugger *dbg,
+        unsigned int bpn, unsigned int *idx)
+{
+    unsigned int pos;
+
+    if (bpn == 0)
+        return NULL;
+
+    pos  = (bpn - 1) / MAX_BREAKPOINTS_PER_LIST;
+    *idx = (bpn - 1) % MAX_BREAKPOINTS_PER_LIST;
+
+    if (pos >= dbg->bpa_count)
+        return NULL;
+    return dbg->bpa[pos];
+}
+
+/*
+ * Get a breakpoint array that is not full, a new one at the end of
+ * `bpa` if they all are.
+ *
+ * @return - the breakpoint array, or NULL on allocation failure
+ */
+static struct breakpoint_array *__debugger_bpa_not_full(
+        struct debugger *dbg)
+{
+    struct breakpoint_array **arrays;
+    struct breakpoint_array *bpa;
+    unsigned int cap;
+
+    if (!sl_list_is_empty(&dbg->bpa_free))
+        return sl_list_node_container(dbg->bpa_free.next,
+                struct breakpoint_array, entry);
+
+    if (dbg->bpa_count == dbg->bpa_cap) {
+        cap = dbg->bpa_cap != 0 ? dbg->bpa_cap * 2 : 8;
+        arrays = realloc(dbg->bpa, cap * sizeof(*arrays));
+        if (arrays == NULL)
+            return NULL;
+        dbg->bpa = arrays;
+        dbg->bpa_cap = cap;
+    }
+
+    bpa = debugger_bpa_alloc();
+    if (bpa == NULL)
+        return NULL;
+    bpa->pos = dbg->bpa_count;
+    dbg->bpa[dbg->bpa_count++] = bpa;
+    sl_list_add(&dbg->bpa_free, &bpa->entry);
+    return bpa;
+}
+
+/*
+ * Insert a breakpoint into the debugger's breakpoint storage and
+ * attribute it a breakpoint number.
  *
  * @param dbg - pointer to debugger structure 
  * @param bp  - pointer to breakpoint structure to insert
+ * @return    - the breakpoint number on success, or ENOBP on error
  */
 int __debugger_breakpoint_insert(struct debugger *dbg, 
         struct breakpoint *bp)
 {
-    sl_list_add(&dbg->breakpoints, &bp->bp_entry);
-    /* TODO: Attribute breakpoint number.*/
+    struct breakpoint_array *bpa;
+    int idx;
+
+    bpa = __debugger_bpa_not_full(dbg);
+    if (bpa == NULL)
+        return ENOBP;
+
+    if (hash_table_insert(&dbg->bp_table, (unsigned long)bp->addr, bp) < 0)
+        return ENOBP;
+
+    /* The array is first in the list of those that are not full */
+    idx = breakpoint_array_add_breakpoint(bpa, bp);
+    if (breakpoint_array_full(bpa))
+        sl_list_delete(&dbg->bpa_free);
+    bp->number = bpa->pos * MAX_BREAKPOINTS_PER_LIST + idx + 1;
+
+    return bp->number;
+}
+
+/*
+ * Remove the breakpoint number `bpn` from the debugger's breakpoint
+ * storage. The breakpoint itself is not freed.
+ *
+ * @param dbg - pointer to debugger structure 
+ * @param bpn - number of the breakpoint to remove
+ * @return    - the removed breakpoint, or NULL if there is none
+ */
+struct breakpoint *__debugger_breakpoint_delete(struct debugger *dbg, 
+        unsigned int bpn)
+{
+    struct breakpoint_array *bpa;
+    struct breakpoint *bp;
+    unsigned int idx;
+
+    bpa = __debugger_bpa_for_number(dbg, bpn, &idx);
+    if (bpa == NULL)
+        return NULL;
+
+    bp = breakpoint_array_get_breakpoint(bpa, idx);
+    if (bp == NULL)
+        return NULL;
+
+    hash_table_delete(&dbg->bp_table, (unsigned long)bp->addr);
+    if (breakpoint_array_full(bpa))
+        sl_list_add(&dbg->bpa_free, &bpa->entry);
+    breakpoint_array_del_breakpoint(bpa, idx);
+
+    return bp;
+}
+
+/*
+ * Find the breakpoint set at address `addr`.
+ *
+ * @param dbg  - pointer to debugger structure 
+ * @param addr - address of the breakpoint
+ * @return     - the breakpoint, or NULL if no breakpoint is set there
+ */
+struct breakpoint *debugger_breakpoint_at(struct debugger *dbg, 
+        void *addr)
+{
+    return hash_table_lookup(&dbg->bp_table, (unsigned long)addr);
 }
 
-void __debugger_breakpoint_delete(struct debugger *dbg, 
+/*
+ * Find the breakpoint number `bpn`.
+ *
+ * @param dbg - pointer to debugger structure 
+ * @param bpn - breakpoint number
+ * @return    - the breakpoint, or NULL if there is none
+ */
+struct breakpoint *debugger_breakpoint_get(struct debugger *dbg, 
         unsigned int bpn)
 {
-    /* TODO: Implement this function */
+    struct breakpoint_array *bpa;
+    unsigned int idx;
+
+    bpa = __debugger_bpa_for_number(dbg, bpn, &idx);
+    if (bpa == NULL)
+        return NULL;
+
+    return breakpoint_array_get_breakpoint(bpa, idx);
 }
 
+/*
+ * Find the watchpoint number `number`, deleted ones included.
+ *
+ * @param dbg    - pointer to debugger structure
+ * @param number - watchpoint number
+ * @return       - the watchpoint, or NULL if there is none
+ */
+struct watchpoint *debugger_watchpoint_get(struct debugger *dbg,
+        unsigned int number)
+{
+    struct sl_list_node *current;
+    struct watchpoint *wp;
+
+    sl_list_traverse((&dbg->watchpoints), current) {
+        wp = sl_list_node_container(current, struct watchpoint, entry);
+        if (wp->number == number)
+            return wp;
+    }
+    return NULL;
+}
 
+#endif /* DEBUGGER_H */
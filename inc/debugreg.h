@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * x86 debug registers of a traced thread.
+ *
+ * DR0 to DR3 hold the addresses of up to four watched ranges of 1, 2, 4
+ * or 8 bytes, aligned on their size. DR7 enables them and tells what
+ * each one watches for, DR6 tells which ones fired. The kernel gives
+ * access to them through PTRACE_PEEKUSER and PTRACE_POKEUSER on
+ * `struct user`, and checks the values written to DR7.
+ */
+
+#ifndef DEBUGREG_H
+#define DEBUGREG_H
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <errno.h>
+#include <stddef.h>
+
+#define DR_SLOTS        4
+#define DR_STATUS       6
+#define DR_CONTROL      7
+
+/* What a slot fires on, the R/W field of DR7 */
+#define DR_RW_EXEC      0x0
+#define DR_RW_WRITE     0x1
+#define DR_RW_ACCESS    0x3     /* reads and writes, no read-only */
+
+/* Bits of DR6 that tell which slots fired */
+#define DR_STATUS_HIT   0xf
+
+/* Resume flag, keeps an instruction breakpoint from firing again */
+#define DR_EFLAGS_RF    (1UL << 16)
+
+/**
+ * Get debug register `n` of thread `pid`.
+ *
+ * @return - 0 on success, -1 on error
+ */
+int debugreg_get(pid_t pid, int n, unsigned long *value)
+{
+    long ret;
+
+    errno = 0;
+    ret = ptrace(PTRACE_PEEKUSER, pid,
+            offsetof(struct user, u_debugreg) + n * sizeof(long), NULL);
+    if (ret == -1 && errno != 0)
+        return -1;
+
+    *value = ret;
+    return 0;
+}
+
+/**
+ * Set debug register `n` of thread `pid`.
+ *
+ * @return - 0 on success, -1 on error
+ */
+int debugreg_set(pid_t pid, int n, unsigned long value)
+{
+    return ptrace(PTRACE_POKEUSER, pid,
+            offsetof(struct user, u_debugreg) + n * sizeof(long),
+            (void *)value) < 0 ? -1 : 0;
+}
+
+/**
+ * Get the LEN field of DR7 for a range of `len` bytes.
+ */
+static inline unsigned long __dr7_len(unsigned int len)
+{
+    switch (len) {
+    case 1:  return 0x0;
+    case 2:  return 0x1;
+    case 8:  return 0x2;
+    default: return 0x3;
+    }
+}
+
+/**
+ * Enable slot `slot` in the DR7 value `dr7`.
+ *
+ * @param rw  - one of the DR_RW_* values
+ * @param len - length of the range, 1, 2, 4 or 8
+ * @return    - the new value of DR7
+ */
+static inline unsigned long dr7_enable(unsigned long dr7, int slot, int rw,
+        unsigned int len)
+{
+    dr7 &= ~(0xfUL << (16 + slot * 4));
+    dr7 |= (unsigned long)(rw | __dr7_len(len) << 2) << (16 + slot * 4);
+    return dr7 | 1UL << (slot * 2);
+}
+
+/**
+ * Disable slot `slot` in the DR7 value `dr7`.
+ */
+static inline unsigned long dr7_disable(unsigned long dr7, int slot)
+{
+    dr7 &= ~(0xfUL << (16 + slot * 4));
+    return dr7 & ~(3UL << (slot * 2));
+}
+
+/**
+ * Check whether slot `slot` is enabled in the DR7 value `dr7`.
+ */
+static inline int dr7_enabled(unsigned long dr7, int slot)
+{
+    return (dr7 >> (slot * 2)) & 3;
+}
+
+/**
+ * Check whether a slot enabled in the DR7 value `dr7` watches for
+ * execution.
+ */
+static inline int dr7_has_exec(unsigned long dr7)
+{
+    int slot;
+
+    for (slot = 0; slot < DR_SLOTS; slot++) {
+        if (dr7_enabled(dr7, slot) &&
+                ((dr7 >> (16 + slot * 4)) & 3) == DR_RW_EXEC)
+            return 1;
+    }
+    return 0;
+}
+
+#endif /* DEBUGREG_H */
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Cache of the debugee's code, for decoding its instructions.
+ *
+ * Decoding an instruction of the debugee used to mean reading its
+ * bytes, and looking every one of them up in the breakpoints for the
+ * code our INT3s and jumps hide. The code is rather read a page at a
+ * time on first use, with the original bytes put back under our
+ * breakpoints, and the instructions decoded in a page are kept along
+ * with it, which also tells their boundaries and lengths.
+ *
+ * Our own breakpoints don't change the original code, their writes are
+ * only mirrored in the copy of the page as it is in the debugee. The
+ * debugee may change its code though, e.g after mprotect(), or unmap
+ * it. Once it ran, a page is therefore compared with the debugee again
+ * before use, at the cost of a single read, and dropped if it changed
+ * or can't be read anymore. Other writes of the debugger drop the pages
+ * they touch.
+ *
+ * Memory Allocation: the cache owns its pages.
+ */
+
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_table.h"
+#include "x86_decode.h"
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE       4096UL
+#define PAGE_MASK       (~(PAGE_SIZE - 1))
+#endif
+
+/* Most pages kept, the least recently used one is evicted past that */
+#define DECODE_CACHE_PAGES  64
+
+/* Bytes kept of a page: the instructions that start at its end run
+ * into the next one */
+#define CODE_PAGE_SIZE      (PAGE_SIZE + X86_MAX_INSN_LEN - 1)
+
+struct code_page {
+    unsigned long       addr;
+
+    /* Number of valid bytes, less than CODE_PAGE_SIZE at the end of
+     * the mapping */
+    size_t              size;
+
+    /* As in the debugee, and the original code */
+    uint8_t             mem[CODE_PAGE_SIZE];
+    uint8_t             code[CODE_PAGE_SIZE];
+
+    /* Instructions decoded at every offset, a length of 0 if not yet.
+     * Allocated on the first decode. */
+    struct x86_insn     *insns;
+
+    /* Value of `epoch` when last compared with the debugee, and of
+     * `tick` when last used */
+    unsigned long       epoch;
+    unsigned long       used;
+};
+
+struct decode_cache {
+    struct hash_table   pages;
+
+    /* Counts the times the debugee ran */
+    unsigned long       epoch;
+    unsigned long       tick;
+};
+
+/**
+ * Initialize an empty cache.
+ *
+ * @return - 0 on success, -1 if out of memory
+ */
+int decode_cache_init(struct decode_cache *cache)
+{
+    cache->epoch = 1;
+    cache->tick = 0;
+    return hash_table_init(&cache->pages, DECODE_CACHE_PAGES);
+}
+
+/**
+ * Drop every page of the cache, e.g because the debugee was replaced.
+ */
+void decode_cache_reset(struct decode_cache *cache)
+{
+    struct hash_slot *slot;
+    struct code_page *p;
+
+    hash_table_for_each(&cache->pages, slot) {
+        p = slot->value;
+        free(p->insns);
+        free(p);
+    }
+    hash_table_clear(&cache->pages);
+}
+
+/**
+ * Free the pages of the cache.
+ */
+void decode_cache_destroy(struct decode_cache *cache)
+{
+    decode_cache_reset(cache);
+    hash_table_destroy(&cache->pages);
+}
+
+/**
+ * Tell the cache that the debugee is about to run, and may change its
+ * code meanwhile.
+ */
+static inline void decode_cache_resume(struct decode_cache *cache)
+{
+    cache->epoch++;
+}
+
+/**
+ * Drop page `addr` from the cache.
+ */
+void decode_cache_drop(struct decode_cache *cache, unsigned long addr)
+{
+    struct code_page *p;
+
+    p = hash_table_delete(&cache->pages, addr);
+    if (p != NULL) {
+        free(p->insns);
+        free(p);
+    }
+}
+
+/**
+ * Get page `addr` if it is in the cache. It may have to be compared
+ * with the debugee before use, see `epoch`.
+ *
+ * @return - the page, or NULL if it is not cached
+ */
+struct code_page *decode_cache_get(struct decode_cache *cache,
+        unsigned long addr)
+{
+    struct code_page *p;
+
+    p = hash_table_lookup(&cache->pages, addr);
+    if (p != NULL)
+        p->used = ++cache->tick;
+    return p;
+}
+
+/**
+ * Add page `addr` to the cache, with the first `size` bytes at `addr`
+ * in the debugee. The original code must then be put in `code`.
+ *
+ * @return - the page, or NULL if out of memory
+ */
+struct code_page *decode_cache_add(struct decode_cache *cache,
+        unsigned long addr, const uint8_t *mem, size_t size)
+{
+    struct code_page *p, *old = NULL;
+    struct hash_slot *slot;
+
+    if (hash_table_count(&cache->pages) >= DECODE_CACHE_PAGES) {
+        hash_table_for_each(&cache->pages, slot) {
+            p = slot->value;
+            if (old == NULL || p->used < old->used)
+                old = p;
+        }
+        decode_cache_drop(cache, old->addr);
+    }
+
+    p = malloc(sizeof(*p));
+    if (p == NULL)
+        return NULL;
+    if (hash_table_insert(&cache->pages, addr, p) < 0) {
+        free(p);
+        return NULL;
+    }
+
+    p->addr = addr;
+    p->size = size;
+    memcpy(p->mem, mem, size);
+    memcpy(p->code, mem, size);
+    p->insns = NULL;
+    p->epoch = cache->epoch;
+    p->used = ++cache->tick;
+    return p;
+}
+
+/**
+ * Decode the instruction at offset `off` of page `p`.
+ *
+ * @param code - where to store the bytes of the instruction
+ * @param insn - where to store the instruction
+ * @return     - 0 on success, -1 if it is invalid or runs past what is
+ *               known of the page
+ */
+int code_page_decode(struct code_page *p, unsigned long off, uint8_t *code,
+        struct x86_insn *insn)
+{
+    size_t avail;
+
+    if (off >= p->size)
+        return -1;
+
+    if (p->insns == NULL)
+        p->insns = calloc(PAGE_SIZE, sizeof(*p->insns));
+
+    if (p->insns != NULL && p->insns[off].len != 0) {
+        *insn = p->insns[off];
+    }
+    else {
+        avail = p->size - off;
+        if (x86_decode(p->code + off, avail < X86_MAX_INSN_LEN ? avail :
+                    X86_MAX_INSN_LEN, insn) < 0)
+            return -1;
+        if (p->insns != NULL)
+            p->insns[off] = *insn;
+    }
+
+    memcpy(code, p->code + off, insn->len);
+    return 0;
+}
+
+/**
+ * Mirror in the cached pages the INT3s and jumps written over the code
+ * of the debugee, or the original code written back. The code the
+ * pages hold doesn't change.
+ *
+ * @param addr - address of the bytes written
+ * @param buf  - bytes written
+ * @param len  - number of bytes written
+ */
+void decode_cache_patched(struct decode_cache *cache, unsigned long addr,
+        const uint8_t *buf, size_t len)
+{
+    unsigned long page, i;
+    struct code_page *p;
+
+    /* The page before keeps the start of the page of `addr` */
+    for (page = (addr & PAGE_MASK) - PAGE_SIZE; page < addr + len;
+            page += PAGE_SIZE) {
+        p = hash_table_lookup(&cache->pages, page);
+        if (p == NULL)
+            continue;
+        for (i = 0; i < len; i++) {
+            if (addr + i >= page && addr + i < page + p->size)
+                p->mem[addr + i - page] = buf[i];
+        }
+    }
+}
+
+/**
+ * Drop the pages that hold any of the `len` bytes at `addr`, which the
+ * debugger changed.
+ */
+void decode_cache_written(struct decode_cache *cache, unsigned long addr,
+        size_t len)
+{
+    unsigned long page;
+
+    for (page = (addr & PAGE_MASK) - PAGE_SIZE; page < addr + len;
+            page += PAGE_SIZE)
+        decode_cache_drop(cache, page);
+}
+
+#endif /* DECODE_CACHE_H */
@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Displaced stepping.
+ *
+ * To resume from a breakpoint, the instruction under the INT3 has to be
+ * executed. Instead of restoring the original byte, single stepping and
+ * writing the INT3 back, every breakpoint gets a "slot" in a scratch area
+ * mapped inside the debugee. The slot holds a relocated copy of the
+ * original instruction followed by a jump back to the next instruction:
+ *
+ *      slot:   <original instruction, fixed up>
+ *              jmp  bp->addr + len
+ *
+ * Resuming from the breakpoint is then only a matter of pointing RIP at
+ * the slot and continuing. The INT3 never leaves the code, so no other
+ * thread can run past the breakpoint in the meantime.
+ *
+ * Relocation needs every rel32 (RIP-relative operands, branches and the
+ * jump back) to still reach its target, so scratch areas are mapped close
+ * to the code. Instructions that cannot be relocated are stepped the
+ * old way (see `step_over_breakpoint()`).
+ */
+
+#ifndef DISPLACED_H
+#define DISPLACED_H
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <limits.h>
+
+#include "breakpoint.h"
+#include "debugger.h"
+#include "inject.h"
+#include "memory.h"
+#include "registers.h"
+#include "x86_decode.h"
+
+#define DISPLACED_SLOT_SIZE     64
+#define DISPLACED_AREA_SIZE     (16 * PAGE_SIZE)
+
+/* Where we try to map scratch areas, relative to the code */
+#define DISPLACED_AREA_DISTANCE (64UL << 20)
+
+/* Areas tried around the preferred one */
+#define DISPLACED_AREA_TRIES    64
+
+/*
+ * A scratch area mapped in the debugee, cut into slots
+ */
+struct displaced_area {
+    unsigned long       base;
+    unsigned long       used;
+    struct sl_list_node entry;
+};
+
+/*
+ * A slot given back by a deleted breakpoint
+ */
+struct displaced_slot {
+    unsigned long       addr;
+    struct sl_list_node entry;
+};
+
+/*
+ * Check that a rel32 at `from` (address of the next instruction)
+ * can reach `to`.
+ */
+static inline int __displaced_reachable(unsigned long from, unsigned long to)
+{
+    long rel = (long)(to - from);
+
+    return rel >= INT_MIN && rel <= INT_MAX;
+}
+
+static inline void __put32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+/*
+ * Emit `jmp rel32` to `target` at `out[*n]`, `slot` being the address
+ * of `out[0]` in the debugee.
+ */
+static int __displaced_emit_jmp(uint8_t *out, int *n, unsigned long slot,
+        unsigned long target)
+{
+    unsigned long next = slot + *n + 5;
+
+    if (!__displaced_reachable(next, target))
+        return -1;
+
+    out[*n] = 0xe9;
+    __put32(out + *n + 1, target - next);
+    *n += 5;
+    return 0;
+}
+
+/*
+ * Emit the push of a 64-bit return address without touching the flags:
+ *
+ *      lea  rsp, [rsp - 8]
+ *      mov  dword [rsp], lo32
+ *      mov  dword [rsp + 4], hi32
+ */
+static void __displaced_emit_push(uint8_t *out, int *n, unsigned long value)
+{
+    static const uint8_t lea[] = { 0x48, 0x8d, 0x64, 0x24, 0xf8 };
+
+    memcpy(out + *n, lea, sizeof(lea));
+    *n += sizeof(lea);
+
+    out[(*n)++] = 0xc7; out[(*n)++] = 0x04; out[(*n)++] = 0x24;
+    __put32(out + *n, (uint32_t)value);
+    *n += 4;
+
+    out[(*n)++] = 0xc7; out[(*n)++] = 0x44; out[(*n)++] = 0x24;
+    out[(*n)++] = 0x04;
+    __put32(out + *n, (uint32_t)(value >> 32));
+    *n += 4;
+}
+
+/*
+ * Copy the instruction `code` to `out[*n]`, adjusting a RIP-relative
+ * displacement for its new address.
+ */
+static int __displaced_emit_copy(uint8_t *out, int *n, unsigned long slot,
+        const uint8_t *code, struct x86_insn *insn, unsigned long from)
+{
+    unsigned long at = slot + *n;
+    int32_t disp;
+
+    memcpy(out + *n, code, insn->len);
+
+    if (insn->rip_relative) {
+        memcpy(&disp, code + insn->disp_off, sizeof(disp));
+        if (!__displaced_reachable(at + insn->len,
+                    from + insn->len + disp))
+            return -1;
+        __put32(out + *n + insn->disp_off,
+                from + insn->len + disp - (at + insn->len));
+    }
+
+    *n += insn->len;
+    return 0;
+}
+
+/*
+ * Check whether the ModRM operand of `insn` is addressed through RSP,
+ * which moves when we push a return address.
+ */
+static int __displaced_uses_rsp(const uint8_t *code, struct x86_insn *insn)
+{
+    uint8_t modrm = code[insn->modrm_off];
+    uint8_t rex_b = insn->rex & 1;
+
+    if ((modrm & 7) != 4 || rex_b)
+        return 0;
+    if ((modrm >> 6) == 3)
+        return 1;
+    return (code[insn->modrm_off + 1] & 7) == 4;
+}
+
+/**
+ * Build the relocated version of the instruction `code`, originally
+ * at `from`, for the slot at address `slot`.
+ *
+ * @param out - buffer of DISPLACED_SLOT_SIZE bytes
+ * @return    - the number of bytes of `out` used, or -1 if the
+ *              instruction cannot be relocated to `slot`
+ */
+int displaced_encode(const uint8_t *code, struct x86_insn *insn,
+        unsigned long from, unsigned long slot, uint8_t *out)
+{
+    unsigned long next = from + insn->len;
+    unsigned long target;
+    uint8_t op;
+    int n = 0;
+
+    switch (insn->kind) {
+    case X86_INSN_OTHER:
+    case X86_INSN_SYSCALL:
+        if (__displaced_emit_copy(out, &n, slot, code, insn, from) < 0 ||
+                __displaced_emit_jmp(out, &n, slot, next) < 0)
+            return -1;
+        break;
+
+    case X86_INSN_RET:
+    case X86_INSN_JMP_IND:
+        /* The target is absolute, nothing comes back to the slot */
+        if (__displaced_emit_copy(out, &n, slot, code, insn, from) < 0)
+            return -1;
+        break;
+
+    case X86_INSN_JMP_REL:
+        target = x86_branch_target(code, insn, from);
+        if (__displaced_emit_jmp(out, &n, slot, target) < 0)
+            return -1;
+        break;
+
+    case X86_INSN_JCC_REL:
+        /* Always re-encoded as jcc rel32, the prefixes are dropped */
+        op = code[insn->opcode_off];
+        target = x86_branch_target(code, insn, from);
+        out[n++] = 0x0f;
+        out[n++] = 0x80 | (op & 0x0f);
+        if (!__displaced_reachable(slot + n + 4, target))
+            return -1;
+        __put32(out + n, target - (slot + n + 4));
+        n += 4;
+        if (__displaced_emit_jmp(out, &n, slot, next) < 0)
+            return -1;
+        break;
+
+    case X86_INSN_LOOP_REL:
+        /*
+         * There is no rel32 form, so branch over the jump back:
+         *
+         *      loop +5
+         *      jmp  next
+         *      jmp  target
+         */
+        target = x86_branch_target(code, insn, from);
+        memcpy(out, code, insn->imm_off);
+        n = insn->imm_off;
+        out[n++] = 5;
+        if (__displaced_emit_jmp(out, &n, slot, next) < 0 ||
+                __displaced_emit_jmp(out, &n, slot, target) < 0)
+            return -1;
+        break;
+
+    case X86_INSN_CALL_REL:
+        target = x86_branch_target(code, insn, from);
+        __displaced_emit_push(out, &n, next);
+        if (__displaced_emit_jmp(out, &n, slot, target) < 0)
+            return -1;
+        break;
+
+    case X86_INSN_CALL_IND:
+        /* call r/m pushes the wrong return address: push + jmp r/m */
+        if (__displaced_uses_rsp(code, insn))
+            return -1;
+        __displaced_emit_push(out, &n, next);
+        if (__displaced_emit_copy(out, &n, slot, code, insn, from) < 0)
+            return -1;
+        /* Turn /2 (call) into /4 (jmp) */
+        out[n - insn->len + insn->modrm_off] ^= (2 ^ 4) << 3;
+        break;
+
+    default:
+        return -1;
+    }
+
+    return n;
+}
+
+/*
+ * Map a new scratch area close to `near`, without replacing any mapping
+ * of the debugee, from which the whole area can reach `near` and back.
+ */
+static struct displaced_area *__displaced_area_alloc(struct debugger *dbg,
+        unsigned long near)
+{
+    struct displaced_area *area;
+    unsigned long hint;
+    long ret = -EEXIST;
+    int i;
+
+    if (near > DISPLACED_AREA_DISTANCE +
+            DISPLACED_AREA_SIZE * DISPLACED_AREA_TRIES)
+        hint = (near - DISPLACED_AREA_DISTANCE) & PAGE_MASK;
+    else
+        hint = (near + DISPLACED_AREA_DISTANCE) & PAGE_MASK;
+
+    for (i = 0; i < DISPLACED_AREA_TRIES && ret == -EEXIST; i++)
+        ret = inject_syscall(dbg, SYS_mmap, hint + i * DISPLACED_AREA_SIZE,
+                DISPLACED_AREA_SIZE, PROT_READ | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (ret < 0)
+        return NULL;
+
+    if (!__displaced_reachable(ret, near) ||
+            !__displaced_reachable(near, ret + DISPLACED_AREA_SIZE))
+        goto unmap;
+
+    area = calloc(1, sizeof(struct displaced_area));
+    if (area == NULL)
+        goto unmap;
+
+    area->base = ret;
+    sl_list_add(&dbg->dstep_areas, &area->entry);
+    return area;
+
+unmap:
+    inject_syscall(dbg, SYS_munmap, ret, DISPLACED_AREA_SIZE, 0, 0, 0, 0);
+    return NULL;
+}
+
+/*
+ * Find a free slot from which code at `near` can be reached.
+ */
+static unsigned long __displaced_slot_alloc(struct debugger *dbg,
+        unsigned long near)
+{
+    struct sl_list_node *prev, *current;
+    struct displaced_slot *slot;
+    struct displaced_area *area;
+    unsigned long addr;
+
+    prev = &dbg->dstep_free;
+    sl_list_traverse((&dbg->dstep_free), current) {
+        slot = sl_list_node_container(current, struct displaced_slot, entry);
+        if (__displaced_reachable(slot->addr, near) &&
+                __displaced_reachable(near, slot->addr +
+                    DISPLACED_SLOT_SIZE)) {
+            addr = slot->addr;
+            __sl_list_delete_after(prev);
+            free(slot);
+            return addr;
+        }
+        prev = current;
+    }
+
+    sl_list_traverse((&dbg->dstep_areas), current) {
+        area = sl_list_node_container(current, struct displaced_area, entry);
+        if (area->used + DISPLACED_SLOT_SIZE <= DISPLACED_AREA_SIZE &&
+                __displaced_reachable(area->base, near) &&
+                __displaced_reachable(near, area->base + DISPLACED_AREA_SIZE))
+            goto found;
+    }
+
+    area = __displaced_area_alloc(dbg, near);
+    if (area == NULL)
+        return 0;
+
+found:
+    addr = area->base + area->used;
+    area->used += DISPLACED_SLOT_SIZE;
+    return addr;
+}
+
+/*
+ * Put the slot at `addr` on the free list.
+ */
+static void __displaced_slot_free(struct debugger *dbg, unsigned long addr)
+{
+    struct displaced_slot *slot;
+
+    slot = malloc(sizeof(struct displaced_slot));
+    if (slot == NULL)
+        return;
+
+    slot->addr = addr;
+    sl_list_add(&dbg->dstep_free, &slot->entry);
+}
+
+/*
+ * Give the slot of `bp` back, e.g because the breakpoint is deleted.
+ */
+void displaced_release(struct debugger *dbg, struct breakpoint *bp)
+{
+    if (bp->displaced_state == DISPLACED_READY)
+        __displaced_slot_free(dbg, (unsigned long)bp->displaced);
+
+    bp->displaced = NULL;
+    bp->displaced_state = DISPLACED_NONE;
+}
+
+/**
+ * Relocate the instruction under breakpoint `bp` into a slot.
+ *
+ * @return - 0 on success, -1 if the instruction cannot be displaced
+ */
+int displaced_prepare(struct debugger *dbg, struct breakpoint *bp)
+{
+    uint8_t code[X86_MAX_INSN_LEN], out[DISPLACED_SLOT_SIZE];
+    unsigned long from = (unsigned long)bp->addr, slot;
+    struct x86_insn insn;
+    int n;
+
+    if (bp->displaced_state != DISPLACED_NONE)
+        return bp->displaced_state == DISPLACED_READY ? 0 : -1;
+
+    bp->displaced_state = DISPLACED_UNSUPPORTED;
+
+    if (read_insn(dbg, bp->addr, code, &insn) < 0)
+        return -1;
+
+    /* Reject early what can never be relocated */
+    if (insn.kind == X86_INSN_TRAP)
+        return -1;
+
+    slot = __displaced_slot_alloc(dbg, from);
+    if (slot == 0)
+        return -1;
+
+    n = displaced_encode(code, &insn, from, slot, out);
+    if (n < 0 || write_memory(dbg, (void *)slot, out, n) != n) {
+        __displaced_slot_free(dbg, slot);
+        return -1;
+    }
+
+    bp->displaced = (void *)slot;
+    bp->displaced_state = DISPLACED_READY;
+    return 0;
+}
+
+/**
+ * Make the debugee, stopped at breakpoint `bp`, resume through the
+ * relocated copy of the instruction under the breakpoint.
+ *
+ * @return - 0 if RIP now points to the slot, -1 if the breakpoint
+ *           has to be stepped over the old way
+ */
+int displaced_resume(struct debugger *dbg, struct breakpoint *bp)
+{
+    struct user_regs_struct regs;
+
+    if (displaced_prepare(dbg, bp) < 0)
+        return -1;
+
+    if (debugger_get_regs(dbg, &regs) < 0)
+        return -1;
+
+    regs.rip = (unsigned long)bp->displaced;
+    debugger_set_regs(dbg, &regs);
+    return 0;
+}
+
+/**
+ * Forget every scratch area and slot, e.g because the debugee was
+ * replaced by a process in which they may not exist. Breakpoints are
+ * relocated again on their next hit.
+ */
+void displaced_reset(struct debugger *dbg)
+{
+    struct sl_list_node *node;
+    struct hash_slot *slot;
+    struct breakpoint *bp;
+
+    while (!sl_list_is_empty(&dbg->dstep_free)) {
+        node = dbg->dstep_free.next;
+        sl_list_delete(&dbg->dstep_free);
+        free(sl_list_node_container(node, struct displaced_slot, entry));
+    }
+
+    while (!sl_list_is_empty(&dbg->dstep_areas)) {
+        node = dbg->dstep_areas.next;
+        sl_list_delete(&dbg->dstep_areas);
+        free(sl_list_node_container(node, struct displaced_area, entry));
+    }
+
+    hash_table_for_each(&dbg->bp_table, slot) {
+        bp = slot->value;
+        bp->displaced = NULL;
+        bp->displaced_state = DISPLACED_NONE;
+    }
+}
+
+#endif /* DISPLACED_H */
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The event loop of the debugger.
+ *
+ * The debugger waits for all of its events at once with epoll: the
+ * input of the user, the events of the debugee, and a timer. The
+ * debugee can then run on its own while commands are being typed.
+ *
+ * The events of the debugee come as SIGCHLD, read from a signalfd,
+ * which the kernel also sends for the ptrace stops of every thread. A
+ * pidfd would only tell when the debugee exits. SIGINT comes the same
+ * way, for Ctrl-C to interrupt the debugee rather than to kill the
+ * debugger. Both are blocked for that, waitpid() works the same.
+ *
+ * Signals of the same kind that come together are merged, so that a
+ * SIGCHLD may stand for several events: they have to be collected
+ * with WNOHANG until there is none left.
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Events returned by `event_loop_wait()` */
+#define EVENT_INPUT         0   /* input is ready */
+#define EVENT_CHILD         1   /* the debugee has events */
+#define EVENT_INTERRUPT     2   /* the user pressed Ctrl-C */
+#define EVENT_TIMER         3   /* the timer expired */
+
+struct event_loop {
+    int     epoll_fd;
+    int     input_fd;
+    int     signal_fd;
+    int     timer_fd;
+};
+
+/**
+ * Mark the event loop as not set up, for `event_loop_destroy()`.
+ */
+void event_loop_clear(struct event_loop *loop)
+{
+    loop->epoll_fd = -1;
+    loop->input_fd = -1;
+    loop->signal_fd = -1;
+    loop->timer_fd = -1;
+}
+
+/**
+ * Close the file descriptors of the event loop. The signals stay
+ * blocked.
+ */
+void event_loop_destroy(struct event_loop *loop)
+{
+    if (loop->epoll_fd >= 0)
+        close(loop->epoll_fd);
+    if (loop->signal_fd >= 0)
+        close(loop->signal_fd);
+    if (loop->timer_fd >= 0)
+        close(loop->timer_fd);
+    event_loop_clear(loop);
+}
+
+static int __event_loop_add(struct event_loop *loop, int fd, int event)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = event;
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * Set up the event loop, with `input_fd` as the input of the user.
+ *
+ * Note that SIGCHLD and SIGINT are blocked from then on, also in the
+ * processes forked afterwards.
+ *
+ * @return - 0 on success, -1 on error
+ */
+int event_loop_init(struct event_loop *loop, int input_fd)
+{
+    sigset_t mask;
+
+    event_loop_clear(loop);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return -1;
+
+    loop->input_fd = input_fd;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->epoll_fd < 0 || loop->signal_fd < 0 || loop->timer_fd < 0 ||
+            __event_loop_add(loop, input_fd, EVENT_INPUT) < 0 ||
+            __event_loop_add(loop, loop->signal_fd, EVENT_CHILD) < 0 ||
+            __event_loop_add(loop, loop->timer_fd, EVENT_TIMER) < 0) {
+        event_loop_destroy(loop);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stop or start waiting for the input of the user, e.g while a command
+ * runs the event loop itself.
+ *
+ * The input is taken out of the epoll set meanwhile: epoll reports
+ * EPOLLHUP and EPOLLERR whatever the events asked for, a pipe that was
+ * closed would keep waking the loop up.
+ *
+ * @param enable - whether `EVENT_INPUT` may be returned
+ */
+void event_loop_input(struct event_loop *loop, int enable)
+{
+    if (enable)
+        __event_loop_add(loop, loop->input_fd, EVENT_INPUT);
+    else
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->input_fd, NULL);
+}
+
+/**
+ * Make the timer expire every `interval_ms` milliseconds from now on,
+ * or never if it is 0.
+ */
+void event_loop_timer(struct event_loop *loop, long interval_ms)
+{
+    struct itimerspec its;
+
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+    its.it_value = its.it_interval;
+    timerfd_settime(loop->timer_fd, 0, &its, NULL);
+}
+
+/**
+ * Wait for the next event.
+ *
+ * @return - one of the EVENT_* values, -1 on error
+ */
+int event_loop_wait(struct event_loop *loop)
+{
+    struct signalfd_siginfo si;
+    struct epoll_event ev;
+    uint64_t expired;
+    int n;
+
+    for (;;) {
+        n = epoll_wait(loop->epoll_fd, &ev, 1, -1);
+        if (n < 0 && errno != EINTR)
+            return -1;
+        if (n <= 0)
+            continue;
+
+        switch (ev.data.u32) {
+        case EVENT_CHILD:
+            /* Nothing to read after all */
+            if (read(loop->signal_fd, &si, sizeof(si)) != sizeof(si))
+                continue;
+            return si.ssi_signo == SIGINT ? EVENT_INTERRUPT : EVENT_CHILD;
+        case EVENT_TIMER:
+            if (read(loop->timer_fd, &expired, sizeof(expired)) !=
+                    sizeof(expired))
+                continue;
+            return EVENT_TIMER;
+        default:
+            return EVENT_INPUT;
+        }
+    }
+}
+
+#endif /* EVENT_LOOP_H */
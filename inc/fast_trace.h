@@ -0,0 +1,744 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Fast tracepoints.
+ *
+ * A fast tracepoint logs the registers of the debugee every time it
+ * runs through an address, without stopping it. The code at the address
+ * is overwritten with a 5-byte jump to a trampoline mapped next to it:
+ *
+ *      tramp:  save the registers on the stack, below the red zone
+ *              take the next record of the ring with lock xadd
+ *              copy the address and the registers into the record
+ *              set the sequence number of the record
+ *              restore the registers
+ *              <instructions replaced by the jump, relocated>
+ *              jmp  addr + len
+ *
+ * The ring is a memfd that both the debugee and the debugger map, and
+ * the debugger drains it whenever it gets control (see
+ * `fast_trace_drain()`), and on a timer while the debugee runs on its
+ * own. The timer follows the rate of the hits, for the ring to be at
+ * most half full when it is drained (see `fast_trace_tick()`). When
+ * the debugee is faster than the debugger all the same, the oldest
+ * records are overwritten and counted as lost.
+ *
+ * Only instructions that fall through to the next one may be replaced,
+ * except for the last one, which is relocated the way displaced
+ * stepping does it (see inc/displaced.h). Note that code jumping into
+ * the middle of the replaced instructions runs into an INT3.
+ */
+
+#ifndef FAST_TRACE_H
+#define FAST_TRACE_H
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "breakpoint.h"
+#include "debugger.h"
+#include "displaced.h"
+#include "inject.h"
+#include "memory.h"
+#include "registers.h"
+#include "trace.h"
+#include "x86_decode.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE     0x100000
+#endif
+
+#define FTRACE_NAME             "retrobugr-ftrace"
+
+/* Records of the ring, a power of two. The trampoline has the size of
+ * a record hard-coded.
+ */
+#define FTRACE_RING_RECORDS     16384
+#define FTRACE_RING_SIZE        ((sizeof(struct ftrace_ring) + \
+            PAGE_SIZE - 1) & PAGE_MASK)
+
+/* Bounds of the interval the ring is drained at while the debugee runs
+ * on its own, in milliseconds */
+#define FTRACE_DRAIN_MIN_MS     1
+#define FTRACE_DRAIN_MAX_MS     100
+
+#define FTRACE_JMP_LEN          5
+#define FTRACE_TRAMP_MAX        512
+
+/* Pages tried for a trampoline around the preferred one */
+#define FTRACE_TRAMP_TRIES      64
+
+/*
+ * A record, as the trampoline writes it: the registers come in the
+ * order the trampoline pushes them, from the bottom of the stack.
+ */
+struct ftrace_record {
+    /* Number of the record plus one, written last */
+    uint64_t        seq;
+    uint64_t        addr;
+    uint64_t        r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t        rdi, rsi, rbp, rbx, rdx, rcx, rax;
+    uint64_t        eflags;
+    uint64_t        rsp;
+};
+
+struct ftrace_ring {
+    /* Number of records taken so far, on its own cache line */
+    uint64_t                head;
+    uint64_t                pad[7];
+    struct ftrace_record    records[FTRACE_RING_RECORDS];
+};
+
+struct fast_trace {
+    int                 memfd;
+    struct ftrace_ring  *ring;
+
+    /* Where the ring is mapped in the debugee, 0 if it is not */
+    unsigned long       remote;
+
+    /* Next record to drain, and records overwritten before that */
+    uint64_t            tail;
+    unsigned long       lost;
+
+    /* Interval the ring is drained at, and the head at the last tick */
+    long                drain_ms;
+    uint64_t            tick_head;
+
+    /* Where drained records go, see `ftrace log` */
+    struct trace_writer *log;
+};
+
+static inline void __emit(uint8_t *out, int *n, const void *code, size_t len)
+{
+    memcpy(out + *n, code, len);
+    *n += len;
+}
+
+static inline void __emit64(uint8_t *out, int *n, uint64_t v)
+{
+    __emit(out, n, &v, sizeof(v));
+}
+
+/*
+ * Emit the part of the trampoline that logs the registers into the
+ * ring at `ring`, for the tracepoint at `addr`.
+ */
+static void __fast_trace_emit_log(uint8_t *out, int *n, unsigned long ring,
+        unsigned long addr)
+{
+    static const uint8_t save[] = {
+        0x48, 0x8d, 0x64, 0x24, 0x80,       /* lea   rsp, [rsp - 128] */
+        0x9c,                               /* pushfq */
+        0x50, 0x51, 0x52, 0x53,             /* push  rax, rcx, rdx, rbx */
+        0x55, 0x56, 0x57,                   /* push  rbp, rsi, rdi */
+        0x41, 0x50, 0x41, 0x51,             /* push  r8 ... r15 */
+        0x41, 0x52, 0x41, 0x53,
+        0x41, 0x54, 0x41, 0x55,
+        0x41, 0x56, 0x41, 0x57,
+        0xfc,                               /* cld */
+        0x48, 0xbe,                         /* movabs rsi, ring */
+    };
+    static const uint8_t reserve[] = {
+        0xb8, 0x01, 0x00, 0x00, 0x00,       /* mov   eax, 1 */
+        0xf0, 0x48, 0x0f, 0xc1, 0x06,       /* lock xadd [rsi], rax */
+        0x48, 0x89, 0xc2,                   /* mov   rdx, rax */
+        0x25,                               /* and   eax, RECORDS - 1 */
+        (FTRACE_RING_RECORDS - 1) & 0xff,
+        ((FTRACE_RING_RECORDS - 1) >> 8) & 0xff,
+        ((FTRACE_RING_RECORDS - 1) >> 16) & 0xff,
+        ((FTRACE_RING_RECORDS - 1) >> 24) & 0xff,
+        0x48, 0x69, 0xc0, 0x98, 0x00,       /* imul  rax, rax, 152 */
+        0x00, 0x00,
+        0x48, 0x8d, 0x7c, 0x06, 0x40,       /* lea   rdi, [rsi + rax + 64] */
+        0x48, 0xb8,                         /* movabs rax, addr */
+    };
+    static const uint8_t fill[] = {
+        0x48, 0x89, 0x47, 0x08,             /* mov   [rdi + 8], rax */
+        0x48, 0x89, 0xe6,                   /* mov   rsi, rsp */
+        0x48, 0x83, 0xc7, 0x10,             /* add   rdi, 16 */
+        0xb9, 0x10, 0x00, 0x00, 0x00,       /* mov   ecx, 16 */
+        0xf3, 0x48, 0xa5,                   /* rep movsq */
+        0x48, 0x8d, 0x84, 0x24, 0x00,       /* lea   rax, [rsp + 256] */
+        0x01, 0x00, 0x00,
+        0x48, 0x89, 0x07,                   /* mov   [rdi], rax */
+        0x48, 0xff, 0xc2,                   /* inc   rdx */
+        0x48, 0x89, 0x97, 0x70, 0xff,       /* mov   [rdi - 144], rdx */
+        0xff, 0xff,
+    };
+    static const uint8_t restore[] = {
+        0x41, 0x5f, 0x41, 0x5e,             /* pop   r15 ... r8 */
+        0x41, 0x5d, 0x41, 0x5c,
+        0x41, 0x5b, 0x41, 0x5a,
+        0x41, 0x59, 0x41, 0x58,
+        0x5f, 0x5e, 0x5d,                   /* pop   rdi, rsi, rbp */
+        0x5b, 0x5a, 0x59, 0x58,             /* pop   rbx, rdx, rcx, rax */
+        0x9d,                               /* popfq */
+        0x48, 0x8d, 0xa4, 0x24, 0x80,       /* lea   rsp, [rsp + 128] */
+        0x00, 0x00, 0x00,
+    };
+
+    __emit(out, n, save, sizeof(save));
+    __emit64(out, n, ring);
+    __emit(out, n, reserve, sizeof(reserve));
+    __emit64(out, n, addr);
+    __emit(out, n, fill, sizeof(fill));
+    __emit(out, n, restore, sizeof(restore));
+}
+
+/**
+ * Build the trampoline of a tracepoint at `from`.
+ *
+ * @param code  - the original code at `from`
+ * @param avail - number of bytes in `code`
+ * @param tramp - address of the trampoline in the debugee
+ * @param ring  - address of the ring in the debugee
+ * @param out   - buffer of FTRACE_TRAMP_MAX bytes
+ * @param len   - where to store the number of bytes the jump replaces
+ * @return      - the size of the trampoline, -1 if the code at `from`
+ *                cannot be replaced
+ */
+int fast_trace_encode(const uint8_t *code, size_t avail, unsigned long from,
+        unsigned long tramp, unsigned long ring, uint8_t *out,
+        unsigned int *len)
+{
+    struct x86_insn insn;
+    unsigned int off = 0;
+    int n = 0, size;
+
+    __fast_trace_emit_log(out, &n, ring, from);
+
+    for (;;) {
+        if (x86_decode(code + off, avail - off, &insn) < 0)
+            return -1;
+
+        if (off + insn.len >= FTRACE_JMP_LEN)
+            break;
+
+        /* Code before the last instruction must fall through */
+        if (insn.kind != X86_INSN_OTHER ||
+                __displaced_emit_copy(out, &n, tramp, code + off, &insn,
+                    from + off) < 0)
+            return -1;
+        off += insn.len;
+    }
+
+    /* The last one jumps back to the code after the replaced ones */
+    size = displaced_encode(code + off, &insn, from + off, tramp + n,
+            out + n);
+    if (size < 0)
+        return -1;
+
+    *len = off + insn.len;
+    return n + size;
+}
+
+/*
+ * Check whether the ring is mapped at `remote` in process `pid`, which
+ * is not the case in checkpoints taken before the ring was.
+ */
+static int __fast_trace_mapped(pid_t pid, unsigned long remote)
+{
+    char path[64], line[512];
+    unsigned long start;
+    int found = 0;
+    FILE *maps;
+
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    maps = fopen(path, "r");
+    if (maps == NULL)
+        return 0;
+
+    while (!found && fgets(line, sizeof(line), maps) != NULL) {
+        if (sscanf(line, "%lx-", &start) == 1 && start == remote)
+            found = strstr(line, FTRACE_NAME) != NULL;
+    }
+    fclose(maps);
+    return found;
+}
+
+/*
+ * Make the debugee map the ring through /proc/<our pid>/fd. The path
+ * is written on its stack, below the red zone.
+ *
+ * @return - the address of the ring, or a negated errno on error
+ */
+static long __fast_trace_inject(struct debugger *dbg, struct fast_trace *ft)
+{
+    struct user_regs_struct regs;
+    char path[64], saved[64];
+    unsigned long at;
+    long fd, ret;
+
+    if (debugger_get_regs(dbg, &regs) < 0)
+        return -ESRCH;
+
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", getpid(), ft->memfd);
+    at = (regs.rsp - 128 - sizeof(path)) & ~15UL;
+    if (read_memory(dbg, (void *)at, saved, sizeof(saved)) != sizeof(saved) ||
+            write_memory(dbg, (void *)at, path, sizeof(path)) != sizeof(path))
+        return -EFAULT;
+
+    fd = inject_syscall(dbg, SYS_open, at, O_RDWR, 0, 0, 0, 0);
+    write_memory(dbg, (void *)at, saved, sizeof(saved));
+    if (fd < 0)
+        return fd;
+
+    ret = inject_syscall(dbg, SYS_mmap, 0, FTRACE_RING_SIZE,
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    inject_syscall(dbg, SYS_close, fd, 0, 0, 0, 0, 0);
+    return ret;
+}
+
+/*
+ * Get the ring, creating it and mapping it into the debugee as needed.
+ *
+ * @return - the ring, or NULL on error
+ */
+static struct fast_trace *__fast_trace_get(struct debugger *dbg)
+{
+    struct fast_trace *ft = dbg->ftrace;
+    long remote;
+
+    if (ft == NULL) {
+        ft = calloc(1, sizeof(struct fast_trace));
+        if (ft == NULL)
+            return NULL;
+
+        ft->memfd = memfd_create(FTRACE_NAME, MFD_CLOEXEC);
+        if (ft->memfd < 0 || ftruncate(ft->memfd, FTRACE_RING_SIZE) < 0) {
+            printf("Couldn't create the tracepoint ring: %s\n",
+                    strerror(errno));
+            if (ft->memfd >= 0)
+                close(ft->memfd);
+            free(ft);
+            return NULL;
+        }
+
+        ft->ring = mmap(NULL, FTRACE_RING_SIZE, PROT_READ | PROT_WRITE,
+                MAP_SHARED, ft->memfd, 0);
+        if (ft->ring == MAP_FAILED) {
+            close(ft->memfd);
+            free(ft);
+            return NULL;
+        }
+        dbg->ftrace = ft;
+    }
+
+    if (ft->remote != 0 && __fast_trace_mapped(dbg->dbge_pid, ft->remote))
+        return ft;
+
+    remote = __fast_trace_inject(dbg, ft);
+    if (remote < 0) {
+        printf("Couldn't map the tracepoint ring into process %d: %s\n",
+                dbg->dbge_pid, strerror(-remote));
+        return NULL;
+    }
+    ft->remote = remote;
+    return ft;
+}
+
+/*
+ * Map a trampoline page from which `near` can be reached.
+ *
+ * @return - the address of the page, 0 on error
+ */
+static unsigned long __fast_trace_tramp_alloc(struct debugger *dbg,
+        unsigned long near)
+{
+    unsigned long hint;
+    long ret;
+    int i;
+
+    if (near > DISPLACED_AREA_DISTANCE + PAGE_SIZE * FTRACE_TRAMP_TRIES)
+        hint = (near - DISPLACED_AREA_DISTANCE) & PAGE_MASK;
+    else
+        hint = (near + DISPLACED_AREA_DISTANCE) & PAGE_MASK;
+
+    for (i = 0; i < FTRACE_TRAMP_TRIES; i++) {
+        ret = inject_syscall(dbg, SYS_mmap, hint + i * PAGE_SIZE, PAGE_SIZE,
+                PROT_READ | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (ret >= 0)
+            return ret;
+        if (ret != -EEXIST)
+            return 0;
+    }
+    return 0;
+}
+
+/*
+ * Check whether `addr` is one of the bytes after the first one that a
+ * tracepoint at `from` replacing `len` bytes overwrites.
+ */
+static inline int __fast_trace_covers(unsigned long from, unsigned int len,
+        unsigned long addr)
+{
+    return addr > from && addr < from + len;
+}
+
+/**
+ * Find the fast tracepoint whose jump overwrites `addr`, other than
+ * with its first byte.
+ *
+ * @return - the tracepoint, or NULL if there is none
+ */
+struct breakpoint *fast_trace_covering(struct debugger *dbg, void *addr)
+{
+    struct breakpoint *bp;
+    int i;
+
+    for (i = 1; dbg->ftrace != NULL && i < FAST_PATCH_MAX; i++) {
+        bp = debugger_breakpoint_at(dbg, (uint8_t *)addr - i);
+        if (bp != NULL && breakpoint_is_enabled(bp) &&
+                bp->kind == BREAKPOINT_FAST &&
+                __fast_trace_covers((unsigned long)bp->addr, bp->fast->len,
+                    (unsigned long)addr))
+            return bp;
+    }
+    return NULL;
+}
+
+/**
+ * Write the jump of the fast tracepoint `bp` into the debugee.
+ *
+ * @return - 0 on success, -1 on error
+ */
+int fast_trace_enable(struct debugger *dbg, struct breakpoint *bp)
+{
+    uint8_t code[FAST_PATCH_MAX + X86_MAX_INSN_LEN], out[FTRACE_TRAMP_MAX];
+    uint8_t patch[FAST_PATCH_MAX];
+    unsigned long from = (unsigned long)bp->addr, tramp;
+    struct user_regs_struct regs;
+    struct fast_trace *ft;
+    unsigned int len, i;
+    ssize_t avail;
+    int n;
+
+    if (bp->fast == NULL) {
+        bp->fast = calloc(1, sizeof(struct fast_tracepoint));
+        if (bp->fast == NULL)
+            return -1;
+    }
+
+    ft = __fast_trace_get(dbg);
+    if (ft == NULL || debugger_get_regs(dbg, &regs) < 0)
+        return -1;
+
+    avail = read_code(dbg, bp->addr, code, sizeof(code));
+    if (avail <= 0) {
+        printf("Cannot access memory at %p: %s\n", bp->addr, strerror(errno));
+        return -1;
+    }
+
+    tramp = __fast_trace_tramp_alloc(dbg, from);
+    if (tramp == 0) {
+        printf("Couldn't map a trampoline close to %p\n", bp->addr);
+        return -1;
+    }
+
+    n = fast_trace_encode(code, avail, from, tramp, ft->remote, out, &len);
+    if (n < 0 || !__displaced_reachable(from + FTRACE_JMP_LEN, tramp)) {
+        printf("Cannot put a fast tracepoint at %p\n", bp->addr);
+        goto unmap;
+    }
+
+    /* The debugee must not be in the middle of the code replaced */
+    for (i = 1; i < len; i++) {
+        if (debugger_breakpoint_at(dbg, (void *)(from + i)) != NULL ||
+                regs.rip == from + i) {
+            printf("Cannot put a fast tracepoint at %p: %p is in the way\n",
+                    bp->addr, (void *)(from + i));
+            goto unmap;
+        }
+    }
+
+    patch[0] = 0xe9;
+    __put32(patch + 1, tramp - (from + FTRACE_JMP_LEN));
+    memset(patch + FTRACE_JMP_LEN, 0xcc, len - FTRACE_JMP_LEN);
+
+    if (write_memory(dbg, (void *)tramp, out, n) != n ||
+            patch_code(dbg, bp->addr, patch, len) != len) {
+        printf("Cannot access memory at %p: %s\n", bp->addr, strerror(errno));
+        goto unmap;
+    }
+
+    memcpy(bp->fast->saved, code, len);
+    bp->fast->len = len;
+    bp->fast->tramp = tramp;
+    __set_breakpoint_enabled(bp);
+    return 0;
+
+unmap:
+    inject_syscall(dbg, SYS_munmap, tramp, PAGE_SIZE, 0, 0, 0, 0);
+    return -1;
+}
+
+/**
+ * Put back the code replaced by the fast tracepoint `bp`. Its
+ * trampoline is unmapped, unless the debugee is in it.
+ */
+void fast_trace_disable(struct debugger *dbg, struct breakpoint *bp)
+{
+    struct fast_tracepoint *fast = bp->fast;
+    struct user_regs_struct regs;
+
+    if (patch_code(dbg, bp->addr, fast->saved, fast->len) != fast->len)
+        printf("Cannot restore memory at %p: %s\n", bp->addr, strerror(errno));
+
+    if (debugger_get_regs(dbg, &regs) == 0 &&
+            (regs.rip < fast->tramp || regs.rip >= fast->tramp + PAGE_SIZE))
+        inject_syscall(dbg, SYS_munmap, fast->tramp, PAGE_SIZE, 0, 0, 0, 0);
+
+    __unset_breakpoint_enabled(bp);
+}
+
+/*
+ * Turn a record into registers, taking those the trampoline does not
+ * save from `regs`.
+ */
+static void __fast_trace_regs(struct ftrace_record *rec,
+        struct user_regs_struct *regs)
+{
+    regs->r15 = rec->r15; regs->r14 = rec->r14;
+    regs->r13 = rec->r13; regs->r12 = rec->r12;
+    regs->r11 = rec->r11; regs->r10 = rec->r10;
+    regs->r9  = rec->r9;  regs->r8  = rec->r8;
+    regs->rdi = rec->rdi; regs->rsi = rec->rsi;
+    regs->rbp = rec->rbp; regs->rbx = rec->rbx;
+    regs->rdx = rec->rdx; regs->rcx = rec->rcx;
+    regs->rax = rec->rax;
+    regs->eflags = rec->eflags;
+    regs->rsp = rec->rsp;
+    regs->rip = rec->addr;
+    regs->orig_rax = -1;
+}
+
+/**
+ * Take the records the trampolines wrote since the last call out of
+ * the ring, count them and log them with `ftrace log`. Records whose
+ * trampoline has not finished writing them are left for later.
+ */
+void fast_trace_drain(struct debugger *dbg)
+{
+    struct fast_trace *ft = dbg->ftrace;
+    struct user_regs_struct regs;
+    struct ftrace_record rec, *slot;
+    struct breakpoint *bp;
+    uint64_t head;
+
+    if (ft == NULL)
+        return;
+
+    head = __atomic_load_n(&ft->ring->head, __ATOMIC_ACQUIRE);
+
+    /* The ring went back in time, e.g with a snapshot */
+    if (head < ft->tail)
+        ft->tail = head;
+
+    if (head - ft->tail > FTRACE_RING_RECORDS) {
+        ft->lost += head - ft->tail - FTRACE_RING_RECORDS;
+        ft->tail = head - FTRACE_RING_RECORDS;
+    }
+
+    if (ft->log != NULL && debugger_get_regs(dbg, &regs) < 0)
+        memset(&regs, 0, sizeof(regs));
+
+    for (; ft->tail < head; ft->tail++) {
+        slot = &ft->ring->records[ft->tail & (FTRACE_RING_RECORDS - 1)];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) < ft->tail + 1)
+            break;
+
+        memcpy(&rec, slot, sizeof(rec));
+
+        /* Overwritten by a later record meanwhile */
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ft->tail + 1 ||
+                rec.seq != ft->tail + 1) {
+            ft->lost++;
+            continue;
+        }
+
+        bp = debugger_breakpoint_at(dbg, (void *)rec.addr);
+        if (bp == NULL || bp->kind != BREAKPOINT_FAST)
+            continue;
+        bp->fast->hits++;
+
+        if (ft->log != NULL) {
+            __fast_trace_regs(&rec, &regs);
+            trace_writer_append(ft->log, &regs);
+        }
+    }
+}
+
+/**
+ * Start draining the ring on a timer, the debugee being about to run on
+ * its own. The first ticks come quickly, in case the tracepoints are
+ * hit right away.
+ *
+ * @return - the interval to drain the ring at, in milliseconds, 0 if
+ *           there are no fast tracepoints
+ */
+long fast_trace_resume(struct debugger *dbg)
+{
+    struct fast_trace *ft = dbg->ftrace;
+
+    if (ft == NULL)
+        return 0;
+    ft->drain_ms = FTRACE_DRAIN_MIN_MS;
+    ft->tick_head = __atomic_load_n(&ft->ring->head, __ATOMIC_ACQUIRE);
+    return ft->drain_ms;
+}
+
+/**
+ * Drain the ring on the timer, and work out when to do it next: soon
+ * enough for the ring to be half full by then at most, at the rate it
+ * filled up since the last tick, and twice as late at most, for the
+ * timer to back off while the tracepoints are not hit.
+ *
+ * @return - the interval to drain the ring at from now on, in
+ *           milliseconds, 0 if there are no fast tracepoints
+ */
+long fast_trace_tick(struct debugger *dbg)
+{
+    struct fast_trace *ft = dbg->ftrace;
+    uint64_t head, n;
+    long ms;
+
+    if (ft == NULL)
+        return 0;
+
+    head = __atomic_load_n(&ft->ring->head, __ATOMIC_ACQUIRE);
+    n = head >= ft->tick_head ? head - ft->tick_head : 0;
+    ft->tick_head = head;
+    fast_trace_drain(dbg);
+
+    ms = ft->drain_ms * 2;
+    if (n > 0 && (uint64_t)ms * n > (uint64_t)ft->drain_ms *
+            (FTRACE_RING_RECORDS / 2))
+        ms = ft->drain_ms * (FTRACE_RING_RECORDS / 2) / n;
+    if (ms < FTRACE_DRAIN_MIN_MS)
+        ms = FTRACE_DRAIN_MIN_MS;
+    if (ms > FTRACE_DRAIN_MAX_MS)
+        ms = FTRACE_DRAIN_MAX_MS;
+    ft->drain_ms = ms;
+    return ms;
+}
+
+/**
+ * Check whether the jump of the fast tracepoint `bp` is in the
+ * debugee, which may be a copy taken before it was set.
+ */
+int fast_trace_present(struct debugger *dbg, struct breakpoint *bp)
+{
+    uint8_t code[FTRACE_JMP_LEN], jmp[FTRACE_JMP_LEN];
+    unsigned long from = (unsigned long)bp->addr;
+
+    if (!breakpoint_is_enabled(bp) || bp->kind != BREAKPOINT_FAST)
+        return 0;
+
+    jmp[0] = 0xe9;
+    __put32(jmp + 1, bp->fast->tramp - (from + FTRACE_JMP_LEN));
+    return read_memory(dbg, bp->addr, code, sizeof(code)) == sizeof(code) &&
+        memcmp(code, jmp, sizeof(jmp)) == 0;
+}
+
+/**
+ * Put the fast tracepoints back after the debugee was replaced by a
+ * copy taken earlier, whose code is the original one where they are
+ * missing.
+ */
+void fast_trace_reset(struct debugger *dbg)
+{
+    struct hash_slot *slot;
+    struct breakpoint *bp;
+
+    if (dbg->ftrace == NULL)
+        return;
+
+    /* Whatever was in the ring has been drained already */
+    dbg->ftrace->tail = dbg->ftrace->ring->head;
+
+    hash_table_for_each(&dbg->bp_table, slot) {
+        bp = slot->value;
+        if (!breakpoint_is_enabled(bp) || bp->kind != BREAKPOINT_FAST ||
+                fast_trace_present(dbg, bp))
+            continue;
+
+        __unset_breakpoint_enabled(bp);
+        if (fast_trace_enable(dbg, bp) < 0)
+            printf("Couldn't put fast tracepoint %u back, disabling it\n",
+                    bp->number);
+    }
+}
+
+/**
+ * Log the records drained from now on to the trace file `path`, in
+ * the format of inc/trace.h, or stop logging if `path` is NULL.
+ */
+void fast_trace_log(struct debugger *dbg, const char *path)
+{
+    struct fast_trace *ft = dbg->ftrace;
+    long size;
+
+    if (ft == NULL) {
+        printf("No fast tracepoints.\n");
+        return;
+    }
+
+    fast_trace_drain(dbg);
+    if (ft->log != NULL) {
+        size = trace_writer_close(ft->log);
+        ft->log = NULL;
+        if (size < 0)
+            printf("Couldn't write the log: %s\n", strerror(errno));
+        else
+            printf("Closed the log, %ld bytes\n", size);
+    }
+
+    if (path == NULL)
+        return;
+
+    ft->log = trace_writer_open(path, 1, 0);
+    if (ft->log == NULL)
+        printf("Couldn't create %s: %s\n", path, strerror(errno));
+}
+
+/**
+ * Unmap the ring and free it, the tracepoints must have been disabled.
+ */
+void fast_trace_free(struct fast_trace *ft)
+{
+    if (ft->log != NULL)
+        trace_writer_close(ft->log);
+    munmap(ft->ring, FTRACE_RING_SIZE);
+    close(ft->memfd);
+    free(ft);
+}
+
+#endif /* FAST_TRACE_H */
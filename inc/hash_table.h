@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A small open addressing hash table mapping an `unsigned long` key
+ * (an address, a pid, a page number...) to a non NULL pointer.
+ *
+ * Collisions are resolved with linear probing.  Deletion shifts the
+ * following entries of the probe run backwards instead of leaving
+ * tombstones behind, so lookups never get slower after many inserts
+ * and deletes.  The table doubles whenever it becomes 3/4 full.
+ *
+ * Memory Allocation: the table owns its slot array, but never the
+ * values stored in it.
+ */
+
+#ifndef HASH_TABLE_H
+#define HASH_TABLE_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_TABLE_MIN_SIZE     64
+
+struct hash_slot {
+    unsigned long   key;
+
+    /* A NULL value marks the slot as free. */
+    void            *value;
+};
+
+struct hash_table {
+    struct hash_slot    *slots;
+
+    /* Always a power of two, so that `mask' can replace modulo. */
+    unsigned long       size;
+    unsigned long       mask;
+    unsigned long       count;
+
+    /* 64 - log2(size), keeps the top bits of the hash product */
+    unsigned int        shift;
+};
+
+/**
+ * This "for loop" macro visits every used slot of the table.
+ *
+ * Note that the table must not be modified while it is traversed.
+ *
+ * @param tbl   - pointer to the hash table
+ * @param slot  - A `struct hash_slot *` to store the current slot
+ */
+#define hash_table_for_each(tbl, slot) \
+    for (slot = (tbl)->slots; slot < (tbl)->slots + (tbl)->size; slot++) \
+        if (slot->value != NULL)
+
+/*
+ * Fibonacci hashing: spreads nearby keys (e.g consecutive
+ * instruction addresses) over the whole table. The top bits of the
+ * product are taken, the low ones are the same for keys that share
+ * trailing zero bits, such as page addresses.
+ */
+static inline unsigned long __hash_table_hash(struct hash_table *tbl,
+        unsigned long key)
+{
+    return (key * 0x9e3779b97f4a7c15UL) >> tbl->shift;
+}
+
+/**
+ * Initialize a hash table able to hold `hint` entries without
+ * growing.
+ *
+ * @param tbl  - pointer to the hash table
+ * @param hint - expected number of entries, may be 0
+ * @return     - 0 on success, -1 if the slots could not be allocated
+ */
+int hash_table_init(struct hash_table *tbl, unsigned long hint)
+{
+    unsigned long size = HASH_TABLE_MIN_SIZE;
+
+    while (size * 3 / 4 <= hint)
+        size <<= 1;
+
+    tbl->slots = calloc(size, sizeof(struct hash_slot));
+    if (tbl->slots == NULL)
+        return -1;
+
+    tbl->size  = size;
+    tbl->mask  = size - 1;
+    tbl->shift = 64 - __builtin_ctzl(size);
+    tbl->count = 0;
+    return 0;
+}
+
+/**
+ * Release the slot array of the table. Stored values are not freed.
+ *
+ * @param tbl - pointer to the hash table
+ */
+void hash_table_destroy(struct hash_table *tbl)
+{
+    free(tbl->slots);
+    tbl->slots = NULL;
+    tbl->size = tbl->mask = tbl->count = 0;
+    tbl->shift = 0;
+}
+
+/*
+ * Return the slot holding `key`, or the free slot where it
+ * would be inserted.
+ */
+static struct hash_slot *__hash_table_find(struct hash_table *tbl,
+        unsigned long key)
+{
+    unsigned long i = __hash_table_hash(tbl, key);
+
+    while (tbl->slots[i].value != NULL && tbl->slots[i].key != key)
+        i = (i + 1) & tbl->mask;
+
+    return &tbl->slots[i];
+}
+
+/*
+ * Double the size of the table and rehash every entry.
+ */
+static int __hash_table_grow(struct hash_table *tbl)
+{
+    struct hash_table new;
+    struct hash_slot *slot;
+
+    if (hash_table_init(&new, tbl->size) < 0)
+        return -1;
+
+    hash_table_for_each(tbl, slot)
+        *__hash_table_find(&new, slot->key) = *slot;
+
+    new.count = tbl->count;
+    free(tbl->slots);
+    *tbl = new;
+    return 0;
+}
+
+/**
+ * Look up the value stored under `key`.
+ *
+ * @param tbl - pointer to the hash table
+ * @param key - key to look for
+ * @return    - the stored value, or NULL if `key` is not in the table
+ */
+void *hash_table_lookup(struct hash_table *tbl, unsigned long key)
+{
+    if (tbl->count == 0)
+        return NULL;
+
+    return __hash_table_find(tbl, key)->value;
+}
+
+/**
+ * Insert `value` under `key`, replacing any previous value.
+ *
+ * @param tbl   - pointer to the hash table
+ * @param key   - key of the entry
+ * @param value - value of the entry, must not be NULL
+ * @return      - 0 on success, -1 if the table could not grow
+ */
+int hash_table_insert(struct hash_table *tbl, unsigned long key,
+        void *value)
+{
+    struct hash_slot *slot;
+
+    if ((tbl->count + 1) * 4 > tbl->size * 3)
+        if (__hash_table_grow(tbl) < 0)
+            return -1;
+
+    slot = __hash_table_find(tbl, key);
+    if (slot->value == NULL)
+        tbl->count++;
+
+    slot->key   = key;
+    slot->value = value;
+    return 0;
+}
+
+/**
+ * Remove `key` from the table.
+ *
+ * The entries that follow in the same probe run are moved back
+ * into the hole, so that no tombstone is left behind.
+ *
+ * @param tbl - pointer to the hash table
+ * @param key - key of the entry to remove
+ * @return    - the removed value, or NULL if `key` was not found
+ */
+void *hash_table_delete(struct hash_table *tbl, unsigned long key)
+{
+    struct hash_slot *hole;
+    unsigned long i, j, home;
+    void *value;
+
+    if (tbl->count == 0)
+        return NULL;
+
+    hole = __hash_table_find(tbl, key);
+    value = hole->value;
+    if (value == NULL)
+        return NULL;
+
+    i = hole - tbl->slots;
+    j = i;
+    for (;;) {
+        j = (j + 1) & tbl->mask;
+        if (tbl->slots[j].value == NULL)
+            break;
+
+        /*
+         * An entry may only move back to `i` if its home slot
+         * does not lie cyclically within (i, j].
+         */
+        home = __hash_table_hash(tbl, tbl->slots[j].key);
+        if (((j - home) & tbl->mask) < ((j - i) & tbl->mask))
+            continue;
+
+        tbl->slots[i] = tbl->slots[j];
+        i = j;
+    }
+
+    tbl->slots[i].value = NULL;
+    tbl->count--;
+    return value;
+}
+
+/**
+ * Remove every entry from the table, keeping its size. Stored values
+ * are not freed.
+ *
+ * @param tbl - pointer to the hash table
+ */
+void hash_table_clear(struct hash_table *tbl)
+{
+    memset(tbl->slots, 0, tbl->size * sizeof(struct hash_slot));
+    tbl->count = 0;
+}
+
+/**
+ * Get the number of entries stored in the table
+ *
+ * @param tbl - pointer to the hash table
+ */
+unsigned long hash_table_count(struct hash_table *tbl)
+{
+    return tbl->count;
+}
+
+#endif /* HASH_TABLE_H */
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Execution history of the debugee.
+ *
+ * Every time the debugee stops, the way it got there is appended to
+ * the history: "continued up to the breakpoint at X", "continued until
+ * it received signal S", "stepped N instructions" or "stepped N
+ * blocks". The number of
+ * records is the logical clock of the debugee, its `tick`. Checkpoints
+ * remember the tick they were taken at.
+ *
+ * Since execution is deterministic (as long as the debugee does not
+ * depend on its environment), replaying the records from a checkpoint
+ * brings a fresh copy of it to exactly the same place as the original
+ * run. This is what reverse execution is built on.
+ *
+ * The exception is an interrupt, which comes at no particular place:
+ * a checkpoint is taken where it stopped the debugee instead, and the
+ * replay of a history that goes through an interrupt starts from there.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdlib.h>
+
+/* Tick of a checkpoint that is not part of the current history */
+#define TICK_NONE           ((unsigned long)-1)
+
+/* Kinds of stops */
+#define STOP_BREAKPOINT     0   /* hit the breakpoint at `addr` */
+#define STOP_SIGNAL         1   /* received signal `arg` */
+#define STOP_STEP           2   /* single stepped `arg` instructions */
+#define STOP_EXIT           3   /* exited, `arg` is the wait status */
+#define STOP_BLOCK          4   /* block stepped `arg` taken branches */
+#define STOP_WATCHPOINT     5   /* hit watchpoint `arg`, stopped at `addr` */
+#define STOP_INTERRUPT      6   /* interrupted by the user at `addr` */
+
+struct stop_record {
+    int                 kind;
+    void *              addr;
+    unsigned long       arg;
+};
+
+struct history {
+    struct stop_record *records;
+    unsigned long       count;
+    unsigned long       capacity;
+};
+
+/**
+ * Initialize an empty history.
+ */
+void history_init(struct history *hist)
+{
+    hist->records = NULL;
+    hist->count = 0;
+    hist->capacity = 0;
+}
+
+/**
+ * Free the records of the history.
+ */
+void history_destroy(struct history *hist)
+{
+    free(hist->records);
+    history_init(hist);
+}
+
+/**
+ * Append a stop to the history, which advances the tick by one.
+ *
+ * @param hist - pointer to the history
+ * @param rec  - the stop
+ * @return     - 0 on success, -1 if out of memory
+ */
+int history_append(struct history *hist, struct stop_record *rec)
+{
+    struct stop_record *records;
+    unsigned long capacity;
+
+    if (hist->count == hist->capacity) {
+        capacity = hist->capacity ? hist->capacity * 2 : 64;
+        records = realloc(hist->records, capacity * sizeof(*records));
+        if (records == NULL)
+            return -1;
+
+        hist->records = records;
+        hist->capacity = capacity;
+    }
+
+    hist->records[hist->count++] = *rec;
+    return 0;
+}
+
+/**
+ * Forget everything that happened after `tick`, e.g because the
+ * debugee was brought back to it and may now take another path.
+ */
+void history_truncate(struct history *hist, unsigned long tick)
+{
+    if (tick < hist->count)
+        hist->count = tick;
+}
+
+/**
+ * Get the record that leads from `tick` to `tick + 1`.
+ */
+struct stop_record *history_get(struct history *hist, unsigned long tick)
+{
+    if (tick >= hist->count)
+        return NULL;
+
+    return &hist->records[tick];
+}
+
+#endif /* HISTORY_H */
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Make the stopped debugee execute a system call on our behalf, e.g
+ * to map memory in its address space.
+ *
+ * A `syscall` instruction is temporarily written at the current RIP,
+ * executed with a single step, and the original code and registers are
+ * put back afterwards.
+ */
+
+#ifndef INJECT_H
+#define INJECT_H
+
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include <sys/syscall.h>
+
+#include <signal.h>
+
+#include "debugger.h"
+#include "memory.h"
+#include "registers.h"
+
+#define INJECT_MAX_ARGS     6
+
+#ifndef CLONE_PTRACE
+#define CLONE_PTRACE        0x00002000
+#endif
+
+#ifndef CLONE_PARENT
+#define CLONE_PARENT        0x00008000
+#endif
+
+/**
+ * Execute the system call `nr` in process `pid`.
+ *
+ * @param pid    - stopped process to run the system call in
+ * @param mem_fd - open /proc/<pid>/mem, or a negative value
+ * @param regs   - current registers of the process, restored afterwards
+ * @param nr     - system call number
+ * @param args   - the INJECT_MAX_ARGS system call arguments
+ * @return       - the value returned by the system call (a negated
+ *                 errno on error), or -ESRCH if the process went away
+ */
+long __inject_syscall(pid_t pid, int mem_fd, struct user_regs_struct *regs,
+        long nr, const long *args)
+{
+    static const uint8_t syscall_insn[2] = { 0x0f, 0x05 };
+    struct user_regs_struct call, done;
+    uint8_t saved[sizeof(syscall_insn)];
+    void *at = (void *)regs->rip;
+    int status;
+    long ret;
+
+    if (__read_memory(pid, mem_fd, at, saved, sizeof(saved)) != sizeof(saved)
+            || __write_memory(pid, mem_fd, at, syscall_insn,
+                sizeof(syscall_insn)) != sizeof(syscall_insn))
+        return -EFAULT;
+
+    call = *regs;
+    call.rax = nr;
+    call.rdi = args[0];
+    call.rsi = args[1];
+    call.rdx = args[2];
+    call.r10 = args[3];
+    call.r8  = args[4];
+    call.r9  = args[5];
+
+    /* Keep the kernel from restarting an interrupted system call */
+    call.orig_rax = -1;
+
+    ret = -ESRCH;
+    if (ptrace(PTRACE_SETREGS, pid, NULL, &call) < 0)
+        goto restore;
+
+    /*
+     * Signals that arrive in the meantime are discarded, the step
+     * is simply retried until the `syscall` has been executed. A
+     * process stopped within a system call, e.g at an exec event,
+     * first only returns from it, with that system call's return
+     * value in RAX. The event stops the system call may raise, e.g
+     * PTRACE_EVENT_FORK for a clone(), come before it returns.
+     */
+    for (;;) {
+        if (ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL) < 0 ||
+                waitpid(pid, &status, __WALL) < 0 || !WIFSTOPPED(status))
+            return -ESRCH;
+        if (WSTOPSIG(status) != SIGTRAP || status >> 16 != 0)
+            continue;
+
+        if (ptrace(PTRACE_GETREGS, pid, NULL, &done) < 0)
+            goto restore;
+        if (done.rip != (unsigned long)at)
+            break;
+        if (ptrace(PTRACE_SETREGS, pid, NULL, &call) < 0)
+            goto restore;
+    }
+    ret = done.rax;
+
+restore:
+    __write_memory(pid, mem_fd, at, saved, sizeof(saved));
+    ptrace(PTRACE_SETREGS, pid, NULL, regs);
+    return ret;
+}
+
+/**
+ * Execute a system call in the debugee.
+ *
+ * @param dbg - pointer to debugger structure
+ * @param nr  - system call number
+ * @param a1..a6 - system call arguments
+ * @return    - the value returned by the system call, a negated errno
+ *              on error
+ */
+long inject_syscall(struct debugger *dbg, long nr, long a1, long a2,
+        long a3, long a4, long a5, long a6)
+{
+    long args[INJECT_MAX_ARGS] = { a1, a2, a3, a4, a5, a6 };
+    struct user_regs_struct regs;
+    long ret;
+
+    if (debugger_get_regs(dbg, &regs) < 0)
+        return -ESRCH;
+
+    ret = __inject_syscall(dbg->dbge_pid, debugger_mem_fd(dbg), &regs, nr,
+            args);
+
+    /* The registers in the debugee are now the ones we passed, but
+     * the system call may have changed its memory */
+    if (dbg->regs_state == REGS_DIRTY)
+        dbg->regs_state = REGS_CLEAN;
+    stop_cache_clear(&dbg->stop);
+    return ret;
+}
+
+/**
+ * Fork process `pid`, which must be stopped, by making it call
+ * clone(CLONE_PTRACE). The child is traced by us from its first
+ * instruction and is left stopped, in the very same state as `pid`.
+ * It is a sibling of `pid` rather than its child, for `pid` not to
+ * wait for it.
+ *
+ * @param pid    - stopped process to fork
+ * @param mem_fd - open /proc/<pid>/mem, or a negative value
+ * @param regs   - current registers of the process, also given to
+ *                 the child
+ * @return       - pid of the child, or a negated errno on error
+ */
+pid_t __inject_fork(pid_t pid, int mem_fd, struct user_regs_struct *regs)
+{
+    long args[INJECT_MAX_ARGS] = {
+        CLONE_PTRACE | CLONE_PARENT | SIGCHLD, 0, 0, 0, 0, 0
+    };
+    uint8_t code[2];
+    int status;
+    pid_t child;
+
+    child = __inject_syscall(pid, mem_fd, regs, SYS_clone, args);
+    if (child < 0)
+        return child;
+
+    if (waitpid(child, &status, __WALL) < 0 || !WIFSTOPPED(status))
+        return -ESRCH;
+
+    /*
+     * The child was forked with our `syscall` in its code and with
+     * the registers of the system call.
+     */
+    if (__read_memory(pid, mem_fd, (void *)regs->rip, code, sizeof(code))
+            != sizeof(code) ||
+            __write_memory(child, -1, (void *)regs->rip, code, sizeof(code))
+            != sizeof(code) ||
+            ptrace(PTRACE_SETREGS, child, NULL, regs) < 0) {
+        kill(child, SIGKILL);
+        waitpid(child, &status, __WALL);
+        return -EFAULT;
+    }
+
+    return child;
+}
+
+#endif /* INJECT_H */
@@ -0,0 +1,1523 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Source lines of the program of the debugee, from DWARF .debug_line.
+ *
+ * .debug_line holds one line number program per compilation unit. Only
+ * the lengths of the units are read up front, everything else is done
+ * per unit and on demand:
+ *
+ *   - the header of a unit, with its table of files, is read the first
+ *     time a file is looked for, to find the units that refer to it.
+ *
+ *   - the program of a unit is run into rows sorted by address the
+ *     first time one of its files, or an address in it, is looked for.
+ *
+ * The unit of an address is found from .debug_aranges, which gives the
+ * ranges of addresses of each compilation unit, and the unit's entry in
+ * .debug_info, whose DW_AT_stmt_list is the offset of its program in
+ * .debug_line. Without them, the first lookup of an address runs the
+ * programs of all units.
+ *
+ * Units are worked on in parallel, by a few threads that each take the
+ * next unit still to be done, so that a program with thousands of them
+ * does not stall the first `break file:line`.
+ *
+ * DWARF versions 2 to 5 are read, in 32 or 64-bit format. Names point
+ * into the sections, which are mapped by the caller.
+ */
+
+#ifndef LINES_H
+#define LINES_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Threads parsing units, and units below which one is enough */
+#define LINE_THREADS_MAX    8
+#define LINE_PARALLEL_MIN   16
+
+/* Steps of a unit, each one done once */
+#define LINE_UNIT_NEW       0
+#define LINE_UNIT_HEADER    1   /* files read */
+#define LINE_UNIT_ROWS      2   /* program run */
+#define LINE_UNIT_BAD       3
+
+/* DWARF constants, not all of which <elf.h> has */
+#define DW_LNS_copy                 1
+#define DW_LNS_advance_pc           2
+#define DW_LNS_advance_line         3
+#define DW_LNS_set_file             4
+#define DW_LNS_negate_stmt          6
+#define DW_LNS_const_add_pc         8
+#define DW_LNS_fixed_advance_pc     9
+#define DW_LNE_end_sequence         1
+#define DW_LNE_set_address          2
+#define DW_LNCT_path                1
+#define DW_LNCT_directory_index     2
+#define DW_FORM_block               0x09
+#define DW_FORM_block1              0x0a
+#define DW_FORM_data1               0x0b
+#define DW_FORM_data2               0x05
+#define DW_FORM_data4               0x06
+#define DW_FORM_data8               0x07
+#define DW_FORM_data16              0x1e
+#define DW_FORM_string              0x08
+#define DW_FORM_strp                0x0e
+#define DW_FORM_udata               0x0f
+#define DW_FORM_line_strp           0x1f
+#define DW_FORM_addr                0x01
+#define DW_FORM_block2              0x03
+#define DW_FORM_block4              0x04
+#define DW_FORM_flag                0x0c
+#define DW_FORM_sdata               0x0d
+#define DW_FORM_ref_addr            0x10
+#define DW_FORM_ref1                0x11
+#define DW_FORM_ref2                0x12
+#define DW_FORM_ref4                0x13
+#define DW_FORM_ref8                0x14
+#define DW_FORM_ref_udata           0x15
+#define DW_FORM_indirect            0x16
+#define DW_FORM_sec_offset          0x17
+#define DW_FORM_exprloc             0x18
+#define DW_FORM_flag_present        0x19
+#define DW_FORM_strx                0x1a
+#define DW_FORM_addrx               0x1b
+#define DW_FORM_ref_sup4            0x1c
+#define DW_FORM_strp_sup            0x1d
+#define DW_FORM_ref_sig8            0x20
+#define DW_FORM_implicit_const      0x21
+#define DW_FORM_loclistx            0x22
+#define DW_FORM_rnglistx            0x23
+#define DW_FORM_ref_sup8            0x24
+#define DW_FORM_strx1               0x25
+#define DW_FORM_strx2               0x26
+#define DW_FORM_strx3               0x27
+#define DW_FORM_strx4               0x28
+#define DW_FORM_addrx1              0x29
+#define DW_FORM_addrx2              0x2a
+#define DW_FORM_addrx3              0x2b
+#define DW_FORM_addrx4              0x2c
+#define DW_AT_stmt_list             0x10
+#define DW_UT_compile               0x01
+#define DW_UT_type                  0x02
+#define DW_UT_partial               0x03
+#define DW_UT_skeleton              0x04
+#define DW_UT_split_compile         0x05
+#define DW_UT_split_type            0x06
+
+struct line_row {
+    unsigned long       addr;       /* in the file */
+    uint32_t            line;
+    uint16_t            file;
+    uint8_t             is_stmt;
+
+    /* First address after a sequence, that has no line */
+    uint8_t             end;
+};
+
+struct line_file {
+    const char          *name;
+
+    /* NULL if unknown, e.g the directory of the compilation */
+    const char          *dir;
+};
+
+struct line_unit {
+    unsigned long       offset;     /* in .debug_line */
+    unsigned long       end;
+    int                 state;
+
+    /* From the header */
+    unsigned int        version;
+    unsigned int        offset_size;
+    unsigned int        min_insn_len;
+    int                 default_is_stmt;
+    int                 line_base;
+    unsigned int        line_range;
+    unsigned int        opcode_base;
+    const uint8_t       *opcode_lengths;
+    unsigned long       program;
+
+    /* Indexed by the file register of the program, may have holes */
+    struct line_file    *files;
+    unsigned int        nfiles;
+
+    /* Sorted by address, sequence by sequence */
+    struct line_row     *rows;
+    unsigned long       nrows;
+    unsigned long       low;
+    unsigned long       high;
+};
+
+/* Addresses of a unit, from .debug_aranges */
+struct line_arange {
+    unsigned long       low;
+    unsigned long       high;
+    struct line_unit    *unit;
+};
+
+struct line_index {
+    const uint8_t       *line;
+    unsigned long       line_size;
+    const uint8_t       *line_str;
+    unsigned long       line_str_size;
+    const uint8_t       *str;
+    unsigned long       str_size;
+
+    int                 scanned;
+    struct line_unit    *units;
+    unsigned long       nunits;
+
+    /* Every unit ran its program */
+    int                 all_rows;
+
+    /*
+     * Units with rows sorted by their lowest address, with the highest
+     * address of those up to each, for units that overlap.
+     */
+    struct line_unit    **by_addr;
+    unsigned long       *max_high;
+    unsigned long       nby_addr;
+
+    /* .debug_aranges, .debug_info and .debug_abbrev, or NULL */
+    const uint8_t       *aranges;
+    unsigned long       aranges_size;
+    const uint8_t       *info;
+    unsigned long       info_size;
+    const uint8_t       *abbrev;
+    unsigned long       abbrev_size;
+
+    /*
+     * Ranges of addresses of the units sorted by their lowest address,
+     * with the highest address of those up to each, and whether every
+     * unit has its ranges, in which case an address out of them has no
+     * line.
+     */
+    int                 ranged;
+    struct line_arange  *ranges;
+    unsigned long       *ranges_high;
+    unsigned long       nranges;
+    int                 ranges_all;
+};
+
+/* Reader of a bounded buffer, that stops at its end */
+struct line_reader {
+    const uint8_t       *p;
+    const uint8_t       *end;
+    int                 error;
+};
+
+static uint64_t __line_read(struct line_reader *r, unsigned int len)
+{
+    uint64_t v = 0;
+    unsigned int i;
+
+    if (r->error || (unsigned long)(r->end - r->p) < len) {
+        r->error = 1;
+        return 0;
+    }
+    for (i = 0; i < len; i++)
+        v |= (uint64_t)r->p[i] << (8 * i);
+    r->p += len;
+    return v;
+}
+
+static uint64_t __line_uleb(struct line_reader *r)
+{
+    uint64_t v = 0;
+    unsigned int shift = 0;
+    uint8_t b;
+
+    do {
+        if (r->error || r->p >= r->end) {
+            r->error = 1;
+            return 0;
+        }
+        b = *r->p++;
+        if (shift < 64)
+            v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+static int64_t __line_sleb(struct line_reader *r)
+{
+    uint64_t v = 0;
+    unsigned int shift = 0;
+    uint8_t b;
+
+    do {
+        if (r->error || r->p >= r->end) {
+            r->error = 1;
+            return 0;
+        }
+        b = *r->p++;
+        if (shift < 64)
+            v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    if (shift < 64 && (b & 0x40))
+        v |= ~0ULL << shift;
+    return (int64_t)v;
+}
+
+/*
+ * Read a string in place.
+ */
+static const char *__line_string(struct line_reader *r)
+{
+    const char *s = (const char *)r->p;
+    const uint8_t *nul;
+
+    if (r->error || (nul = memchr(r->p, '\0', r->end - r->p)) == NULL) {
+        r->error = 1;
+        return NULL;
+    }
+    r->p = nul + 1;
+    return s;
+}
+
+/*
+ * Get the string at `off` of a string section.
+ */
+static const char *__line_strp(const uint8_t *sec, unsigned long size,
+        uint64_t off)
+{
+    if (sec == NULL || off >= size ||
+            memchr(sec + off, '\0', size - off) == NULL)
+        return NULL;
+    return (const char *)sec + off;
+}
+
+/*
+ * Read an attribute of form `form` of the tables of directories and
+ * files of DWARF 5, as a string if it is one, or a number.
+ *
+ * @return - 0 on success, -1 if the form is not supported
+ */
+static int __line_form(struct line_index *li, struct line_unit *unit,
+        struct line_reader *r, uint64_t form, const char **str,
+        uint64_t *num)
+{
+    uint64_t len;
+
+    *str = NULL;
+    *num = 0;
+    switch (form) {
+    case DW_FORM_string:
+        *str = __line_string(r);
+        break;
+    case DW_FORM_line_strp:
+        *str = __line_strp(li->line_str, li->line_str_size,
+                __line_read(r, unit->offset_size));
+        break;
+    case DW_FORM_strp:
+        *str = __line_strp(li->str, li->str_size,
+                __line_read(r, unit->offset_size));
+        break;
+    case DW_FORM_udata:
+        *num = __line_uleb(r);
+        break;
+    case DW_FORM_data1:
+        *num = __line_read(r, 1);
+        break;
+    case DW_FORM_data2:
+        *num = __line_read(r, 2);
+        break;
+    case DW_FORM_data4:
+        *num = __line_read(r, 4);
+        break;
+    case DW_FORM_data8:
+        *num = __line_read(r, 8);
+        break;
+    case DW_FORM_data16:
+        __line_read(r, 8);
+        __line_read(r, 8);
+        break;
+    case DW_FORM_block:
+    case DW_FORM_block1:
+        len = form == DW_FORM_block ? __line_uleb(r) : __line_read(r, 1);
+        if (len > (unsigned long)(r->end - r->p))
+            return -1;
+        r->p += len;
+        break;
+    default:
+        return -1;
+    }
+    return r->error ? -1 : 0;
+}
+
+/*
+ * Read the table of directories or of files of a DWARF 5 header into
+ * `files`, with the directory of each file taken from `dirs`.
+ *
+ * @return - the number of entries, -1 on error
+ */
+static long __line_entries5(struct line_index *li, struct line_unit *unit,
+        struct line_reader *r, const struct line_file *dirs,
+        unsigned long ndirs, struct line_file **files)
+{
+    uint64_t formats[16][2], count, i, num;
+    unsigned int nformats, j;
+    const char *str;
+
+    nformats = __line_read(r, 1);
+    if (nformats > 16)
+        return -1;
+    for (j = 0; j < nformats; j++) {
+        formats[j][0] = __line_uleb(r);
+        formats[j][1] = __line_uleb(r);
+    }
+    count = __line_uleb(r);
+    if (r->error || count > (unsigned long)(r->end - r->p))
+        return -1;
+
+    *files = calloc(count + 1, sizeof(**files));
+    if (*files == NULL)
+        return -1;
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < nformats; j++) {
+            if (__line_form(li, unit, r, formats[j][1], &str, &num) < 0) {
+                free(*files);
+                return -1;
+            }
+            if (formats[j][0] == DW_LNCT_path)
+                (*files)[i].name = str;
+            else if (formats[j][0] == DW_LNCT_directory_index &&
+                    num < ndirs)
+                (*files)[i].dir = dirs[num].name;
+        }
+    }
+    return count;
+}
+
+/*
+ * Read the header of `unit`, up to its table of files.
+ *
+ * @return - 0 on success, -1 if it is corrupt or of an unknown version
+ */
+static int __line_unit_header(struct line_index *li, struct line_unit *unit)
+{
+    struct line_reader r = {
+        li->line + unit->offset, li->line + unit->end, 0
+    };
+    struct line_file *dirs = NULL, *files = NULL, *tmp;
+    unsigned long ndirs = 0, nfiles = 1, cap = 16;
+    uint64_t len, dir;
+    const char *name;
+    long n;
+
+    len = __line_read(&r, 4);
+    unit->offset_size = 4;
+    if (len == 0xffffffff) {
+        __line_read(&r, 8);
+        unit->offset_size = 8;
+    }
+    unit->version = __line_read(&r, 2);
+    if (unit->version < 2 || unit->version > 5)
+        return -1;
+    if (unit->version >= 5)
+        __line_read(&r, 2);     /* address and segment selector sizes */
+
+    len = __line_read(&r, unit->offset_size);
+    if (r.error || len > (unsigned long)(r.end - r.p))
+        return -1;
+    unit->program = r.p + len - li->line;
+
+    unit->min_insn_len = __line_read(&r, 1);
+    if (unit->version >= 4)
+        __line_read(&r, 1);     /* operations per instruction, for VLIW */
+    unit->default_is_stmt = __line_read(&r, 1) != 0;
+    unit->line_base = (int8_t)__line_read(&r, 1);
+    unit->line_range = __line_read(&r, 1);
+    unit->opcode_base = __line_read(&r, 1);
+    unit->opcode_lengths = r.p;
+    if (r.error || unit->line_range == 0 || unit->opcode_base == 0 ||
+            unit->opcode_base - 1UL > (unsigned long)(r.end - r.p))
+        return -1;
+    r.p += unit->opcode_base - 1;
+
+    if (unit->version >= 5) {
+        n = __line_entries5(li, unit, &r, NULL, 0, &dirs);
+        if (n < 0)
+            return -1;
+        ndirs = n;
+        n = __line_entries5(li, unit, &r, dirs, ndirs, &files);
+        free(dirs);
+        if (n < 0)
+            return -1;
+        unit->files = files;
+        unit->nfiles = n;
+        return 0;
+    }
+
+    /* Directory 0 is the one of the compilation, which is not here */
+    dirs = calloc(cap, sizeof(*dirs));
+    if (dirs == NULL)
+        return -1;
+    ndirs = 1;
+    while ((name = __line_string(&r)) != NULL && *name != '\0') {
+        if (ndirs == cap) {
+            cap *= 2;
+            tmp = realloc(dirs, cap * sizeof(*dirs));
+            if (tmp == NULL)
+                goto fail;
+            dirs = tmp;
+        }
+        dirs[ndirs++].name = name;
+    }
+
+    /* Files count from 1 */
+    cap = 16;
+    files = calloc(cap, sizeof(*files));
+    if (files == NULL)
+        goto fail;
+    while ((name = __line_string(&r)) != NULL && *name != '\0') {
+        dir = __line_uleb(&r);
+        __line_uleb(&r);        /* modification time */
+        __line_uleb(&r);        /* length */
+        if (nfiles == cap) {
+            cap *= 2;
+            tmp = realloc(files, cap * sizeof(*files));
+            if (tmp == NULL)
+                goto fail;
+            files = tmp;
+        }
+        files[nfiles].name = name;
+        files[nfiles].dir = dir < ndirs ? dirs[dir].name : NULL;
+        nfiles++;
+    }
+    if (r.error)
+        goto fail;
+
+    free(dirs);
+    unit->files = files;
+    unit->nfiles = nfiles;
+    return 0;
+
+fail:
+    free(dirs);
+    free(files);
+    return -1;
+}
+
+/*
+ * Add a row to `unit`.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+static int __line_row_add(struct line_unit *unit, unsigned long *cap,
+        const struct line_row *row)
+{
+    struct line_row *tmp;
+
+    if (unit->nrows == *cap) {
+        *cap = *cap != 0 ? *cap * 2 : 256;
+        tmp = realloc(unit->rows, *cap * sizeof(*tmp));
+        if (tmp == NULL)
+            return -1;
+        unit->rows = tmp;
+    }
+    unit->rows[unit->nrows++] = *row;
+    return 0;
+}
+
+/* A sequence of rows of a unit, while they are sorted */
+struct line_seq {
+    unsigned long       addr;
+    unsigned long       first;
+    unsigned long       count;
+};
+
+static int __line_seq_compare(const void *a, const void *b)
+{
+    const struct line_seq *x = a, *y = b;
+
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    return x->first < y->first ? -1 : 1;
+}
+
+/*
+ * Sort the rows of `unit` by address. Addresses only grow within a
+ * sequence, so sequences are sorted as a whole.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+static int __line_unit_sort(struct line_unit *unit, struct line_seq *seqs,
+        unsigned long nseqs)
+{
+    struct line_row *rows;
+    unsigned long i, n = 0;
+
+    for (i = 1; i < nseqs; i++)
+        if (seqs[i].addr < seqs[i - 1].addr)
+            break;
+    if (i >= nseqs)
+        return 0;
+
+    rows = malloc(unit->nrows * sizeof(*rows));
+    if (rows == NULL)
+        return -1;
+    qsort(seqs, nseqs, sizeof(*seqs), __line_seq_compare);
+    for (i = 0; i < nseqs; i++) {
+        memcpy(&rows[n], &unit->rows[seqs[i].first],
+                seqs[i].count * sizeof(*rows));
+        n += seqs[i].count;
+    }
+    free(unit->rows);
+    unit->rows = rows;
+    unit->nrows = n;
+    return 0;
+}
+
+/*
+ * Run the line number program of `unit` into its rows.
+ *
+ * @return - 0 on success, -1 if it is corrupt, or on allocation failure
+ */
+static int __line_unit_run(struct line_index *li, struct line_unit *unit)
+{
+    struct line_reader r = {
+        li->line + unit->program, li->line + unit->end, 0
+    };
+    struct line_seq *seqs = NULL, *tmp;
+    unsigned long cap = 0, nseqs = 0, seqs_cap = 0, first = 0;
+    struct line_row row;
+    unsigned int op, adj, i;
+    uint64_t len;
+    const uint8_t *next;
+
+    memset(&row, 0, sizeof(row));
+    row.line = 1;
+    row.file = 1;
+    row.is_stmt = unit->default_is_stmt;
+    unit->low = ~0UL;
+    unit->high = 0;
+
+    while (r.p < r.end && !r.error) {
+        op = __line_read(&r, 1);
+
+        if (op >= unit->opcode_base) {
+            adj = op - unit->opcode_base;
+            row.addr += (adj / unit->line_range) * unit->min_insn_len;
+            row.line += unit->line_base + (int)(adj % unit->line_range);
+            if (__line_row_add(unit, &cap, &row) < 0)
+                goto fail;
+            continue;
+        }
+
+        switch (op) {
+        case 0:
+            len = __line_uleb(&r);
+            if (r.error || len == 0 || len > (unsigned long)(r.end - r.p))
+                goto fail;
+            next = r.p + len;
+            op = __line_read(&r, 1);
+            if (op == DW_LNE_end_sequence) {
+                row.end = 1;
+                if (__line_row_add(unit, &cap, &row) < 0)
+                    goto fail;
+
+                /* Code of discarded sections is at 0, or the tombstone */
+                if (unit->rows[first].addr != 0 &&
+                        unit->rows[first].addr < ~1UL) {
+                    if (nseqs == seqs_cap) {
+                        seqs_cap = seqs_cap != 0 ? seqs_cap * 2 : 16;
+                        tmp = realloc(seqs, seqs_cap * sizeof(*seqs));
+                        if (tmp == NULL)
+                            goto fail;
+                        seqs = tmp;
+                    }
+                    seqs[nseqs].addr = unit->rows[first].addr;
+                    seqs[nseqs].first = first;
+                    seqs[nseqs].count = unit->nrows - first;
+                    nseqs++;
+                    if (unit->rows[first].addr < unit->low)
+                        unit->low = unit->rows[first].addr;
+                    if (row.addr > unit->high)
+                        unit->high = row.addr;
+                } else {
+                    unit->nrows = first;
+                }
+                first = unit->nrows;
+
+                memset(&row, 0, sizeof(row));
+                row.line = 1;
+                row.file = 1;
+                row.is_stmt = unit->default_is_stmt;
+            } else if (op == DW_LNE_set_address) {
+                row.addr = __line_read(&r, len - 1 < 8 ? len - 1 : 8);
+            }
+            r.p = next;
+            break;
+        case DW_LNS_copy:
+            if (__line_row_add(unit, &cap, &row) < 0)
+                goto fail;
+            break;
+        case DW_LNS_advance_pc:
+            row.addr += __line_uleb(&r) * unit->min_insn_len;
+            break;
+        case DW_LNS_advance_line:
+            row.line += __line_sleb(&r);
+            break;
+        case DW_LNS_set_file:
+            row.file = __line_uleb(&r);
+            break;
+        case DW_LNS_negate_stmt:
+            row.is_stmt = !row.is_stmt;
+            break;
+        case DW_LNS_const_add_pc:
+            row.addr += ((255 - unit->opcode_base) / unit->line_range) *
+                unit->min_insn_len;
+            break;
+        case DW_LNS_fixed_advance_pc:
+            row.addr += __line_read(&r, 2);
+            break;
+        default:
+            /* Skip the operands of the others, all LEB128 */
+            for (i = 0; i < unit->opcode_lengths[op - 1]; i++)
+                __line_uleb(&r);
+            break;
+        }
+    }
+
+    /* Rows after the last sequence have no end, and are dropped */
+    unit->nrows = first;
+    if (r.error || __line_unit_sort(unit, seqs, nseqs) < 0)
+        goto fail;
+    free(seqs);
+    return 0;
+
+fail:
+    free(seqs);
+    free(unit->rows);
+    unit->rows = NULL;
+    unit->nrows = 0;
+    return -1;
+}
+
+/*
+ * Take `unit` to step `state`, on any thread.
+ */
+static void __line_unit_to(struct line_index *li, struct line_unit *unit,
+        int state)
+{
+    if (unit->state == LINE_UNIT_NEW && state >= LINE_UNIT_HEADER)
+        unit->state = __line_unit_header(li, unit) == 0 ?
+            LINE_UNIT_HEADER : LINE_UNIT_BAD;
+    if (unit->state == LINE_UNIT_HEADER && state >= LINE_UNIT_ROWS)
+        unit->state = __line_unit_run(li, unit) == 0 ?
+            LINE_UNIT_ROWS : LINE_UNIT_BAD;
+}
+
+/* Units worked on in parallel */
+struct line_batch {
+    struct line_index   *li;
+    struct line_unit    **units;
+    unsigned long       count;
+    int                 state;
+    unsigned long       next;
+};
+
+static void *__line_worker(void *arg)
+{
+    struct line_batch *batch = arg;
+    unsigned long i;
+
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) <
+            batch->count)
+        __line_unit_to(batch->li, batch->units[i], batch->state);
+    return NULL;
+}
+
+/*
+ * Take the `count` units of `units` to step `state`, with a few threads
+ * if there are many of them. The threads take no signals, they are for
+ * the thread of the debugger.
+ */
+static void __line_units_to(struct line_index *li, struct line_unit **units,
+        unsigned long count, int state)
+{
+    struct line_batch batch = { li, units, count, state, 0 };
+    pthread_t threads[LINE_THREADS_MAX - 1];
+    sigset_t all, old;
+    long nthreads = 1, started = 0, i;
+
+    if (count >= LINE_PARALLEL_MIN) {
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nthreads > LINE_THREADS_MAX)
+            nthreads = LINE_THREADS_MAX;
+    }
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[started], NULL, __line_worker,
+                    &batch) != 0)
+            break;
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    __line_worker(&batch);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+/*
+ * Find where the units are, from their lengths.
+ *
+ * @return - 0 on success, -1 if there is no .debug_line
+ */
+static int __line_scan(struct line_index *li)
+{
+    struct line_reader r = { li->line, li->line + li->line_size, 0 };
+    unsigned long cap = 0, off;
+    struct line_unit *tmp;
+    uint64_t len;
+
+    if (li->scanned)
+        return li->units != NULL ? 0 : -1;
+    li->scanned = 1;
+    if (li->line == NULL)
+        return -1;
+
+    while (r.p < r.end) {
+        off = r.p - li->line;
+        len = __line_read(&r, 4);
+        if (len == 0xffffffff)
+            len = __line_read(&r, 8);
+        else if (len >= 0xfffffff0)
+            break;
+        if (r.error || len > (unsigned long)(r.end - r.p))
+            break;
+        r.p += len;
+
+        if (li->nunits == cap) {
+            cap = cap != 0 ? cap * 2 : 64;
+            tmp = realloc(li->units, cap * sizeof(*tmp));
+            if (tmp == NULL)
+                break;
+            li->units = tmp;
+        }
+        memset(&li->units[li->nunits], 0, sizeof(*li->units));
+        li->units[li->nunits].offset = off;
+        li->units[li->nunits].end = r.p - li->line;
+        li->nunits++;
+    }
+    return li->units != NULL ? 0 : -1;
+}
+
+/*
+ * Check whether `file` is the file `path` the user gave, that is also
+ * the end of its path after a '/', e.g `src/main.c` for main.c.
+ */
+static int __line_file_is(const struct line_file *file, const char *path)
+{
+    size_t len = strlen(path), name_len, dir_len;
+    const char *name = file->name;
+
+    if (name == NULL)
+        return 0;
+    name_len = strlen(name);
+    if (name_len >= len)
+        return strcmp(name + name_len - len, path) == 0 &&
+            (name_len == len || name[name_len - len - 1] == '/');
+
+    /* The rest of the path may be in the directory */
+    if (file->dir == NULL || name[0] == '/' ||
+            strncmp(path + len - name_len, name, name_len) != 0 ||
+            path[len - name_len - 1] != '/')
+        return 0;
+    len -= name_len + 1;
+    dir_len = strlen(file->dir);
+    return dir_len >= len &&
+        strncmp(file->dir + dir_len - len, path, len) == 0 &&
+        (dir_len == len || path[0] == '/' ||
+         file->dir[dir_len - len - 1] == '/');
+}
+
+/**
+ * Set up the line index of a program, whose sections are mapped by the
+ * caller. Nothing is read yet.
+ *
+ * @param line     - .debug_line, NULL if the program has none
+ * @param line_str - .debug_line_str, of DWARF 5, or NULL
+ * @param str      - .debug_str, or NULL
+ */
+void line_index_init(struct line_index *li, const uint8_t *line,
+        unsigned long line_size, const uint8_t *line_str,
+        unsigned long line_str_size, const uint8_t *str,
+        unsigned long str_size)
+{
+    memset(li, 0, sizeof(*li));
+    li->line = line;
+    li->line_size = line_size;
+    li->line_str = line_str;
+    li->line_str_size = line_str_size;
+    li->str = str;
+    li->str_size = str_size;
+}
+
+/**
+ * Give the line index the sections that tell which unit has the code
+ * at an address, for a lookup by address to run the program of that
+ * unit only. They are mapped by the caller, and may be NULL.
+ *
+ * @param aranges - .debug_aranges
+ * @param info    - .debug_info
+ * @param abbrev  - .debug_abbrev
+ */
+void line_index_units(struct line_index *li, const uint8_t *aranges,
+        unsigned long aranges_size, const uint8_t *info,
+        unsigned long info_size, const uint8_t *abbrev,
+        unsigned long abbrev_size)
+{
+    li->aranges = aranges;
+    li->aranges_size = aranges_size;
+    li->info = info;
+    li->info_size = info_size;
+    li->abbrev = abbrev;
+    li->abbrev_size = abbrev_size;
+}
+
+/**
+ * Free what the line index of a program read.
+ */
+void line_index_destroy(struct line_index *li)
+{
+    unsigned long i;
+
+    for (i = 0; i < li->nunits; i++) {
+        free(li->units[i].files);
+        free(li->units[i].rows);
+    }
+    free(li->units);
+    free(li->by_addr);
+    free(li->max_high);
+    free(li->ranges);
+    free(li->ranges_high);
+}
+
+/**
+ * Find the code of line `line` of the source file `path`: the lowest
+ * address of that line, or of the closest line after it that has code,
+ * like a breakpoint on a comment stops at the next statement.
+ *
+ * @param addr  - where to store the address, in the file
+ * @param found - where to store the line it is the code of
+ * @return      - 0 on success, -1 if no unit has code for that file
+ *                at or after that line
+ */
+int line_lookup_file(struct line_index *li, const char *path,
+        unsigned int line, unsigned long *addr, unsigned int *found)
+{
+    struct line_unit **units, *unit;
+    unsigned long i, n = 0, r;
+    unsigned int best = 0, f;
+    const struct line_row *row;
+    uint8_t *is_path;
+
+    if (__line_scan(li) < 0)
+        return -1;
+    units = malloc(li->nunits * sizeof(*units));
+    if (units == NULL)
+        return -1;
+
+    /* The headers say which units have code from the file */
+    for (i = 0; i < li->nunits; i++)
+        units[i] = &li->units[i];
+    __line_units_to(li, units, li->nunits, LINE_UNIT_HEADER);
+
+    for (i = 0; i < li->nunits; i++) {
+        unit = &li->units[i];
+        if (unit->state == LINE_UNIT_BAD)
+            continue;
+        for (f = 0; f < unit->nfiles; f++) {
+            if (__line_file_is(&unit->files[f], path)) {
+                units[n++] = unit;
+                break;
+            }
+        }
+    }
+    __line_units_to(li, units, n, LINE_UNIT_ROWS);
+
+    for (i = 0; i < n; i++) {
+        unit = units[i];
+        if (unit->state != LINE_UNIT_ROWS)
+            continue;
+        is_path = calloc(unit->nfiles, 1);
+        if (is_path == NULL)
+            continue;
+        for (f = 0; f < unit->nfiles; f++)
+            is_path[f] = __line_file_is(&unit->files[f], path);
+
+        for (r = 0; r < unit->nrows; r++) {
+            row = &unit->rows[r];
+            if (row->end || !row->is_stmt || row->line < line ||
+                    row->file >= unit->nfiles || !is_path[row->file])
+                continue;
+            if (best == 0 || row->line < best ||
+                    (row->line == best && row->addr < *addr)) {
+                best = row->line;
+                *addr = row->addr;
+            }
+        }
+        free(is_path);
+    }
+    free(units);
+
+    *found = best;
+    return best != 0 ? 0 : -1;
+}
+
+static int __line_unit_compare(const void *a, const void *b)
+{
+    const struct line_unit *x = *(struct line_unit *const *)a;
+    const struct line_unit *y = *(struct line_unit *const *)b;
+
+    if (x->low != y->low)
+        return x->low < y->low ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Run the programs of all units, and sort those with rows by address.
+ */
+static void __line_all_rows(struct line_index *li)
+{
+    struct line_unit **units;
+    unsigned long i, n = 0;
+
+    li->all_rows = 1;
+    units = malloc(li->nunits * sizeof(*units));
+    li->max_high = malloc(li->nunits * sizeof(*li->max_high));
+    if (units == NULL || li->max_high == NULL) {
+        free(units);
+        return;
+    }
+    for (i = 0; i < li->nunits; i++)
+        units[i] = &li->units[i];
+    __line_units_to(li, units, li->nunits, LINE_UNIT_ROWS);
+
+    for (i = 0; i < li->nunits; i++)
+        if (li->units[i].state == LINE_UNIT_ROWS && li->units[i].nrows > 0)
+            units[n++] = &li->units[i];
+    qsort(units, n, sizeof(*units), __line_unit_compare);
+    for (i = 0; i < n; i++)
+        li->max_high[i] = i == 0 || units[i]->high > li->max_high[i - 1] ?
+            units[i]->high : li->max_high[i - 1];
+
+    li->by_addr = units;
+    li->nby_addr = n;
+}
+
+/*
+ * Find the row of `unit` for the code at `addr`.
+ *
+ * @return - the row, or NULL if the code has no line
+ */
+static const struct line_row *__line_unit_row(struct line_unit *unit,
+        unsigned long addr)
+{
+    const struct line_row *row;
+    unsigned long lo = 0, hi = unit->nrows, mid;
+
+    if (addr < unit->low || addr >= unit->high)
+        return NULL;
+
+    /* The last row at or before `addr` */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (unit->rows[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0 || unit->rows[lo - 1].end)
+        return NULL;
+
+    /* Of the rows of that address, the last statement if any */
+    row = &unit->rows[lo - 1];
+    for (lo--; lo > 0 && !row->is_stmt &&
+            unit->rows[lo - 1].addr == row->addr &&
+            !unit->rows[lo - 1].end; lo--) {
+        if (unit->rows[lo - 1].is_stmt)
+            row = &unit->rows[lo - 1];
+    }
+    if (row->file >= unit->nfiles || unit->files[row->file].name == NULL)
+        return NULL;
+    return row;
+}
+
+/*
+ * Skip an attribute of form `form` of a unit of .debug_info.
+ *
+ * @return - 0 on success, -1 if the form is not known
+ */
+static int __line_skip_form(struct line_reader *r, uint64_t form,
+        unsigned int version, unsigned int addr_size,
+        unsigned int offset_size)
+{
+    uint64_t len = 0;
+
+    switch (form) {
+    case DW_FORM_flag_present:
+    case DW_FORM_implicit_const:
+        break;
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+        len = 1;
+        break;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+        len = 2;
+        break;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+        len = 3;
+        break;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+        len = 4;
+        break;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+        len = 8;
+        break;
+    case DW_FORM_data16:
+        len = 16;
+        break;
+    case DW_FORM_addr:
+        len = addr_size;
+        break;
+    case DW_FORM_ref_addr:
+        len = version == 2 ? addr_size : offset_size;
+        break;
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+    case DW_FORM_strp_sup:
+    case DW_FORM_sec_offset:
+        len = offset_size;
+        break;
+    case DW_FORM_sdata:
+        __line_sleb(r);
+        break;
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+        __line_uleb(r);
+        break;
+    case DW_FORM_string:
+        __line_string(r);
+        break;
+    case DW_FORM_block1:
+        len = __line_read(r, 1);
+        break;
+    case DW_FORM_block2:
+        len = __line_read(r, 2);
+        break;
+    case DW_FORM_block4:
+        len = __line_read(r, 4);
+        break;
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+        len = __line_uleb(r);
+        break;
+    case DW_FORM_indirect:
+        form = __line_uleb(r);
+        if (r->error || form == DW_FORM_indirect)
+            return -1;
+        return __line_skip_form(r, form, version, addr_size, offset_size);
+    default:
+        return -1;
+    }
+
+    if (r->error || len > (unsigned long)(r->end - r->p))
+        return -1;
+    r->p += len;
+    return 0;
+}
+
+/*
+ * Find the unit of .debug_line of the compilation unit at `offset` in
+ * .debug_info, from the DW_AT_stmt_list of its first entry.
+ *
+ * @return - the unit, or NULL if it has none
+ */
+static struct line_unit *__line_unit_of_info(struct line_index *li,
+        unsigned long offset)
+{
+    struct line_reader r = { li->info, li->info + li->info_size, 0 };
+    unsigned int version, addr_size, offset_size = 4, type = DW_UT_compile;
+    uint64_t len, abbrev_off, code, name, form;
+    struct line_reader a;
+    unsigned long lo, hi, mid;
+
+    if (offset >= li->info_size)
+        return NULL;
+    r.p += offset;
+
+    len = __line_read(&r, 4);
+    if (len == 0xffffffff) {
+        len = __line_read(&r, 8);
+        offset_size = 8;
+    }
+    if (r.error || len > (unsigned long)(r.end - r.p))
+        return NULL;
+    r.end = r.p + len;
+
+    version = __line_read(&r, 2);
+    if (version >= 5) {
+        type = __line_read(&r, 1);
+        addr_size = __line_read(&r, 1);
+        abbrev_off = __line_read(&r, offset_size);
+        if (type == DW_UT_skeleton || type == DW_UT_split_compile)
+            __line_read(&r, 8);
+        else if (type != DW_UT_compile && type != DW_UT_partial)
+            return NULL;
+    }
+    else {
+        abbrev_off = __line_read(&r, offset_size);
+        addr_size = __line_read(&r, 1);
+    }
+    code = __line_uleb(&r);
+    if (r.error || version < 2 || version > 5 || code == 0 ||
+            li->abbrev == NULL || abbrev_off >= li->abbrev_size)
+        return NULL;
+
+    /* The declaration of the first entry, skipping the ones before */
+    a.p = li->abbrev + abbrev_off;
+    a.end = li->abbrev + li->abbrev_size;
+    a.error = 0;
+    while (__line_uleb(&a) != code) {
+        if (a.error)
+            return NULL;
+        __line_uleb(&a);
+        __line_read(&a, 1);
+        do {
+            name = __line_uleb(&a);
+            form = __line_uleb(&a);
+            if (form == DW_FORM_implicit_const)
+                __line_sleb(&a);
+        } while ((name != 0 || form != 0) && !a.error);
+    }
+    __line_uleb(&a);
+    __line_read(&a, 1);
+
+    for (;;) {
+        name = __line_uleb(&a);
+        form = __line_uleb(&a);
+        if (form == DW_FORM_implicit_const)
+            __line_sleb(&a);
+        if (a.error || (name == 0 && form == 0))
+            return NULL;
+        if (name == DW_AT_stmt_list)
+            break;
+        if (__line_skip_form(&r, form, version, addr_size, offset_size) < 0)
+            return NULL;
+    }
+
+    if (form == DW_FORM_sec_offset || form == DW_FORM_data4)
+        offset = __line_read(&r, form == DW_FORM_data4 ? 4 : offset_size);
+    else if (form == DW_FORM_data8)
+        offset = __line_read(&r, 8);
+    else
+        return NULL;
+    if (r.error)
+        return NULL;
+
+    /* The units are in the order of their offsets */
+    lo = 0;
+    hi = li->nunits;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (li->units[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == li->nunits || li->units[lo].offset != offset)
+        return NULL;
+    return &li->units[lo];
+}
+
+static int __line_arange_compare(const void *a, const void *b)
+{
+    const struct line_arange *x = a, *y = b;
+
+    if (x->low != y->low)
+        return x->low < y->low ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Read the ranges of addresses of the units from .debug_aranges, one
+ * set of ranges per compilation unit, and sort them.
+ */
+static void __line_aranges(struct line_index *li)
+{
+    struct line_reader r = { li->aranges, li->aranges + li->aranges_size, 0 };
+    unsigned long cap = 0, i, covered = 0;
+    unsigned int offset_size, addr_size, seg_size;
+    struct line_arange *tmp;
+    struct line_reader s;
+    struct line_unit *unit;
+    const uint8_t *set;
+    uint64_t len, low;
+    uint8_t *has;
+
+    li->ranged = 1;
+    if (li->aranges == NULL || li->info == NULL)
+        return;
+    has = calloc(li->nunits, 1);
+    if (has == NULL)
+        return;
+
+    while (r.p < r.end) {
+        set = r.p;
+        offset_size = 4;
+        len = __line_read(&r, 4);
+        if (len == 0xffffffff) {
+            len = __line_read(&r, 8);
+            offset_size = 8;
+        }
+        if (r.error || len > (unsigned long)(r.end - r.p))
+            break;
+        s.p = r.p;
+        s.end = r.p + len;
+        s.error = 0;
+        r.p += len;
+
+        __line_read(&s, 2);
+        unit = __line_unit_of_info(li, __line_read(&s, offset_size));
+        addr_size = __line_read(&s, 1);
+        seg_size = __line_read(&s, 1);
+        if (s.error || unit == NULL || addr_size == 0 || addr_size > 8)
+            continue;
+        if (!has[unit - li->units]) {
+            has[unit - li->units] = 1;
+            covered++;
+        }
+
+        /* The ranges are aligned on twice the size of an address */
+        s.p = set + (s.p - set + 2 * addr_size - 1) / (2 * addr_size) *
+            (2 * addr_size);
+        for (;;) {
+            __line_read(&s, seg_size);
+            low = __line_read(&s, addr_size);
+            len = __line_read(&s, addr_size);
+            if (s.error || (low == 0 && len == 0))
+                break;
+            if (len == 0)
+                continue;
+
+            if (li->nranges == cap) {
+                cap = cap != 0 ? cap * 2 : 64;
+                tmp = realloc(li->ranges, cap * sizeof(*tmp));
+                if (tmp == NULL)
+                    goto out;
+                li->ranges = tmp;
+            }
+            li->ranges[li->nranges].low = low;
+            li->ranges[li->nranges].high = low + len;
+            li->ranges[li->nranges].unit = unit;
+            li->nranges++;
+        }
+    }
+
+    li->ranges_high = malloc((li->nranges + 1) * sizeof(*li->ranges_high));
+    if (li->ranges_high == NULL)
+        goto out;
+    qsort(li->ranges, li->nranges, sizeof(*li->ranges),
+            __line_arange_compare);
+    for (i = 0; i < li->nranges; i++)
+        li->ranges_high[i] = i == 0 ||
+            li->ranges[i].high > li->ranges_high[i - 1] ?
+            li->ranges[i].high : li->ranges_high[i - 1];
+    li->ranges_all = covered == li->nunits;
+
+out:
+    free(has);
+}
+
+/*
+ * Find the row for the code at `addr` in the units whose ranges have
+ * it, running their programs.
+ *
+ * @return - the row, or NULL if they have no line for it
+ */
+static const struct line_row *__line_row_ranged(struct line_index *li,
+        unsigned long addr, struct line_unit **unit)
+{
+    const struct line_row *row;
+    struct line_arange *range;
+    unsigned long lo = 0, hi = li->nranges, mid;
+
+    /* The ranges that start at or before `addr`, and may still have it */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (li->ranges[mid].low <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo > 0 && li->ranges_high[lo - 1] > addr; lo--) {
+        range = &li->ranges[lo - 1];
+        if (addr >= range->high)
+            continue;
+        __line_unit_to(li, range->unit, LINE_UNIT_ROWS);
+        if (range->unit->state != LINE_UNIT_ROWS)
+            continue;
+        row = __line_unit_row(range->unit, addr);
+        if (row != NULL) {
+            *unit = range->unit;
+            return row;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Find the row for the code at `addr`, and the unit it is in. Only the
+ * programs of the units whose ranges have `addr` are run, unless some
+ * units have no ranges, in which case the first lookup of an address
+ * out of the ranges runs the programs of all units.
+ *
+ * @return - the row, or NULL if the code has no line
+ */
+static const struct line_row *__line_row_at(struct line_index *li,
+        unsigned long addr, struct line_unit **unit)
+{
+    const struct line_row *row;
+    unsigned long lo, hi, mid;
+
+    if (__line_scan(li) < 0)
+        return NULL;
+    if (!li->ranged)
+        __line_aranges(li);
+    if (li->ranges_high != NULL) {
+        row = __line_row_ranged(li, addr, unit);
+        if (row != NULL || li->ranges_all)
+            return row;
+    }
+    if (!li->all_rows)
+        __line_all_rows(li);
+
+    /* The units that start at or before `addr`, and may still cover it */
+    lo = 0;
+    hi = li->nby_addr;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (li->by_addr[mid]->low <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo > 0 && li->max_high[lo - 1] > addr; lo--) {
+        row = __line_unit_row(li->by_addr[lo - 1], addr);
+        if (row != NULL) {
+            *unit = li->by_addr[lo - 1];
+            return row;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find the source line of the code at `addr`, running the program of
+ * its unit if it is the first lookup there.
+ *
+ * @param addr - address in the file
+ * @param line - where to store the line
+ * @return     - the file, or NULL if the code has no line
+ */
+const struct line_file *line_lookup_addr(struct line_index *li,
+        unsigned long addr, unsigned int *line)
+{
+    const struct line_row *row;
+    struct line_unit *unit;
+
+    row = __line_row_at(li, addr, &unit);
+    if (row == NULL)
+        return NULL;
+    *line = row->line;
+    return &unit->files[row->file];
+}
+
+/**
+ * Find the code of the source line `addr` is in: the rows around it
+ * for the same line, up to the next statement of another line.
+ *
+ * @param addr  - address in the file
+ * @param start - where to store the first address of the line
+ * @param end   - where to store the first address after it
+ * @return      - 0 on success, -1 if the code has no line
+ */
+int line_lookup_range(struct line_index *li, unsigned long addr,
+        unsigned long *start, unsigned long *end)
+{
+    const struct line_row *row, *first, *last;
+    struct line_unit *unit;
+
+    row = __line_row_at(li, addr, &unit);
+    if (row == NULL)
+        return -1;
+
+    for (first = row; first > unit->rows && !first[-1].end &&
+            first[-1].line == row->line && first[-1].file == row->file;
+            first--)
+        ;
+    for (last = row + 1; last < unit->rows + unit->nrows && !last->end &&
+            (last->addr == row->addr || !last->is_stmt ||
+             (last->line == row->line && last->file == row->file));
+            last++)
+        ;
+    if (last == unit->rows + unit->nrows)
+        return -1;
+
+    *start = first->addr;
+    *end = last->addr;
+    return 0;
+}
+
+#endif /* LINES_H */
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A small LZ77 block codec in the spirit of LZ4, used to compress the
+ * chunks of trace files (see inc/trace.h).
+ *
+ * A block is a series of sequences. Each starts with a token byte whose
+ * high nibble is the number of literals and low nibble the length of the
+ * match minus LZ_MIN_MATCH; a nibble of 15 is continued by bytes that
+ * are added to it until one is not 255. Then come the literals, and the
+ * match as a 16 bit little endian distance back into the output. The
+ * last sequence has literals only.
+ *
+ * Matches are found with a single hash table probe, which is enough for
+ * trace records that repeat the same register deltas over and over.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH    4
+#define LZ_MAX_DISTANCE 65535
+#define LZ_HASH_BITS    12
+
+/* Inputs shorter than that are stored as literals only */
+#define LZ_MIN_INPUT    12
+
+/*
+ * Worst case size of the compressed form of `len` bytes.
+ */
+#define LZ_BOUND(len)   ((len) + (len) / 255 + 16)
+
+static inline uint32_t __lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t __lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * Write the extra bytes of a length whose nibble is 15.
+ */
+static uint8_t *__lz_put_length(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/*
+ * Emit a sequence of `nlit` literals from `lit`, followed by a match
+ * of `mlen` bytes `dist` bytes back, or by nothing if `mlen` is 0.
+ */
+static uint8_t *__lz_put_sequence(uint8_t *op, const uint8_t *lit,
+        size_t nlit, size_t dist, size_t mlen)
+{
+    uint8_t *token = op++;
+
+    *token = (nlit >= 15 ? 15 : nlit) << 4;
+    if (nlit >= 15)
+        op = __lz_put_length(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+
+    if (mlen == 0)
+        return op;
+
+    *op++ = dist & 0xff;
+    *op++ = dist >> 8;
+
+    mlen -= LZ_MIN_MATCH;
+    *token |= mlen >= 15 ? 15 : mlen;
+    if (mlen >= 15)
+        op = __lz_put_length(op, mlen - 15);
+    return op;
+}
+
+/**
+ * Compress `len` bytes from `src` into `dst`.
+ *
+ * @param src - data to compress
+ * @param len - size of the data
+ * @param dst - output buffer of at least LZ_BOUND(len) bytes
+ * @return    - size of the compressed data
+ */
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    size_t ip = 0, anchor = 0, ref, mlen;
+    uint8_t *op = dst;
+    uint32_t seq, h;
+
+    /* Positions are stored plus one, 0 is an empty entry */
+    memset(table, 0, sizeof(table));
+
+    while (len >= LZ_MIN_INPUT && ip <= len - LZ_MIN_INPUT) {
+        seq = __lz_read32(src + ip);
+        h = __lz_hash(seq);
+        ref = table[h];
+        table[h] = ip + 1;
+
+        if (ref == 0 || ip - (ref - 1) > LZ_MAX_DISTANCE ||
+                __lz_read32(src + ref - 1) != seq) {
+            ip++;
+            continue;
+        }
+        ref--;
+
+        /* The last bytes are always literals */
+        mlen = LZ_MIN_MATCH;
+        while (ip + mlen < len - 5 && src[ref + mlen] == src[ip + mlen])
+            mlen++;
+
+        op = __lz_put_sequence(op, src + anchor, ip - anchor, ip - ref, mlen);
+        ip += mlen;
+        anchor = ip;
+    }
+
+    op = __lz_put_sequence(op, src + anchor, len - anchor, 0, 0);
+    return op - dst;
+}
+
+/*
+ * Read the extra bytes of a length whose nibble was 15.
+ *
+ * @return - 0 on success, -1 if the input is truncated
+ */
+static int __lz_get_length(const uint8_t **ip, const uint8_t *end,
+        size_t *len)
+{
+    uint8_t b;
+
+    do {
+        if (*ip >= end)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/**
+ * Decompress the block of `len` bytes at `src` into `dst`.
+ *
+ * @param src - compressed data
+ * @param len - size of the compressed data
+ * @param dst - output buffer
+ * @param cap - size of the output buffer
+ * @return    - size of the decompressed data, -1 if the block is corrupt
+ *              or does not fit
+ */
+long lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+    const uint8_t *ip = src, *end = src + len;
+    size_t op = 0, nlit, mlen, dist;
+    uint8_t token;
+
+    while (ip < end) {
+        token = *ip++;
+
+        nlit = token >> 4;
+        if (nlit == 15 && __lz_get_length(&ip, end, &nlit) < 0)
+            return -1;
+        if (nlit > (size_t)(end - ip) || nlit > cap - op)
+            return -1;
+        memcpy(dst + op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+
+        /* Last sequence */
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return -1;
+        dist = ip[0] | ip[1] << 8;
+        ip += 2;
+
+        mlen = token & 15;
+        if (mlen == 15 && __lz_get_length(&ip, end, &mlen) < 0)
+            return -1;
+        mlen += LZ_MIN_MATCH;
+
+        if (dist == 0 || dist > op || mlen > cap - op)
+            return -1;
+
+        /* Matches may overlap their own output */
+        for (; mlen > 0; mlen--, op++)
+            dst[op] = dst[op - dist];
+    }
+
+    return op;
+}
+
+#endif /* LZ_H */
@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Access to the debugee's memory.
+ *
+ * PTRACE_PEEKDATA and PTRACE_POKEDATA move a single word per system
+ * call, so they are only used as a last resort. In order:
+ *
+ *  - reads use process_vm_readv(), which copies any amount of memory
+ *    in one call, but refuses pages that are not readable;
+ *  - writes use pwrite() on /proc/<pid>/mem. Unlike process_vm_writev()
+ *    it is allowed to write read-only pages such as .text, which is
+ *    what breakpoints need;
+ *  - whatever is left is transferred word by word with ptrace.
+ */
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "debugger.h"
+#include "x86_decode.h"
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE       4096UL
+#define PAGE_MASK       (~(PAGE_SIZE - 1))
+#endif
+
+/* `mem_fd' value once /proc/<pid>/mem turned out to be unusable */
+#define MEM_FD_NONE     -2
+
+/*
+ * Number of bytes from `addr` to the end of its page, capped to `len`
+ */
+static inline size_t __page_chunk(unsigned long addr, size_t len)
+{
+    size_t left = PAGE_SIZE - (addr & ~PAGE_MASK);
+
+    return len < left ? len : left;
+}
+
+/*
+ * Read `len` bytes (less than a page) word by word with
+ * PTRACE_PEEKDATA. A word that would cross into the next, possibly
+ * unmapped, page is read ending at the last wanted byte instead.
+ */
+static ssize_t __peek_memory(pid_t pid, unsigned long addr, uint8_t *buf,
+        size_t len)
+{
+    size_t i = 0, n;
+    long word;
+
+    while (i < len) {
+        n = len - i < sizeof(long) ? len - i : sizeof(long);
+
+        errno = 0;
+        word = ptrace(PTRACE_PEEKDATA, pid, addr + i, NULL);
+        if (errno == 0) {
+            memcpy(buf + i, &word, n);
+        }
+        else if (n < sizeof(long)) {
+            errno = 0;
+            word = ptrace(PTRACE_PEEKDATA, pid, addr + i + n - sizeof(long),
+                    NULL);
+            if (errno != 0)
+                break;
+            memcpy(buf + i, (uint8_t *)&word + sizeof(long) - n, n);
+        }
+        else {
+            break;
+        }
+        i += n;
+    }
+
+    return i ? (ssize_t)i : -1;
+}
+
+/*
+ * Write `len` bytes (less than a page) word by word with
+ * PTRACE_POKEDATA. A trailing partial word is merged with the
+ * current contents of the debugee's memory.
+ */
+static ssize_t __poke_memory(pid_t pid, unsigned long addr,
+        const uint8_t *buf, size_t len)
+{
+    size_t i = 0, n;
+    unsigned long at;
+    long word;
+
+    while (i < len) {
+        n = len - i < sizeof(long) ? len - i : sizeof(long);
+        at = addr + i;
+
+        if (n < sizeof(long)) {
+            /* Stay inside the page if the word would cross it */
+            if (__page_chunk(at, sizeof(long)) < sizeof(long))
+                at = addr + i + n - sizeof(long);
+
+            errno = 0;
+            word = ptrace(PTRACE_PEEKDATA, pid, at, NULL);
+            if (errno != 0)
+                break;
+            memcpy((uint8_t *)&word + (addr + i - at), buf + i, n);
+        }
+        else {
+            memcpy(&word, buf + i, n);
+        }
+
+        if (ptrace(PTRACE_POKEDATA, pid, at, word) < 0)
+            break;
+        i += n;
+    }
+
+    return i ? (ssize_t)i : -1;
+}
+
+/**
+ * Read `len` bytes at `addr` from the memory of process `pid`.
+ *
+ * @param pid    - process to read from
+ * @param mem_fd - open /proc/<pid>/mem, or a negative value
+ * @param addr   - address in the process
+ * @param buf    - where to store the bytes read
+ * @param len    - number of bytes to read
+ * @return       - the number of bytes read, which is smaller than
+ *                 `len` if an inaccessible page was reached, or -1
+ *                 if nothing could be read
+ */
+ssize_t __read_memory(pid_t pid, int mem_fd, void *addr, void *buf,
+        size_t len)
+{
+    unsigned long at = (unsigned long)addr;
+    struct iovec local, remote;
+    size_t done = 0, chunk;
+    ssize_t n;
+
+    while (done < len) {
+        local.iov_base  = (uint8_t *)buf + done;
+        local.iov_len   = len - done;
+        remote.iov_base = (void *)(at + done);
+        remote.iov_len  = len - done;
+
+        n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+
+        /*
+         * The page at `at + done` is not readable (e.g PROT_NONE).
+         * /proc/<pid>/mem and ptrace ignore page protections.
+         */
+        chunk = __page_chunk(at + done, len - done);
+        n = -1;
+        if (mem_fd >= 0)
+            n = pread(mem_fd, (uint8_t *)buf + done, chunk, at + done);
+        if (n <= 0)
+            n = __peek_memory(pid, at + done, (uint8_t *)buf + done, chunk);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+
+    return done ? (ssize_t)done : -1;
+}
+
+/**
+ * Write `len` bytes at `addr` into the memory of process `pid`.
+ *
+ * @param pid    - process to write to
+ * @param mem_fd - open /proc/<pid>/mem, or a negative value
+ * @param addr   - address in the process
+ * @param buf    - bytes to write
+ * @param len    - number of bytes to write
+ * @return       - the number of bytes written, or -1 if nothing
+ *                 could be written
+ */
+ssize_t __write_memory(pid_t pid, int mem_fd, void *addr, const void *buf,
+        size_t len)
+{
+    unsigned long at = (unsigned long)addr;
+    struct iovec local, remote;
+    size_t done = 0, chunk;
+    ssize_t n;
+
+    while (done < len) {
+        n = -1;
+        if (mem_fd >= 0)
+            n = pwrite(mem_fd, (const uint8_t *)buf + done, len - done,
+                    at + done);
+
+        if (n <= 0) {
+            local.iov_base  = (uint8_t *)buf + done;
+            local.iov_len   = len - done;
+            remote.iov_base = (void *)(at + done);
+            remote.iov_len  = len - done;
+            n = process_vm_writev(pid, &local, 1, &remote, 1, 0);
+        }
+
+        if (n <= 0) {
+            chunk = __page_chunk(at + done, len - done);
+            n = __poke_memory(pid, at + done, (const uint8_t *)buf + done,
+                    chunk);
+        }
+
+        if (n <= 0)
+            break;
+        done += n;
+    }
+
+    return done ? (ssize_t)done : -1;
+}
+
+/*
+ * Get the debugger's /proc/<pid>/mem file descriptor, opening it on
+ * first use. The file must be opened after exec(), as it is bound to
+ * the address space that existed when it was opened.
+ */
+int debugger_mem_fd(struct debugger *dbg)
+{
+    char path[64];
+
+    if (dbg->mem_fd == -1) {
+        snprintf(path, sizeof(path), "/proc/%d/mem", dbg->dbge_pid);
+        dbg->mem_fd = open(path, O_RDWR | O_CLOEXEC);
+        if (dbg->mem_fd < 0)
+            dbg->mem_fd = MEM_FD_NONE;
+    }
+
+    return dbg->mem_fd;
+}
+
+/*
+ * Close the debugger's /proc/<pid>/mem file, e.g because the debugee
+ * was replaced, and forget its memory and code. The file is reopened on
+ * the next memory access.
+ */
+void debugger_mem_reset(struct debugger *dbg)
+{
+    if (dbg->mem_fd >= 0)
+        close(dbg->mem_fd);
+    dbg->mem_fd = -1;
+    stop_cache_clear(&dbg->stop);
+    decode_cache_reset(&dbg->decode);
+}
+
+/**
+ * Read `len` bytes of the debugee's memory at `addr` into `buf`.
+ *
+ * Reads of less than a page are served from the pages read since the
+ * debugee stopped (see inc/stop_cache.h), which are read whole on first
+ * use. Larger reads, and reads while threads of the debugee run, go to
+ * the debugee.
+ *
+ * @return - the number of bytes read, or -1 on error
+ */
+ssize_t read_memory(struct debugger *dbg, void *addr, void *buf, size_t len)
+{
+    unsigned long at = (unsigned long)addr, page;
+    struct stop_cache *cache = &dbg->stop;
+    uint8_t data[PAGE_SIZE];
+    struct stop_page *p;
+    size_t done = 0, chunk;
+    ssize_t n;
+
+    if (len >= PAGE_SIZE || dbg->running || dbg->non_stop)
+        return __read_memory(dbg->dbge_pid, debugger_mem_fd(dbg), addr, buf,
+                len);
+
+    while (done < len) {
+        page = (at + done) & PAGE_MASK;
+        chunk = __page_chunk(at + done, len - done);
+
+        p = stop_cache_get(cache, page);
+        if (p != NULL) {
+            cache->stats.mem_hits++;
+        }
+        else {
+            cache->stats.mem_misses++;
+            if (__read_memory(dbg->dbge_pid, debugger_mem_fd(dbg),
+                    (void *)page, data, PAGE_SIZE) == (ssize_t)PAGE_SIZE)
+                p = stop_cache_add(cache, page, data);
+        }
+
+        /* Partly readable, or out of memory */
+        if (p == NULL) {
+            n = __read_memory(dbg->dbge_pid, debugger_mem_fd(dbg),
+                    (void *)(at + done), (uint8_t *)buf + done, len - done);
+            if (n > 0)
+                done += n;
+            break;
+        }
+
+        memcpy((uint8_t *)buf + done, p->data + (at + done - page), chunk);
+        done += chunk;
+    }
+
+    return done ? (ssize_t)done : -1;
+}
+
+/**
+ * Read the `n` pieces of the debugee's memory described by `remote`
+ * into those of `local`, which have the same lengths.
+ *
+ * While the debugee is stopped, the pieces are read one by one through
+ * `read_memory()`, which serves them from the pages kept. Otherwise
+ * they are read at once with a single process_vm_readv(), and one by
+ * one again if it falls short.
+ *
+ * @return - 0 if every piece was read whole, -1 otherwise
+ */
+int read_memory_v(struct debugger *dbg, const struct iovec *local,
+        const struct iovec *remote, unsigned int n)
+{
+    ssize_t expected = 0;
+    unsigned int i;
+
+    if (!dbg->running && !dbg->non_stop)
+        goto one_by_one;
+
+    for (i = 0; i < n; i++)
+        expected += local[i].iov_len;
+    if (process_vm_readv(dbg->dbge_pid, local, n, remote, n, 0) == expected)
+        return 0;
+
+one_by_one:
+    for (i = 0; i < n; i++)
+        if (read_memory(dbg, remote[i].iov_base, local[i].iov_base,
+                    local[i].iov_len) != (ssize_t)local[i].iov_len)
+            return -1;
+    return 0;
+}
+
+/**
+ * Write `len` bytes from `buf` into the debugee's memory at `addr`.
+ *
+ * @return - the number of bytes written, or -1 on error
+ */
+ssize_t write_memory(struct debugger *dbg, void *addr, const void *buf,
+        size_t len)
+{
+    ssize_t n;
+
+    decode_cache_written(&dbg->decode, (unsigned long)addr, len);
+    n = __write_memory(dbg->dbge_pid, debugger_mem_fd(dbg), addr, buf, len);
+    if (n > 0)
+        stop_cache_written(&dbg->stop, (unsigned long)addr, buf, n);
+    return n;
+}
+
+/**
+ * Write the INT3 or the jump of one of our breakpoints over the code of
+ * the debugee at `addr`, or put the original code back. Unlike other
+ * writes, this keeps the code cache (see inc/decode_cache.h).
+ *
+ * @return - the number of bytes written, or -1 on error
+ */
+ssize_t patch_code(struct debugger *dbg, void *addr, const void *buf,
+        size_t len)
+{
+    ssize_t n;
+
+    n = __write_memory(dbg->dbge_pid, debugger_mem_fd(dbg), addr, buf, len);
+    if (n > 0) {
+        decode_cache_patched(&dbg->decode, (unsigned long)addr, buf, n);
+        stop_cache_written(&dbg->stop, (unsigned long)addr, buf, n);
+    }
+    return n;
+}
+
+/*
+ * Put back into `code`, read from `addr`, the part of the code replaced
+ * by the jump of the fast tracepoint `bp` that it overlaps.
+ */
+static void __unpatch_code(struct breakpoint *bp, void *addr, uint8_t *code,
+        ssize_t n)
+{
+    long off = (uint8_t *)bp->addr - (uint8_t *)addr;
+    long i;
+
+    for (i = 0; i < (long)bp->fast->len; i++) {
+        if (off + i >= 0 && off + i < n)
+            code[off + i] = bp->fast->saved[i];
+    }
+}
+
+/*
+ * Put back into `code`, `n` bytes read at `addr`, what breakpoint `bp`
+ * hides of it if anything.
+ */
+static void __unpatch_breakpoint(struct breakpoint *bp, void *addr,
+        uint8_t *code, ssize_t n)
+{
+    long off = (uint8_t *)bp->addr - (uint8_t *)addr;
+
+    if (!breakpoint_is_enabled(bp))
+        return;
+    if (bp->kind == BREAKPOINT_FAST)
+        __unpatch_code(bp, addr, code, n);
+    else if (off >= 0 && off < n)
+        code[off] = breakpoint_get_saved_data(bp);
+}
+
+/*
+ * Put back into `code`, `n` bytes read at `addr`, the bytes that the
+ * INT3s of all our breakpoints and the jumps of our fast tracepoints
+ * replaced.
+ */
+static void __unpatch_all(struct debugger *dbg, void *addr, uint8_t *code,
+        ssize_t n)
+{
+    struct hash_slot *slot;
+    struct breakpoint *bp;
+    ssize_t i;
+
+    /* Going over the breakpoints is faster for a page of code */
+    if ((ssize_t)hash_table_count(&dbg->bp_table) < n) {
+        hash_table_for_each(&dbg->bp_table, slot)
+            __unpatch_breakpoint(slot->value, addr, code, n);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        bp = debugger_breakpoint_at(dbg, (uint8_t *)addr + i);
+        if (bp != NULL)
+            __unpatch_breakpoint(bp, addr, code, n);
+    }
+
+    /* A jump may start before `addr` and run into it */
+    for (i = 1; dbg->ftrace != NULL && n > 0 && i < FAST_PATCH_MAX; i++) {
+        bp = debugger_breakpoint_at(dbg, (uint8_t *)addr - i);
+        if (bp != NULL && bp->kind == BREAKPOINT_FAST)
+            __unpatch_breakpoint(bp, addr, code, n);
+    }
+}
+
+/**
+ * Read the original code at `addr`, i.e with the INT3s of all our
+ * breakpoints and the jumps of our fast tracepoints replaced by the
+ * bytes they hide.
+ *
+ * @return - the number of bytes read, or -1 on error
+ */
+ssize_t read_code(struct debugger *dbg, void *addr, uint8_t *code, size_t len)
+{
+    ssize_t n;
+
+    n = read_memory(dbg, addr, code, len);
+    if (n > 0)
+        __unpatch_all(dbg, addr, code, n);
+    return n;
+}
+
+/**
+ * Decode the original instruction at `addr`, from the code cache. Its
+ * page is read on first use, and compared with the debugee again once
+ * it ran (see inc/decode_cache.h).
+ *
+ * @param code - where to store the bytes of the instruction, at least
+ *               X86_MAX_INSN_LEN
+ * @param insn - where to store the instruction
+ * @return     - 0 on success, -1 if it could not be read or decoded
+ */
+int read_insn(struct debugger *dbg, void *addr, uint8_t *code,
+        struct x86_insn *insn)
+{
+    unsigned long at = (unsigned long)addr, page = at & PAGE_MASK;
+    struct decode_cache *cache = &dbg->decode;
+    uint8_t mem[CODE_PAGE_SIZE];
+    struct code_page *p;
+    ssize_t n;
+
+    /* The other threads keep running in non-stop mode */
+    p = decode_cache_get(cache, page);
+    if (p != NULL && (p->epoch != cache->epoch || dbg->non_stop)) {
+        n = read_memory(dbg, (void *)page, mem, p->size);
+        if (n == (ssize_t)p->size && memcmp(mem, p->mem, n) == 0) {
+            p->epoch = cache->epoch;
+        }
+        else {
+            decode_cache_drop(cache, page);
+            p = NULL;
+        }
+    }
+
+    if (p == NULL) {
+        n = read_memory(dbg, (void *)page, mem, sizeof(mem));
+        if (n <= (ssize_t)(at - page))
+            return -1;
+        p = decode_cache_add(cache, page, mem, n);
+        if (p == NULL) {
+            n = read_code(dbg, addr, code, X86_MAX_INSN_LEN);
+            return n > 0 && x86_decode(code, n, insn) >= 0 ? 0 : -1;
+        }
+        __unpatch_all(dbg, (void *)page, p->code, n);
+    }
+
+    return code_page_decode(p, at - page, code, insn);
+}
+
+#endif /* MEMORY_H */
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The debugee's address space as seen from /proc: its mappings, from
+ * /proc/<pid>/maps, and the state of their pages, from
+ * /proc/<pid>/pagemap.
+ *
+ * Pagemap entries carry a soft-dirty bit, set by the kernel on the
+ * first write to a page after the bits were cleared through
+ * /proc/<pid>/clear_refs. This tells which pages a process wrote to
+ * without reading its memory. Kernels built without
+ * CONFIG_MEM_SOFT_DIRTY accept the clear request but never set the
+ * bit, `pagemap_soft_dirty_works()` checks for that.
+ */
+
+#ifndef PAGEMAP_H
+#define PAGEMAP_H
+
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE       4096UL
+#define PAGE_MASK       (~(PAGE_SIZE - 1))
+#endif
+
+/* Bits of a pagemap entry */
+#define PM_SOFT_DIRTY   (1ULL << 55)
+#define PM_EXCLUSIVE    (1ULL << 56)
+#define PM_FILE         (1ULL << 61)
+#define PM_SWAPPED      (1ULL << 62)
+#define PM_PRESENT      (1ULL << 63)
+
+/* Pagemap entries read at once by `pagemap_read()` callers */
+#define PAGEMAP_BATCH   512
+
+/*
+ * A mapping of the debugee, one line of /proc/<pid>/maps.
+ */
+struct mem_region {
+    unsigned long   start;
+    unsigned long   end;
+
+    /* PROT_* flags of the mapping */
+    int             prot;
+    int             shared;
+};
+
+/**
+ * Read the mappings of process `pid`.
+ *
+ * @param pid      - the process
+ * @param regions  - where to store the malloc'ed array of mappings
+ * @param writable - only keep the private mappings the process can
+ *                   write to
+ * @return         - the number of mappings, -1 on error
+ */
+int pagemap_regions(pid_t pid, struct mem_region **regions, int writable)
+{
+    struct mem_region *array = NULL, *tmp;
+    unsigned int count = 0, capacity = 0;
+    char path[64], line[512], perms[8];
+    unsigned long start, end;
+    FILE *maps;
+
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    maps = fopen(path, "r");
+    if (maps == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), maps) != NULL) {
+        if (sscanf(line, "%lx-%lx %7s", &start, &end, perms) != 3)
+            continue;
+
+        /* The kernel maps [vsyscall] but does not let us read it */
+        if (start >= 0xffffffffff600000UL)
+            continue;
+        if (writable && (perms[1] != 'w' || perms[3] != 'p'))
+            continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            tmp = realloc(array, capacity * sizeof(*array));
+            if (tmp == NULL) {
+                free(array);
+                fclose(maps);
+                return -1;
+            }
+            array = tmp;
+        }
+
+        array[count].start = start;
+        array[count].end = end;
+        array[count].prot = (perms[0] == 'r' ? PROT_READ : 0) |
+            (perms[1] == 'w' ? PROT_WRITE : 0) |
+            (perms[2] == 'x' ? PROT_EXEC : 0);
+        array[count].shared = perms[3] == 's';
+        count++;
+    }
+
+    fclose(maps);
+    *regions = array;
+    return count;
+}
+
+/**
+ * Open /proc/<pid>/pagemap.
+ *
+ * @return - the file descriptor, -1 on error
+ */
+int pagemap_open(pid_t pid)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", pid);
+    return open(path, O_RDONLY);
+}
+
+/**
+ * Read the pagemap entries of `npages` pages starting at `addr`.
+ *
+ * @param fd      - open /proc/<pid>/pagemap
+ * @param addr    - page aligned address of the first page
+ * @param npages  - number of pages
+ * @param entries - where to store the entries
+ * @return        - the number of entries read, -1 on error
+ */
+ssize_t pagemap_read(int fd, unsigned long addr, unsigned long npages,
+        uint64_t *entries)
+{
+    ssize_t n;
+
+    n = pread(fd, entries, npages * sizeof(uint64_t),
+            (addr / PAGE_SIZE) * sizeof(uint64_t));
+    if (n < 0)
+        return -1;
+    return n / sizeof(uint64_t);
+}
+
+/**
+ * Clear the soft-dirty bits of every page of process `pid`.
+ *
+ * @return - 0 on success, -1 on error
+ */
+int pagemap_clear_soft_dirty(pid_t pid)
+{
+    char path[64];
+    int fd, ret;
+
+    snprintf(path, sizeof(path), "/proc/%d/clear_refs", pid);
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+
+    ret = write(fd, "4", 1) == 1 ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+/*
+ * Check that a page of ours gets its soft-dirty bit back when written
+ * to after the bits were cleared.
+ */
+static int __pagemap_probe_soft_dirty(void)
+{
+    volatile uint8_t *page;
+    uint64_t entry = 0;
+    int fd, works = 0;
+
+    page = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED)
+        return 0;
+
+    fd = pagemap_open(getpid());
+    if (fd < 0)
+        goto out;
+
+    page[0] = 1;
+    if (pagemap_clear_soft_dirty(getpid()) < 0 ||
+            pagemap_read(fd, (unsigned long)page, 1, &entry) != 1 ||
+            (entry & PM_SOFT_DIRTY))
+        goto out;
+
+    page[0] = 2;
+    if (pagemap_read(fd, (unsigned long)page, 1, &entry) == 1)
+        works = (entry & PM_SOFT_DIRTY) != 0;
+
+out:
+    if (fd >= 0)
+        close(fd);
+    munmap((void *)page, PAGE_SIZE);
+    return works;
+}
+
+/**
+ * Check whether the running kernel tracks soft-dirty pages. Note that
+ * the first call clears the soft-dirty bits of the debugger itself.
+ */
+int pagemap_soft_dirty_works(void)
+{
+    static int works = -1;
+
+    if (works < 0)
+        works = __pagemap_probe_soft_dirty();
+    return works;
+}
+
+#endif /* PAGEMAP_H */
@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Processes traced by the debugger.
+ *
+ * The processes the debugee forks are attached to us by the kernel
+ * through PTRACE_O_TRACEFORK and PTRACE_O_TRACEVFORK, and traced as
+ * well, each with its own threads (see inc/thread.h), breakpoints and
+ * stop state. The debugger works on one of them at a time, the one
+ * that has the focus: its state is in `struct debugger`, where the rest
+ * of the debugger finds it, and the state of the others is put aside in
+ * their `struct process` meanwhile. `follow-fork-mode` tells whether
+ * the focus goes to the child when the process that has it forks.
+ *
+ * The other processes run on their own. A child gets copies of the
+ * breakpoints of its parent, with the same numbers, whose INT3s it
+ * inherited. The internal breakpoints, the coverage, the fast
+ * tracepoints and the watchpoints stay with the parent, and are taken
+ * out of the child.
+ *
+ * Processes are kept in a hash table keyed by PID, and the threads of
+ * those put aside in another one keyed by TID, so that routing a wait
+ * event to its process does not depend on the number of processes:
+ *
+ *   - new threads and new processes are taken care of, and processes
+ *     that exit are taken out of the table.
+ *
+ *   - a stop to report gives the process the focus if the debugee is
+ *     being continued. It is kept in the thread otherwise, the process
+ *     being on the list of those with a stop to report, until then.
+ *
+ * The first stop of a child may come before the fork event of its
+ * parent, the child is then kept stopped until that event, in state
+ * PROCESS_NEW.
+ *
+ * Memory Allocation: the table owns the processes and the tables put
+ * aside in them. The breakpoints and watchpoints are freed by the
+ * debugger when the process exits.
+ */
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "debugreg.h"
+#include "decode_cache.h"
+#include "hash_table.h"
+#include "symbols.h"
+#include "thread.h"
+#include "watch_index.h"
+
+/* Values of `follow-fork-mode` */
+#define FOLLOW_FORK_PARENT  0
+#define FOLLOW_FORK_CHILD   1
+
+/* Values of `state` */
+#define PROCESS_NEW         0   /* stopped, the fork event is to come */
+#define PROCESS_TRACED      1   /* its state is put aside in here */
+#define PROCESS_FOCUSED     2   /* its state is in the debugger */
+
+struct breakpoint_array;
+struct breakpoint;
+struct watchpoint;
+struct coverage;
+
+struct process {
+    pid_t               pid;
+    int                 state;
+
+    /* The process that forked it, 0 for the debugee */
+    pid_t               parent;
+
+    /* Whether it is on the list of the processes with a stop to
+     * report, through `entry`.
+     */
+    int                 pending;
+    struct sl_list_node entry;
+
+    /* Put aside from `struct debugger` while it does not have the
+     * focus, see there.
+     */
+    pid_t               dbge_pid;
+    struct thread_table threads;
+    struct breakpoint_array **bpa;
+    unsigned int        bpa_count;
+    unsigned int        bpa_cap;
+    struct sl_list_node bpa_free;
+    struct hash_table   bp_table;
+    int                 mem_fd;
+    struct decode_cache decode;
+    struct user_regs_struct regs;
+    int                 regs_state;
+    struct breakpoint * stopped_bp;
+    int                 pending_signal;
+    struct sl_list_node dstep_areas;
+    struct sl_list_node dstep_free;
+    struct sl_list_node watchpoints;
+    struct watchpoint * dr_watch[DR_SLOTS];
+    unsigned long       dr7;
+    struct watch_index  soft_watch;
+    struct watchpoint * soft_hit;
+    struct symbol_index *symbols;
+    struct coverage *   coverage;
+};
+
+struct process_table {
+    struct hash_table   procs;
+
+    /* The process of every thread of the processes put aside */
+    struct hash_table   tids;
+
+    /* Processes put aside with a stop to report */
+    struct sl_list_node pending;
+
+    /* The process the last stop was reported for, and the one the
+     * history is of, see inc/history.h.
+     */
+    pid_t               reported;
+    pid_t               history;
+};
+
+/**
+ * Get the process `pid`.
+ *
+ * @return - the process, or NULL if it is not in the table
+ */
+struct process *process_get(struct process_table *tbl, pid_t pid)
+{
+    return hash_table_lookup(&tbl->procs, pid);
+}
+
+/**
+ * Get the process put aside that thread `tid` belongs to.
+ *
+ * @return - the process, or NULL if `tid` is none of their threads
+ */
+struct process *process_of(struct process_table *tbl, pid_t tid)
+{
+    return hash_table_lookup(&tbl->tids, tid);
+}
+
+/**
+ * Add the process `pid` to the table, in state `state`.
+ *
+ * @return - the process, or NULL on allocation failure
+ */
+struct process *process_add(struct process_table *tbl, pid_t pid,
+        int state)
+{
+    struct process *p;
+
+    p = calloc(1, sizeof(struct process));
+    if (p == NULL)
+        return NULL;
+    if (hash_table_insert(&tbl->procs, pid, p) < 0) {
+        free(p);
+        return NULL;
+    }
+
+    p->pid = pid;
+    p->state = state;
+    p->mem_fd = -1;
+    return p;
+}
+
+/**
+ * Route the events of the threads of `p`, which is put aside, to it.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+int process_route(struct process_table *tbl, struct process *p)
+{
+    struct hash_slot *slot;
+
+    hash_table_for_each(&p->threads.threads, slot) {
+        if (hash_table_insert(&tbl->tids, slot->key, p) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stop routing the events of the threads of `p` to it, e.g because it
+ * gets the focus.
+ */
+void process_unroute(struct process_table *tbl, struct process *p)
+{
+    struct hash_slot *slot;
+
+    hash_table_for_each(&p->threads.threads, slot)
+        hash_table_delete(&tbl->tids, slot->key);
+}
+
+/**
+ * Add the new thread `tid` to `p`, which is put aside.
+ *
+ * @return - the thread, or NULL on allocation failure
+ */
+struct thread *process_thread_add(struct process_table *tbl,
+        struct process *p, pid_t tid)
+{
+    struct thread *t;
+
+    t = thread_add(&p->threads, tid);
+    if (t != NULL && hash_table_insert(&tbl->tids, tid, p) < 0) {
+        thread_remove(&p->threads, tid);
+        return NULL;
+    }
+    return t;
+}
+
+/**
+ * Key `p` by `pid` from now on, e.g because it was replaced by a copy
+ * of itself taken at a checkpoint.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+int process_move(struct process_table *tbl, struct process *p, pid_t pid)
+{
+    hash_table_delete(&tbl->procs, p->pid);
+    if (tbl->reported == p->pid)
+        tbl->reported = pid;
+    if (tbl->history == p->pid)
+        tbl->history = pid;
+
+    p->pid = pid;
+    return hash_table_insert(&tbl->procs, pid, p);
+}
+
+/**
+ * Put `p` on the list of the processes with a stop to report.
+ */
+void process_set_pending(struct process_table *tbl, struct process *p)
+{
+    if (p->pending)
+        return;
+    p->pending = 1;
+    sl_list_add(&tbl->pending, &p->entry);
+}
+
+/**
+ * Take a process off the list of the processes with a stop to report.
+ *
+ * @return - the process, or NULL if the list is empty
+ */
+struct process *process_take_pending(struct process_table *tbl)
+{
+    struct process *p;
+
+    if (sl_list_is_empty(&tbl->pending))
+        return NULL;
+
+    p = sl_list_node_container(tbl->pending.next, struct process, entry);
+    sl_list_delete(&tbl->pending);
+    p->pending = 0;
+    return p;
+}
+
+static void __process_free(struct process *p)
+{
+    unsigned int i;
+
+    /* The state of a process that has the focus is not in here */
+    if (p->state == PROCESS_TRACED) {
+        thread_table_destroy(&p->threads);
+        for (i = 0; i < p->bpa_count; i++)
+            free(p->bpa[i]);
+        free(p->bpa);
+        hash_table_destroy(&p->bp_table);
+        if (p->mem_fd >= 0)
+            close(p->mem_fd);
+        decode_cache_destroy(&p->decode);
+        watch_index_destroy(&p->soft_watch);
+        if (p->symbols != NULL)
+            symbol_index_close(p->symbols);
+    }
+    free(p);
+}
+
+/**
+ * Remove the process `pid` from the table, if it is in it.
+ */
+void process_remove(struct process_table *tbl, pid_t pid)
+{
+    struct process *p;
+
+    p = hash_table_delete(&tbl->procs, pid);
+    if (p == NULL)
+        return;
+
+    if (p->pending)
+        sl_list_delete_node(&tbl->pending, &p->entry);
+    if (p->state == PROCESS_TRACED)
+        process_unroute(tbl, p);
+    __process_free(p);
+}
+
+/**
+ * Initialize an empty process table.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+int process_table_init(struct process_table *tbl)
+{
+    sl_list_init(&tbl->pending);
+    tbl->reported = 0;
+    tbl->history = 0;
+    if (hash_table_init(&tbl->procs, 0) < 0)
+        return -1;
+    return hash_table_init(&tbl->tids, 0);
+}
+
+/**
+ * Free every process of the table.
+ */
+void process_table_destroy(struct process_table *tbl)
+{
+    struct hash_slot *slot;
+
+    hash_table_for_each(&tbl->procs, slot)
+        __process_free(slot->value);
+    hash_table_destroy(&tbl->procs);
+    hash_table_destroy(&tbl->tids);
+}
+
+#endif /* PROCESS_H */
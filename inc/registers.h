@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Access to the debugee's general purpose registers.
+ *
+ * The registers are fetched once per stop and kept in `struct debugger`.
+ * Changes are only written back when the debugee is resumed, so that
+ * e.g rewinding RIP after a breakpoint and then moving it somewhere else
+ * costs a single PTRACE_SETREGSET. The x87 and SSE state is much larger
+ * and seldom needed, it is fetched on its own on first use.
+ */
+
+#ifndef REGISTERS_H
+#define REGISTERS_H
+
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+
+#include <elf.h>
+
+#include <string.h>
+
+#include "debugger.h"
+
+/**
+ * Get the registers of the stopped debugee.
+ *
+ * @param dbg  - pointer to debugger structure
+ * @param regs - where to store the registers
+ * @return     - 0 on success, -1 if they could not be read
+ */
+int debugger_get_regs(struct debugger *dbg, struct user_regs_struct *regs)
+{
+    struct iovec iov = { &dbg->regs, sizeof(dbg->regs) };
+
+    if (dbg->regs_state == REGS_INVALID) {
+        if (ptrace(PTRACE_GETREGSET, dbg->dbge_pid, NT_PRSTATUS, &iov) < 0)
+            return -1;
+        dbg->regs_state = REGS_CLEAN;
+        dbg->stop.stats.regs_misses++;
+    }
+    else {
+        dbg->stop.stats.regs_hits++;
+    }
+
+    memcpy(regs, &dbg->regs, sizeof(*regs));
+    return 0;
+}
+
+/**
+ * Change the registers of the stopped debugee. They are written back
+ * by `debugger_flush_regs()` before the debugee runs again.
+ *
+ * @param dbg  - pointer to debugger structure
+ * @param regs - new register values
+ */
+void debugger_set_regs(struct debugger *dbg, struct user_regs_struct *regs)
+{
+    memcpy(&dbg->regs, regs, sizeof(*regs));
+    dbg->regs_state = REGS_DIRTY;
+}
+
+/**
+ * Write modified registers back into the debugee.
+ *
+ * @return - 0 on success, -1 on error
+ */
+int debugger_flush_regs(struct debugger *dbg)
+{
+    struct iovec iov = { &dbg->regs, sizeof(dbg->regs) };
+
+    if (dbg->regs_state != REGS_DIRTY)
+        return 0;
+
+    if (ptrace(PTRACE_SETREGSET, dbg->dbge_pid, NT_PRSTATUS, &iov) < 0)
+        return -1;
+
+    dbg->regs_state = REGS_CLEAN;
+    return 0;
+}
+
+/**
+ * Get the x87 and SSE registers of the stopped debugee.
+ *
+ * @param dbg    - pointer to debugger structure
+ * @param fpregs - where to store the registers
+ * @return       - 0 on success, -1 if they could not be read
+ */
+int debugger_get_fpregs(struct debugger *dbg,
+        struct user_fpregs_struct *fpregs)
+{
+    struct iovec iov = { &dbg->fpregs, sizeof(dbg->fpregs) };
+
+    if (dbg->fpregs_state == REGS_INVALID) {
+        if (ptrace(PTRACE_GETREGSET, dbg->dbge_pid, NT_PRFPREG, &iov) < 0)
+            return -1;
+        dbg->fpregs_state = REGS_CLEAN;
+        dbg->stop.stats.fpregs_misses++;
+    }
+    else {
+        dbg->stop.stats.fpregs_hits++;
+    }
+
+    memcpy(fpregs, &dbg->fpregs, sizeof(*fpregs));
+    return 0;
+}
+
+/**
+ * Forget the cached registers and memory, e.g because the debugee is
+ * about to run. Modified registers must have been flushed before. The
+ * cached code has to be checked again as well.
+ */
+void debugger_invalidate_regs(struct debugger *dbg)
+{
+    dbg->regs_state = REGS_INVALID;
+    dbg->fpregs_state = REGS_INVALID;
+    stop_cache_clear(&dbg->stop);
+    decode_cache_resume(&dbg->decode);
+}
+
+#endif /* REGISTERS_H */
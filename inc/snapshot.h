@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Memory snapshot files.
+ *
+ * A snapshot holds the registers of the debugee and the content of its
+ * private writable pages. Only the first snapshot of a series is
+ * complete, each later one holds the pages that changed since the
+ * previous one and names it as its base, so the memory of the debugee
+ * is given by the chain of snapshots down to the complete one. The file
+ * is laid out as:
+ *
+ *   struct snapshot_header, padded to SNAPSHOT_DATA_OFFSET
+ *   page data, PAGE_SIZE bytes per page
+ *   struct snapshot_page index[npages]
+ *
+ * The index is sorted by page address, pages of zeroes have no data.
+ * Readers map the file as a whole, a page is found by a binary search
+ * of the index of each snapshot of the chain in turn.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE       4096UL
+#define PAGE_MASK       (~(PAGE_SIZE - 1))
+#endif
+
+#define SNAPSHOT_MAGIC          "RBSNAP"
+#define SNAPSHOT_VERSION        1
+
+#define SNAPSHOT_PATH_MAX       PATH_MAX
+#define SNAPSHOT_DATA_OFFSET    ((sizeof(struct snapshot_header) + \
+            PAGE_SIZE - 1) & PAGE_MASK)
+
+/* Snapshots a chain may be made of, which also catches loops */
+#define SNAPSHOT_MAX_CHAIN      256
+
+/* Pages written to the file at once */
+#define SNAPSHOT_BATCH          64
+
+struct snapshot_header {
+    char                    magic[8];
+    uint32_t                version;
+    int32_t                 pending_signal;
+    uint64_t                npages;
+    uint64_t                index_offset;
+    struct user_regs_struct regs;
+
+    /* Absolute path of the base snapshot, empty if complete */
+    char                    base[SNAPSHOT_PATH_MAX];
+};
+
+struct snapshot_page {
+    uint64_t                addr;
+
+    /* In the file, 0 for a page of zeroes */
+    uint64_t                offset;
+};
+
+struct snapshot_writer {
+    int                     fd;
+    struct snapshot_header  hdr;
+
+    /* Pages not written to the file yet */
+    uint8_t *               batch;
+    unsigned int            batch_used;
+    uint64_t                offset;
+
+    struct snapshot_page *  index;
+    uint64_t                capacity;
+};
+
+struct snapshot {
+    char                    path[SNAPSHOT_PATH_MAX];
+    const uint8_t *         map;
+    size_t                  size;
+    struct snapshot_header  hdr;
+    const struct snapshot_page *index;
+
+    /* Older snapshot this one is relative to, NULL if complete */
+    struct snapshot *       base;
+};
+
+/**
+ * Create the snapshot file `path`.
+ *
+ * @param path           - path of the file
+ * @param base           - absolute path of the base snapshot, NULL for
+ *                         a complete snapshot
+ * @param regs           - registers of the debugee
+ * @param pending_signal - signal the debugee is to receive on resume
+ * @return               - the writer, or NULL on error
+ */
+struct snapshot_writer *snapshot_writer_open(const char *path,
+        const char *base, struct user_regs_struct *regs, int pending_signal)
+{
+    struct snapshot_writer *w;
+
+    if (base != NULL && strlen(base) >= SNAPSHOT_PATH_MAX)
+        return NULL;
+
+    w = calloc(1, sizeof(*w));
+    if (w == NULL)
+        return NULL;
+
+    w->batch = malloc(SNAPSHOT_BATCH * PAGE_SIZE);
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->batch == NULL || w->fd < 0) {
+        if (w->fd >= 0)
+            close(w->fd);
+        free(w->batch);
+        free(w);
+        return NULL;
+    }
+
+    memcpy(w->hdr.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    w->hdr.version = SNAPSHOT_VERSION;
+    w->hdr.pending_signal = pending_signal;
+    w->hdr.regs = *regs;
+    if (base != NULL)
+        strcpy(w->hdr.base, base);
+    w->offset = SNAPSHOT_DATA_OFFSET;
+    return w;
+}
+
+/*
+ * Write the batched pages to the file.
+ */
+static int __snapshot_writer_flush(struct snapshot_writer *w)
+{
+    size_t len = w->batch_used * PAGE_SIZE;
+
+    if (len > 0 && pwrite(w->fd, w->batch, len, w->offset) != (ssize_t)len)
+        return -1;
+
+    w->offset += len;
+    w->batch_used = 0;
+    return 0;
+}
+
+/*
+ * Check whether a page only holds zeroes.
+ */
+static int __snapshot_page_is_zero(const uint8_t *data)
+{
+    const uint64_t *words = (const uint64_t *)data;
+    unsigned long i;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+        if (words[i] != 0)
+            return 0;
+    return 1;
+}
+
+/**
+ * Add a page to the snapshot. Pages must be added by increasing
+ * address.
+ *
+ * @param w    - the snapshot writer
+ * @param addr - address of the page
+ * @param data - PAGE_SIZE bytes, the content of the page
+ * @return     - 0 on success, -1 on error
+ */
+int snapshot_writer_add(struct snapshot_writer *w, unsigned long addr,
+        const uint8_t *data)
+{
+    struct snapshot_page *tmp, *page;
+
+    if (w->hdr.npages == w->capacity) {
+        tmp = realloc(w->index, (w->capacity ? w->capacity * 2 : 256) *
+                sizeof(*w->index));
+        if (tmp == NULL)
+            return -1;
+        w->index = tmp;
+        w->capacity = w->capacity ? w->capacity * 2 : 256;
+    }
+
+    page = &w->index[w->hdr.npages++];
+    page->addr = addr;
+    page->offset = 0;
+    if (__snapshot_page_is_zero(data))
+        return 0;
+
+    page->offset = w->offset + w->batch_used * PAGE_SIZE;
+    memcpy(w->batch + w->batch_used * PAGE_SIZE, data, PAGE_SIZE);
+    if (++w->batch_used == SNAPSHOT_BATCH)
+        return __snapshot_writer_flush(w);
+    return 0;
+}
+
+/**
+ * Complete the snapshot file with its index and header, and free the
+ * writer.
+ *
+ * @return - size of the file on success, -1 on error
+ */
+long snapshot_writer_close(struct snapshot_writer *w)
+{
+    size_t index_size = w->hdr.npages * sizeof(struct snapshot_page);
+    long ret = -1;
+
+    if (__snapshot_writer_flush(w) < 0)
+        goto out;
+
+    w->hdr.index_offset = w->offset;
+    if (pwrite(w->fd, w->index, index_size, w->offset) !=
+            (ssize_t)index_size ||
+            pwrite(w->fd, &w->hdr, sizeof(w->hdr), 0) != sizeof(w->hdr))
+        goto out;
+    ret = w->offset + index_size;
+
+out:
+    close(w->fd);
+    free(w->index);
+    free(w->batch);
+    free(w);
+    return ret;
+}
+
+/**
+ * Close a snapshot opened with `snapshot_open()`, and its bases.
+ */
+void snapshot_close(struct snapshot *s)
+{
+    struct snapshot *base;
+
+    while (s != NULL) {
+        base = s->base;
+        munmap((void *)s->map, s->size);
+        free(s);
+        s = base;
+    }
+}
+
+/*
+ * Open a single snapshot file, without its base.
+ */
+static struct snapshot *__snapshot_open_one(const char *path)
+{
+    const struct snapshot_page *page;
+    struct snapshot *s;
+    struct stat st;
+    uint64_t i;
+    int fd;
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return NULL;
+
+    if (realpath(path, s->path) == NULL)
+        goto fail;
+
+    fd = open(s->path, O_RDONLY);
+    if (fd < 0)
+        goto fail;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < SNAPSHOT_DATA_OFFSET) {
+        close(fd);
+        goto fail;
+    }
+
+    s->size = st.st_size;
+    s->map = mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->map == MAP_FAILED)
+        goto fail;
+
+    memcpy(&s->hdr, s->map, sizeof(s->hdr));
+    if (memcmp(s->hdr.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+            s->hdr.version != SNAPSHOT_VERSION ||
+            s->hdr.base[SNAPSHOT_PATH_MAX - 1] != '\0' ||
+            s->hdr.index_offset > s->size ||
+            s->hdr.npages > (s->size - s->hdr.index_offset) /
+                sizeof(struct snapshot_page))
+        goto unmap;
+    s->index = (const struct snapshot_page *)(s->map + s->hdr.index_offset);
+
+    for (i = 0; i < s->hdr.npages; i++) {
+        page = &s->index[i];
+        if ((page->addr & ~PAGE_MASK) != 0 ||
+                (i > 0 && page->addr <= s->index[i - 1].addr) ||
+                (page->offset != 0 && ((page->offset & ~PAGE_MASK) ||
+                    page->offset < SNAPSHOT_DATA_OFFSET ||
+                    page->offset + PAGE_SIZE > s->hdr.index_offset)))
+            goto unmap;
+    }
+    return s;
+
+unmap:
+    munmap((void *)s->map, s->size);
+fail:
+    free(s);
+    return NULL;
+}
+
+/**
+ * Open the snapshot file `path` and the snapshots it is relative to.
+ *
+ * @return - the snapshot, or NULL if it or one of its bases could not be
+ *           opened or is not a valid snapshot
+ */
+struct snapshot *snapshot_open(const char *path)
+{
+    struct snapshot *s, *last;
+    unsigned int n = 1;
+
+    s = last = __snapshot_open_one(path);
+    while (last != NULL && last->hdr.base[0] != '\0') {
+        if (n++ == SNAPSHOT_MAX_CHAIN) {
+            snapshot_close(s);
+            return NULL;
+        }
+
+        last->base = __snapshot_open_one(last->hdr.base);
+        if (last->base == NULL) {
+            snapshot_close(s);
+            return NULL;
+        }
+        last = last->base;
+    }
+    return s;
+}
+
+/**
+ * Check whether the file `path` is one of the snapshots of chain `s`.
+ */
+int snapshot_in_chain(struct snapshot *s, const char *path)
+{
+    char real[SNAPSHOT_PATH_MAX];
+
+    if (realpath(path, real) == NULL)
+        return 0;
+
+    for (; s != NULL; s = s->base)
+        if (strcmp(s->path, real) == 0)
+            return 1;
+    return 0;
+}
+
+/**
+ * Get the content of the page at `addr` from the chain of snapshots.
+ *
+ * @return - PAGE_SIZE bytes, or NULL if no snapshot of the chain has the
+ *           page
+ */
+const uint8_t *snapshot_page(struct snapshot *s, unsigned long addr)
+{
+    static const uint8_t zero[PAGE_SIZE];
+    uint64_t lo, hi, mid;
+
+    for (; s != NULL; s = s->base) {
+        lo = 0;
+        hi = s->hdr.npages;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (s->index[mid].addr < addr)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo < s->hdr.npages && s->index[lo].addr == addr)
+            return s->index[lo].offset ? s->map + s->index[lo].offset : zero;
+    }
+    return NULL;
+}
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * What the debugger read of the stopped debugee, until it runs again.
+ *
+ * Nothing changes in a stopped debugee but what the debugger writes, so
+ * the pages of memory read during a stop are kept, and the next reads
+ * of the same stop served from them. Writes go through to the debugee
+ * and update the pages kept. Everything is forgotten when the debugee
+ * is resumed, which costs next to nothing: it happens on every step.
+ *
+ * The registers are kept in `struct debugger` (see inc/registers.h),
+ * only the counts of their reads are here.
+ *
+ * Memory Allocation: the pages are allocated on first use, and owned
+ * by the cache.
+ */
+
+#ifndef STOP_CACHE_H
+#define STOP_CACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE       4096UL
+#define PAGE_MASK       (~(PAGE_SIZE - 1))
+#endif
+
+/* Most pages kept during a stop, they are then replaced in turn */
+#define STOP_CACHE_PAGES    16
+
+struct stop_page {
+    unsigned long       addr;
+    uint8_t             data[PAGE_SIZE];
+};
+
+/* Reads served from what the debugger has, and reads of the debugee */
+struct stop_stats {
+    unsigned long       regs_hits;
+    unsigned long       regs_misses;
+    unsigned long       fpregs_hits;
+    unsigned long       fpregs_misses;
+    unsigned long       mem_hits;
+    unsigned long       mem_misses;
+};
+
+struct stop_cache {
+    struct stop_page *  pages;
+
+    /* Pages read since the stop, and the one replaced next once
+     * they are all used */
+    unsigned int        npages;
+    unsigned int        next;
+
+    struct stop_stats   stats;
+};
+
+/**
+ * Initialize an empty cache.
+ */
+void stop_cache_init(struct stop_cache *cache)
+{
+    cache->pages = NULL;
+    cache->npages = 0;
+    cache->next = 0;
+    memset(&cache->stats, 0, sizeof(cache->stats));
+}
+
+/**
+ * Free the pages of the cache.
+ */
+void stop_cache_destroy(struct stop_cache *cache)
+{
+    free(cache->pages);
+    cache->pages = NULL;
+    cache->npages = 0;
+}
+
+/**
+ * Forget the pages, because the debugee is about to run or was
+ * replaced.
+ */
+static inline void stop_cache_clear(struct stop_cache *cache)
+{
+    cache->npages = 0;
+    cache->next = 0;
+}
+
+/**
+ * Get page `addr` if it was read during this stop.
+ *
+ * @return - the page, or NULL
+ */
+static inline struct stop_page *stop_cache_get(struct stop_cache *cache,
+        unsigned long addr)
+{
+    unsigned int i;
+
+    for (i = 0; i < cache->npages; i++)
+        if (cache->pages[i].addr == addr)
+            return &cache->pages[i];
+    return NULL;
+}
+
+/**
+ * Keep page `addr` of the debugee, whose contents are `data`.
+ *
+ * @return - the page, or NULL if out of memory
+ */
+struct stop_page *stop_cache_add(struct stop_cache *cache, unsigned long addr,
+        const uint8_t *data)
+{
+    struct stop_page *p;
+
+    if (cache->pages == NULL) {
+        cache->pages = malloc(STOP_CACHE_PAGES * sizeof(*cache->pages));
+        if (cache->pages == NULL)
+            return NULL;
+    }
+
+    if (cache->npages < STOP_CACHE_PAGES) {
+        p = &cache->pages[cache->npages++];
+    }
+    else {
+        p = &cache->pages[cache->next];
+        cache->next = (cache->next + 1) % STOP_CACHE_PAGES;
+    }
+
+    p->addr = addr;
+    memcpy(p->data, data, PAGE_SIZE);
+    return p;
+}
+
+/**
+ * Update the pages kept with `len` bytes of `buf` that were written
+ * into the debugee at `addr`.
+ */
+void stop_cache_written(struct stop_cache *cache, unsigned long addr,
+        const void *buf, size_t len)
+{
+    unsigned long start, end;
+    struct stop_page *p;
+    unsigned int i;
+
+    for (i = 0; i < cache->npages; i++) {
+        p = &cache->pages[i];
+        start = addr > p->addr ? addr : p->addr;
+        end = addr + len < p->addr + PAGE_SIZE ? addr + len :
+                p->addr + PAGE_SIZE;
+        if (start < end)
+            memcpy(p->data + (start - p->addr),
+                    (const uint8_t *)buf + (start - addr), end - start);
+    }
+}
+
+#endif /* STOP_CACHE_H */
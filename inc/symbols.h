@@ -0,0 +1,874 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Symbols of the program of the debugee.
+ *
+ * The ELF file is mapped as a whole, and only its headers are looked at
+ * when it is opened. Each symbol table, .symtab and .dynsym, is indexed
+ * on its first use:
+ *
+ *   - by address, with an array of its function and object symbols
+ *     sorted by address, that is binary searched.
+ *
+ *   - by name, on the first lookup by name, with an open addressing
+ *     table of positions in that array, keyed by a hash of the name.
+ *
+ * A stripped program only has .dynsym, which is then never looked at
+ * if .symtab has what is looked for. Names are offsets in the string
+ * tables of the mapping.
+ *
+ * The index of a program with a build-id is kept in its cache file (see
+ * inc/cache.h), written when the debugger is done with the program, and
+ * used in place by the next sessions instead of any of the above.
+ *
+ * Addresses are the ones of the running program: the symbols of a PIE
+ * are moved by `bias`, its load address, found from the entry point in
+ * the auxiliary vector of the debugee.
+ *
+ * Source lines come from .debug_line, see inc/lines.h.
+ *
+ * Memory Allocation: the index owns the mappings and the arrays. It is
+ * shared by the processes that run the program, and freed when the
+ * last one gives it back.
+ */
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "lines.h"
+
+/* Positions of the symbol tables in `struct symbol_index` */
+#define SYMTAB_STATIC       0   /* .symtab */
+#define SYMTAB_DYNAMIC      1   /* .dynsym */
+#define SYMTAB_COUNT        2
+
+/* Also the layout of the cache file */
+struct symbol {
+    unsigned long       addr;       /* in the file */
+    unsigned long       size;
+    uint32_t            name;       /* in the strings of `table` */
+    uint32_t            table;      /* SYMTAB_* */
+};
+
+/* Slot of the table by name, free if `sym` is 0 */
+struct symbol_name {
+    uint32_t            hash;
+
+    /* Position in `syms` plus one */
+    uint32_t            sym;
+};
+
+struct symbol_table {
+    /* The section, NULL if there is none */
+    const Elf64_Shdr    *shdr;
+    const char          *strs;
+    unsigned long       strs_size;
+    int                 loaded;
+    int                 named;
+
+    /* Sorted by address */
+    struct symbol       *syms;
+    unsigned long       count;
+
+    struct symbol_name  *names;
+    unsigned long       names_mask;
+};
+
+struct symbol_index {
+    const uint8_t       *map;
+    size_t              size;
+    int                 pie;
+    unsigned long       bias;
+
+    /* Addresses the segments are loaded at, in the file */
+    unsigned long       start;
+    unsigned long       end;
+
+    struct symbol_table tables[SYMTAB_COUNT];
+
+    uint8_t             id[CACHE_ID_MAX];
+    unsigned int        id_len;
+
+    /* Where the tables are, NULL if they were built */
+    struct cache        *cache;
+
+    struct line_index   lines;
+
+    /* Processes the index is shared by, see `symbol_index_share()` */
+    unsigned int        refs;
+};
+
+/* FNV-1a */
+static uint32_t __symbol_hash(const char *name)
+{
+    uint32_t h = 0x811c9dc5;
+
+    while (*name != '\0')
+        h = (h ^ (uint8_t)*name++) * 0x01000193;
+    return h;
+}
+
+/*
+ * Sort the `count` symbols of `syms` by address, with a radix sort on
+ * the bytes of the addresses that are not the same for all of them.
+ * Several times faster than qsort() on the hundreds of thousands of
+ * symbols of a big program.
+ *
+ * @param tmp - scratch space for `count` symbols
+ */
+static void __symbol_sort(struct symbol *syms, struct symbol *tmp,
+        unsigned long count)
+{
+    unsigned long pos[256 + 1], i;
+    struct symbol *from = syms, *to = tmp, *swap;
+    unsigned int shift, b;
+
+    for (shift = 0; shift < 64 && count > 1; shift += 8) {
+        memset(pos, 0, sizeof(pos));
+        for (i = 0; i < count; i++)
+            pos[((from[i].addr >> shift) & 0xff) + 1]++;
+        if (pos[((from[0].addr >> shift) & 0xff) + 1] == count)
+            continue;
+
+        for (b = 0; b < 256; b++)
+            pos[b + 1] += pos[b];
+        for (i = 0; i < count; i++)
+            to[pos[(from[i].addr >> shift) & 0xff]++] = from[i];
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != syms)
+        memcpy(syms, from, count * sizeof(*syms));
+}
+
+/*
+ * Check that `len` bytes at `off` are within the file.
+ */
+static int __symbol_in_file(struct symbol_index *idx, unsigned long off,
+        unsigned long len)
+{
+    return off <= idx->size && len <= idx->size - off;
+}
+
+/*
+ * Index the symbol table `tbl`, on its first use.
+ *
+ * @return - 0 on success, -1 if the table is missing or corrupt, or
+ *           on allocation failure
+ */
+static int __symbol_table_load(struct symbol_index *idx,
+        struct symbol_table *tbl)
+{
+    struct symbol *tmp;
+    const Elf64_Sym *sym;
+    unsigned long n, i;
+
+    if (tbl->loaded)
+        return tbl->syms != NULL ? 0 : -1;
+    tbl->loaded = 1;
+    if (tbl->shdr == NULL)
+        return -1;
+
+    n = tbl->shdr->sh_size / sizeof(Elf64_Sym);
+    sym = (const Elf64_Sym *)(idx->map + tbl->shdr->sh_offset);
+    tbl->syms = malloc((n + 1) * sizeof(*tbl->syms));
+    if (tbl->syms == NULL)
+        return -1;
+
+    for (i = 0; i < n; i++, sym++) {
+        if ((ELF64_ST_TYPE(sym->st_info) != STT_FUNC &&
+                    ELF64_ST_TYPE(sym->st_info) != STT_OBJECT) ||
+                sym->st_shndx == SHN_UNDEF || sym->st_value == 0 ||
+                sym->st_name >= tbl->strs_size)
+            continue;
+        tbl->syms[tbl->count].addr = sym->st_value;
+        tbl->syms[tbl->count].size = sym->st_size;
+        tbl->syms[tbl->count].name = sym->st_name;
+        tbl->syms[tbl->count].table = tbl - idx->tables;
+        tbl->count++;
+    }
+
+    tmp = malloc((tbl->count + 1) * sizeof(*tmp));
+    if (tmp == NULL) {
+        free(tbl->syms);
+        tbl->syms = NULL;
+        tbl->count = 0;
+        return -1;
+    }
+    __symbol_sort(tbl->syms, tmp, tbl->count);
+    free(tmp);
+
+    return 0;
+}
+
+/*
+ * Index the symbol table `tbl` by name, on the first lookup by name.
+ *
+ * @return - 0 on success, -1 if the table is missing or corrupt, or
+ *           on allocation failure
+ */
+static int __symbol_table_name(struct symbol_index *idx,
+        struct symbol_table *tbl)
+{
+    unsigned long i, size, slot;
+    struct symbol_name *names;
+    const char *name;
+    uint32_t h;
+
+    if (tbl->named)
+        return tbl->names != NULL ? 0 : -1;
+    if (__symbol_table_load(idx, tbl) < 0)
+        return -1;
+    tbl->named = 1;
+
+    /* At most half full */
+    for (size = 16; size < 2 * tbl->count; size *= 2)
+        ;
+    names = calloc(size, sizeof(*names));
+    if (names == NULL)
+        return -1;
+
+    /* The first symbol of a name wins, e.g over local namesakes */
+    for (i = 0; i < tbl->count; i++) {
+        name = tbl->strs + tbl->syms[i].name;
+        h = __symbol_hash(name);
+        for (slot = h & (size - 1); names[slot].sym != 0;
+                slot = (slot + 1) & (size - 1)) {
+            if (names[slot].hash == h && strcmp(name,
+                        tbl->strs + tbl->syms[names[slot].sym - 1].name) == 0)
+                break;
+        }
+        if (names[slot].sym == 0) {
+            names[slot].hash = h;
+            names[slot].sym = i + 1;
+        }
+    }
+    tbl->names = names;
+    tbl->names_mask = size - 1;
+    return 0;
+}
+
+/*
+ * Find the string table of the symbol table `tbl`, forgetting the
+ * symbol table if either is corrupt.
+ */
+static void __symbol_table_strings(struct symbol_index *idx,
+        struct symbol_table *tbl)
+{
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)idx->map;
+    const Elf64_Shdr *shdr = tbl->shdr, *strtab;
+
+    if (shdr == NULL)
+        return;
+    tbl->shdr = NULL;
+
+    if (shdr->sh_link >= ehdr->e_shnum)
+        return;
+    strtab = (const Elf64_Shdr *)(idx->map + ehdr->e_shoff) + shdr->sh_link;
+    if (!__symbol_in_file(idx, shdr->sh_offset, shdr->sh_size) ||
+            !__symbol_in_file(idx, strtab->sh_offset, strtab->sh_size) ||
+            strtab->sh_size == 0)
+        return;
+
+    /* Names are looked at in place, they must end within the table */
+    if (idx->map[strtab->sh_offset + strtab->sh_size - 1] != '\0')
+        return;
+
+    tbl->shdr = shdr;
+    tbl->strs = (const char *)idx->map + strtab->sh_offset;
+    tbl->strs_size = strtab->sh_size;
+}
+
+/*
+ * Find the build-id of the program, in its PT_NOTE segments.
+ */
+static void __symbol_build_id(struct symbol_index *idx,
+        const Elf64_Phdr *phdr, unsigned int phnum)
+{
+    const Elf64_Nhdr *note;
+    unsigned long off, end, len;
+    unsigned int i;
+
+    for (i = 0; i < phnum; i++) {
+        if (phdr[i].p_type != PT_NOTE ||
+                !__symbol_in_file(idx, phdr[i].p_offset, phdr[i].p_filesz))
+            continue;
+
+        off = phdr[i].p_offset;
+        end = off + phdr[i].p_filesz;
+        while (end - off >= sizeof(*note)) {
+            note = (const Elf64_Nhdr *)(idx->map + off);
+            off += sizeof(*note);
+            len = ((note->n_namesz + 3UL) & ~3UL) +
+                ((note->n_descsz + 3UL) & ~3UL);
+            if (len > end - off)
+                break;
+
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                    memcmp(idx->map + off, "GNU", 4) == 0 &&
+                    note->n_descsz > 0) {
+                idx->id_len = note->n_descsz < CACHE_ID_MAX ?
+                    note->n_descsz : CACHE_ID_MAX;
+                memcpy(idx->id, idx->map + off + 4, idx->id_len);
+                return;
+            }
+            off += len;
+        }
+    }
+}
+
+/*
+ * Find the header of the section called `name`, which must have
+ * contents in the file.
+ *
+ * @return - the header, or NULL if there is no such section
+ */
+static const Elf64_Shdr *__symbol_section_header(struct symbol_index *idx,
+        const char *name)
+{
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)idx->map;
+    const Elf64_Shdr *shdr = (const Elf64_Shdr *)(idx->map + ehdr->e_shoff);
+    const Elf64_Shdr *names;
+    unsigned int i;
+
+    if (ehdr->e_shstrndx >= ehdr->e_shnum)
+        return NULL;
+    names = &shdr[ehdr->e_shstrndx];
+    if (!__symbol_in_file(idx, names->sh_offset, names->sh_size) ||
+            names->sh_size == 0 ||
+            idx->map[names->sh_offset + names->sh_size - 1] != '\0')
+        return NULL;
+
+    for (i = 0; i < ehdr->e_shnum; i++) {
+        if (shdr[i].sh_name >= names->sh_size ||
+                strcmp((const char *)idx->map + names->sh_offset +
+                    shdr[i].sh_name, name) != 0)
+            continue;
+        if (shdr[i].sh_type == SHT_NOBITS ||
+                !__symbol_in_file(idx, shdr[i].sh_offset, shdr[i].sh_size))
+            return NULL;
+        return &shdr[i];
+    }
+    return NULL;
+}
+
+/*
+ * Find the section called `name`.
+ *
+ * @param size - where to store its size
+ * @return     - the section in the mapping, or NULL if there is none
+ */
+static const uint8_t *__symbol_section(struct symbol_index *idx,
+        const char *name, unsigned long *size)
+{
+    const Elf64_Shdr *shdr = __symbol_section_header(idx, name);
+
+    *size = shdr != NULL ? shdr->sh_size : 0;
+    return shdr != NULL ? idx->map + shdr->sh_offset : NULL;
+}
+
+/* Sections of the cache file of each table, by address and by name */
+static const unsigned int __symbol_sections[SYMTAB_COUNT][2] = {
+    [SYMTAB_STATIC] = { CACHE_SYMS_STATIC, CACHE_NAMES_STATIC },
+    [SYMTAB_DYNAMIC] = { CACHE_SYMS_DYNAMIC, CACHE_NAMES_DYNAMIC },
+};
+
+/*
+ * Check the table by name `names` of `n` slots, over `count` symbols,
+ * that comes from a cache file: a lookup must neither run out of the
+ * symbols nor probe forever.
+ *
+ * @return - 1 if it is usable, 0 otherwise
+ */
+static int __symbol_names_valid(const struct symbol_name *names,
+        unsigned long n, unsigned long count)
+{
+    unsigned long i, empty = 0;
+
+    if (n == 0 || (n & (n - 1)) != 0)
+        return 0;
+    for (i = 0; i < n; i++) {
+        if (names[i].sym > count)
+            return 0;
+        if (names[i].sym == 0)
+            empty++;
+    }
+    return empty > 0;
+}
+
+/*
+ * Use the tables of the cache file of the program instead of building
+ * them, unless they are corrupt.
+ *
+ * @return - 0 on success, -1 if the tables are to be built
+ */
+static int __symbol_cache_use(struct symbol_index *idx, struct cache *cache)
+{
+    const struct symbol_name *names[SYMTAB_COUNT];
+    const struct symbol *syms[SYMTAB_COUNT];
+    unsigned long count[SYMTAB_COUNT], n[SYMTAB_COUNT], size;
+    struct symbol_table *tbl;
+    int i;
+
+    for (i = 0; i < SYMTAB_COUNT; i++) {
+        syms[i] = cache_section(cache, __symbol_sections[i][0], &size);
+        if (size % sizeof(struct symbol) != 0)
+            return -1;
+        count[i] = size / sizeof(struct symbol);
+
+        names[i] = cache_section(cache, __symbol_sections[i][1], &size);
+        if (size % sizeof(struct symbol_name) != 0)
+            return -1;
+        n[i] = size / sizeof(struct symbol_name);
+
+        /* A table the program does not have is empty altogether, one
+         * without symbols has no names either */
+        if (names[i] == NULL && syms[i] == NULL)
+            continue;
+        if (names[i] == NULL ||
+                !__symbol_names_valid(names[i], n[i], count[i]))
+            return -1;
+        if (syms[i] == NULL)
+            names[i] = NULL;
+    }
+
+    for (i = 0; i < SYMTAB_COUNT; i++) {
+        tbl = &idx->tables[i];
+        tbl->loaded = 1;
+        tbl->named = 1;
+        tbl->syms = (struct symbol *)syms[i];
+        tbl->count = syms[i] != NULL ? count[i] : 0;
+        tbl->names = (struct symbol_name *)names[i];
+        tbl->names_mask = names[i] != NULL ? n[i] - 1 : 0;
+    }
+    idx->cache = cache;
+    return 0;
+}
+
+/*
+ * Build the tables that were not used yet and write them all to the
+ * cache file of the program.
+ */
+static void __symbol_cache_write(struct symbol_index *idx)
+{
+    const void *data[CACHE_SECTIONS] = { NULL };
+    unsigned long sizes[CACHE_SECTIONS] = { 0 };
+    struct symbol_table *tbl;
+    int i;
+
+    for (i = 0; i < SYMTAB_COUNT; i++) {
+        tbl = &idx->tables[i];
+        if (__symbol_table_name(idx, tbl) < 0)
+            continue;
+        data[__symbol_sections[i][0]] = tbl->syms;
+        sizes[__symbol_sections[i][0]] = tbl->count * sizeof(*tbl->syms);
+        data[__symbol_sections[i][1]] = tbl->names;
+        sizes[__symbol_sections[i][1]] = (tbl->names_mask + 1) * sizeof(*tbl->names);
+    }
+
+    cache_write(idx->id, idx->id_len, idx->size, data, sizes);
+}
+
+/**
+ * Open the symbols of the ELF program `path`. The symbol tables are
+ * only read on first use, unless they are in the cache.
+ *
+ * @return - the index, or NULL if the file is not a 64-bit ELF file
+ */
+struct symbol_index *symbol_index_open(const char *path)
+{
+    const Elf64_Ehdr *ehdr;
+    const Elf64_Phdr *phdr;
+    const Elf64_Shdr *shdr;
+    const uint8_t *line, *line_str, *str, *aranges, *info, *abbrev;
+    unsigned long line_size, line_str_size, str_size;
+    unsigned long aranges_size, info_size, abbrev_size;
+    struct symbol_index *idx;
+    struct cache *cache;
+    struct stat st;
+    int fd, i;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    idx = calloc(1, sizeof(*idx));
+    if (idx == NULL) {
+        close(fd);
+        return NULL;
+    }
+    idx->refs = 1;
+    idx->size = st.st_size;
+    idx->map = mmap(NULL, idx->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (idx->map == MAP_FAILED) {
+        free(idx);
+        return NULL;
+    }
+
+    ehdr = (const Elf64_Ehdr *)idx->map;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+            ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+            ehdr->e_shentsize != sizeof(Elf64_Shdr) ||
+            !__symbol_in_file(idx, ehdr->e_shoff,
+                (unsigned long)ehdr->e_shnum * sizeof(Elf64_Shdr))) {
+        munmap((void *)idx->map, idx->size);
+        free(idx);
+        return NULL;
+    }
+    idx->pie = ehdr->e_type == ET_DYN;
+
+    idx->start = ~0UL;
+    phdr = (const Elf64_Phdr *)(idx->map + ehdr->e_phoff);
+    if (ehdr->e_phentsize == sizeof(Elf64_Phdr) &&
+            __symbol_in_file(idx, ehdr->e_phoff,
+                (unsigned long)ehdr->e_phnum * sizeof(Elf64_Phdr))) {
+        __symbol_build_id(idx, phdr, ehdr->e_phnum);
+        for (i = 0; i < ehdr->e_phnum; i++) {
+            if (phdr[i].p_type != PT_LOAD)
+                continue;
+            if (phdr[i].p_vaddr < idx->start)
+                idx->start = phdr[i].p_vaddr;
+            if (phdr[i].p_vaddr + phdr[i].p_memsz > idx->end)
+                idx->end = phdr[i].p_vaddr + phdr[i].p_memsz;
+        }
+    }
+
+    shdr = (const Elf64_Shdr *)(idx->map + ehdr->e_shoff);
+    for (i = 0; i < ehdr->e_shnum; i++) {
+        if (shdr[i].sh_type == SHT_SYMTAB)
+            idx->tables[SYMTAB_STATIC].shdr = &shdr[i];
+        else if (shdr[i].sh_type == SHT_DYNSYM)
+            idx->tables[SYMTAB_DYNAMIC].shdr = &shdr[i];
+    }
+    for (i = 0; i < SYMTAB_COUNT; i++)
+        __symbol_table_strings(idx, &idx->tables[i]);
+
+    line = __symbol_section(idx, ".debug_line", &line_size);
+    line_str = __symbol_section(idx, ".debug_line_str", &line_str_size);
+    str = __symbol_section(idx, ".debug_str", &str_size);
+    line_index_init(&idx->lines, line, line_size, line_str, line_str_size,
+            str, str_size);
+    aranges = __symbol_section(idx, ".debug_aranges", &aranges_size);
+    info = __symbol_section(idx, ".debug_info", &info_size);
+    abbrev = __symbol_section(idx, ".debug_abbrev", &abbrev_size);
+    line_index_units(&idx->lines, aranges, aranges_size, info, info_size,
+            abbrev, abbrev_size);
+
+    if (idx->id_len > 0) {
+        /* A corrupt cache is written again by `symbol_index_save()` */
+        cache = cache_open(idx->id, idx->id_len, idx->size);
+        if (cache != NULL && __symbol_cache_use(idx, cache) < 0)
+            cache_close(cache);
+    }
+    return idx;
+}
+
+/**
+ * Write the cache of the program if it has a build-id and no cache yet,
+ * building the tables that were not used. The index is then as good as
+ * one opened from the cache.
+ */
+void symbol_index_save(struct symbol_index *idx)
+{
+    if (idx->cache == NULL && idx->id_len > 0)
+        __symbol_cache_write(idx);
+}
+
+/**
+ * Take another reference to `idx`, for a process forked by one that
+ * runs the program.
+ *
+ * @return - `idx`
+ */
+struct symbol_index *symbol_index_share(struct symbol_index *idx)
+{
+    idx->refs++;
+    return idx;
+}
+
+/**
+ * Give back a reference to an index opened with `symbol_index_open()`,
+ * which is closed with the last one.
+ */
+void symbol_index_close(struct symbol_index *idx)
+{
+    int i;
+
+    if (--idx->refs > 0)
+        return;
+
+    if (idx->cache != NULL) {
+        cache_close(idx->cache);
+    } else {
+        for (i = 0; i < SYMTAB_COUNT; i++) {
+            free(idx->tables[i].syms);
+            free(idx->tables[i].names);
+        }
+    }
+    line_index_destroy(&idx->lines);
+    munmap((void *)idx->map, idx->size);
+    free(idx);
+}
+
+/**
+ * Take the load address of a PIE from the auxiliary vector of process
+ * `pid`, which runs the program: it is where the entry point ended up,
+ * less the entry point in the file.
+ *
+ * @return - 0 on success, -1 if the vector could not be read
+ */
+int symbol_index_relocate(struct symbol_index *idx, pid_t pid)
+{
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)idx->map;
+    Elf64_auxv_t auxv;
+    char path[64];
+    FILE *f;
+    int ret = -1;
+
+    if (!idx->pie)
+        return 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/auxv", pid);
+    f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    while (fread(&auxv, sizeof(auxv), 1, f) == 1 &&
+            auxv.a_type != AT_NULL) {
+        if (auxv.a_type == AT_ENTRY) {
+            idx->bias = auxv.a_un.a_val - ehdr->e_entry;
+            ret = 0;
+            break;
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+/**
+ * Get the name of a symbol found in the index.
+ */
+const char *symbol_name(struct symbol_index *idx, const struct symbol *sym)
+{
+    const struct symbol_table *tbl;
+
+    /* Those of the cache file are only checked here */
+    if (sym->table >= SYMTAB_COUNT)
+        return "??";
+    tbl = &idx->tables[sym->table];
+    if (sym->name >= tbl->strs_size)
+        return "??";
+    return tbl->strs + sym->name;
+}
+
+/**
+ * Find the symbol called `name`, in .symtab first.
+ *
+ * @param addr - where to store the address of the symbol
+ * @return     - the symbol, or NULL if there is none of that name
+ */
+const struct symbol *symbol_lookup_name(struct symbol_index *idx,
+        const char *name, unsigned long *addr)
+{
+    uint32_t h = __symbol_hash(name);
+    struct symbol_table *tbl;
+    const struct symbol *sym;
+    unsigned long slot;
+    int i;
+
+    for (i = 0; i < SYMTAB_COUNT; i++) {
+        tbl = &idx->tables[i];
+        if (__symbol_table_name(idx, tbl) < 0)
+            continue;
+
+        for (slot = h & tbl->names_mask; tbl->names[slot].sym != 0 &&
+                tbl->names[slot].sym <= tbl->count;
+                slot = (slot + 1) & tbl->names_mask) {
+            sym = &tbl->syms[tbl->names[slot].sym - 1];
+            if (tbl->names[slot].hash == h &&
+                    strcmp(symbol_name(idx, sym), name) == 0) {
+                *addr = sym->addr + idx->bias;
+                return sym;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find the code of line `line` of the source file `path`, or of the
+ * closest line after it that has code.
+ *
+ * @param addr  - where to store the address of the code
+ * @param found - where to store the line the code is of
+ * @return      - 0 on success, -1 if there is no such code
+ */
+int symbol_lookup_line(struct symbol_index *idx, const char *path,
+        unsigned int line, unsigned long *addr, unsigned int *found)
+{
+    if (line_lookup_file(&idx->lines, path, line, addr, found) < 0)
+        return -1;
+    *addr += idx->bias;
+    return 0;
+}
+
+/**
+ * Find the source line of the code at `addr`.
+ *
+ * @param line - where to store the line
+ * @return     - the source file, or NULL if the code has no line
+ */
+const struct line_file *symbol_line_at(struct symbol_index *idx,
+        unsigned long addr, unsigned int *line)
+{
+    return line_lookup_addr(&idx->lines, addr - idx->bias, line);
+}
+
+/**
+ * Find the code of the source line `addr` is in.
+ *
+ * @param start - where to store the first address of the line
+ * @param end   - where to store the first address after it
+ * @return      - 0 on success, -1 if the code has no line
+ */
+int symbol_line_range(struct symbol_index *idx, unsigned long addr,
+        unsigned long *start, unsigned long *end)
+{
+    if (line_lookup_range(&idx->lines, addr - idx->bias, start, end) < 0)
+        return -1;
+    *start += idx->bias;
+    *end += idx->bias;
+    return 0;
+}
+
+/**
+ * Get the code of the program, its .text section.
+ *
+ * @param addr - where to store its address in the file
+ * @param size - where to store its size
+ * @return     - the code in the mapping, or NULL if there is none
+ */
+const uint8_t *symbol_text(struct symbol_index *idx, unsigned long *addr,
+        unsigned long *size)
+{
+    const Elf64_Shdr *shdr = __symbol_section_header(idx, ".text");
+
+    if (shdr == NULL)
+        return NULL;
+    *addr = shdr->sh_addr;
+    *size = shdr->sh_size;
+    return idx->map + shdr->sh_offset;
+}
+
+/**
+ * Get the function and object symbols of .symtab, or of .dynsym if the
+ * program is stripped, sorted by address. Addresses are in the file.
+ *
+ * @param count - where to store the number of symbols
+ * @return      - the symbols, NULL if there are none
+ */
+const struct symbol *symbol_all(struct symbol_index *idx,
+        unsigned long *count)
+{
+    struct symbol_table *tbl;
+    int i;
+
+    for (i = 0; i < SYMTAB_COUNT; i++) {
+        tbl = &idx->tables[i];
+        if (__symbol_table_load(idx, tbl) == 0 && tbl->count > 0) {
+            *count = tbl->count;
+            return tbl->syms;
+        }
+    }
+    *count = 0;
+    return NULL;
+}
+
+/**
+ * Find the symbol `addr` is in, in .symtab first: the closest one at or
+ * before it, that also covers it unless its size is not known. Only
+ * addresses within the segments of the program have one.
+ *
+ * @param offset - where to store the offset of `addr` in the symbol
+ * @return       - the symbol, or NULL if there is none
+ */
+const struct symbol *symbol_lookup_addr(struct symbol_index *idx,
+        unsigned long addr, unsigned long *offset)
+{
+    struct symbol_table *tbl;
+    const struct symbol *sym;
+    unsigned long lo, hi, mid;
+    int i;
+
+    /* Symbols of unknown size only cover the program */
+    addr -= idx->bias;
+    if (addr < idx->start || addr >= idx->end)
+        return NULL;
+
+    for (i = 0; i < SYMTAB_COUNT; i++) {
+        tbl = &idx->tables[i];
+        if (__symbol_table_load(idx, tbl) < 0)
+            continue;
+
+        /* The first symbol above `addr` */
+        lo = 0;
+        hi = tbl->count;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (tbl->syms[mid].addr <= addr)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == 0)
+            continue;
+
+        sym = &tbl->syms[lo - 1];
+        if (sym->size != 0 && addr - sym->addr >= sym->size)
+            continue;
+        *offset = addr - sym->addr;
+        return sym;
+    }
+    return NULL;
+}
+
+#endif /* SYMBOLS_H */
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Threads of the debugee.
+ *
+ * Every thread of the debugee is traced, the kernel attaching the new
+ * ones for us through PTRACE_O_TRACECLONE. By default the debugger works
+ * in all-stop mode: when a thread stops, the others are interrupted as
+ * well, and they are all resumed together, except when stepping, which
+ * only resumes the current thread.
+ *
+ * In non-stop mode, only the thread that stops does, and only the
+ * current thread is resumed. Resuming from a breakpoint then goes
+ * through its displaced instruction, so that the other threads never
+ * run past a missing INT3 (see inc/displaced.h).
+ *
+ * The current thread is the one `dbge_pid` of the debugger refers to,
+ * and whose registers and stop state are in `struct debugger`. Those
+ * of the other threads are kept in their `struct thread` meanwhile.
+ *
+ * Threads are kept in a hash table keyed by TID, so that finding the
+ * thread of a wait event does not depend on the number of threads.
+ *
+ * Memory Allocation: the table owns the threads.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <stdlib.h>
+
+#include "hash_table.h"
+
+/* Values of `state` */
+#define THREAD_STOPPED      0
+#define THREAD_RUNNING      1
+
+struct breakpoint;
+
+struct thread {
+    pid_t               tid;
+    int                 state;
+
+    /* The thread was interrupted and the stop is still to come */
+    int                 stop_requested;
+
+    /* Stopped for a moment while running in non-stop mode */
+    int                 held;
+
+    /* A stop of the thread that was not reported yet, because it
+     * happened while the thread was being stopped, 0 if none */
+    int                 pending_status;
+
+    /* Saved from `struct debugger` while not the current thread */
+    struct user_regs_struct regs;
+    int                 regs_state;
+    struct breakpoint * stopped_bp;
+    int                 pending_signal;
+};
+
+struct thread_table {
+    struct hash_table   threads;
+
+    /* The thread group leader, whose TID is the PID of the debugee */
+    pid_t               leader;
+
+    /* The thread the last stop was reported for */
+    pid_t               reported;
+};
+
+/**
+ * Get the thread `tid`.
+ *
+ * @return - the thread, or NULL if it is not in the table
+ */
+struct thread *thread_get(struct thread_table *tbl, pid_t tid)
+{
+    return hash_table_lookup(&tbl->threads, tid);
+}
+
+/**
+ * Add the stopped thread `tid` to the table.
+ *
+ * @return - the thread, or NULL on allocation failure
+ */
+struct thread *thread_add(struct thread_table *tbl, pid_t tid)
+{
+    struct thread *t;
+
+    t = calloc(1, sizeof(struct thread));
+    if (t == NULL)
+        return NULL;
+    if (hash_table_insert(&tbl->threads, tid, t) < 0) {
+        free(t);
+        return NULL;
+    }
+
+    t->tid = tid;
+    t->state = THREAD_STOPPED;
+    return t;
+}
+
+/**
+ * Remove the thread `tid` from the table, e.g because it exited.
+ */
+void thread_remove(struct thread_table *tbl, pid_t tid)
+{
+    free(hash_table_delete(&tbl->threads, tid));
+}
+
+/**
+ * Get the number of threads in the table.
+ */
+unsigned long thread_count(struct thread_table *tbl)
+{
+    return hash_table_count(&tbl->threads);
+}
+
+/**
+ * Initialize a thread table with the single, stopped, thread `leader`.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+int thread_table_init(struct thread_table *tbl, pid_t leader)
+{
+    tbl->leader = leader;
+    tbl->reported = leader;
+    if (hash_table_init(&tbl->threads, 0) < 0)
+        return -1;
+    return thread_add(tbl, leader) != NULL ? 0 : -1;
+}
+
+/**
+ * Free every thread of the table.
+ */
+void thread_table_destroy(struct thread_table *tbl)
+{
+    struct hash_slot *slot;
+
+    hash_table_for_each(&tbl->threads, slot)
+        free(slot->value);
+    hash_table_destroy(&tbl->threads);
+}
+
+/**
+ * Remove every thread from the table, e.g because the debugee exited.
+ * The leader is kept, to tell which process it was.
+ */
+void thread_table_clear(struct thread_table *tbl)
+{
+    struct hash_slot *slot;
+
+    hash_table_for_each(&tbl->threads, slot)
+        free(slot->value);
+    hash_table_clear(&tbl->threads);
+}
+
+/**
+ * Replace the threads of the table by the single thread `leader`, e.g
+ * because the debugee was replaced by another process.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+int thread_table_reset(struct thread_table *tbl, pid_t leader)
+{
+    thread_table_destroy(tbl);
+    return thread_table_init(tbl, leader);
+}
+
+#endif /* THREAD_H */
@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Execution trace files.
+ *
+ * A trace is the sequence of register states of the debugee, one
+ * record per step. The file is laid out as:
+ *
+ *   struct trace_header
+ *   chunk 0, chunk 1, ...
+ *   struct trace_chunk index[nchunks]
+ *
+ * A chunk holds TRACE_CHUNK_RECORDS records (the last one may hold
+ * less), so the chunk of record `n` is simply `n / chunk_records` and
+ * no search is needed. Chunks are decoded independently of each other:
+ * the first record of a chunk is a delta against all-zero registers.
+ *
+ * Records are normally taken after every instruction. In traces with
+ * the TRACE_BLOCKS flag, they are only taken when a branch is taken:
+ * the instructions in between are straight-line code, which can be
+ * recovered from the code bytes.
+ *
+ * A record is a varint mask of the registers that changed since the
+ * previous record, followed for each of them by the zigzag varint of
+ * the difference. Single stepping mostly changes RIP and a register
+ * or two, which takes a handful of bytes. A chunk is then compressed
+ * with inc/lz.h, unless that does not make it smaller.
+ *
+ * Both writing and reading go through mmap(), and reading only touches
+ * the chunk of the requested record, so traces larger than memory are
+ * fine.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lz.h"
+
+#define TRACE_MAGIC         "RBTRACE"
+#define TRACE_VERSION       1
+
+/* Registers per record, all of `struct user_regs_struct` */
+#define TRACE_NREGS         (sizeof(struct user_regs_struct) / sizeof(uint64_t))
+
+#define TRACE_CHUNK_RECORDS 4096
+
+/* Worst case size of a record: the mask and a delta for every register */
+#define TRACE_RECORD_MAX    (5 + 10 * TRACE_NREGS)
+
+/* Values of `trace_header.flags` */
+#define TRACE_BLOCKS        0x1     /* one record per taken branch */
+
+/* Values of `trace_chunk.flags` */
+#define TRACE_CHUNK_LZ      0x1
+
+/* The file is grown by at least that much at once */
+#define TRACE_GROW_MIN      (1UL << 20)
+
+struct trace_header {
+    char                magic[8];
+    uint32_t            version;
+    uint32_t            nregs;
+    uint32_t            chunk_records;
+    uint32_t            flags;
+    uint64_t            nrecords;
+    uint64_t            nchunks;
+    uint64_t            index_offset;
+};
+
+struct trace_chunk {
+    uint64_t            offset;     /* in the file */
+    uint32_t            size;       /* in the file */
+    uint32_t            raw_size;   /* once decompressed */
+    uint32_t            flags;
+    uint32_t            nrecords;
+};
+
+struct trace_writer {
+    int                 fd;
+    int                 compress;
+    uint32_t            flags;
+
+    /* The file, mapped as a whole and grown with mremap() */
+    uint8_t *           map;
+    size_t              map_size;
+    size_t              used;
+
+    /* The chunk being encoded */
+    uint8_t *           raw;
+    size_t              raw_used;
+    uint32_t            chunk_nrecords;
+    uint64_t            prev[TRACE_NREGS];
+
+    struct trace_chunk *index;
+    uint64_t            nchunks;
+    uint64_t            index_capacity;
+    uint64_t            nrecords;
+};
+
+struct trace_reader {
+    int                 fd;
+    const uint8_t *     map;
+    size_t              size;
+    struct trace_header hdr;
+    const struct trace_chunk *index;
+
+    /* Decoding position: next record to decode in chunk `chunk` */
+    int64_t             chunk;
+    uint8_t *           raw;
+    const uint8_t *     data;
+    size_t              data_size;
+    size_t              pos;
+    uint64_t            next;
+    uint64_t            regs[TRACE_NREGS];
+};
+
+static inline uint8_t *__trace_put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+/*
+ * @return - the position after the varint, NULL if it is truncated
+ */
+static inline const uint8_t *__trace_get_varint(const uint8_t *p,
+        const uint8_t *end, uint64_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    while (p < end && shift < 64) {
+        *v |= (uint64_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+        shift += 7;
+    }
+    return NULL;
+}
+
+static inline uint64_t __trace_zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t __trace_unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/*
+ * Make room for `len` more bytes in the file of `w`.
+ *
+ * @return - 0 on success, -1 on error
+ */
+static int __trace_writer_reserve(struct trace_writer *w, size_t len)
+{
+    size_t size;
+    void *map;
+
+    if (w->used + len <= w->map_size)
+        return 0;
+
+    size = w->map_size * 2;
+    if (size < w->used + len)
+        size = w->used + len;
+    if (size < TRACE_GROW_MIN)
+        size = TRACE_GROW_MIN;
+    size = (size + 4095) & ~4095UL;
+
+    /* Allocate the blocks now, running out of space while writing
+     * through the mapping would be a SIGBUS */
+    if (posix_fallocate(w->fd, 0, size) != 0)
+        return -1;
+
+    if (w->map == NULL)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+    else
+        map = mremap(w->map, w->map_size, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+        return -1;
+
+    w->map = map;
+    w->map_size = size;
+    return 0;
+}
+
+/*
+ * Move the chunk being encoded into the file.
+ *
+ * @return - 0 on success, -1 on error
+ */
+static int __trace_writer_flush(struct trace_writer *w)
+{
+    struct trace_chunk *chunk, *index;
+    uint64_t capacity;
+    size_t size;
+
+    if (w->chunk_nrecords == 0)
+        return 0;
+
+    if (w->nchunks == w->index_capacity) {
+        capacity = w->index_capacity ? w->index_capacity * 2 : 64;
+        index = realloc(w->index, capacity * sizeof(*index));
+        if (index == NULL)
+            return -1;
+        w->index = index;
+        w->index_capacity = capacity;
+    }
+
+    if (__trace_writer_reserve(w, LZ_BOUND(w->raw_used)) < 0)
+        return -1;
+
+    chunk = &w->index[w->nchunks++];
+    chunk->offset = w->used;
+    chunk->raw_size = w->raw_used;
+    chunk->nrecords = w->chunk_nrecords;
+    chunk->flags = 0;
+
+    size = w->compress ? lz_compress(w->raw, w->raw_used, w->map + w->used) :
+        w->raw_used;
+    if (w->compress && size < w->raw_used) {
+        chunk->flags |= TRACE_CHUNK_LZ;
+    }
+    else {
+        memcpy(w->map + w->used, w->raw, w->raw_used);
+        size = w->raw_used;
+    }
+
+    chunk->size = size;
+    w->used += size;
+
+    w->raw_used = 0;
+    w->chunk_nrecords = 0;
+    memset(w->prev, 0, sizeof(w->prev));
+    return 0;
+}
+
+/**
+ * Create the trace file `path`, replacing any existing file.
+ *
+ * @param path     - path of the file
+ * @param compress - whether to compress chunks
+ * @param flags    - TRACE_* flags of the trace
+ * @return         - the writer, or NULL on error
+ */
+struct trace_writer *trace_writer_open(const char *path, int compress,
+        uint32_t flags)
+{
+    struct trace_writer *w;
+
+    w = calloc(1, sizeof(*w));
+    if (w == NULL)
+        return NULL;
+
+    w->compress = compress;
+    w->flags = flags;
+    w->raw = malloc(TRACE_CHUNK_RECORDS * TRACE_RECORD_MAX);
+    w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (w->raw == NULL || w->fd < 0 ||
+            __trace_writer_reserve(w, sizeof(struct trace_header)) < 0) {
+        if (w->fd >= 0)
+            close(w->fd);
+        free(w->raw);
+        free(w);
+        return NULL;
+    }
+
+    w->used = sizeof(struct trace_header);
+    return w;
+}
+
+/**
+ * Append a record to the trace.
+ *
+ * @param w    - the trace writer
+ * @param regs - registers of the step
+ * @return     - 0 on success, -1 on error
+ */
+int trace_writer_append(struct trace_writer *w, struct user_regs_struct *regs)
+{
+    uint64_t cur[TRACE_NREGS], mask = 0;
+    uint8_t *p = w->raw + w->raw_used;
+    unsigned int i;
+
+    memcpy(cur, regs, sizeof(cur));
+    for (i = 0; i < TRACE_NREGS; i++)
+        if (cur[i] != w->prev[i])
+            mask |= 1ULL << i;
+
+    p = __trace_put_varint(p, mask);
+    for (i = 0; i < TRACE_NREGS; i++)
+        if (mask & (1ULL << i))
+            p = __trace_put_varint(p, __trace_zigzag(cur[i] - w->prev[i]));
+
+    memcpy(w->prev, cur, sizeof(cur));
+    w->raw_used = p - w->raw;
+    w->nrecords++;
+
+    if (++w->chunk_nrecords == TRACE_CHUNK_RECORDS)
+        return __trace_writer_flush(w);
+    return 0;
+}
+
+/**
+ * Complete the trace file with its index and header, and free the
+ * writer.
+ *
+ * @return - size of the file on success, -1 on error
+ */
+long trace_writer_close(struct trace_writer *w)
+{
+    struct trace_header hdr;
+    size_t index_size;
+    long ret = -1;
+
+    if (__trace_writer_flush(w) < 0)
+        goto out;
+
+    index_size = w->nchunks * sizeof(struct trace_chunk);
+    if (__trace_writer_reserve(w, index_size) < 0)
+        goto out;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    hdr.version = TRACE_VERSION;
+    hdr.flags = w->flags;
+    hdr.nregs = TRACE_NREGS;
+    hdr.chunk_records = TRACE_CHUNK_RECORDS;
+    hdr.nrecords = w->nrecords;
+    hdr.nchunks = w->nchunks;
+    hdr.index_offset = w->used;
+
+    memcpy(w->map + w->used, w->index, index_size);
+    w->used += index_size;
+    memcpy(w->map, &hdr, sizeof(hdr));
+    ret = w->used;
+
+out:
+    if (w->map != NULL)
+        munmap(w->map, w->map_size);
+    if (ret >= 0 && ftruncate(w->fd, w->used) < 0)
+        ret = -1;
+    close(w->fd);
+    free(w->index);
+    free(w->raw);
+    free(w);
+    return ret;
+}
+
+/**
+ * Open the trace file `path` for reading.
+ *
+ * @return - the reader, or NULL if the file could not be opened or is
+ *           not a valid trace
+ */
+struct trace_reader *trace_reader_open(const char *path)
+{
+    struct trace_reader *r;
+    struct stat st;
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    r->chunk = -1;
+
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0 || fstat(r->fd, &st) < 0 ||
+            (size_t)st.st_size < sizeof(struct trace_header))
+        goto fail;
+
+    r->size = st.st_size;
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        goto fail;
+    }
+
+    memcpy(&r->hdr, r->map, sizeof(r->hdr));
+    if (memcmp(r->hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+            r->hdr.version != TRACE_VERSION ||
+            r->hdr.nregs != TRACE_NREGS ||
+            r->hdr.chunk_records == 0 ||
+            r->hdr.chunk_records > TRACE_CHUNK_RECORDS ||
+            r->hdr.index_offset > r->size ||
+            r->hdr.nchunks > (r->size - r->hdr.index_offset) /
+                sizeof(struct trace_chunk) ||
+            r->hdr.nrecords > r->hdr.nchunks * r->hdr.chunk_records)
+        goto fail;
+    r->index = (const struct trace_chunk *)(r->map + r->hdr.index_offset);
+
+    r->raw = malloc(TRACE_CHUNK_RECORDS * TRACE_RECORD_MAX);
+    if (r->raw == NULL)
+        goto fail;
+
+    /* Chunks are decoded front to back */
+    madvise((void *)r->map, r->size, MADV_SEQUENTIAL);
+    return r;
+
+fail:
+    if (r->map != NULL)
+        munmap((void *)r->map, r->size);
+    if (r->fd >= 0)
+        close(r->fd);
+    free(r);
+    return NULL;
+}
+
+/**
+ * Close a trace opened with `trace_reader_open()`.
+ */
+void trace_reader_close(struct trace_reader *r)
+{
+    munmap((void *)r->map, r->size);
+    close(r->fd);
+    free(r->raw);
+    free(r);
+}
+
+/*
+ * Start decoding chunk number `n`.
+ *
+ * @return - 0 on success, -1 if the chunk is corrupt
+ */
+static int __trace_reader_load(struct trace_reader *r, uint64_t n)
+{
+    const struct trace_chunk *chunk = &r->index[n];
+    long size;
+
+    r->chunk = -1;
+    if (chunk->offset > r->size || chunk->size > r->size - chunk->offset ||
+            chunk->raw_size > TRACE_CHUNK_RECORDS * TRACE_RECORD_MAX)
+        return -1;
+
+    if (chunk->flags & TRACE_CHUNK_LZ) {
+        size = lz_decompress(r->map + chunk->offset, chunk->size, r->raw,
+                chunk->raw_size);
+        if (size != chunk->raw_size)
+            return -1;
+        r->data = r->raw;
+    }
+    else {
+        r->data = r->map + chunk->offset;
+    }
+
+    r->data_size = chunk->raw_size;
+    r->pos = 0;
+    r->next = n * r->hdr.chunk_records;
+    r->chunk = n;
+    memset(r->regs, 0, sizeof(r->regs));
+    return 0;
+}
+
+/**
+ * Get the registers of record number `n`. Reading records in order only
+ * decodes each record once.
+ *
+ * @param r    - the trace reader
+ * @param n    - the record number
+ * @param regs - where to store the registers
+ * @return     - 0 on success, -1 if there is no such record or the
+ *               trace is corrupt
+ */
+int trace_read(struct trace_reader *r, uint64_t n,
+        struct user_regs_struct *regs)
+{
+    const uint8_t *p, *end;
+    uint64_t chunk, mask, v;
+    unsigned int i;
+
+    if (n >= r->hdr.nrecords)
+        return -1;
+
+    chunk = n / r->hdr.chunk_records;
+    if ((int64_t)chunk != r->chunk || n + 1 < r->next)
+        if (__trace_reader_load(r, chunk) < 0)
+            return -1;
+
+    p = r->data + r->pos;
+    end = r->data + r->data_size;
+    while (r->next <= n) {
+        p = __trace_get_varint(p, end, &mask);
+        if (p == NULL)
+            goto corrupt;
+
+        for (i = 0; i < TRACE_NREGS; i++) {
+            if (!(mask & (1ULL << i)))
+                continue;
+            p = __trace_get_varint(p, end, &v);
+            if (p == NULL)
+                goto corrupt;
+            r->regs[i] += __trace_unzigzag(v);
+        }
+        r->next++;
+    }
+    r->pos = p - r->data;
+
+    memcpy(regs, r->regs, sizeof(*regs));
+    return 0;
+
+corrupt:
+    r->chunk = -1;
+    return -1;
+}
+
+#endif /* TRACE_H */
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Index of the software watchpoints.
+ *
+ * Software watchpoints take the access they watch for away from the
+ * pages they cover, and the debugee faults on every such access to the
+ * pages, most of them outside of the watched ranges. To tell quickly
+ * whether a fault is a hit, the ranges are kept in an array sorted by
+ * start address, searched by bisection. Since ranges may overlap, the
+ * search goes on backwards over the ranges that start at most the
+ * length of the longest range before the address.
+ *
+ * Pages are kept in a hash table with their original protection and
+ * the number of watchpoints of every type over them, from which the
+ * protection they should have is computed. Pages are never removed
+ * from it, so that the protection of copies of the debugee made when
+ * a page was still watched can be put right (see inc/checkpoint.h).
+ *
+ * Memory Allocation: the index owns the range array and the pages, not
+ * the watchpoints.
+ */
+
+#ifndef WATCH_INDEX_H
+#define WATCH_INDEX_H
+
+#include <sys/mman.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "breakpoint.h"
+#include "hash_table.h"
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE       4096UL
+#define PAGE_MASK       (~(PAGE_SIZE - 1))
+#endif
+
+#define WATCH_INDEX_MIN_CAPACITY    16
+
+struct watch_range {
+    unsigned long       start;
+    unsigned long       end;
+    struct watchpoint   *wp;
+};
+
+/*
+ * A page with software watchpoints over it, now or in the past.
+ */
+struct watch_page {
+    unsigned long       page;
+
+    /* Protection of the page without watchpoints */
+    int                 prot;
+
+    /* Watchpoints over the page, by WATCH_* type */
+    unsigned int        count[3];
+};
+
+struct watch_index {
+    struct watch_range  *ranges;
+    unsigned int        count;
+    unsigned int        capacity;
+
+    /* Length of the longest range */
+    unsigned long       max_len;
+
+    struct hash_table   pages;
+};
+
+/**
+ * Initialize an empty watch index.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+int watch_index_init(struct watch_index *idx)
+{
+    idx->ranges = NULL;
+    idx->count = 0;
+    idx->capacity = 0;
+    idx->max_len = 0;
+    return hash_table_init(&idx->pages, 0);
+}
+
+/**
+ * Free everything held by the index.
+ */
+void watch_index_destroy(struct watch_index *idx)
+{
+    struct hash_slot *slot;
+
+    hash_table_for_each(&idx->pages, slot)
+        free(slot->value);
+    hash_table_destroy(&idx->pages);
+    free(idx->ranges);
+}
+
+/*
+ * Find the position of the first range that starts after `addr`.
+ */
+static unsigned int __watch_index_upper(struct watch_index *idx,
+        unsigned long addr)
+{
+    unsigned int lo = 0, hi = idx->count, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (idx->ranges[mid].start <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * Get the page of the index that contains `addr`.
+ *
+ * @return - the page, or NULL if no software watchpoint was ever
+ *           over it
+ */
+struct watch_page *watch_index_page(struct watch_index *idx,
+        unsigned long addr)
+{
+    return hash_table_lookup(&idx->pages, addr & PAGE_MASK);
+}
+
+/**
+ * Get the protection page `wp` should have, given the watchpoints over
+ * it.
+ */
+int watch_page_prot(struct watch_page *wp)
+{
+    int prot = wp->prot;
+
+    if (wp->count[WATCH_ACCESS] > 0)
+        return PROT_NONE;
+    if (wp->count[WATCH_WRITE] > 0)
+        prot &= ~PROT_WRITE;
+    if (wp->count[WATCH_EXEC] > 0)
+        prot &= ~PROT_EXEC;
+    return prot;
+}
+
+/**
+ * Add the watchpoint `wp` to the index. Its pages that are not in the
+ * index yet are added with protection `prot`, which the caller must
+ * have looked up if `watch_index_covers_new()` says so.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+int watch_index_add(struct watch_index *idx, struct watchpoint *wp,
+        int prot)
+{
+    unsigned long start = (unsigned long)wp->addr, end = start + wp->len;
+    unsigned long page, capacity;
+    struct watch_page *p;
+    struct watch_range *ranges;
+    unsigned int pos;
+
+    if (idx->count == idx->capacity) {
+        capacity = idx->capacity ? idx->capacity * 2 :
+            WATCH_INDEX_MIN_CAPACITY;
+        ranges = realloc(idx->ranges, capacity * sizeof(*ranges));
+        if (ranges == NULL)
+            return -1;
+        idx->ranges = ranges;
+        idx->capacity = capacity;
+    }
+
+    for (page = start & PAGE_MASK; page < end; page += PAGE_SIZE) {
+        p = watch_index_page(idx, page);
+        if (p != NULL)
+            continue;
+
+        p = calloc(1, sizeof(struct watch_page));
+        if (p == NULL || hash_table_insert(&idx->pages, page, p) < 0) {
+            free(p);
+            return -1;
+        }
+        p->page = page;
+        p->prot = prot;
+    }
+
+    for (page = start & PAGE_MASK; page < end; page += PAGE_SIZE)
+        watch_index_page(idx, page)->count[wp->type]++;
+
+    pos = __watch_index_upper(idx, start);
+    memmove(idx->ranges + pos + 1, idx->ranges + pos,
+            (idx->count - pos) * sizeof(*idx->ranges));
+    idx->ranges[pos].start = start;
+    idx->ranges[pos].end = end;
+    idx->ranges[pos].wp = wp;
+    idx->count++;
+
+    if (wp->len > idx->max_len)
+        idx->max_len = wp->len;
+    return 0;
+}
+
+/**
+ * Check whether some of the pages of the range [addr, addr + len) are
+ * not in the index yet.
+ */
+int watch_index_covers_new(struct watch_index *idx, unsigned long addr,
+        size_t len)
+{
+    unsigned long page;
+
+    for (page = addr & PAGE_MASK; page < addr + len; page += PAGE_SIZE) {
+        if (watch_index_page(idx, page) == NULL)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Remove the watchpoint `wp` from the index. Its pages stay.
+ */
+void watch_index_remove(struct watch_index *idx, struct watchpoint *wp)
+{
+    unsigned long start = (unsigned long)wp->addr, page;
+    unsigned int i;
+
+    for (i = 0; i < idx->count; i++) {
+        if (idx->ranges[i].wp == wp)
+            break;
+    }
+    if (i == idx->count)
+        return;
+
+    memmove(idx->ranges + i, idx->ranges + i + 1,
+            (idx->count - i - 1) * sizeof(*idx->ranges));
+    idx->count--;
+
+    for (page = start & PAGE_MASK; page < start + wp->len; page += PAGE_SIZE)
+        watch_index_page(idx, page)->count[wp->type]--;
+}
+
+/**
+ * Find a watchpoint of the index hit by an access of `len` bytes at
+ * `addr`.
+ *
+ * @param types - mask of the WATCH_* types of watchpoints to look for
+ * @return      - the watchpoint, or NULL if the access is outside of
+ *                all the watched ranges of these types
+ */
+struct watchpoint *watch_index_find(struct watch_index *idx,
+        unsigned long addr, size_t len, unsigned int types)
+{
+    struct watch_range *r;
+    unsigned int i;
+
+    /* Ranges that start at addr + len or later are out */
+    i = __watch_index_upper(idx, addr + len - 1);
+    while (i-- > 0) {
+        r = &idx->ranges[i];
+        if (r->start + idx->max_len <= addr)
+            break;
+        if (r->end > addr && (types & (1U << r->wp->type)))
+            return r->wp;
+    }
+    return NULL;
+}
+
+#endif /* WATCH_INDEX_H */
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Index of the debugee's memory writes, built while recording.
+ *
+ * At the end of each interval of a recording, the pages the debugee
+ * wrote to are compared with a copy of them taken at the end of the
+ * previous interval. For every page, the index keeps the list of the
+ * intervals that changed it, together with a mask of the 8 byte words
+ * that changed, so that the last write to an address can be found by
+ * looking at a single list instead of replaying the whole recording.
+ *
+ * Intervals are identified by the tick of the history they end at (see
+ * inc/history.h): the interval is the history record going from
+ * `tick - 1` to `tick`.
+ *
+ * Memory Allocation: the index owns the copies of the pages and the
+ * lists of intervals.
+ */
+
+#ifndef WRITE_INDEX_H
+#define WRITE_INDEX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_table.h"
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE       4096UL
+#define PAGE_MASK       (~(PAGE_SIZE - 1))
+#endif
+
+/* One bit per 8 byte word of a page */
+#define WRITE_INDEX_WORD        sizeof(uint64_t)
+#define WRITE_INDEX_MASK_LEN    (PAGE_SIZE / WRITE_INDEX_WORD / 64)
+
+/*
+ * An interval that changed a page.
+ */
+struct write_entry {
+    unsigned long   tick;
+    uint64_t        mask[WRITE_INDEX_MASK_LEN];
+};
+
+/*
+ * Everything known about the writes to one page. `shadow` is the page
+ * as it was at the end of the last interval, NULL when unknown.
+ */
+struct page_writes {
+    unsigned long       page;
+    uint8_t             *shadow;
+
+    /* Sorted by tick */
+    struct write_entry  *entries;
+    unsigned long       count;
+    unsigned long       capacity;
+};
+
+struct write_index {
+    /* Page address -> struct page_writes */
+    struct hash_table   pages;
+};
+
+/**
+ * Initialize an empty write index.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+int write_index_init(struct write_index *idx)
+{
+    return hash_table_init(&idx->pages, 0);
+}
+
+/**
+ * Free everything held by the index.
+ */
+void write_index_destroy(struct write_index *idx)
+{
+    struct page_writes *pw;
+    struct hash_slot *slot;
+
+    hash_table_for_each(&idx->pages, slot) {
+        pw = slot->value;
+        free(pw->shadow);
+        free(pw->entries);
+        free(pw);
+    }
+    hash_table_destroy(&idx->pages);
+}
+
+/*
+ * Find the page that contains `addr`, creating it if asked to.
+ */
+static struct page_writes *__write_index_page(struct write_index *idx,
+        unsigned long addr, int create)
+{
+    struct page_writes *pw;
+
+    pw = hash_table_lookup(&idx->pages, addr & PAGE_MASK);
+    if (pw != NULL || !create)
+        return pw;
+
+    pw = calloc(1, sizeof(*pw));
+    if (pw == NULL)
+        return NULL;
+
+    pw->page = addr & PAGE_MASK;
+    if (hash_table_insert(&idx->pages, pw->page, pw) < 0) {
+        free(pw);
+        return NULL;
+    }
+    return pw;
+}
+
+/*
+ * Compare `data` with what the page used to be and append an entry for
+ * the words that differ, if any.
+ */
+static int __write_index_append(struct page_writes *pw, const uint8_t *old,
+        const uint8_t *data, unsigned long tick)
+{
+    struct write_entry *e, *tmp;
+    uint64_t mask[WRITE_INDEX_MASK_LEN] = { 0 };
+    const uint64_t *a = (const uint64_t *)old;
+    const uint64_t *b = (const uint64_t *)data;
+    unsigned long i, changed = 0;
+
+    for (i = 0; i < PAGE_SIZE / WRITE_INDEX_WORD; i++) {
+        if (a[i] != b[i]) {
+            mask[i / 64] |= 1ULL << (i % 64);
+            changed = 1;
+        }
+    }
+    if (!changed)
+        return 0;
+
+    if (pw->count == pw->capacity) {
+        tmp = realloc(pw->entries, (pw->capacity ? pw->capacity * 2 : 8) *
+                sizeof(*pw->entries));
+        if (tmp == NULL)
+            return -1;
+        pw->entries = tmp;
+        pw->capacity = pw->capacity ? pw->capacity * 2 : 8;
+    }
+
+    e = &pw->entries[pw->count++];
+    e->tick = tick;
+    memcpy(e->mask, mask, sizeof(mask));
+    return 0;
+}
+
+/**
+ * Account for the content of a page at the end of an interval.
+ *
+ * A page seen for the first time, or since `write_index_truncate()`,
+ * is compared with a page of zeroes, which is what new anonymous
+ * memory looks like.
+ *
+ * @param idx    - pointer to the write index
+ * @param page   - address of the page
+ * @param data   - PAGE_SIZE bytes, the content of the page
+ * @param tick   - tick at the end of the interval
+ * @param record - 0 to only remember the content, e.g at the start of a
+ *                 recording
+ * @return       - 0 on success, -1 on allocation failure
+ */
+int write_index_update(struct write_index *idx, unsigned long page,
+        const uint8_t *data, unsigned long tick, int record)
+{
+    static const uint8_t zero[PAGE_SIZE];
+    struct page_writes *pw;
+
+    pw = __write_index_page(idx, page, 1);
+    if (pw == NULL)
+        return -1;
+
+    if (pw->shadow == NULL) {
+        pw->shadow = malloc(PAGE_SIZE);
+        if (pw->shadow == NULL)
+            return -1;
+        memcpy(pw->shadow, zero, PAGE_SIZE);
+    }
+
+    if (record && __write_index_append(pw, pw->shadow, data, tick) < 0)
+        return -1;
+
+    memcpy(pw->shadow, data, PAGE_SIZE);
+    return 0;
+}
+
+/**
+ * Find the latest interval that ended at or before `tick` and changed
+ * the word containing `addr`.
+ *
+ * @return - the entry, or NULL if there is none
+ */
+struct write_entry *write_index_last(struct write_index *idx, void *addr,
+        unsigned long tick)
+{
+    unsigned long word = ((unsigned long)addr & ~PAGE_MASK) /
+        WRITE_INDEX_WORD;
+    unsigned long lo = 0, hi, mid;
+    struct page_writes *pw;
+
+    pw = __write_index_page(idx, (unsigned long)addr, 0);
+    if (pw == NULL)
+        return NULL;
+
+    /* First entry past `tick` */
+    hi = pw->count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pw->entries[mid].tick <= tick)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    while (lo-- > 0)
+        if (pw->entries[lo].mask[word / 64] & (1ULL << (word % 64)))
+            return &pw->entries[lo];
+    return NULL;
+}
+
+/**
+ * Forget the intervals that ended after `tick`, because the history
+ * was truncated there. The copies of the pages are dropped as well,
+ * they describe the memory of a future that did not happen.
+ */
+void write_index_truncate(struct write_index *idx, unsigned long tick)
+{
+    struct page_writes *pw;
+    struct hash_slot *slot;
+
+    hash_table_for_each(&idx->pages, slot) {
+        pw = slot->value;
+        while (pw->count > 0 && pw->entries[pw->count - 1].tick > tick)
+            pw->count--;
+        free(pw->shadow);
+        pw->shadow = NULL;
+    }
+}
+
+#endif /* WRITE_INDEX_H */
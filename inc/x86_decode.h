@@ -0,0 +1,519 @@
+/*
+ * Copyright (c) 2023 Yuran Pereira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+ * AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A minimal x86-64 instruction decoder.
+ *
+ * This is not a disassembler: it only finds out how long an instruction
+ * is, where its ModRM, displacement and immediate fields are, and whether
+ * it transfers control. That is all the debugger needs in order to move
+ * an instruction somewhere else or to find where execution goes next.
+ * The size of the memory access of the common instructions is worked
+ * out as well, to tell which watched bytes a faulting access touches.
+ *
+ * Only 64-bit mode is supported.
+ */
+
+#ifndef X86_DECODE_H
+#define X86_DECODE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define X86_MAX_INSN_LEN    15
+
+/* What kind of control transfer an instruction does */
+enum x86_insn_kind {
+    X86_INSN_OTHER = 0,     /* falls through to the next instruction */
+    X86_INSN_JMP_REL,       /* jmp rel8/rel32 */
+    X86_INSN_JCC_REL,       /* jcc rel8/rel32 */
+    X86_INSN_LOOP_REL,      /* loop, loope, loopne, jrcxz: rel8 only */
+    X86_INSN_CALL_REL,      /* call rel32 */
+    X86_INSN_CALL_IND,      /* call r/m64 */
+    X86_INSN_JMP_IND,       /* jmp r/m64 */
+    X86_INSN_RET,           /* ret, ret imm16 */
+    X86_INSN_SYSCALL,       /* syscall */
+    X86_INSN_TRAP,          /* int3, int n, ud2, hlt, far transfers... */
+};
+
+/*
+ * A decoded instruction. Offsets are relative to the first byte of
+ * the instruction, a size of 0 means that the field is absent.
+ */
+struct x86_insn {
+    uint8_t             len;
+    uint8_t             opcode_off;
+    uint8_t             modrm_off;
+    uint8_t             has_modrm;
+    uint8_t             disp_off;
+    uint8_t             disp_size;
+    uint8_t             imm_off;
+    uint8_t             imm_size;
+    uint8_t             rex;
+
+    /* The displacement is relative to the next instruction */
+    uint8_t             rip_relative;
+
+    /* Bytes of memory accessed through the ModRM operand, the string
+     * operands or the stack, 0 if none or not known */
+    uint8_t             mem_size;
+    enum x86_insn_kind  kind;
+};
+
+/* Immediate operand types of the one byte opcode map */
+#define I_NONE  0
+#define I_B     1       /* imm8 */
+#define I_W     2       /* imm16 */
+#define I_Z     3       /* imm16 or imm32, depending on 0x66 */
+#define I_V     4       /* imm16, imm32 or imm64 (mov r, imm) */
+#define I_WB    5       /* imm16 + imm8 (enter) */
+#define I_MOFF  6       /* 64 bit address (mov al, moffs) */
+#define I_REL32 7       /* rel32, never shortened by 0x66 */
+#define I_BAD   8       /* invalid in 64-bit mode */
+
+/* Bitmap of the one byte opcodes that take a ModRM byte */
+static const uint32_t __x86_modrm_1byte[8] = {
+    0x0f0f0f0f, 0x0f0f0f0f, 0x00000000, 0x00000a08,
+    0x0000ffff, 0x00000000, 0xff0f00c3, 0xc0c00000,
+};
+
+/* Bitmap of the two byte (0x0f xx) opcodes that take a ModRM byte */
+static const uint32_t __x86_modrm_0f[8] = {
+    0xffffa00f, 0x0000ff0f, 0xffffffff, 0xff7fffff,
+    0xffff0000, 0xfffff838, 0xffff00ff, 0xffffffff,
+};
+
+static const uint8_t __x86_imm_1byte[256] = {
+    /* 0x00 */ 0, 0, 0, 0, I_B, I_Z, I_BAD, I_BAD,
+               0, 0, 0, 0, I_B, I_Z, I_BAD, 0,
+    /* 0x10 */ 0, 0, 0, 0, I_B, I_Z, I_BAD, I_BAD,
+               0, 0, 0, 0, I_B, I_Z, I_BAD, I_BAD,
+    /* 0x20 */ 0, 0, 0, 0, I_B, I_Z, 0, I_BAD,
+               0, 0, 0, 0, I_B, I_Z, 0, I_BAD,
+    /* 0x30 */ 0, 0, 0, 0, I_B, I_Z, 0, I_BAD,
+               0, 0, 0, 0, I_B, I_Z, 0, I_BAD,
+    /* 0x40 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0x50 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0x60 */ I_BAD, I_BAD, 0, 0, 0, 0, 0, 0,
+               I_Z, I_Z, I_B, I_B, 0, 0, 0, 0,
+    /* 0x70 */ I_B, I_B, I_B, I_B, I_B, I_B, I_B, I_B,
+               I_B, I_B, I_B, I_B, I_B, I_B, I_B, I_B,
+    /* 0x80 */ I_B, I_Z, I_BAD, I_B, 0, 0, 0, 0,
+               0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0x90 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, I_BAD, 0, 0, 0, 0, 0,
+    /* 0xa0 */ I_MOFF, I_MOFF, I_MOFF, I_MOFF, 0, 0, 0, 0,
+               I_B, I_Z, 0, 0, 0, 0, 0, 0,
+    /* 0xb0 */ I_B, I_B, I_B, I_B, I_B, I_B, I_B, I_B,
+               I_V, I_V, I_V, I_V, I_V, I_V, I_V, I_V,
+    /* 0xc0 */ I_B, I_B, I_W, 0, 0, 0, I_B, I_Z,
+               I_WB, 0, I_W, 0, 0, I_B, I_BAD, 0,
+    /* 0xd0 */ 0, 0, 0, 0, I_BAD, I_BAD, I_BAD, 0,
+               0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0xe0 */ I_B, I_B, I_B, I_B, I_B, I_B, I_B, I_B,
+               I_REL32, I_REL32, I_BAD, I_B, 0, 0, 0, 0,
+    /* 0xf0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static inline int __x86_bit(const uint32_t *map, uint8_t op)
+{
+    return (map[op >> 5] >> (op & 31)) & 1;
+}
+
+static inline int __x86_is_legacy_prefix(uint8_t b)
+{
+    switch (b) {
+    case 0xf0: case 0xf2: case 0xf3:
+    case 0x2e: case 0x36: case 0x3e: case 0x26: case 0x64: case 0x65:
+    case 0x66: case 0x67:
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Decode the ModRM byte at `code[off]` and the SIB/displacement bytes
+ * that follow it.
+ *
+ * @return - offset of the first byte after the ModRM operand
+ */
+static int __x86_decode_modrm(const uint8_t *code, int off,
+        struct x86_insn *insn)
+{
+    uint8_t modrm = code[off];
+    uint8_t mod = modrm >> 6, rm = modrm & 7;
+
+    insn->has_modrm = 1;
+    insn->modrm_off = off++;
+
+    if (mod == 3)
+        return off;
+
+    if (rm == 4) {
+        /* SIB byte, base 101 with mod 00 means disp32 and no base */
+        if (mod == 0 && (code[off] & 7) == 5)
+            insn->disp_size = 4;
+        off++;
+    }
+    else if (mod == 0 && rm == 5) {
+        insn->disp_size = 4;
+        insn->rip_relative = 1;
+    }
+
+    if (mod == 1)
+        insn->disp_size = 1;
+    else if (mod == 2)
+        insn->disp_size = 4;
+
+    if (insn->disp_size) {
+        insn->disp_off = off;
+        off += insn->disp_size;
+    }
+    return off;
+}
+
+/*
+ * Classify the control transfer done by a one byte opcode
+ */
+static enum x86_insn_kind __x86_kind_1byte(uint8_t op, uint8_t reg)
+{
+    if (op >= 0x70 && op <= 0x7f)
+        return X86_INSN_JCC_REL;
+
+    switch (op) {
+    case 0xe0: case 0xe1: case 0xe2: case 0xe3:
+        return X86_INSN_LOOP_REL;
+    case 0xe8:
+        return X86_INSN_CALL_REL;
+    case 0xe9: case 0xeb:
+        return X86_INSN_JMP_REL;
+    case 0xc2: case 0xc3:
+        return X86_INSN_RET;
+    case 0xca: case 0xcb: case 0xcc: case 0xcd: case 0xcf:
+    case 0xf1: case 0xf4:
+        return X86_INSN_TRAP;
+    case 0xff:
+        if (reg == 2)
+            return X86_INSN_CALL_IND;
+        if (reg == 4)
+            return X86_INSN_JMP_IND;
+        if (reg == 3 || reg == 5)
+            return X86_INSN_TRAP;
+        break;
+    }
+    return X86_INSN_OTHER;
+}
+
+/*
+ * Size of the memory access of a one byte opcode, with operand size
+ * `osize`. String instructions and those that use the stack access
+ * memory without a ModRM operand.
+ */
+static uint8_t __x86_mem_size_1byte(uint8_t op, uint8_t reg, int has_mem,
+        uint8_t osize)
+{
+    if (!has_mem) {
+        switch (op) {
+        case 0xa0: case 0xa2: case 0xa4: case 0xa6:
+        case 0xaa: case 0xac: case 0xae:
+            return 1;
+        case 0xa1: case 0xa3: case 0xa5: case 0xa7:
+        case 0xab: case 0xad: case 0xaf:
+            return osize;
+        case 0x68: case 0x6a: case 0x9c: case 0x9d:
+        case 0xc2: case 0xc3: case 0xe8:
+            return 8;
+        }
+        return op >= 0x50 && op <= 0x5f ? 8 : 0;
+    }
+
+    /* add, or, adc, sbb, and, sub, xor and cmp with byte operands */
+    if (op < 0x40 && (op & 7) < 4 && !(op & 1))
+        return 1;
+
+    switch (op) {
+    case 0x80: case 0x84: case 0x86: case 0x88: case 0x8a:
+    case 0xc0: case 0xc6: case 0xd0: case 0xd2: case 0xf6: case 0xfe:
+        return 1;
+    case 0x63:
+        return 4;
+    case 0x8c: case 0x8e:
+        return 2;
+    case 0x8f:
+        return 8;
+    case 0x8d:
+        /* lea only computes the address */
+        return 0;
+    case 0xff:
+        if (reg == 2 || reg == 4 || reg == 6)
+            return 8;
+        return reg < 2 ? osize : 0;
+    }
+
+    /* x87 */
+    if (op >= 0xd8 && op <= 0xdf)
+        return 0;
+    return osize;
+}
+
+/*
+ * Size of the memory operand of a two byte opcode (0x0f xx), with
+ * operand size `osize` and mandatory prefix `simd` (0, 0x66, 0xf3 or
+ * 0xf2). `wide` is REX.W or VEX.W, `vex_l` the vector length of VEX.
+ */
+static const uint8_t __x86_vex_simd[4] = { 0, 0x66, 0xf3, 0xf2 };
+
+static uint8_t __x86_mem_size_0f(uint8_t op, uint8_t reg, uint8_t osize,
+        uint8_t simd, int wide, int vex, int vex_l)
+{
+    uint8_t vsize = vex_l ? 32 : 16;
+
+    if (!vex) {
+        if ((op >= 0x40 && op <= 0x4f) || op == 0xa3 || op == 0xab ||
+                op == 0xaf || op == 0xb1 || op == 0xb3 || op == 0xb8 ||
+                op == 0xba || op == 0xbb || op == 0xbc || op == 0xbd ||
+                op == 0xc1 || op == 0xc3)
+            return osize;
+        if ((op >= 0x90 && op <= 0x9f) || op == 0xb0 || op == 0xb6 ||
+                op == 0xbe || op == 0xc0)
+            return 1;
+        if (op == 0xb7 || op == 0xbf)
+            return 2;
+        if (op == 0xc7 && reg == 1)
+            return wide ? 16 : 8;
+    }
+
+    switch (op) {
+    case 0x10: case 0x11:
+    case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56:
+    case 0x57: case 0x58: case 0x59: case 0x5c: case 0x5d: case 0x5e:
+    case 0x5f:
+        if (simd == 0xf3)
+            return 4;
+        if (simd == 0xf2)
+            return 8;
+        return vsize;
+    case 0x12: case 0x13: case 0x16: case 0x17: case 0xd6:
+        return 8;
+    case 0x28: case 0x29: case 0x2b:
+        return vsize;
+    case 0x6f: case 0x7f: case 0xe7:
+        /* The MMX forms have no prefix */
+        return simd == 0 && !vex ? 8 : vsize;
+    case 0x2a:
+        return simd == 0 ? 8 : wide ? 8 : 4;
+    case 0x2c: case 0x2d:
+        return simd == 0xf3 ? 4 : 8;
+    case 0x2e: case 0x2f:
+        return simd == 0x66 ? 8 : 4;
+    case 0x6e:
+        return wide ? 8 : 4;
+    case 0x7e:
+        return simd == 0xf3 ? 8 : wide ? 8 : 4;
+    }
+    return 0;
+}
+
+/**
+ * Decode the instruction at `code`.
+ *
+ * @param code  - instruction bytes
+ * @param avail - number of bytes available at `code`
+ * @param insn  - where to store the decoded instruction
+ * @return      - the length of the instruction, or -1 if it is invalid
+ *                or longer than `avail`
+ */
+int x86_decode(const uint8_t *code, size_t avail, struct x86_insn *insn)
+{
+    uint8_t buf[X86_MAX_INSN_LEN + 8];
+    int off = 0, opsize16 = 0, addr32 = 0, imm = I_NONE, vex = -1, evex = 0;
+    uint8_t op, map = 1, simd = 0, wide, osize, reg = 0;
+
+    /* Work on a padded copy so that decoding never reads past `avail` */
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, code, avail < X86_MAX_INSN_LEN ? avail : X86_MAX_INSN_LEN);
+    code = buf;
+
+    memset(insn, 0, sizeof(*insn));
+
+    while (off < X86_MAX_INSN_LEN && __x86_is_legacy_prefix(code[off])) {
+        if (code[off] == 0x66)
+            opsize16 = 1;
+        else if (code[off] == 0x67)
+            addr32 = 1;
+        else if (code[off] == 0xf2 || code[off] == 0xf3)
+            simd = code[off];
+        off++;
+    }
+
+    if ((code[off] & 0xf0) == 0x40)
+        insn->rex = code[off++];
+
+    op = code[off];
+    wide = (insn->rex & 0x08) != 0;
+    if (simd == 0 && opsize16)
+        simd = 0x66;
+
+    if (op == 0xc4 || op == 0xc5 || op == 0x62) {
+        /* VEX and EVEX: the map is encoded in the prefix itself */
+        if (op == 0xc5) {
+            map = 1;
+            vex = code[off + 1];
+            off += 2;
+        }
+        else if (op == 0xc4) {
+            map = code[off + 1] & 0x1f;
+            vex = code[off + 2];
+            wide = (vex & 0x80) != 0;
+            off += 3;
+        }
+        else {
+            map = code[off + 1] & 0x07;
+            evex = 1;
+            off += 4;
+        }
+
+        insn->opcode_off = off;
+        op = code[off++];
+
+        /* vzeroupper and vzeroall are the only ones without ModRM */
+        if (!(map == 1 && op == 0x77))
+            off = __x86_decode_modrm(code, off, insn);
+
+        if (map == 3 || (map == 1 && ((op >= 0x70 && op <= 0x73) ||
+                        op == 0xc2 || (op >= 0xc4 && op <= 0xc6))))
+            imm = I_B;
+    }
+    else if (op == 0x0f) {
+        op = code[++off];
+        if (op == 0x38 || op == 0x3a) {
+            map = op == 0x38 ? 2 : 3;
+            insn->opcode_off = ++off;
+            off = __x86_decode_modrm(code, off + 1, insn);
+            if (op == 0x3a)
+                imm = I_B;
+        }
+        else {
+            insn->opcode_off = off++;
+            if (__x86_bit(__x86_modrm_0f, op))
+                off = __x86_decode_modrm(code, off, insn);
+
+            if (op >= 0x80 && op <= 0x8f) {
+                imm = I_REL32;
+                insn->kind = X86_INSN_JCC_REL;
+            }
+            else if ((op >= 0x70 && op <= 0x73) || op == 0xa4 ||
+                    op == 0xac || op == 0xba || op == 0xc2 ||
+                    (op >= 0xc4 && op <= 0xc6) || op == 0x0f) {
+                /* 0x0f 0x0f is 3DNow!, whose opcode is a trailing imm8 */
+                imm = I_B;
+            }
+            else if (op == 0x05) {
+                insn->kind = X86_INSN_SYSCALL;
+            }
+            else if (op == 0x0b || op == 0xb9 || op == 0xff ||
+                    op == 0x07 || op == 0x34 || op == 0x35) {
+                insn->kind = X86_INSN_TRAP;
+            }
+        }
+    }
+    else {
+        map = 0;
+        insn->opcode_off = off++;
+        imm = __x86_imm_1byte[op];
+        if (imm == I_BAD)
+            return -1;
+
+        if (__x86_bit(__x86_modrm_1byte, op)) {
+            off = __x86_decode_modrm(code, off, insn);
+
+            /* test r/m, imm is hidden in group 3 */
+            if ((op == 0xf6 || op == 0xf7) &&
+                    ((code[insn->modrm_off] >> 3) & 7) < 2)
+                imm = op == 0xf6 ? I_B : I_Z;
+        }
+
+        insn->kind = __x86_kind_1byte(op, insn->has_modrm ?
+                (code[insn->modrm_off] >> 3) & 7 : 0);
+    }
+
+    /* The mandatory prefix of a VEX instruction is in the VEX prefix */
+    if (vex >= 0)
+        simd = __x86_vex_simd[vex & 3];
+    osize = wide ? 8 : opsize16 ? 2 : 4;
+    if (insn->has_modrm)
+        reg = (code[insn->modrm_off] >> 3) & 7;
+    if ((insn->has_modrm && code[insn->modrm_off] >> 6 == 3) || evex)
+        insn->mem_size = 0;
+    else if (map == 0)
+        insn->mem_size = __x86_mem_size_1byte(op, reg, insn->has_modrm,
+                osize);
+    else if (map == 1 && insn->has_modrm)
+        insn->mem_size = __x86_mem_size_0f(op, reg, osize, simd, wide,
+                vex >= 0, vex >= 0 && (vex & 0x04) != 0);
+
+    insn->imm_off = off;
+    switch (imm) {
+    case I_B:       insn->imm_size = 1; break;
+    case I_W:       insn->imm_size = 2; break;
+    case I_WB:      insn->imm_size = 3; break;
+    case I_REL32:   insn->imm_size = 4; break;
+    case I_Z:       insn->imm_size = opsize16 ? 2 : 4; break;
+    case I_MOFF:    insn->imm_size = addr32 ? 4 : 8; break;
+    case I_V:
+        if (insn->rex & 0x08)
+            insn->imm_size = 8;
+        else
+            insn->imm_size = opsize16 ? 2 : 4;
+        break;
+    }
+    off += insn->imm_size;
+
+    if (off > X86_MAX_INSN_LEN || (size_t)off > avail)
+        return -1;
+
+    insn->len = off;
+    return off;
+}
+
+/**
+ * Get the target of a relative branch (jmp, jcc, loop, call rel).
+ *
+ * @param code - instruction bytes
+ * @param insn - decoded instruction
+ * @param addr - address of the instruction
+ */
+unsigned long x86_branch_target(const uint8_t *code, struct x86_insn *insn,
+        unsigned long addr)
+{
+    long rel;
+
+    if (insn->imm_size == 1)
+        rel = (int8_t)code[insn->imm_off];
+    else
+        rel = (int32_t)(code[insn->imm_off] |
+                code[insn->imm_off + 1] << 8 |
+                code[insn->imm_off + 2] << 16 |
+                (uint32_t)code[insn->imm_off + 3] << 24);
+
+    return addr + insn->len + rel;
+}
+
+#endif /* X86_DECODE_H */
@@ -0,0 +1,167 @@
+/*
+ * Benchmark of the breakpoint batches of inc/breakpoint_batch.h.
+ *
+ * A traced child maps a region of code and stops. A breakpoint is put
+ * every few bytes of it, then taken out, first one by one the way
+ * `breakpoint_enable()` and `breakpoint_disable()` do, with a read and
+ * a write each, then in a batch, with a read and a write per page. The
+ * code of the child is checked after each pass.
+ *
+ * Usage: ./bench_batch [breakpoints]
+ */
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "../inc/debugger.h"
+#include "../inc/breakpoint_batch.h"
+#include "../inc/memory.h"
+
+/* Bytes between two breakpoints */
+#define BENCH_STRIDE    8
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void child(int fd, size_t len)
+{
+    uint8_t *code;
+
+    code = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        exit(1);
+    memset(code, 0x90, len);
+    mprotect(code, len, PROT_READ | PROT_EXEC);
+
+    write(fd, &code, sizeof(code));
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+    exit(0);
+}
+
+/*
+ * Check that the code of the child has an INT3 at each of the `n`
+ * breakpoints if `armed`, and is all NOPs otherwise.
+ */
+static void check(struct debugger *dbg, uint8_t *code, size_t len,
+        unsigned long n, int armed, const char *what)
+{
+    uint8_t *copy = malloc(len), want;
+    size_t i;
+
+    if (copy == NULL || __read_memory(dbg->dbge_pid, -1, code, copy,
+                len) != (ssize_t)len) {
+        printf("error: code not read after %s\n", what);
+        free(copy);
+        return;
+    }
+    for (i = 0; i < len; i++) {
+        want = armed && i % BENCH_STRIDE == 0 && i / BENCH_STRIDE < n ?
+            0xcc : 0x90;
+        if (copy[i] != want) {
+            printf("error: %#x at +%#zx after %s\n", copy[i], i, what);
+            break;
+        }
+    }
+    free(copy);
+}
+
+static void report(const char *what, unsigned long n, double t)
+{
+    printf("%-20s %8lu breakpoints in %7.3f s  %8.1f ns/breakpoint\n", what,
+            n, t, t * 1e9 / n);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    size_t len = n * BENCH_STRIDE;
+    struct breakpoint_batch batch;
+    struct breakpoint *bps;
+    uint8_t *code, data, int3 = 0xcc;
+    struct debugger *dbg;
+    int fds[2], status;
+    unsigned long i;
+    pid_t pid;
+    double t0;
+
+    len = (len + PAGE_SIZE - 1) & PAGE_MASK;
+    if (pipe(fds) < 0)
+        return 1;
+
+    pid = fork();
+    if (pid == 0)
+        child(fds[1], len);
+
+    if (read(fds[0], &code, sizeof(code)) != sizeof(code))
+        return 1;
+    waitpid(pid, &status, 0);
+    dbg = debugger_alloc();
+    debugger_init(dbg, "bench", pid);
+
+    bps = calloc(n, sizeof(*bps));
+    if (bps == NULL)
+        return 1;
+    for (i = 0; i < n; i++) {
+        bps[i].pid = pid;
+        bps[i].addr = code + i * BENCH_STRIDE;
+    }
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        read_memory(dbg, bps[i].addr, &data, 1);
+        patch_code(dbg, bps[i].addr, &int3, 1);
+        breakpoint_save_data(&bps[i], data);
+        __set_breakpoint_enabled(&bps[i]);
+    }
+    report("enable, one by one", n, now_sec() - t0);
+    check(dbg, code, len, n, 1, "enable");
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        data = breakpoint_get_saved_data(&bps[i]);
+        patch_code(dbg, bps[i].addr, &data, 1);
+        __unset_breakpoint_enabled(&bps[i]);
+    }
+    report("disable, one by one", n, now_sec() - t0);
+    check(dbg, code, len, n, 0, "disable");
+
+    breakpoint_batch_init(&batch);
+    t0 = now_sec();
+    for (i = 0; i < n; i++)
+        breakpoint_batch_add(&batch, &bps[i], BATCH_ENABLE);
+    if (breakpoint_batch_commit(dbg, &batch) != 0)
+        printf("error: batch not enabled\n");
+    report("enable, batch", n, now_sec() - t0);
+    check(dbg, code, len, n, 1, "batch enable");
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++)
+        breakpoint_batch_add(&batch, &bps[i], BATCH_DISABLE);
+    if (breakpoint_batch_commit(dbg, &batch) != 0)
+        printf("error: batch not disabled\n");
+    report("disable, batch", n, now_sec() - t0);
+    check(dbg, code, len, n, 0, "batch disable");
+
+    breakpoint_batch_destroy(&batch);
+    free(bps);
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    debugger_free(dbg);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Microbenchmark of the breakpoint lookup done on every SIGTRAP.
+ *
+ * Compares the address indexed hash table of `struct debugger` with
+ * a linear walk of the breakpoint arrays, for 1k to 100k breakpoints.
+ * No debugee is involved, breakpoints are only stored, not written.
+ *
+ * Keys are spaced like instructions, like function entries aligned on
+ * 16 bytes, and like pages, which the tables keyed by page use: the
+ * hash must spread keys that share their low bits as well.
+ *
+ * Usage: ./bench_bptable [lookups]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list.h"
+#include "../inc/debugger.h"
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* What the SIGTRAP handler had to do before the hash table */
+static struct breakpoint *linear_lookup(struct debugger *dbg, void *addr)
+{
+    struct breakpoint *bp;
+    unsigned int pos;
+    int i;
+
+    for (pos = 0; pos < dbg->bpa_count; pos++) {
+        for (i = 0; i < MAX_BREAKPOINTS_PER_LIST; i++) {
+            bp = dbg->bpa[pos]->array[i];
+            if (bp != NULL && bp->addr == addr)
+                return bp;
+        }
+    }
+    return NULL;
+}
+
+static void bench(unsigned int nbp, unsigned long lookups,
+        unsigned long stride)
+{
+    struct debugger dbg;
+    struct breakpoint *bps, *bp;
+    unsigned long i, found = 0;
+    double t0, hash_ns, linear_ns, insert_ns, delete_ns;
+    unsigned long linear_lookups = lookups / (nbp / 1000 + 1);
+
+    bps = calloc(nbp, sizeof(struct breakpoint));
+    debugger_init(&dbg, "bench", 0);
+
+    t0 = now_ns();
+    for (i = 0; i < nbp; i++) {
+        bps[i].addr = (void *)(0x401000UL + i * stride);
+        __debugger_breakpoint_insert(&dbg, &bps[i]);
+    }
+    insert_ns = (now_ns() - t0) / nbp;
+
+    srand(1);
+    t0 = now_ns();
+    for (i = 0; i < lookups; i++) {
+        bp = debugger_breakpoint_at(&dbg, bps[rand() % nbp].addr);
+        found += (bp != NULL);
+    }
+    hash_ns = (now_ns() - t0) / lookups;
+
+    srand(1);
+    t0 = now_ns();
+    for (i = 0; i < linear_lookups; i++) {
+        bp = linear_lookup(&dbg, bps[rand() % nbp].addr);
+        found += (bp != NULL);
+    }
+    linear_ns = (now_ns() - t0) / linear_lookups;
+
+    t0 = now_ns();
+    for (i = 1; i <= nbp; i++)
+        __debugger_breakpoint_delete(&dbg, i);
+    delete_ns = (now_ns() - t0) / nbp;
+
+    printf("%7u bps, stride %4lu: insert %6.1f ns  hash lookup %6.1f ns  "
+            "linear lookup %10.1f ns  delete %6.1f ns  (%lu found)\n",
+            nbp, stride, insert_ns, hash_ns, linear_ns, delete_ns, found);
+
+    if (hash_table_count(&dbg.bp_table) != 0)
+        printf("error: %lu breakpoints left after deletion\n",
+                hash_table_count(&dbg.bp_table));
+
+    hash_table_destroy(&dbg.bp_table);
+    for (i = 0; i < dbg.bpa_count; i++)
+        debugger_bpa_free(dbg.bpa[i]);
+    free(dbg.bpa);
+    free(bps);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long lookups = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    static const unsigned long strides[] = { 13, 16, 4096 };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(strides) / sizeof(strides[0]); i++) {
+        bench(1000, lookups, strides[i]);
+        bench(10000, lookups, strides[i]);
+        bench(100000, lookups, strides[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Benchmark of conditional breakpoints whose condition does not hold.
+ *
+ * A traced child calls a function in a loop, with a breakpoint on it.
+ * Every hit is handled the way `continue_execution()` does: the
+ * registers are fetched once, the compiled condition is evaluated from
+ * them, and the child is resumed through the displaced copy of the
+ * instruction. The evaluation alone is timed as well, with conditions
+ * on registers only, on memory at a constant address (read before the
+ * bytecode runs) and on memory at a computed address.
+ *
+ * Usage: ./bench_cond [hits]
+ */
+#define _GNU_SOURCE
+
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "../inc/debugger.h"
+#include "../inc/memory.h"
+#include "../inc/registers.h"
+#include "../inc/displaced.h"
+#include "../inc/condition.h"
+
+#define EVALS   1000000
+
+volatile long sink;
+
+__attribute__((noinline)) void target(long i)
+{
+    sink += i;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Hit the breakpoint forever, until we are killed.
+ */
+static void child(void)
+{
+    long i;
+
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+    for (i = 0; ; i++)
+        target(i);
+}
+
+/*
+ * Resume the child stopped at `bp` and wait for the next hit.
+ */
+static int next_hit(struct debugger *dbg, struct breakpoint *bp)
+{
+    struct user_regs_struct regs;
+    int status;
+
+    if (bp != NULL && displaced_resume(dbg, bp) < 0)
+        return -1;
+    debugger_flush_regs(dbg);
+    debugger_invalidate_regs(dbg);
+
+    if (ptrace(PTRACE_CONT, dbg->dbge_pid, NULL, NULL) < 0 ||
+            waitpid(dbg->dbge_pid, &status, 0) < 0 ||
+            !WIFSTOPPED(status) || WSTOPSIG(status) != SIGTRAP ||
+            debugger_get_regs(dbg, &regs) < 0)
+        return -1;
+
+    /* Back on the breakpoint, like handle_sigtrap() */
+    regs.rip--;
+    debugger_set_regs(dbg, &regs);
+    return 0;
+}
+
+static struct condition *compile(const char *text)
+{
+    struct condition *c;
+    char err[128];
+
+    c = condition_compile(text, err, sizeof(err));
+    if (c == NULL) {
+        printf("%s: %s\n", text, err);
+        exit(1);
+    }
+    return c;
+}
+
+static void bench(struct debugger *dbg, struct breakpoint *bp,
+        const char *text, unsigned long hits)
+{
+    struct condition *c = compile(text);
+    struct user_regs_struct regs;
+    unsigned long i;
+    int64_t value;
+    double t0, eval, run;
+
+    /* The evaluation alone, on the registers of the last hit */
+    debugger_get_regs(dbg, &regs);
+    t0 = now_sec();
+    for (i = 0; i < EVALS; i++)
+        if (condition_eval(c, &regs, read_memory_v, dbg, &value) < 0 || value)
+            break;
+    eval = (now_sec() - t0) / i * 1e9;
+
+    t0 = now_sec();
+    for (i = 0; i < hits; i++) {
+        if (next_hit(dbg, bp) < 0 || debugger_get_regs(dbg, &regs) < 0 ||
+                condition_eval(c, &regs, read_memory_v, dbg, &value) < 0 ||
+                value) {
+            printf("%s: stopped after %lu hits\n", text, i);
+            break;
+        }
+    }
+    run = now_sec() - t0;
+
+    printf("%-40s %4zu bytes %8.1f ns/eval %10.0f hits/s\n", text, c->len,
+            eval, i / run);
+    condition_free(c);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long hits = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    uint8_t int3 = 0xcc, data;
+    struct breakpoint *bp;
+    struct debugger dbg;
+    char text[128];
+    int status;
+    pid_t pid;
+
+    pid = fork();
+    if (pid == 0)
+        child();
+
+    waitpid(pid, &status, 0);
+    debugger_init(&dbg, "bench", pid);
+
+    bp = calloc(1, sizeof(*bp));
+    bp->pid = pid;
+    bp->addr = (void *)target;
+    if (read_memory(&dbg, bp->addr, &data, 1) != 1 ||
+            write_memory(&dbg, bp->addr, &int3, 1) != 1 ||
+            __debugger_breakpoint_insert(&dbg, bp) == ENOBP) {
+        printf("Couldn't set the breakpoint\n");
+        return 1;
+    }
+    breakpoint_save_data(bp, data);
+    __set_breakpoint_enabled(bp);
+
+    if (next_hit(&dbg, NULL) < 0) {
+        printf("The child did not hit the breakpoint\n");
+        return 1;
+    }
+
+    bench(&dbg, bp, "$rdi == -1", hits);
+    bench(&dbg, bp, "$rdi < 0 || ($rdi & 0xff) == 0x1ff", hits);
+    snprintf(text, sizeof(text), "*(long *)%p == -1", (void *)&sink);
+    bench(&dbg, bp, text, hits);
+    bench(&dbg, bp, "*(long *)$rsp == 0", hits);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * Benchmark of the one-shot coverage of inc/coverage.h.
+ *
+ * A traced child runs a loop of branches a number of times, three
+ * times over: on its own, with an INT3 at every block of the program
+ * that is stepped over and written back at each hit, the way a plain
+ * breakpoint counts hits, and with the INT3s of the coverage, which are
+ * taken out the first time their block runs. The INT3s are written a
+ * page at a time, and the blocks run are the same in both cases.
+ *
+ * Usage: ./bench_coverage [rounds]
+ */
+#define _GNU_SOURCE
+
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "../inc/debugger.h"
+#include "../inc/memory.h"
+#include "../inc/registers.h"
+
+enum bench_mode {
+    BENCH_NATIVE,
+    BENCH_PERSISTENT,
+    BENCH_ONE_SHOT,
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile unsigned long sink;
+
+__attribute__((noinline)) static unsigned long branches(unsigned long i)
+{
+    unsigned long r = i;
+
+    if (i & 1)
+        r *= 3;
+    else
+        r /= 2;
+    if (i % 3 == 0)
+        r += 7;
+    switch (i & 3) {
+    case 0:
+        return r + 1;
+    case 1:
+        return r ^ 5;
+    default:
+        return r - 2;
+    }
+}
+
+static void child(unsigned long rounds)
+{
+    unsigned long i;
+
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+
+    for (i = 0; i < rounds; i++)
+        sink += branches(i);
+    _exit(0);
+}
+
+/*
+ * Write an INT3 at every block of `cov`, one write per page.
+ *
+ * @param saved - where to save the code of the blocks
+ */
+static void arm(struct debugger *dbg, struct coverage *cov, uint8_t *saved)
+{
+    unsigned long i, j, k, lo;
+    uint8_t code[PAGE_SIZE];
+    size_t len;
+
+    for (i = 0; i < cov->count; i = j) {
+        lo = cov->blocks[i] + cov->bias;
+        for (j = i + 1; j < cov->count &&
+                ((cov->blocks[j] + cov->bias) & PAGE_MASK) ==
+                (lo & PAGE_MASK); j++)
+            ;
+        len = cov->blocks[j - 1] + cov->bias - lo + 1;
+        read_memory(dbg, (void *)lo, code, len);
+        for (k = i; k < j; k++) {
+            saved[k] = code[cov->blocks[k] + cov->bias - lo];
+            code[cov->blocks[k] + cov->bias - lo] = 0xcc;
+        }
+        patch_code(dbg, (void *)lo, code, len);
+    }
+}
+
+/*
+ * Run the child to its end, handling the INT3s of the blocks according
+ * to `mode`.
+ *
+ * @return - the number of traps
+ */
+static unsigned long run(struct coverage *cov, unsigned long rounds,
+        enum bench_mode mode)
+{
+    struct user_regs_struct regs;
+    unsigned long traps = 0;
+    struct debugger *dbg;
+    uint8_t *saved, int3 = 0xcc;
+    int status;
+    long idx;
+    pid_t pid;
+
+    pid = fork();
+    if (pid == 0)
+        child(rounds);
+    waitpid(pid, &status, 0);
+    dbg = debugger_alloc();
+    debugger_init(dbg, "bench", pid);
+
+    saved = malloc(cov->count);
+    if (mode != BENCH_NATIVE)
+        arm(dbg, cov, saved);
+
+    for (;;) {
+        debugger_flush_regs(dbg);
+        debugger_invalidate_regs(dbg);
+        ptrace(PTRACE_CONT, pid, NULL, NULL);
+        waitpid(pid, &status, 0);
+        if (!WIFSTOPPED(status) || WSTOPSIG(status) != SIGTRAP)
+            break;
+
+        traps++;
+        debugger_get_regs(dbg, &regs);
+        regs.rip--;
+        idx = coverage_block(cov, regs.rip);
+        if (idx < 0) {
+            printf("error: trap out of a block at %#llx\n", regs.rip);
+            break;
+        }
+        coverage_mark(cov, regs.rip);
+        debugger_set_regs(dbg, &regs);
+        patch_code(dbg, (void *)regs.rip, &saved[idx], 1);
+        if (mode == BENCH_PERSISTENT) {
+            debugger_flush_regs(dbg);
+            debugger_invalidate_regs(dbg);
+            ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL);
+            waitpid(pid, &status, 0);
+            patch_code(dbg, (void *)regs.rip, &int3, 1);
+        }
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        printf("error: child did not exit cleanly (%#x)\n", status);
+    free(saved);
+    debugger_free(dbg);
+    return traps;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000;
+    static const char *names[] = { "native", "INT3 kept", "one-shot" };
+    unsigned long addr, size, nsyms, traps, hit[3] = { 0 };
+    const struct symbol *syms;
+    struct symbol_index *idx;
+    struct coverage *cov;
+    const uint8_t *text;
+    double t0;
+    int mode;
+
+    idx = symbol_index_open("/proc/self/exe");
+    text = idx != NULL ? symbol_text(idx, &addr, &size) : NULL;
+    syms = idx != NULL ? symbol_all(idx, &nsyms) : NULL;
+    if (text == NULL || syms == NULL ||
+            symbol_index_relocate(idx, getpid()) < 0) {
+        printf("Couldn't read the code and symbols of the benchmark\n");
+        return 1;
+    }
+
+    for (mode = BENCH_NATIVE; mode <= BENCH_ONE_SHOT; mode++) {
+        cov = coverage_alloc(text, addr, size, syms, nsyms, idx->bias,
+                "/dev/null");
+        if (cov == NULL)
+            return 1;
+
+        t0 = now_sec();
+        traps = run(cov, rounds, mode);
+        t0 = now_sec() - t0;
+        hit[mode] = cov->hit;
+        printf("%-10s %8lu rounds in %7.3f s  %8lu traps, %lu of %lu "
+                "blocks\n", names[mode], rounds, t0, traps, cov->hit,
+                cov->count);
+        coverage_free(cov);
+    }
+
+    if (hit[BENCH_PERSISTENT] != hit[BENCH_ONE_SHOT])
+        printf("error: %lu blocks run with INT3s kept, %lu one-shot\n",
+                hit[BENCH_PERSISTENT], hit[BENCH_ONE_SHOT]);
+
+    symbol_index_close(idx);
+    return 0;
+}
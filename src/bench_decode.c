@@ -0,0 +1,181 @@
+/*
+ * Benchmark of the decoding of the debugee's instructions.
+ *
+ * A traced child maps a region of code, made of the same few
+ * instructions over and over, and stops. The region is decoded from
+ * start to end with read_code() and x86_decode(), one read per
+ * instruction, then with read_insn(), first filling the code cache and
+ * then from it. An INT3 is written over every 16th instruction, which
+ * read_insn() must not see.
+ *
+ * The child is then resumed, changes the first instruction of every
+ * page after mprotect(), and stops again: the pages have to be compared
+ * with the debugee before use, and the changed instructions seen.
+ *
+ * Usage: ./bench_decode [pages]
+ */
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "../inc/debugger.h"
+#include "../inc/memory.h"
+#include "../inc/registers.h"
+
+/* mov %rsp,%rbp; sub $0x10,%rsp; nop; call .+5; xor %eax,%eax; ret,
+ * 16 bytes */
+static const uint8_t pattern[] = {
+    0x48, 0x89, 0xe5, 0x48, 0x83, 0xec, 0x10, 0x90,
+    0xe8, 0x00, 0x00, 0x00, 0x00, 0x31, 0xc0, 0xc3,
+};
+static const uint8_t lens[] = { 3, 4, 1, 5, 2, 1 };
+
+/* movabs $0, %rax, which the child writes at the start of every page */
+static const uint8_t changed[] = { 0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void child(int fd, size_t npages)
+{
+    size_t len = npages * PAGE_SIZE, i;
+    uint8_t *code;
+
+    code = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        exit(1);
+    for (i = 0; i < len; i += sizeof(pattern))
+        memcpy(code + i, pattern, sizeof(pattern));
+    mprotect(code, len, PROT_READ | PROT_EXEC);
+
+    write(fd, &code, sizeof(code));
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+
+    mprotect(code, len, PROT_READ | PROT_WRITE);
+    for (i = 0; i < len; i += PAGE_SIZE)
+        memcpy(code + i, changed, sizeof(changed));
+    mprotect(code, len, PROT_READ | PROT_EXEC);
+    raise(SIGSTOP);
+    exit(0);
+}
+
+/*
+ * Decode the whole region with `how`, and check the instruction
+ * lengths against the pattern.
+ *
+ * @return - the number of instructions decoded
+ */
+static unsigned long sweep(struct debugger *dbg, uint8_t *code, size_t len,
+        int cached, const char *what)
+{
+    uint8_t bytes[X86_MAX_INSN_LEN];
+    unsigned long n = 0, at;
+    struct x86_insn insn;
+    double t0;
+    ssize_t avail;
+    int ok;
+
+    t0 = now_sec();
+    for (at = 0; at < len; at += insn.len, n++) {
+        if (cached) {
+            ok = read_insn(dbg, code + at, bytes, &insn) == 0;
+        }
+        else {
+            avail = read_code(dbg, code + at, bytes, sizeof(bytes));
+            ok = avail > 0 && x86_decode(bytes, avail, &insn) >= 0;
+        }
+        if (!ok || insn.len != lens[n % sizeof(lens)] ||
+                memcmp(bytes, pattern + at % sizeof(pattern), insn.len)) {
+            printf("error: wrong instruction at +%#lx\n", at);
+            return n;
+        }
+    }
+    t0 = now_sec() - t0;
+    printf("%-22s %8lu insns in %7.3f s  %8.1f ns/insn\n", what, n, t0,
+            t0 * 1e9 / n);
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    size_t npages = argc > 1 ? strtoul(argv[1], NULL, 10) : 32;
+    size_t len = npages * PAGE_SIZE, i;
+    uint8_t bytes[X86_MAX_INSN_LEN], int3 = 0xcc;
+    struct x86_insn insn;
+    struct breakpoint *bp;
+    struct debugger dbg;
+    uint8_t *code;
+    int fds[2], status;
+    pid_t pid;
+
+    if (npages > DECODE_CACHE_PAGES)
+        npages = DECODE_CACHE_PAGES;
+    len = npages * PAGE_SIZE;
+    if (pipe(fds) < 0)
+        return 1;
+
+    pid = fork();
+    if (pid == 0)
+        child(fds[1], npages);
+
+    if (read(fds[0], &code, sizeof(code)) != sizeof(code))
+        return 1;
+    waitpid(pid, &status, 0);
+    debugger_init(&dbg, "bench", pid);
+
+    /* An INT3 over the `call` of every 16th instruction */
+    for (i = 8; i < len; i += 16 * sizeof(pattern) / sizeof(lens)) {
+        bp = calloc(1, sizeof(*bp));
+        bp->addr = code + i - i % sizeof(pattern) + 8;
+        if (debugger_breakpoint_at(&dbg, bp->addr) != NULL) {
+            free(bp);
+            continue;
+        }
+        read_memory(&dbg, bp->addr, &bp->saved_data, 1);
+        bp->enabled = 1;
+        hash_table_insert(&dbg.bp_table, (unsigned long)bp->addr, bp);
+        patch_code(&dbg, bp->addr, &int3, 1);
+    }
+
+    sweep(&dbg, code, len, 0, "read_code+x86_decode");
+    sweep(&dbg, code, len, 1, "read_insn, cold");
+    sweep(&dbg, code, len, 1, "read_insn, cached");
+
+    /* Resumed, the pages are compared once each */
+    debugger_invalidate_regs(&dbg);
+    sweep(&dbg, code, len, 1, "read_insn, after resume");
+
+    debugger_invalidate_regs(&dbg);
+    ptrace(PTRACE_CONT, pid, NULL, NULL);
+    waitpid(pid, &status, 0);
+
+    for (i = 0; i < len; i += PAGE_SIZE) {
+        if (read_insn(&dbg, code + i, bytes, &insn) < 0 ||
+                insn.len != sizeof(changed)) {
+            printf("error: change at +%#zx not seen\n", i);
+            break;
+        }
+    }
+    if (i == len)
+        printf("changes seen on all %zu pages\n", npages);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return 0;
+}
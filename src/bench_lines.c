@@ -0,0 +1,79 @@
+/*
+ * Benchmark of the line index of inc/lines.h.
+ *
+ * Opens an ELF program with DWARF line tables and times the first
+ * lookup of a source line, which reads the headers of all units and
+ * runs the programs of those of the file, then the first lookup of an
+ * address, which reads the ranges of the units and runs the program of
+ * the unit of the address only, and a million lookups of random
+ * addresses of the program.
+ *
+ * Usage: ./bench_lines [program [file:line]]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../inc/symbols.h"
+
+#define LOOKUPS     1000000
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "/proc/self/exe";
+    const char *location = argc > 2 ? argv[2] : "bench_lines.c:30";
+    unsigned long addr, found = 0, i, rows = 0;
+    const struct line_file *file;
+    struct symbol_index *idx;
+    unsigned int line, at;
+    char name[256];
+    double t0;
+
+    if (sscanf(location, "%255[^:]:%u", name, &line) != 2) {
+        printf("Bad location %s, expected file:line\n", location);
+        return 1;
+    }
+
+    idx = symbol_index_open(path);
+    if (idx == NULL) {
+        printf("Couldn't open %s as an ELF program\n", path);
+        return 1;
+    }
+    printf("debug_line         %10lu KB\n", idx->lines.line_size >> 10);
+
+    t0 = now_sec();
+    if (symbol_lookup_line(idx, name, line, &addr, &at) < 0)
+        printf("no line %s\n", location);
+    printf("first file:line    %10.3f ms\n", (now_sec() - t0) * 1e3);
+
+    for (i = 0; i < idx->lines.nunits; i++)
+        rows += idx->lines.units[i].nrows;
+    printf("units              %10lu, %lu rows\n", idx->lines.nunits, rows);
+
+    t0 = now_sec();
+    symbol_line_at(idx, idx->start, &at);
+    printf("first by address   %10.3f ms\n", (now_sec() - t0) * 1e3);
+
+    srand(1);
+    t0 = now_sec();
+    for (i = 0; i < LOOKUPS; i++) {
+        addr = idx->start + rand() % (idx->end - idx->start);
+        file = symbol_line_at(idx, addr + idx->bias, &at);
+        found += file != NULL;
+    }
+    printf("by address         %10.1f ns/lookup, %lu with a line\n",
+            (now_sec() - t0) * 1e9 / LOOKUPS, found);
+
+    symbol_index_close(idx);
+    return 0;
+}
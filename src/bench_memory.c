@@ -0,0 +1,136 @@
+/*
+ * Throughput benchmark of the debugee memory access paths.
+ *
+ * A traced child maps and fills a 256 MB heap region, then stops.
+ * The region is read back with PTRACE_PEEKDATA, process_vm_readv(),
+ * pread() on /proc/<pid>/mem, and read_memory(), which picks between
+ * them. PTRACE_PEEKDATA only reads the first 16 MB, since it would
+ * take too long to read the whole region word by word.
+ *
+ * Usage: ./bench_memory [megabytes]
+ */
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "../inc/debugger.h"
+#include "../inc/memory.h"
+
+#define PEEK_LIMIT  (16UL << 20)
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *method, size_t len, double secs)
+{
+    printf("%-18s %8.1f MB in %7.3f s  %10.1f MB/s\n", method,
+            len / 1048576.0, secs, len / 1048576.0 / secs);
+}
+
+/*
+ * Map and fill the heap region, tell the parent where it is,
+ * and stop until we are killed.
+ */
+static void child(int fd, size_t len)
+{
+    uint8_t *heap;
+
+    heap = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (heap == MAP_FAILED)
+        exit(1);
+    memset(heap, 0xa5, len);
+
+    write(fd, &heap, sizeof(heap));
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+    exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    size_t len = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+    size_t peek_len = len < PEEK_LIMIT ? len : PEEK_LIMIT;
+    struct debugger dbg;
+    struct iovec local, remote;
+    uint8_t *buf, *heap;
+    int fds[2], status, fd;
+    size_t i, done;
+    ssize_t n;
+    double t0;
+    pid_t pid;
+
+    buf = malloc(len);
+    if (buf == NULL || pipe(fds) < 0)
+        return 1;
+
+    pid = fork();
+    if (pid == 0)
+        child(fds[1], len);
+
+    if (read(fds[0], &heap, sizeof(heap)) != sizeof(heap))
+        return 1;
+    waitpid(pid, &status, 0);
+    debugger_init(&dbg, "bench", pid);
+
+    /* Fault the buffer in, so that the first method isn't penalized */
+    memset(buf, 0, len);
+
+    /* PTRACE_PEEKDATA, one word per system call */
+    t0 = now_sec();
+    for (i = 0; i < peek_len; i += sizeof(long)) {
+        long word = ptrace(PTRACE_PEEKDATA, pid, heap + i, NULL);
+        memcpy(buf + i, &word, sizeof(long));
+    }
+    report("PTRACE_PEEKDATA", peek_len, now_sec() - t0);
+
+    /* process_vm_readv, the whole region at once */
+    local.iov_base  = buf;
+    local.iov_len   = len;
+    remote.iov_base = heap;
+    remote.iov_len  = len;
+    t0 = now_sec();
+    n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    report("process_vm_readv", n > 0 ? n : 0, now_sec() - t0);
+
+    /* pread on /proc/<pid>/mem, which may return short counts */
+    fd = debugger_mem_fd(&dbg);
+    t0 = now_sec();
+    for (done = 0; fd >= 0 && done < len; done += n) {
+        n = pread(fd, buf + done, len - done, (unsigned long)heap + done);
+        if (n <= 0)
+            break;
+    }
+    report("/proc/pid/mem", done, now_sec() - t0);
+
+    memset(buf, 0, len);
+    t0 = now_sec();
+    n = read_memory(&dbg, heap, buf, len);
+    report("read_memory", n > 0 ? n : 0, now_sec() - t0);
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] != 0xa5) {
+            printf("error: read_memory returned wrong data at +%zu\n", i);
+            break;
+        }
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    free(buf);
+    return 0;
+}
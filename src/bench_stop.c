@@ -0,0 +1,170 @@
+/*
+ * Benchmark of the reads of a stopped debugee.
+ *
+ * A traced child fills a buffer and stops. What the commands of a stop
+ * typically do is then timed: small reads of words scattered over a few
+ * pages, and reads of the registers, first straight from the debugee
+ * and then through the debugger, which keeps what it read until the
+ * debugee is resumed (see inc/stop_cache.h).
+ *
+ * The child is then resumed, changes the first word of every page and
+ * stops again: the changes must be seen. A write of the debugger must
+ * be seen at once.
+ *
+ * Usage: ./bench_stop [reads]
+ */
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "../inc/debugger.h"
+#include "../inc/memory.h"
+#include "../inc/registers.h"
+
+/* Pages the words are read from */
+#define BENCH_PAGES     8
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void child(int fd)
+{
+    size_t len = BENCH_PAGES * PAGE_SIZE, i;
+    unsigned long *buf;
+
+    buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+        exit(1);
+    for (i = 0; i < len / sizeof(*buf); i++)
+        buf[i] = i;
+
+    write(fd, &buf, sizeof(buf));
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+
+    for (i = 0; i < len / sizeof(*buf); i += PAGE_SIZE / sizeof(*buf))
+        buf[i] = ~0UL;
+    raise(SIGSTOP);
+    exit(0);
+}
+
+/*
+ * Read `n` words of the child, spread over its buffer, and check them.
+ */
+static void words(struct debugger *dbg, unsigned long *buf, unsigned long n,
+        int cached, const char *what)
+{
+    unsigned long i, at, word;
+    double t0;
+    ssize_t ret;
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        at = (i * 97) % (BENCH_PAGES * PAGE_SIZE / sizeof(word));
+        if (cached)
+            ret = read_memory(dbg, buf + at, &word, sizeof(word));
+        else
+            ret = __read_memory(dbg->dbge_pid, -1, buf + at, &word,
+                    sizeof(word));
+        if (ret != sizeof(word) || word != at) {
+            printf("error: wrong word at +%#lx\n", at * sizeof(word));
+            return;
+        }
+    }
+    t0 = now_sec() - t0;
+    printf("%-26s %8lu reads in %7.3f s  %8.1f ns/read\n", what, n, t0,
+            t0 * 1e9 / n);
+}
+
+static void regs(struct debugger *dbg, unsigned long n, int cached,
+        const char *what)
+{
+    struct user_regs_struct r;
+    unsigned long i;
+    double t0;
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        if (cached ? debugger_get_regs(dbg, &r) :
+                ptrace(PTRACE_GETREGS, dbg->dbge_pid, NULL, &r)) {
+            printf("error: registers not read\n");
+            return;
+        }
+    }
+    t0 = now_sec() - t0;
+    printf("%-26s %8lu reads in %7.3f s  %8.1f ns/read\n", what, n, t0,
+            t0 * 1e9 / n);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    unsigned long *buf, word, i;
+    struct stop_stats *st;
+    struct debugger dbg;
+    int fds[2], status;
+    pid_t pid;
+
+    if (pipe(fds) < 0)
+        return 1;
+
+    pid = fork();
+    if (pid == 0)
+        child(fds[1]);
+
+    if (read(fds[0], &buf, sizeof(buf)) != sizeof(buf))
+        return 1;
+    waitpid(pid, &status, 0);
+    debugger_init(&dbg, "bench", pid);
+
+    words(&dbg, buf, n, 0, "process_vm_readv");
+    words(&dbg, buf, n, 1, "read_memory, same stop");
+    regs(&dbg, n, 0, "PTRACE_GETREGS");
+    regs(&dbg, n, 1, "debugger_get_regs");
+
+    st = &dbg.stop.stats;
+    printf("memory: %lu hits, %lu misses; registers: %lu hits, "
+            "%lu misses\n", st->mem_hits, st->mem_misses, st->regs_hits,
+            st->regs_misses);
+
+    /* A write goes through, and is seen by the next read */
+    word = 42;
+    if (write_memory(&dbg, buf, &word, sizeof(word)) != sizeof(word) ||
+            read_memory(&dbg, buf, &word, sizeof(word)) != sizeof(word) ||
+            __read_memory(pid, -1, buf, &word, sizeof(word)) !=
+            sizeof(word) || word != 42)
+        printf("error: write not seen\n");
+
+    debugger_invalidate_regs(&dbg);
+    ptrace(PTRACE_CONT, pid, NULL, NULL);
+    waitpid(pid, &status, 0);
+
+    for (i = 0; i < BENCH_PAGES; i++) {
+        if (read_memory(&dbg, buf + i * PAGE_SIZE / sizeof(word), &word,
+                sizeof(word)) != sizeof(word) || word != ~0UL) {
+            printf("error: change on page %lu not seen\n", i);
+            break;
+        }
+    }
+    if (i == BENCH_PAGES)
+        printf("changes seen on all %d pages\n", BENCH_PAGES);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Benchmark of the symbol index of inc/symbols.h.
+ *
+ * Opens an ELF program, which only maps it, then times the first
+ * lookup by address, which indexes .symtab, and the first lookup by
+ * name, followed by a million lookups of random symbols by address and
+ * by name. Then times saving the index to the cache file of the
+ * program, if it has a build-id, and the same first lookups once the
+ * index is opened again from the cache. The cache is kept in a
+ * temporary directory, not the one of the user.
+ *
+ * Usage: ./bench_symbols [program]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../inc/symbols.h"
+
+#define LOOKUPS     1000000
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "/proc/self/exe";
+    const struct symbol *sym;
+    struct symbol_index *idx;
+    struct symbol_table *tbl;
+    unsigned long off, addr, found = 0, i;
+    char dir[] = "/tmp/bench_symbols.XXXXXX", cache[PATH_MAX];
+    double t0;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("XDG_CACHE_HOME", dir, 1);
+
+    t0 = now_sec();
+    idx = symbol_index_open(path);
+    if (idx == NULL) {
+        printf("Couldn't open %s as an ELF program\n", path);
+        return 1;
+    }
+    printf("open               %10.3f ms (%zu MB)\n",
+            (now_sec() - t0) * 1e3, idx->size >> 20);
+
+    t0 = now_sec();
+    symbol_lookup_addr(idx, idx->start, &off);
+    printf("first by address   %10.3f ms\n", (now_sec() - t0) * 1e3);
+
+    t0 = now_sec();
+    symbol_lookup_name(idx, "main", &addr);
+    printf("first by name      %10.3f ms\n", (now_sec() - t0) * 1e3);
+
+    tbl = &idx->tables[SYMTAB_STATIC];
+    if (tbl->count == 0)
+        tbl = &idx->tables[SYMTAB_DYNAMIC];
+    printf("symbols            %10lu\n", tbl->count);
+    if (tbl->count == 0)
+        return 0;
+
+    srand(1);
+    t0 = now_sec();
+    for (i = 0; i < LOOKUPS; i++) {
+        sym = &tbl->syms[rand() % tbl->count];
+        found += symbol_lookup_addr(idx, sym->addr + idx->bias, &off) != NULL;
+    }
+    printf("by address         %10.1f ns/lookup, %lu found\n",
+            (now_sec() - t0) * 1e9 / LOOKUPS, found);
+
+    found = 0;
+    t0 = now_sec();
+    for (i = 0; i < LOOKUPS; i++) {
+        sym = &tbl->syms[rand() % tbl->count];
+        found += symbol_lookup_name(idx, symbol_name(idx, sym), &addr)
+            != NULL;
+    }
+    printf("by name            %10.1f ns/lookup, %lu found\n",
+            (now_sec() - t0) * 1e9 / LOOKUPS, found);
+
+    if (idx->id_len == 0) {
+        printf("no build-id, no cache\n");
+        symbol_index_close(idx);
+        return 0;
+    }
+
+    t0 = now_sec();
+    symbol_index_save(idx);
+    printf("save               %10.3f ms\n", (now_sec() - t0) * 1e3);
+    symbol_index_close(idx);
+
+    t0 = now_sec();
+    idx = symbol_index_open(path);
+    printf("cached open        %10.3f ms%s\n", (now_sec() - t0) * 1e3,
+            idx->cache != NULL ? "" : " (no cache)");
+
+    t0 = now_sec();
+    symbol_lookup_addr(idx, idx->start, &off);
+    symbol_lookup_name(idx, "main", &addr);
+    printf("cached first two   %10.3f ms\n", (now_sec() - t0) * 1e3);
+
+    __cache_path(idx->id, idx->id_len, 0, cache);
+    symbol_index_close(idx);
+    unlink(cache);
+    *strrchr(cache, '/') = '\0';
+    rmdir(cache);
+    rmdir(dir);
+    return 0;
+}
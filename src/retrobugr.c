@@ -1,12 +1,19 @@
+#define _GNU_SOURCE
+
 #include <sys/ptrace.h>
 #include <sys/personality.h>
 #include <sys/types.h>
+#include <sys/user.h>
 #include <sys/wait.h>
 
+#include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "linenoise.h"
@@ -14,6 +21,20 @@
 #include "../inc/breakpoint.h"
 #include "../inc/breakpoint_array.h"
 #include "../inc/debugger.h"
+#include "../inc/memory.h"
+#include "../inc/registers.h"
+#include "../inc/displaced.h"
+#include "../inc/x86_decode.h"
+#include "../inc/inject.h"
+#include "../inc/checkpoint.h"
+#include "../inc/debugreg.h"
+#include "../inc/history.h"
+#include "../inc/trace.h"
+#include "../inc/pagemap.h"
+#include "../inc/snapshot.h"
+#include "../inc/write_index.h"
+#include "../inc/fast_trace.h"
+#include "../inc/breakpoint_batch.h"
 
 /**
  * Tokenize a string and retun an array of tokens.
@@ -57,6 +78,172 @@ int is_prefix(char *s, const char *of)
     return strncmp(s, of, strlen(of)) == 0;
 }
 
+/* Longest `func+off` location printed */
+#define LOCATION_MAX    256
+
+/*
+ * Keep the symbols of the program in its cache for the next sessions,
+ * once done with it.
+ */
+static void __symbols_save(struct debugger *dbg)
+{
+    if (dbg->symbols != NULL)
+        symbol_index_save(dbg->symbols);
+}
+
+/*
+ * Use the symbols `idx` of `path`, the program the debugee now runs, in
+ * place of the ones it had.
+ */
+static void __symbols_replace(struct debugger *dbg, struct symbol_index *idx,
+        const char *path)
+{
+    if (dbg->symbols != NULL) {
+        symbol_index_save(dbg->symbols);
+        symbol_index_close(dbg->symbols);
+    }
+
+    dbg->symbols = idx;
+    if (dbg->symbols != NULL &&
+            symbol_index_relocate(dbg->symbols, dbg->threads.leader) < 0) {
+        printf("Couldn't find where %s is loaded\n", path);
+        symbol_index_close(dbg->symbols);
+        dbg->symbols = NULL;
+    }
+}
+
+/*
+ * Open the symbols of `path`, the program the debugee now runs, in
+ * place of the ones it had.
+ */
+static void __symbols_load(struct debugger *dbg, const char *path)
+{
+    __symbols_replace(dbg, symbol_index_open(path), path);
+}
+
+/*
+ * Format `addr` into `buf`, which holds LOCATION_MAX bytes, along with
+ * the function and the source line it is in, if any, e.g
+ * `0x401126 <main+4> at main.c:12`.
+ */
+static char *__location(struct debugger *dbg, void *addr, char *buf)
+{
+    const struct symbol *sym = NULL;
+    const struct line_file *file = NULL;
+    unsigned long off;
+    unsigned int line = 0;
+    int len;
+
+    if (dbg->symbols != NULL) {
+        sym = symbol_lookup_addr(dbg->symbols, (unsigned long)addr, &off);
+        file = symbol_line_at(dbg->symbols, (unsigned long)addr, &line);
+    }
+
+    if (sym == NULL)
+        len = snprintf(buf, LOCATION_MAX, "%p", addr);
+    else if (off == 0)
+        len = snprintf(buf, LOCATION_MAX, "%p <%s>", addr,
+                symbol_name(dbg->symbols, sym));
+    else
+        len = snprintf(buf, LOCATION_MAX, "%p <%s+%lu>", addr,
+                symbol_name(dbg->symbols, sym), off);
+
+    if (file != NULL && len < LOCATION_MAX)
+        snprintf(buf + len, LOCATION_MAX - len, " at %s:%u", file->name,
+                line);
+    return buf;
+}
+
+/*
+ * Print the source line of the code at `addr`, or where it would be if
+ * the source file can't be read.
+ */
+static void __print_source(struct debugger *dbg, void *addr)
+{
+    const struct line_file *file;
+    unsigned int line, n = 0;
+    char path[PATH_MAX];
+    char *text = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    FILE *fp;
+
+    if (dbg->symbols == NULL)
+        return;
+    file = symbol_line_at(dbg->symbols, (unsigned long)addr, &line);
+    if (file == NULL)
+        return;
+
+    if (file->name[0] == '/' || file->dir == NULL)
+        snprintf(path, sizeof(path), "%s", file->name);
+    else
+        snprintf(path, sizeof(path), "%s/%s", file->dir, file->name);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        fp = fopen(file->name, "r");
+    if (fp == NULL) {
+        printf("%u\tin %s\n", line, path);
+        return;
+    }
+
+    while ((len = getline(&text, &cap, fp)) >= 0) {
+        if (++n < line)
+            continue;
+        if (len > 0 && text[len - 1] == '\n')
+            text[len - 1] = '\0';
+        printf("%u\t%s\n", line, text);
+        break;
+    }
+    if (n < line)
+        printf("%u\tin %s\n", line, path);
+    free(text);
+    fclose(fp);
+}
+
+/*
+ * Parse the code location `arg`: `file:line`, the name of a function,
+ * or else a hexadecimal address.
+ *
+ * @return - 0 on success, -1 if it is neither, which is reported
+ */
+static int __parse_location(struct debugger *dbg, const char *arg,
+        void **addr)
+{
+    const char *colon = strrchr(arg, ':');
+    char file[PATH_MAX];
+    unsigned long value;
+    unsigned int found;
+    char *end;
+
+    if (colon != NULL && colon != arg && colon[1] != '\0' &&
+            strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+        value = strtoul(colon + 1, NULL, 10);
+        snprintf(file, sizeof(file), "%.*s", (int)(colon - arg), arg);
+        if (dbg->symbols == NULL || value == 0 || value > UINT_MAX ||
+                symbol_lookup_line(dbg->symbols, file, value, &value,
+                    &found) < 0) {
+            printf("No line %s in file \"%s\".\n", colon + 1, file);
+            return -1;
+        }
+        *addr = (void *)value;
+        return 0;
+    }
+
+    if (dbg->symbols != NULL &&
+            symbol_lookup_name(dbg->symbols, arg, &value) != NULL) {
+        *addr = (void *)value;
+        return 0;
+    }
+
+    value = strtoul(arg, &end, 16);
+    if (*arg == '\0' || *end != '\0') {
+        printf("Function \"%s\" not defined.\n", arg);
+        return -1;
+    }
+    *addr = (void *)value;
+    return 0;
+}
+
 /*--------------------------*/
 struct debugee {
     // Is this even necessary?
@@ -65,254 +252,5456 @@ struct debugee {
 #define INT3    0xcc
 
 /*
- * This structure represents a single breakpoint.
- * It has embedded within it a linked list entry
- * that contains a pointer to the next breakpoint
- * in the list.
+ * Allocate a breakpoint for address `addr` in the process `pid`.
+ * The breakpoint is not written into the debugee until it is
+ * enabled with `breakpoint_enable()`.
  */
-struct breakpoint {
-    pid_t pid;
-    void *addr;
-    int enabled;
-    u_int8_t saved_data;
-
-    /* This number is returned to the user when
-     * a new breakpoint is created. It is unique
-     * And represents a single breakpoint in the
-     * list. */
-    int number;
-
-    /* The breakpoint entry list */
-    struct sl_list_node bp_entry;
-};
-
-struct breakpoint *breakpoint_enable(pid_t pid, void *addr)
+struct breakpoint *breakpoint_alloc(pid_t pid, void *addr)
 {
-    u_int64_t data = 0;
     struct breakpoint *bp;
-    u_int64_t data_with_int3;
 
-    bp = malloc(sizeof(struct breakpoint));
+    bp = calloc(1, sizeof(struct breakpoint));
     if (bp == NULL)
         return NULL;
 
     bp->pid = pid;
     bp->addr = addr;
-    errno = 0;
-    data = ptrace(PTRACE_PEEKDATA, pid, addr, 0);
-    if (data == -1 && errno != 0)
-        printf("errno is: %d\n", errno);
-    bp->saved_data = ( data & (u_int8_t)0xff); // save bottom byte
-    data_with_int3 = (( data & ~0xff) | INT3); // set bottom byte to 0xcc
-    printf("errno = %d, pid = %d, addr = %p original = 0x%lx, modified = 0x%lx\n",
-            errno, pid, addr, data, data_with_int3);
-
-    ptrace(PTRACE_POKEDATA, pid, addr, data_with_int3);
-    bp->enabled = 1;
-    printf("Enabled breakpoint\n");
-
     return bp;
 }
 
-void breakpoint_disable(struct breakpoint *bp)
+int breakpoint_enable(struct debugger *dbg, struct breakpoint *bp)
 {
-    u_int64_t data, restored_data; 
-    
-    data = ptrace(PTRACE_PEEKDATA, bp->pid, bp->addr, NULL);
-    restored_data = ((data & ~0xff) | bp->saved_data);
+    uint8_t data, int3 = INT3;
 
-    ptrace(PTRACE_PEEKDATA, bp->pid, bp->addr, restored_data);
-    free(bp);
+    if (bp->kind == BREAKPOINT_FAST)
+        return fast_trace_enable(dbg, bp);
+
+    if (read_memory(dbg, bp->addr, &data, 1) != 1 ||
+            patch_code(dbg, bp->addr, &int3, 1) != 1) {
+        printf("Cannot access memory at %p: %s\n", bp->addr, strerror(errno));
+        return -1;
+    }
+    breakpoint_save_data(bp, data);
+    __set_breakpoint_enabled(bp);
+
+    return 0;
+}
+
+void breakpoint_disable(struct debugger *dbg, struct breakpoint *bp)
+{
+    uint8_t data = breakpoint_get_saved_data(bp);
+
+    if (bp->kind == BREAKPOINT_FAST) {
+        fast_trace_disable(dbg, bp);
+        return;
+    }
+
+    if (patch_code(dbg, bp->addr, &data, 1) != 1)
+        printf("Cannot restore memory at %p: %s\n", bp->addr, strerror(errno));
+    __unset_breakpoint_enabled(bp);
 }
 /*--------------------------*/
-/* Debugger stuff */
-struct debugger {
-    char *dbge_path;
-    pid_t dbge_pid;
-    
-    /* This is the `head` of the 
-     * breakpoints linked list. */
-    struct sl_list_node breakpoints;
-};
 
-/**
- * This function allocates memory for a debugger structure and
- * returns to the caller.
+/*
+ * Forget that the debugee stopped at breakpoint `bp`, which is taken
+ * out: threads stopped there are resumed as they are, without stepping
+ * over it.
  */
-struct debugger *debugger_alloc(void) 
+static void __breakpoint_forget(struct debugger *dbg, struct breakpoint *bp)
 {
-    return (struct debugger *)malloc(sizeof(struct debugger));
+    struct hash_slot *slot;
+    struct thread *t;
+
+    if (dbg->stopped_bp == bp)
+        dbg->stopped_bp = NULL;
+    hash_table_for_each(&dbg->threads.threads, slot) {
+        t = slot->value;
+        if (t->stopped_bp == bp)
+            t->stopped_bp = NULL;
+    }
 }
 
-/**
- * Free the debugger structure acquired by `debugger_alloc()`
- *
- * @param dbg - The `struct debugger *` to be freed
+/*
+ * Take the INT3 of coverage block `bp` out, out of the debugee as well
+ * unless it is `gone`, and free it.
  */
-void debugger_free(struct debugger *dbg)
+static void __coverage_drop(struct debugger *dbg, struct breakpoint *bp,
+        int gone)
 {
-    free(dbg);
+    hash_table_delete(&dbg->bp_table, (unsigned long)bp->addr);
+    __breakpoint_forget(dbg, bp);
+    if (!gone && breakpoint_is_enabled(bp))
+        breakpoint_disable(dbg, bp);
+    displaced_release(dbg, bp);
+    free(bp);
 }
 
+/*
+ * Take note that the block of coverage breakpoint `bp` runs, and take
+ * the breakpoint out for good.
+ */
+static void __coverage_hit(struct debugger *dbg, struct breakpoint *bp)
+{
+    coverage_mark(dbg->coverage, (unsigned long)bp->addr);
+    __coverage_drop(dbg, bp, 0);
+}
 
 /*
- * Initialize a debugger structure allocated by `debugger_alloc()`
- *
- * @param dbg       - pointer to the to a `struct debugger`
- * @param dbge_path - Debugee's path
- * @param dbge_pid  - Debugee's pid
+ * Make room at `addr` for another breakpoint, by taking out the INT3 of
+ * the coverage block there if any. The block is then counted when the
+ * debugee goes on from the other breakpoint, see `__debugger_start()`,
+ * or gets its INT3 back when it is deleted, see `__coverage_give_back()`.
  */
-void debugger_init(struct debugger *dbg, char *dbge_path, 
-        pid_t dbge_pid)
+static void __coverage_take(struct debugger *dbg, void *addr)
 {
-    dbg->dbge_path = dbge_path;
-    dbg->dbge_pid  = dbge_pid;
-    sl_list_init(&dbg->breakpoints);
+    struct breakpoint *bp = debugger_breakpoint_at(dbg, addr);
+
+    if (bp != NULL && bp->coverage)
+        __coverage_drop(dbg, bp, 0);
 }
 
 /*
- * Insert a breakpoint into the debugger's breakpoint list.
+ * Hand the INT3 of breakpoint `bp`, which is deleted, back to the
+ * coverage if it took the one of a block that didn't run yet. The INT3
+ * stays in the debugee for the block, and `bp` is left disabled.
  *
- * @param dbg - pointer to debugger structure 
- * @param bp  - pointer to breakpoint structure to insert
+ * @return - 1 if the INT3 was handed back, 0 if it is to be taken out
  */
-int __debugger_breakpoint_insert(struct debugger *dbg, 
-        struct breakpoint *bp)
+static int __coverage_give_back(struct debugger *dbg, struct breakpoint *bp)
 {
-    sl_list_add(&dbg->breakpoints, &bp->bp_entry);
-    /* TODO: Attribute breakpoint number.*/
+    struct breakpoint *cov_bp;
+
+    if (dbg->coverage == NULL || !breakpoint_has_int3(bp) ||
+            coverage_ran(dbg->coverage, (unsigned long)bp->addr) != 0)
+        return 0;
+
+    cov_bp = breakpoint_alloc(dbg->dbge_pid, bp->addr);
+    if (cov_bp == NULL)
+        return 0;
+    if (hash_table_insert(&dbg->bp_table, (unsigned long)bp->addr,
+                cov_bp) < 0) {
+        free(cov_bp);
+        return 0;
+    }
+    cov_bp->coverage = 1;
+    breakpoint_save_data(cov_bp, breakpoint_get_saved_data(bp));
+    __set_breakpoint_enabled(cov_bp);
+    __unset_breakpoint_enabled(bp);
+    return 1;
 }
 
-void __debugger_breakpoint_delete(struct debugger *dbg, 
-        unsigned int bpn)
+/*
+ * Check that a breakpoint can be set at `addr`, and tell the user
+ * why not otherwise.
+ */
+static int __breakpoint_can_set(struct debugger *dbg, void *addr)
 {
-    /* TODO: Implement this function */
+    struct breakpoint *bp;
+
+    __coverage_take(dbg, addr);
+    if (debugger_breakpoint_at(dbg, addr) != NULL) {
+        printf("There is already a breakpoint at %p\n", addr);
+        return 0;
+    }
+
+    bp = fast_trace_covering(dbg, addr);
+    if (bp != NULL) {
+        printf("%p is overwritten by fast tracepoint %u\n", addr,
+                bp->number);
+        return 0;
+    }
+    return 1;
 }
 
-void set_breakpoint_at_address(struct debugger *dbg,  void *addr)
+/*
+ * Set a breakpoint at `addr`, which only stops the debugee when
+ * `condition` holds if it is not NULL.
+ */
+void set_breakpoint_at_address(struct debugger *dbg, void *addr,
+        const char *condition)
 {
+    struct condition *cond = NULL;
+    char err[128], loc[LOCATION_MAX];
     struct breakpoint *bp;
-    printf("Set breakpoint at address %p\n", addr);
 
-    bp = breakpoint_enable(dbg->dbge_pid, addr);
-    __debugger_breakpoint_insert(dbg, bp);
+    if (!__breakpoint_can_set(dbg, addr))
+        return;
+
+    if (condition != NULL) {
+        cond = condition_compile(condition, err, sizeof(err));
+        if (cond == NULL) {
+            printf("%s\n", err);
+            return;
+        }
+    }
+
+    bp = breakpoint_alloc(dbg->dbge_pid, addr);
+    if (bp == NULL) {
+        condition_free(cond);
+        return;
+    }
+    bp->condition = cond;
+
+    if (breakpoint_enable(dbg, bp) < 0 ||
+            __debugger_breakpoint_insert(dbg, bp) == ENOBP) {
+        condition_free(cond);
+        free(bp);
+        return;
+    }
+    printf("Breakpoint %u at %s\n", bp->number, __location(dbg, addr, loc));
 }
 
-/**
- * Continue execution of debugee process.
- *
- * @param pid - Pid of the debugee process
+/*
+ * Set a fast tracepoint at `addr`, which logs the registers every time
+ * the debugee runs through it, without stopping it.
  */
-void continue_execution(pid_t pid)
+void set_fast_tracepoint(struct debugger *dbg, void *addr)
 {
-    int wait_status, options = 0;
+    struct breakpoint *bp;
 
-    ptrace(PTRACE_CONT, pid, NULL, NULL);
-    waitpid(pid, &wait_status, options);
-}
+    if (!__breakpoint_can_set(dbg, addr))
+        return;
 
-#define MAX_LINE_ARGS 64
+    bp = breakpoint_alloc(dbg->dbge_pid, addr);
+    if (bp == NULL)
+        return;
+    bp->kind = BREAKPOINT_FAST;
+
+    if (breakpoint_enable(dbg, bp) < 0 ||
+            __debugger_breakpoint_insert(dbg, bp) == ENOBP) {
+        free(bp->fast);
+        free(bp);
+        return;
+    }
+    printf("Fast tracepoint %u at %p, %u bytes replaced\n", bp->number,
+            addr, bp->fast->len);
+}
 
 /*
- * Handle input
+ * Delete the breakpoints numbered in `numbers`, a NULL terminated list,
+ * with their INT3s taken out of the debugee together.
  */
-void handle_command(struct debugger *dbg, char *line)
+void delete_breakpoints(struct debugger *dbg, char **numbers)
 {
-    char **args = split(line, "  ", MAX_LINE_ARGS);
-    char *command = args[0];
+    struct breakpoint_batch batch;
+    struct breakpoint **bps;
+    unsigned int i, n = 0, bpn;
+    int alive;
 
-    if (is_prefix(command, "continue")) {
-        continue_execution(dbg->dbge_pid);
-    }
-    else if (is_prefix(command, "break")) {
-        char *addr = (char *)strtol(args[1], NULL, 16);
+    /* The code of a debugee that exited is gone with it */
+    alive = thread_count(&dbg->threads) > 0;
+
+    for (i = 0; numbers[i] != NULL; i++)
+        ;
+    bps = malloc(i * sizeof(*bps));
+    if (bps == NULL)
+        return;
 
-        set_breakpoint_at_address(dbg, addr);
-        printf("breakpoint set at %p\n", addr);
+    breakpoint_batch_init(&batch);
+    for (i = 0; numbers[i] != NULL; i++) {
+        bpn = strtoul(numbers[i], NULL, 10);
+        bps[n] = __debugger_breakpoint_delete(dbg, bpn);
+        if (bps[n] == NULL) {
+            printf("No breakpoint number %u\n", bpn);
+            continue;
+        }
+
+        __breakpoint_forget(dbg, bps[n]);
+        if (alive && !__coverage_give_back(dbg, bps[n]) &&
+                breakpoint_batch_add(&batch, bps[n], BATCH_DISABLE) < 0)
+            breakpoint_disable(dbg, bps[n]);
+        n++;
     }
-    else if (is_prefix(command, "quit")) {
-        exit(0);
+    breakpoint_batch_commit(dbg, &batch);
+    breakpoint_batch_destroy(&batch);
+
+    for (i = 0; i < n; i++) {
+        displaced_release(dbg, bps[i]);
+        condition_free(bps[i]->condition);
+        free(bps[i]->fast);
+        free(bps[i]);
     }
-    else {
-        puts("Unknown command\n");
+    free(bps);
+}
+
+/*
+ * List every breakpoint, in breakpoint number order.
+ */
+void info_breakpoints(struct debugger *dbg)
+{
+    struct breakpoint *bp;
+    unsigned int pos;
+    int i;
+
+    fast_trace_drain(dbg);
+
+    for (pos = 0; pos < dbg->bpa_count; pos++) {
+        for (i = 0; i < MAX_BREAKPOINTS_PER_LIST; i++) {
+            bp = breakpoint_array_get_breakpoint(dbg->bpa[pos], i);
+            if (bp == NULL || bp->temporary)
+                continue;
+            printf("%-4u %p %s", bp->number, bp->addr,
+                    breakpoint_is_enabled(bp) ? "enabled" : "disabled");
+            if (bp->condition != NULL)
+                printf(" if %s", bp->condition->text);
+            if (bp->kind == BREAKPOINT_FAST)
+                printf(" fast, %lu hits", bp->fast->hits);
+            printf("\n");
+        }
     }
+
+    if (dbg->ftrace != NULL && dbg->ftrace->lost > 0)
+        printf("%lu tracepoint hits lost\n", dbg->ftrace->lost);
 }
 
+static int __trap_is_int3(struct debugger *dbg);
+
 /*
- * Launch the debugger by initiating the debugger loop
+ * Check whether the debugee stopped with `wait_status` at the INT3 of a
+ * coverage block. The block is then taken note of, its INT3 taken out,
+ * and RIP moved back to it: the debugee is to be resumed as if nothing
+ * happened.
  *
- * @param dbg - pointer to debugger structure
+ * @return - 1 if it did, 0 otherwise
  */
-void debugger_launch(struct debugger *dbg)
+static int __coverage_trap(struct debugger *dbg, int wait_status)
 {
-    char *line;
-    int wait_status;
-    int options = 0;
+    struct user_regs_struct regs;
+    struct breakpoint *bp;
 
-    /* Wait for SIGTRAP */
-    waitpid(dbg->dbge_pid, &wait_status, options);
+    if (dbg->coverage == NULL || !WIFSTOPPED(wait_status) ||
+            WSTOPSIG(wait_status) != SIGTRAP ||
+            debugger_get_regs(dbg, &regs) < 0)
+        return 0;
 
-    while ((line = linenoise("retrobugr> ")) != NULL) {
-        handle_command(dbg, line);
-        linenoiseHistoryAdd(line);
-        linenoiseFree(line);
+    bp = debugger_breakpoint_at(dbg, (void *)(regs.rip - 1));
+    if (bp == NULL || !bp->coverage || !__trap_is_int3(dbg))
+        return 0;
+
+    regs.rip--;
+    debugger_set_regs(dbg, &regs);
+    __coverage_hit(dbg, bp);
+    return 1;
+}
+
+/*
+ * Put an INT3 at every block of the coverage, with a single write per
+ * page of code. Blocks that already have a breakpoint, or that a fast
+ * tracepoint overwrites, are left out.
+ *
+ * @param pages - where to store the number of pages written
+ * @return      - the number of INT3s written
+ */
+static unsigned long __coverage_arm(struct debugger *dbg, unsigned long *pages)
+{
+    struct coverage *cov = dbg->coverage;
+    unsigned long i, addr, page = 0, armed = 0;
+    struct breakpoint_batch batch;
+    struct breakpoint *bp;
+
+    breakpoint_batch_init(&batch);
+    for (i = 0; i < cov->count; i++) {
+        addr = cov->blocks[i] + cov->bias;
+        if (debugger_breakpoint_at(dbg, (void *)addr) != NULL ||
+                fast_trace_covering(dbg, (void *)addr) != NULL)
+            continue;
+
+        bp = breakpoint_alloc(dbg->dbge_pid, (void *)addr);
+        if (bp == NULL)
+            break;
+        bp->coverage = 1;
+        if (hash_table_insert(&dbg->bp_table, addr, bp) < 0) {
+            free(bp);
+            break;
+        }
+        if (breakpoint_batch_add(&batch, bp, BATCH_ENABLE) < 0) {
+            __coverage_drop(dbg, bp, 1);
+            break;
+        }
     }
+    breakpoint_batch_commit(dbg, &batch);
+    breakpoint_batch_destroy(&batch);
 
+    /* Those that couldn't be written are left out */
+    *pages = 0;
+    for (i = 0; i < cov->count; i++) {
+        addr = cov->blocks[i] + cov->bias;
+        bp = debugger_breakpoint_at(dbg, (void *)addr);
+        if (bp == NULL || !bp->coverage)
+            continue;
+        if (!breakpoint_is_enabled(bp)) {
+            __coverage_drop(dbg, bp, 1);
+            continue;
+        }
+        if ((addr & PAGE_MASK) != page)
+            (*pages)++;
+        page = addr & PAGE_MASK;
+        armed++;
+    }
+    return armed;
 }
 
-int main(int argc, char **argv) 
+/*
+ * Write the blocks that ran to the file of the coverage, and stop
+ * collecting it. The INT3s left are taken out of the debugee unless it
+ * is `gone`.
+ */
+static void __coverage_done(struct debugger *dbg, int gone)
 {
-    struct debugger *dbg;
-    char *program;
-    pid_t pid;
+    struct coverage *cov = dbg->coverage;
+    struct breakpoint_batch batch;
+    struct breakpoint *bp;
+    unsigned long i;
 
-    if (argc < 2) {
-        printf("Please specify target program.\n");
-        return -1;
+    if (cov == NULL)
+        return;
+
+    breakpoint_batch_init(&batch);
+    for (i = 0; i < cov->count && !gone; i++) {
+        bp = debugger_breakpoint_at(dbg,
+                (void *)(cov->blocks[i] + cov->bias));
+        if (bp != NULL && bp->coverage &&
+                breakpoint_batch_add(&batch, bp, BATCH_DISABLE) < 0)
+            break;
     }
-    program = argv[1];
+    breakpoint_batch_commit(dbg, &batch);
+    breakpoint_batch_destroy(&batch);
 
-    dbg = debugger_alloc();
-    if (!dbg) {
-        printf("Couldn't allocate debugger\n");
-        return -1;
+    for (i = 0; i < cov->count; i++) {
+        bp = debugger_breakpoint_at(dbg,
+                (void *)(cov->blocks[i] + cov->bias));
+        if (bp != NULL && bp->coverage)
+            __coverage_drop(dbg, bp, gone);
     }
 
-    pid = fork();
-    if (pid == 0) {
-        printf("Child started.\n");
-        personality(ADDR_NO_RANDOMIZE);
-        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
-        execl(program, program, NULL);
+    if (coverage_write(cov) < 0)
+        printf("Couldn't write %s: %s\n", cov->path, strerror(errno));
+    else
+        printf("%lu of %lu blocks ran, written to %s\n", cov->hit,
+                cov->count, cov->path);
+    coverage_free(cov);
+    dbg->coverage = NULL;
+}
+
+/*
+ * Handle `coverage [file]`: start collecting the basic blocks of the
+ * program that run, which are written to `file` when it exits, or tell
+ * how many ran so far.
+ */
+void handle_coverage_command(struct debugger *dbg, char **args)
+{
+    const struct symbol *syms;
+    unsigned long addr = 0, size = 0, nsyms, armed, pages;
+    const uint8_t *text;
+
+    if (args[1] == NULL) {
+        if (dbg->coverage == NULL)
+            printf("No coverage is being collected.\n");
+        else
+            printf("%lu of %lu blocks ran\n", dbg->coverage->hit,
+                    dbg->coverage->count);
+        return;
     }
-    else if (pid >= 1) {
-        printf("Parent process.\n");
-        debugger_init(dbg, program, pid);
-        debugger_launch(dbg);
+
+    if (dbg->coverage != NULL) {
+        printf("Coverage is already being collected to %s\n",
+                dbg->coverage->path);
+        return;
     }
 
-    return 0;
+    text = dbg->symbols != NULL ?
+        symbol_text(dbg->symbols, &addr, &size) : NULL;
+    syms = dbg->symbols != NULL ? symbol_all(dbg->symbols, &nsyms) : NULL;
+    if (text == NULL || syms == NULL) {
+        printf("No code or symbols to find the blocks of the program in.\n");
+        return;
+    }
+
+    dbg->coverage = coverage_alloc(text, addr, size, syms, nsyms,
+            dbg->symbols->bias, args[1]);
+    if (dbg->coverage == NULL) {
+        printf("Out of memory\n");
+        return;
+    }
+
+    armed = __coverage_arm(dbg, &pages);
+    printf("Coverage of %lu blocks, %lu INT3s written in %lu pages\n",
+            dbg->coverage->count, armed, pages);
 }
 
+/* Stepping policies of `debugger_resume()` */
+#define RESUME_CONTINUE     0   /* until something stops the debugee */
+#define RESUME_STEP         1   /* for a single instruction */
+#define RESUME_BLOCK        2   /* until a branch is taken */
 
 /*
- * SIDENOTES: Following are points that I must keep in mind next time
- * come back.
+ * Set debug register `n` of every thread of the debugee, each thread
+ * having its own.
  *
- * Implement breakpoint deletion functions
- * Find a way to handle breakpoint numbers
- * Fix empty input segmentation fault
+ * @return - 0 on success, -1 on error
+ */
+static int __debugreg_set_all(struct debugger *dbg, int n, unsigned long value)
+{
+    struct hash_slot *slot;
+    struct thread *t;
+
+    hash_table_for_each(&dbg->threads.threads, slot) {
+        t = slot->value;
+        if (debugreg_set(t->tid, n, value) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Split the range [addr, addr + len) into ranges a debug register can
+ * watch: 1, 2, 4 or 8 bytes, aligned on their size.
  *
- * Note: Consider using a hash table to store breakpoints instead lin-
- * -ked lists. Consider using the breakpoint address as a key? My fear
- *  of hash tables is: possible issues with hash collision.
+ * @return - the number of ranges, -1 if there are more than DR_SLOTS
+ */
+static int __watch_split(unsigned long addr, size_t len,
+        unsigned long *start, unsigned int *size)
+{
+    unsigned int chunk;
+    int n = 0;
+
+    while (len > 0) {
+        if (n == DR_SLOTS)
+            return -1;
+
+        for (chunk = 8; chunk > len || addr % chunk != 0; chunk /= 2)
+            ;
+        start[n] = addr;
+        size[n++] = chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+    return n;
+}
+
+/*
+ * Program the watchpoint `wp` into free debug registers of the debugee.
  *
- * But hash tables seem to me like a better choice than linked lists,
- * because I can easily use the index returned to the user as to cal-
- * -culate the index of the breakpoint in the hash table.
+ * @return - 0 on success, -1 if there are not enough free ones or on
+ *           error
+ */
+static int __watch_arm_hw(struct debugger *dbg, struct watchpoint *wp)
+{
+    static const int rw[] = {
+        [WATCH_WRITE]  = DR_RW_WRITE,
+        [WATCH_ACCESS] = DR_RW_ACCESS,
+        [WATCH_EXEC]   = DR_RW_EXEC,
+    };
+    unsigned long start[DR_SLOTS], dr7 = dbg->dr7;
+    unsigned int size[DR_SLOTS], slots = 0;
+    int n, i, slot, free = 0;
+
+    n = __watch_split((unsigned long)wp->addr, wp->len, start, size);
+    for (slot = 0; slot < DR_SLOTS; slot++)
+        free += dbg->dr_watch[slot] == NULL;
+    if (n < 0 || n > free)
+        return -1;
+
+    for (i = 0, slot = 0; i < n; i++, slot++) {
+        while (dbg->dr_watch[slot] != NULL)
+            slot++;
+        if (__debugreg_set_all(dbg, slot, start[i]) < 0)
+            return -1;
+        dr7 = dr7_enable(dr7, slot, rw[wp->type], size[i]);
+        slots |= 1U << slot;
+    }
+
+    if (__debugreg_set_all(dbg, DR_CONTROL, dr7) < 0)
+        return -1;
+
+    dbg->dr7 = dr7;
+    for (slot = 0; slot < DR_SLOTS; slot++) {
+        if (slots & (1U << slot))
+            dbg->dr_watch[slot] = wp;
+    }
+    wp->slots = slots;
+    wp->enabled = 1;
+    return 0;
+}
+
+/*
+ * Free the debug registers of the watchpoint `wp`.
+ */
+static void __watch_disarm_hw(struct debugger *dbg, struct watchpoint *wp)
+{
+    int slot;
+
+    for (slot = 0; slot < DR_SLOTS; slot++) {
+        if (wp->slots & (1U << slot)) {
+            dbg->dr7 = dr7_disable(dbg->dr7, slot);
+            dbg->dr_watch[slot] = NULL;
+        }
+    }
+    __debugreg_set_all(dbg, DR_CONTROL, dbg->dr7);
+    wp->slots = 0;
+    wp->enabled = 0;
+}
+
+/*
+ * Give the pages of the range [addr, addr + len) the protection the
+ * software watchpoints over them call for.
  *
- * If I can fix the hash collision issue, I can easily use the index 
- * returned to the user as an index for deletion. A hash table seems 
- * like the best data structure for this scenario.
+ * @return - 0 on success, -1 on error
+ */
+static int __watch_protect(struct debugger *dbg, unsigned long addr,
+        size_t len)
+{
+    struct watch_page *p;
+    unsigned long page;
+
+    for (page = addr & PAGE_MASK; page < addr + len; page += PAGE_SIZE) {
+        p = watch_index_page(&dbg->soft_watch, page);
+        if (p != NULL && inject_syscall(dbg, SYS_mprotect, page, PAGE_SIZE,
+                    watch_page_prot(p), 0, 0, 0) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Watch `wp` by taking the access it watches for away from its pages.
+ * Instructions cannot be watched that way, nor can code be watched for
+ * reads, as the debugee would have to run code without access to it.
  *
+ * @return - 0 on success, -1 on error, which is reported
  */
+static int __watch_arm_soft(struct debugger *dbg, struct watchpoint *wp)
+{
+    unsigned long start = (unsigned long)wp->addr, page;
+    struct mem_region *regions;
+    struct watch_page *p;
+    int nregions, i, prot = 0;
+
+    if (wp->type == WATCH_EXEC) {
+        printf("No hardware watchpoint register left, use a breakpoint "
+                "to stop at %p\n", wp->addr);
+        return -1;
+    }
+
+    /* The pages of the range are in one mapping, and have its protection */
+    if (watch_index_covers_new(&dbg->soft_watch, start, wp->len)) {
+        nregions = pagemap_regions(dbg->dbge_pid, &regions, 0);
+        if (nregions < 0)
+            return -1;
+        for (i = 0; i < nregions && regions[i].end <= start; i++)
+            ;
+        if (i == nregions || regions[i].start > start ||
+                regions[i].end < start + wp->len) {
+            printf("Cannot watch %zu bytes at %p: not in a single mapping\n",
+                    wp->len, wp->addr);
+            free(regions);
+            return -1;
+        }
+        prot = regions[i].prot;
+        free(regions);
+    }
+
+    for (page = start & PAGE_MASK; page < start + wp->len; page += PAGE_SIZE) {
+        p = watch_index_page(&dbg->soft_watch, page);
+        if (wp->type == WATCH_ACCESS &&
+                ((p != NULL ? p->prot : prot) & PROT_EXEC)) {
+            printf("Cannot watch code at %p for reads without a hardware "
+                    "watchpoint register\n", wp->addr);
+            return -1;
+        }
+    }
+
+    if (watch_index_add(&dbg->soft_watch, wp, prot) < 0)
+        return -1;
+    if (__watch_protect(dbg, start, wp->len) < 0) {
+        printf("Cannot protect the pages of %p\n", wp->addr);
+        watch_index_remove(&dbg->soft_watch, wp);
+        __watch_protect(dbg, start, wp->len);
+        return -1;
+    }
+
+    wp->slots = 0;
+    wp->enabled = 1;
+    return 0;
+}
+
+/*
+ * Give the pages of the software watchpoint `wp` their access back,
+ * unless other watchpoints are over them.
+ */
+static void __watch_disarm_soft(struct debugger *dbg, struct watchpoint *wp)
+{
+    watch_index_remove(&dbg->soft_watch, wp);
+    __watch_protect(dbg, (unsigned long)wp->addr, wp->len);
+    wp->enabled = 0;
+}
+
+/*
+ * Start watching for `wp`, in the debug registers if there are enough
+ * free ones, with page protection otherwise.
+ *
+ * @return - 0 on success, -1 on error
+ */
+static int __watch_arm(struct debugger *dbg, struct watchpoint *wp)
+{
+    if (__watch_arm_hw(dbg, wp) == 0)
+        return 0;
+    return __watch_arm_soft(dbg, wp);
+}
+
+/*
+ * Stop watching for `wp`.
+ */
+static void __watch_disarm(struct debugger *dbg, struct watchpoint *wp)
+{
+    if (wp->slots != 0)
+        __watch_disarm_hw(dbg, wp);
+    else
+        __watch_disarm_soft(dbg, wp);
+}
+
+/*
+ * Program the debug registers of thread `tid`, which starts without
+ * any, the way they are in the other threads.
+ *
+ * @return - 0 on success, -1 on error
+ */
+static int __watch_program(struct debugger *dbg, pid_t tid)
+{
+    unsigned long start[DR_SLOTS];
+    struct sl_list_node *current;
+    unsigned int size[DR_SLOTS];
+    struct watchpoint *wp;
+    int i, slot;
+
+    if (dbg->dr7 == 0)
+        return 0;
+
+    /* The ranges of a watchpoint are in its registers in order */
+    sl_list_traverse((&dbg->watchpoints), current) {
+        wp = sl_list_node_container(current, struct watchpoint, entry);
+        if (wp->slots == 0)
+            continue;
+        __watch_split((unsigned long)wp->addr, wp->len, start, size);
+        for (i = 0, slot = 0; slot < DR_SLOTS; slot++) {
+            if (wp->slots & (1U << slot))
+                debugreg_set(tid, slot, start[i++]);
+        }
+    }
+    return debugreg_set(tid, DR_CONTROL, dbg->dr7);
+}
+
+/*
+ * Program the debug registers of a new debugee the way they were in
+ * the previous one, protect the pages of the software watchpoints,
+ * which it may have with other protections, and take note of the
+ * content of the watched ranges there.
+ */
+static void __watch_reset(struct debugger *dbg)
+{
+    struct sl_list_node *current;
+    struct watchpoint *wp;
+    struct hash_slot *hslot;
+
+    sl_list_traverse((&dbg->watchpoints), current) {
+        wp = sl_list_node_container(current, struct watchpoint, entry);
+        if (wp->type == WATCH_WRITE)
+            read_memory(dbg, wp->addr, wp->value, wp->len);
+    }
+
+    if (__watch_program(dbg, dbg->dbge_pid) < 0)
+        printf("Couldn't put the hardware watchpoints back\n");
+
+    hash_table_for_each(&dbg->soft_watch.pages, hslot) {
+        if (__watch_protect(dbg, hslot->key, PAGE_SIZE) < 0) {
+            printf("Couldn't put the software watchpoints back\n");
+            break;
+        }
+    }
+}
+
+/* Pages an instruction may touch, e.g when it crosses a page boundary */
+#define WATCH_FAULT_MAX_PAGES   4
+
+/*
+ * Go over the access that made the debugee fault on a page protected
+ * for software watchpoints: the pages it touches get their protection
+ * back for a single step over the instruction, and are protected again.
+ *
+ * The size of the access is that of the memory operand of the
+ * faulting instruction, or 8 bytes if the decoder does not know it.
+ * A write watchpoint is only hit if the watched content changed, which
+ * is also the only way to tell writes from reads on a page watched for
+ * reads.
+ *
+ * @param how         - the RESUME_* policy the debugee was resumed with
+ * @param wait_status - the SIGSEGV stop on entry, replaced by the stop
+ *                      that follows the step
+ * @return            - 1 if the debugee has to be resumed again, 0 if
+ *                      the stop stands, a watchpoint hit being left in
+ *                      `dbg->soft_hit`, -1 if the fault has nothing to
+ *                      do with the watchpoints
+ */
+static int __watch_fault(struct debugger *dbg, int how, int *wait_status)
+{
+    struct watch_page *pages[WATCH_FAULT_MAX_PAGES], *p;
+    struct watchpoint *wp = NULL;
+    uint8_t code[X86_MAX_INSN_LEN];
+    struct user_regs_struct regs;
+    struct x86_insn insn;
+    int npages = 0, branch = 0, status, changed, i;
+    unsigned long addr, dr6;
+    size_t size = 8;
+    siginfo_t si;
+
+    if (debugger_get_regs(dbg, &regs) < 0)
+        return -1;
+    if (read_insn(dbg, (void *)regs.rip, code, &insn) == 0) {
+        branch = insn.kind != X86_INSN_OTHER;
+        if (insn.mem_size != 0)
+            size = insn.mem_size;
+    }
+
+    status = *wait_status;
+    while (WIFSTOPPED(status) && WSTOPSIG(status) == SIGSEGV &&
+            npages < WATCH_FAULT_MAX_PAGES) {
+        if (ptrace(PTRACE_GETSIGINFO, dbg->dbge_pid, NULL, &si) < 0 ||
+                si.si_code != SEGV_ACCERR)
+            break;
+
+        addr = (unsigned long)si.si_addr;
+        p = watch_index_page(&dbg->soft_watch, addr);
+        if (p == NULL || watch_page_prot(p) == p->prot)
+            break;
+
+        /* Still faults with the protection of the page without
+         * watchpoints */
+        for (i = 0; i < npages && pages[i] != p; i++)
+            ;
+        if (i < npages)
+            break;
+
+        if (wp == NULL)
+            wp = watch_index_find(&dbg->soft_watch, addr, size,
+                    (1U << WATCH_ACCESS) | (1U << WATCH_WRITE));
+
+        if (inject_syscall(dbg, SYS_mprotect, p->page, PAGE_SIZE, p->prot,
+                    0, 0, 0) < 0)
+            break;
+        pages[npages++] = p;
+
+        if (ptrace(PTRACE_SINGLESTEP, dbg->dbge_pid, NULL, NULL) < 0 ||
+                waitpid(dbg->dbge_pid, &status, __WALL) < 0)
+            return -1;
+        debugger_invalidate_regs(dbg);
+    }
+
+    if (npages == 0)
+        return -1;
+    *wait_status = status;
+    if (!WIFSTOPPED(status))
+        return -1;
+
+    for (i = 0; i < npages; i++)
+        __watch_protect(dbg, pages[i]->page, PAGE_SIZE);
+    if (WSTOPSIG(status) != SIGTRAP)
+        return -1;
+
+    if (wp != NULL && wp->type == WATCH_WRITE) {
+        changed = read_memory(dbg, wp->addr, wp->old_value, wp->len) ==
+            (ssize_t)wp->len && memcmp(wp->old_value, wp->value, wp->len);
+        if (!changed)
+            wp = NULL;
+    }
+    dbg->soft_hit = wp;
+
+    /* A hardware watchpoint may have fired during the step */
+    if (wp != NULL || how == RESUME_STEP || (how == RESUME_BLOCK && branch))
+        return 0;
+    if (dbg->dr7 != 0 && debugreg_get(dbg->dbge_pid, DR_STATUS, &dr6) == 0 &&
+            (dr6 & DR_STATUS_HIT) != 0)
+        return 0;
+    return 1;
+}
+
+/*
+ * Find the watchpoint that made the debugee stop with SIGTRAP, if it
+ * is a software watchpoint or one of those in the debug registers, and
+ * take note of its new content.
+ *
+ * @return - the watchpoint, or NULL
+ */
+static struct watchpoint *__watch_hit(struct debugger *dbg)
+{
+    struct watchpoint *wp = dbg->soft_hit;
+    unsigned long dr6;
+    int slot;
+
+    dbg->soft_hit = NULL;
+    if (wp == NULL) {
+        if (dbg->dr7 == 0 ||
+                debugreg_get(dbg->dbge_pid, DR_STATUS, &dr6) < 0 ||
+                (dr6 & DR_STATUS_HIT) == 0)
+            return NULL;
+
+        /* The processor never clears it */
+        debugreg_set(dbg->dbge_pid, DR_STATUS, 0);
+
+        for (slot = 0; wp == NULL && slot < DR_SLOTS; slot++) {
+            if ((dr6 & (1UL << slot)) && dr7_enabled(dbg->dr7, slot))
+                wp = dbg->dr_watch[slot];
+        }
+    }
+
+    if (wp != NULL && wp->type == WATCH_WRITE) {
+        memcpy(wp->old_value, wp->value, wp->len);
+        read_memory(dbg, wp->addr, wp->value, wp->len);
+    }
+    return wp;
+}
+
+/*
+ * Watch the `len` bytes at `addr` for `type` accesses, one of the
+ * WATCH_* values.
+ */
+void set_watchpoint(struct debugger *dbg, void *addr, size_t len, int type)
+{
+    struct watchpoint *wp;
+
+    /* Instructions are watched for at their first byte */
+    if (type == WATCH_EXEC)
+        len = 1;
+    if (len == 0) {
+        printf("Cannot watch 0 bytes\n");
+        return;
+    }
+
+    wp = calloc(1, sizeof(struct watchpoint));
+    if (wp == NULL)
+        return;
+    wp->addr = addr;
+    wp->len = len;
+    wp->type = type;
+
+    if (type == WATCH_WRITE) {
+        wp->value = malloc(len * 2);
+        if (wp->value == NULL) {
+            free(wp);
+            return;
+        }
+        wp->old_value = wp->value + len;
+        if (read_memory(dbg, addr, wp->value, len) != (ssize_t)len) {
+            printf("Cannot access memory at %p: %s\n", addr,
+                    strerror(errno));
+            goto fail;
+        }
+    }
+
+    if (__watch_arm(dbg, wp) < 0)
+        goto fail;
+
+    wp->number = dbg->watch_number++;
+    sl_list_add_end(&dbg->watchpoints, &wp->entry);
+    printf("%s watchpoint %u at %p, %zu bytes\n",
+            wp->slots != 0 ? "Hardware" : "Software", wp->number, addr, len);
+    return;
+
+fail:
+    free(wp->value);
+    free(wp);
+}
+
+/*
+ * Delete watchpoint number `number`. It is kept, disabled, for the
+ * history to be replayed.
+ */
+void delete_watchpoint(struct debugger *dbg, unsigned int number)
+{
+    struct watchpoint *wp;
+
+    wp = debugger_watchpoint_get(dbg, number);
+    if (wp == NULL || wp->deleted) {
+        printf("No watchpoint number %u\n", number);
+        return;
+    }
+
+    if (wp->enabled)
+        __watch_disarm(dbg, wp);
+    wp->deleted = 1;
+}
+
+/*
+ * List every watchpoint, in watchpoint number order.
+ */
+void info_watchpoints(struct debugger *dbg)
+{
+    static const char *types[] = {
+        [WATCH_WRITE]  = "write",
+        [WATCH_ACCESS] = "access",
+        [WATCH_EXEC]   = "exec",
+    };
+    struct sl_list_node *current;
+    struct watchpoint *wp;
+
+    sl_list_traverse((&dbg->watchpoints), current) {
+        wp = sl_list_node_container(current, struct watchpoint, entry);
+        if (wp->deleted)
+            continue;
+        printf("Watchpoint %-4u %p %zu bytes %s%s\n", wp->number, wp->addr,
+                wp->len, types[wp->type], wp->slots != 0 ? ", hw" : ", sw");
+    }
+}
+
+/*
+ * Print `len` bytes of memory in `value`, as a number if it fits.
+ */
+static void __print_value(const char *what, const uint8_t *value, size_t len)
+{
+    uint64_t n = 0;
+    size_t i;
+
+    printf("%s = ", what);
+    if (len <= sizeof(n)) {
+        memcpy(&n, value, len);
+        printf("%#lx\n", n);
+        return;
+    }
+
+    for (i = 0; i < len; i++)
+        printf("%02x%s", value[i], i + 1 < len ? " " : "\n");
+}
+
+/*
+ * Handle a SIGTRAP stop of the debugee. If the trap was caused by
+ * one of our INT3s, RIP points one byte past the breakpoint address,
+ * and is rewound to it.
+ *
+ * @return - the breakpoint that was hit, or NULL
+ */
+struct breakpoint *handle_sigtrap(struct debugger *dbg)
+{
+    struct user_regs_struct regs;
+    struct breakpoint *bp;
+
+    if (debugger_get_regs(dbg, &regs) < 0)
+        return NULL;
+
+    bp = debugger_breakpoint_at(dbg, (void *)(regs.rip - 1));
+    if (bp == NULL || !breakpoint_has_int3(bp))
+        return NULL;
+
+    regs.rip = (unsigned long)bp->addr;
+    debugger_set_regs(dbg, &regs);
+    dbg->stopped_bp = bp;
+    return bp;
+}
+
+/* Flags of `__breakpoints_written()` */
+#define WRITTEN_FAST    1   /* the fast tracepoints as well */
+#define WRITTEN_OWN     2   /* only those children get no copy of */
+
+/*
+ * List the breakpoints written into the debugee, with the code they
+ * replace. Fast tracepoints are left out unless WRITTEN_FAST is set in
+ * `flags`. With WRITTEN_OWN, the breakpoints listed are only those that
+ * stay with the debugee when it forks: the internal breakpoints, the
+ * coverage, and the fast tracepoints, see inc/process.h.
+ *
+ * @param nbps - where to store the number of breakpoints
+ * @return     - the breakpoints, to be freed, NULL on allocation failure
+ */
+static struct checkpoint_bp *__breakpoints_written(struct debugger *dbg,
+        int flags, unsigned int *nbps)
+{
+    struct checkpoint_bp *bps;
+    struct hash_slot *slot;
+    struct breakpoint *bp;
+
+    bps = malloc(sizeof(*bps) * (hash_table_count(&dbg->bp_table) + 1));
+    if (bps == NULL)
+        return NULL;
+
+    *nbps = 0;
+    hash_table_for_each(&dbg->bp_table, slot) {
+        bp = slot->value;
+        if (!breakpoint_is_enabled(bp) ||
+                (bp->kind == BREAKPOINT_FAST && !(flags & WRITTEN_FAST)) ||
+                ((flags & WRITTEN_OWN) && bp->kind == BREAKPOINT_INT3 &&
+                 !bp->temporary && !bp->coverage))
+            continue;
+        bps[*nbps].addr = bp->addr;
+        if (bp->kind == BREAKPOINT_FAST) {
+            memcpy(bps[*nbps].saved, bp->fast->saved, bp->fast->len);
+            bps[*nbps].len = bp->fast->len;
+        }
+        else {
+            bps[*nbps].saved[0] = breakpoint_get_saved_data(bp);
+            bps[*nbps].len = 1;
+        }
+        (*nbps)++;
+    }
+    return bps;
+}
+
+/*
+ * Write the INT3s and the page protections of the software watchpoints
+ * back into the debugee, through its stopped thread `tid`, after they
+ * were taken out of the memory it shared with a vfork child.
+ */
+static void __breakpoints_rewrite(struct debugger *dbg, pid_t tid)
+{
+    long args[INJECT_MAX_ARGS] = { 0 };
+    struct breakpoint_batch batch;
+    struct user_regs_struct regs;
+    struct hash_slot *slot;
+
+    breakpoint_batch_init(&batch);
+    hash_table_for_each(&dbg->bp_table, slot)
+        breakpoint_batch_add(&batch, slot->value, BATCH_REWRITE);
+    breakpoint_batch_commit(dbg, &batch);
+    breakpoint_batch_destroy(&batch);
+
+    if (ptrace(PTRACE_GETREGS, tid, NULL, &regs) < 0)
+        return;
+
+    hash_table_for_each(&dbg->soft_watch.pages, slot) {
+        args[0] = slot->key;
+        args[1] = PAGE_SIZE;
+        args[2] = watch_page_prot(slot->value);
+        __inject_syscall(tid, debugger_mem_fd(dbg), &regs, SYS_mprotect,
+                args);
+    }
+}
+
+/*
+ * Take the breakpoints `bps` and the page protections of the software
+ * watchpoints out of the stopped process `pid`, a copy of the debugee
+ * or a process that shares its memory, before it is detached.
+ */
+static void __process_clean(struct debugger *dbg, pid_t pid,
+        struct checkpoint_bp *bps, unsigned int nbps)
+{
+    long args[INJECT_MAX_ARGS] = { 0 };
+    struct user_regs_struct regs;
+    struct hash_slot *slot;
+    struct watch_page *p;
+    unsigned int i;
+
+    for (i = 0; i < nbps; i++)
+        __write_memory(pid, MEM_FD_NONE, bps[i].addr, bps[i].saved,
+                bps[i].len);
+
+    if (ptrace(PTRACE_GETREGS, pid, NULL, &regs) < 0)
+        return;
+
+    hash_table_for_each(&dbg->soft_watch.pages, slot) {
+        p = slot->value;
+        if (watch_page_prot(p) == p->prot)
+            continue;
+        args[0] = slot->key;
+        args[1] = PAGE_SIZE;
+        args[2] = p->prot;
+        __inject_syscall(pid, MEM_FD_NONE, &regs, SYS_mprotect, args);
+    }
+}
+
+/*
+ * Make `t` the current thread of the debugee. The registers and stop
+ * state of the previous one are put aside in its `struct thread`.
+ */
+static void __thread_switch(struct debugger *dbg, struct thread *t)
+{
+    struct thread *prev;
+
+    if (t->tid == dbg->dbge_pid)
+        return;
+
+    /* Gone if it exited */
+    prev = thread_get(&dbg->threads, dbg->dbge_pid);
+    if (prev != NULL) {
+        debugger_flush_regs(dbg);
+        prev->regs = dbg->regs;
+        prev->regs_state = dbg->regs_state;
+        prev->stopped_bp = dbg->stopped_bp;
+        prev->pending_signal = dbg->pending_signal;
+    }
+
+    dbg->dbge_pid = t->tid;
+    dbg->regs = t->regs;
+    dbg->regs_state = t->regs_state;
+    dbg->fpregs_state = REGS_INVALID;
+    dbg->stopped_bp = t->stopped_bp;
+    dbg->pending_signal = t->pending_signal;
+}
+
+/* Events of the debugee we get, see inc/thread.h and inc/process.h */
+#define DEBUGEE_PTRACE_OPTIONS  (PTRACE_O_EXITKILL | PTRACE_O_TRACECLONE | \
+        PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | \
+        PTRACE_O_TRACEVFORKDONE | PTRACE_O_TRACEEXEC)
+
+/* Stop of a thread that was interrupted, or that just started */
+#define __is_event_stop(status)     ((status) >> 16 == PTRACE_EVENT_STOP)
+
+/*
+ * Take note of the new thread `tid` of the debugee, that the kernel
+ * attached to us, and resume it if `run` is set. It starts with a
+ * PTRACE_EVENT_STOP, which may already have been waited for.
+ */
+static void __thread_new(struct debugger *dbg, pid_t tid, int run)
+{
+    struct thread *t;
+    int status;
+
+    t = thread_get(&dbg->threads, tid);
+    if (t == NULL) {
+        t = thread_add(&dbg->threads, tid);
+        if (t == NULL)
+            return;
+        waitpid(tid, &status, __WALL);
+    }
+
+    /* Debug registers are not inherited */
+    __watch_program(dbg, tid);
+
+    if (run && ptrace(PTRACE_CONT, tid, NULL, NULL) == 0)
+        t->state = THREAD_RUNNING;
+}
+
+/*
+ * Wait for the running thread `tid`, that was interrupted, to stop. A
+ * stop it had on its own meanwhile is kept for later.
+ */
+static void __thread_wait_stop(struct debugger *dbg, pid_t tid)
+{
+    unsigned long msg;
+    struct thread *t;
+    int status;
+
+    t = thread_get(&dbg->threads, tid);
+    if (t == NULL || waitpid(tid, &status, __WALL) < 0)
+        return;
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        thread_remove(&dbg->threads, tid);
+        return;
+    }
+
+    t->state = THREAD_STOPPED;
+    t->regs_state = REGS_INVALID;
+    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
+        /* The interrupt is still to come */
+        if (ptrace(PTRACE_GETEVENTMSG, tid, NULL, &msg) == 0)
+            __thread_new(dbg, msg, 0);
+    }
+    else if (__is_event_stop(status))
+        t->stop_requested = 0;
+    else
+        t->pending_status = status;
+}
+
+/*
+ * Stop every running thread of the debugee. In non-stop mode, threads
+ * stopped with `hold` set only are for a moment, see
+ * `__threads_release()`.
+ */
+static void __threads_stop(struct debugger *dbg, int hold)
+{
+    struct hash_slot *slot;
+    struct thread *t;
+    pid_t *tids;
+    int n = 0, i;
+
+    tids = malloc(thread_count(&dbg->threads) * sizeof(*tids));
+    if (tids == NULL)
+        return;
+
+    hash_table_for_each(&dbg->threads.threads, slot) {
+        t = slot->value;
+        if (t->state != THREAD_RUNNING)
+            continue;
+        if (!t->stop_requested &&
+                ptrace(PTRACE_INTERRUPT, t->tid, NULL, NULL) == 0)
+            t->stop_requested = 1;
+        t->held = hold;
+        tids[n++] = t->tid;
+    }
+
+    /* Threads may come and go, the table is not walked meanwhile */
+    for (i = 0; i < n; i++)
+        __thread_wait_stop(dbg, tids[i]);
+    free(tids);
+}
+
+/*
+ * Let the threads held by `__threads_stop()` run again, unless they
+ * had a stop of their own to report.
+ */
+static void __threads_release(struct debugger *dbg)
+{
+    struct hash_slot *slot;
+    struct thread *t;
+
+    hash_table_for_each(&dbg->threads.threads, slot) {
+        t = slot->value;
+        if (!t->held)
+            continue;
+        t->held = 0;
+        if (t->pending_status == 0 && t->tid != dbg->dbge_pid &&
+                ptrace(PTRACE_CONT, t->tid, NULL, NULL) == 0)
+            t->state = THREAD_RUNNING;
+    }
+}
+
+/*
+ * Resume every stopped thread of the debugee but the current one.
+ * Threads stopped at a breakpoint go through the displaced copy of
+ * its instruction, not to hit it once more right away.
+ */
+static void __threads_resume(struct debugger *dbg)
+{
+    struct hash_slot *slot;
+    struct thread *t;
+
+    hash_table_for_each(&dbg->threads.threads, slot) {
+        t = slot->value;
+        if (t->tid == dbg->dbge_pid || t->state != THREAD_STOPPED)
+            continue;
+
+        if (t->stopped_bp != NULL && t->regs_state != REGS_INVALID &&
+                displaced_prepare(dbg, t->stopped_bp) == 0) {
+            t->regs.rip = (unsigned long)t->stopped_bp->displaced;
+            ptrace(PTRACE_SETREGS, t->tid, NULL, &t->regs);
+        }
+        t->stopped_bp = NULL;
+        t->regs_state = REGS_INVALID;
+
+        if (ptrace(PTRACE_CONT, t->tid, NULL, t->pending_signal) == 0)
+            t->state = THREAD_RUNNING;
+        t->pending_signal = 0;
+    }
+}
+
+/*
+ * Check whether thread `tid` stopped at an INT3 that is gone, because
+ * its breakpoint was deleted before the stop could be reported. RIP is
+ * then moved back for the instruction to be executed for real.
+ */
+static int __trap_is_stale(struct debugger *dbg, pid_t tid)
+{
+    struct user_regs_struct regs;
+    uint8_t byte;
+    siginfo_t si;
+
+    if (ptrace(PTRACE_GETSIGINFO, tid, NULL, &si) < 0 ||
+            si.si_code != SI_KERNEL ||
+            ptrace(PTRACE_GETREGS, tid, NULL, &regs) < 0 ||
+            read_memory(dbg, (void *)(regs.rip - 1), &byte, 1) != 1 ||
+            byte == INT3)
+        return 0;
+
+    regs.rip--;
+    return ptrace(PTRACE_SETREGS, tid, NULL, &regs) == 0;
+}
+
+static void __history_reset(struct debugger *dbg);
+static void __step_done(struct debugger *dbg, int gone);
+static long __proc_field(pid_t pid, const char *file, const char *field);
+
+/* Exchange `a` and `b` */
+#define __swap(a, b)    do { \
+        __typeof__(a) __tmp = (a); \
+        (a) = (b); \
+        (b) = __tmp; \
+    } while (0)
+
+/*
+ * Exchange the state of the process that has the focus, which is in the
+ * debugger, with the state put aside in `p`.
+ */
+static void __process_swap(struct debugger *dbg, struct process *p)
+{
+    unsigned int i;
+
+    __swap(dbg->dbge_pid, p->dbge_pid);
+    __swap(dbg->threads, p->threads);
+    __swap(dbg->bpa, p->bpa);
+    __swap(dbg->bpa_count, p->bpa_count);
+    __swap(dbg->bpa_cap, p->bpa_cap);
+    __swap(dbg->bpa_free, p->bpa_free);
+    __swap(dbg->bp_table, p->bp_table);
+    __swap(dbg->mem_fd, p->mem_fd);
+    __swap(dbg->decode, p->decode);
+    __swap(dbg->regs, p->regs);
+    __swap(dbg->regs_state, p->regs_state);
+    __swap(dbg->stopped_bp, p->stopped_bp);
+    __swap(dbg->pending_signal, p->pending_signal);
+    __swap(dbg->dstep_areas, p->dstep_areas);
+    __swap(dbg->dstep_free, p->dstep_free);
+    __swap(dbg->watchpoints, p->watchpoints);
+    for (i = 0; i < DR_SLOTS; i++)
+        __swap(dbg->dr_watch[i], p->dr_watch[i]);
+    __swap(dbg->dr7, p->dr7);
+    __swap(dbg->soft_watch, p->soft_watch);
+    __swap(dbg->soft_hit, p->soft_hit);
+    __swap(dbg->symbols, p->symbols);
+    __swap(dbg->coverage, p->coverage);
+}
+
+/*
+ * Give the focus to process `p`, see inc/process.h. The state of the
+ * process that had it is put aside, and the events of its threads are
+ * routed to it from then on.
+ */
+static void __process_switch(struct debugger *dbg, struct process *p)
+{
+    struct process *prev = dbg->process;
+    struct hash_slot *slot;
+
+    if (p == prev)
+        return;
+
+    debugger_flush_regs(dbg);
+
+    /* The entry of the process that has the focus is left empty */
+    __process_swap(dbg, prev);
+    prev->state = PROCESS_TRACED;
+    if (process_route(&dbg->procs, prev) < 0)
+        printf("Couldn't keep track of the threads of process %d\n",
+                prev->pid);
+
+    /* Stops it did not report yet, see `__processes_pending()` */
+    hash_table_for_each(&prev->threads.threads, slot) {
+        if (((struct thread *)slot->value)->pending_status != 0) {
+            process_set_pending(&dbg->procs, prev);
+            break;
+        }
+    }
+
+    process_unroute(&dbg->procs, p);
+    __process_swap(dbg, p);
+    p->state = PROCESS_FOCUSED;
+    dbg->process = p;
+
+    dbg->fpregs_state = REGS_INVALID;
+    stop_cache_clear(&dbg->stop);
+}
+
+/*
+ * Resume every stopped thread of the process that has the focus, the
+ * current one included, e.g for it to run on its own once it loses the
+ * focus.
+ */
+static void __process_run(struct debugger *dbg)
+{
+    pid_t tid = dbg->dbge_pid;
+    struct thread *t;
+
+    /* Put aside like by `__thread_switch()`, to be resumed along */
+    t = thread_get(&dbg->threads, tid);
+    if (t != NULL) {
+        debugger_flush_regs(dbg);
+        t->regs = dbg->regs;
+        t->regs_state = dbg->regs_state;
+        t->stopped_bp = dbg->stopped_bp;
+        t->pending_signal = dbg->pending_signal;
+    }
+
+    dbg->dbge_pid = 0;
+    __threads_resume(dbg);
+    dbg->dbge_pid = tid;
+
+    dbg->stopped_bp = NULL;
+    dbg->pending_signal = 0;
+    debugger_invalidate_regs(dbg);
+}
+
+/*
+ * Free the breakpoints of `bp_table`, e.g those of a process that
+ * exited.
+ */
+static void __breakpoints_free(struct hash_table *bp_table)
+{
+    struct hash_slot *slot;
+    struct breakpoint *bp;
+
+    hash_table_for_each(bp_table, slot) {
+        bp = slot->value;
+        condition_free(bp->condition);
+        free(bp->fast);
+        free(bp);
+    }
+    hash_table_clear(bp_table);
+}
+
+/*
+ * Give process `p`, that the process that has the focus just forked,
+ * copies of the breakpoints of its parent, with the same numbers. The
+ * breakpoints that stay with the parent are left out, see
+ * inc/process.h.
+ *
+ * @return - 0 on success, -1 on allocation failure
+ */
+static int __breakpoints_copy(struct debugger *dbg, struct process *p)
+{
+    struct breakpoint_array *bpa;
+    struct breakpoint *bp, *copy;
+    char err[128];
+    unsigned int pos, i;
+
+    p->bpa = calloc(dbg->bpa_cap, sizeof(*p->bpa));
+    if (p->bpa == NULL && dbg->bpa_cap > 0)
+        return -1;
+    p->bpa_cap = dbg->bpa_cap;
+
+    for (pos = 0; pos < dbg->bpa_count; pos++) {
+        bpa = debugger_bpa_alloc();
+        if (bpa == NULL)
+            return -1;
+        bpa->pos = pos;
+        p->bpa[p->bpa_count++] = bpa;
+
+        for (i = 0; i < MAX_BREAKPOINTS_PER_LIST; i++) {
+            bp = breakpoint_array_get_breakpoint(dbg->bpa[pos], i);
+            if (bp == NULL || bp->kind != BREAKPOINT_INT3 || bp->temporary)
+                continue;
+
+            copy = malloc(sizeof(*copy));
+            if (copy == NULL)
+                return -1;
+            *copy = *bp;
+            copy->pid = p->pid;
+            copy->displaced = NULL;
+            copy->displaced_state = DISPLACED_NONE;
+            if (bp->condition != NULL)
+                copy->condition = condition_compile(bp->condition->text,
+                        err, sizeof(err));
+
+            if (hash_table_insert(&p->bp_table, (unsigned long)copy->addr,
+                        copy) < 0) {
+                condition_free(copy->condition);
+                free(copy);
+                return -1;
+            }
+            breakpoint_array_set_breakpoint(bpa, i, copy);
+        }
+
+        if (!breakpoint_array_full(bpa))
+            sl_list_add(&p->bpa_free, &bpa->entry);
+    }
+    return 0;
+}
+
+/*
+ * Add `pid`, that the process that has the focus just forked and that
+ * is stopped, to the processes traced, put aside.
+ *
+ * @return - the process, or NULL on allocation failure
+ */
+static struct process *__process_new(struct debugger *dbg, pid_t pid)
+{
+    struct process *p;
+
+    p = process_add(&dbg->procs, pid, PROCESS_TRACED);
+    if (p == NULL)
+        return NULL;
+
+    p->parent = dbg->threads.leader;
+    p->dbge_pid = pid;
+    sl_list_init(&p->bpa_free);
+    sl_list_init(&p->dstep_areas);
+    sl_list_init(&p->dstep_free);
+    sl_list_init(&p->watchpoints);
+    if (dbg->symbols != NULL)
+        p->symbols = symbol_index_share(dbg->symbols);
+
+    if (thread_table_init(&p->threads, pid) < 0 ||
+            hash_table_init(&p->bp_table, MAX_BREAKPOINTS_PER_LIST) < 0 ||
+            decode_cache_init(&p->decode) < 0 ||
+            watch_index_init(&p->soft_watch) < 0 ||
+            __breakpoints_copy(dbg, p) < 0 ||
+            process_route(&dbg->procs, p) < 0) {
+        __breakpoints_free(&p->bp_table);
+        process_remove(&dbg->procs, pid);
+        return NULL;
+    }
+    return p;
+}
+
+/*
+ * Detach `child`, that the debugee just forked and that stopped, once
+ * the breakpoints are out of it, if it could not be traced. A vfork
+ * child shares the memory of the debugee, whose INT3s are written back
+ * on PTRACE_EVENT_VFORK_DONE, and the fast tracepoints are left to it,
+ * it only adds records to the ring.
+ */
+static void __child_detach(struct debugger *dbg, pid_t child, int vfork)
+{
+    struct checkpoint_bp *bps;
+    unsigned int nbps;
+
+    bps = __breakpoints_written(dbg, vfork ? 0 : WRITTEN_FAST, &nbps);
+    if (bps != NULL) {
+        __process_clean(dbg, child, bps, nbps);
+        free(bps);
+    }
+    ptrace(PTRACE_DETACH, child, NULL, NULL);
+    printf("[Detaching after %s from child process %d]\n",
+            vfork ? "vfork" : "fork", child);
+}
+
+/*
+ * Get the child of the fork or vfork event thread `tid` is stopped at,
+ * once the child stopped as well.
+ *
+ * @return - the child, -1 on error
+ */
+static pid_t __fork_child(struct debugger *dbg, pid_t tid)
+{
+    unsigned long msg;
+    struct process *p;
+    int status;
+
+    if (ptrace(PTRACE_GETEVENTMSG, tid, NULL, &msg) < 0)
+        return -1;
+
+    /* Its first stop may have come first */
+    p = process_get(&dbg->procs, msg);
+    if (p != NULL && p->state == PROCESS_NEW)
+        process_remove(&dbg->procs, msg);
+    else if (waitpid(msg, &status, __WALL) < 0)
+        return -1;
+    return msg;
+}
+
+/*
+ * Trace `child`, that thread `tid` of the process that has the focus
+ * just forked and that stopped, as a process of its own, see
+ * inc/process.h. The breakpoints that stay with the parent are taken
+ * out of the child, out of the parent as well with vfork, whose memory
+ * the child shares: they are written back on PTRACE_EVENT_VFORK_DONE,
+ * and the fast tracepoints are left to the child then.
+ *
+ * The child gets the focus if `follow` is set, the parent running on
+ * its own from then on, and runs on its own otherwise.
+ *
+ * @return - the thread left stopped, which is the child if it gets the
+ *           focus
+ */
+static pid_t __process_fork(struct debugger *dbg, pid_t tid, pid_t child,
+        int vfork, int follow)
+{
+    pid_t parent = dbg->threads.leader;
+    struct checkpoint_bp *bps;
+    struct process *p;
+    struct thread *t;
+    unsigned int nbps;
+
+    bps = __breakpoints_written(dbg,
+            vfork ? WRITTEN_OWN : WRITTEN_OWN | WRITTEN_FAST, &nbps);
+    if (bps != NULL) {
+        __process_clean(dbg, child, bps, nbps);
+        free(bps);
+    }
+
+    p = __process_new(dbg, child);
+    if (p == NULL) {
+        printf("Couldn't keep track of process %d\n", child);
+        __child_detach(dbg, child, vfork);
+        return tid;
+    }
+
+    if (!follow) {
+        t = thread_get(&p->threads, child);
+        if (ptrace(PTRACE_CONT, child, NULL, NULL) == 0)
+            t->state = THREAD_RUNNING;
+        printf("[New process %d]\n", child);
+        return tid;
+    }
+
+    /* What the parent was stepping through is left behind */
+    __step_done(dbg, 0);
+
+    /* Stopped at the event, it runs on its own with the others */
+    t = thread_get(&dbg->threads, tid);
+    if (t != NULL)
+        t->state = THREAD_STOPPED;
+    __process_run(dbg);
+    __process_switch(dbg, p);
+    __history_reset(dbg);
+    dbg->procs.reported = child;
+
+    printf("[Attaching after process %d %s to child process %d]\n", parent,
+            vfork ? "vfork" : "fork", child);
+    return child;
+}
+
+/*
+ * Take the process that has the focus, which exited, out of the table
+ * along with its breakpoints and watchpoints, and give the focus to
+ * `next`.
+ */
+static void __process_exit(struct debugger *dbg, struct process *next)
+{
+    struct process *p = dbg->process;
+    struct sl_list_node *node;
+    struct watchpoint *wp;
+
+    __coverage_done(dbg, 1);
+    displaced_reset(dbg);
+    __breakpoints_free(&dbg->bp_table);
+    while (!sl_list_is_empty(&dbg->watchpoints)) {
+        node = dbg->watchpoints.next;
+        sl_list_delete(&dbg->watchpoints);
+        wp = sl_list_node_container(node, struct watchpoint, entry);
+        free(wp->value);
+        free(wp);
+    }
+    thread_table_clear(&dbg->threads);
+    debugger_invalidate_regs(dbg);
+
+    __process_switch(dbg, next);
+    process_remove(&dbg->procs, p->pid);
+}
+
+/*
+ * Take care of the wait event `status` of `pid`, which is a thread of
+ * none of the processes traced: a new thread before its clone event,
+ * or a new process before the fork event of its parent, see
+ * inc/process.h.
+ */
+static void __stray_event(struct debugger *dbg, pid_t pid, int status)
+{
+    struct process *p;
+
+    p = process_get(&dbg->procs, pid);
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        if (p != NULL && p->state == PROCESS_NEW)
+            process_remove(&dbg->procs, pid);
+        return;
+    }
+    if (p != NULL)
+        return;
+
+    if (syscall(SYS_tgkill, dbg->threads.leader, pid, 0) == 0) {
+        thread_add(&dbg->threads, pid);
+        return;
+    }
+
+    /* A new thread of a process put aside */
+    p = process_get(&dbg->procs, __proc_field(pid, "status", "Tgid"));
+    if (p != NULL && p->state == PROCESS_TRACED)
+        process_thread_add(&dbg->procs, p, pid);
+    else
+        process_add(&dbg->procs, pid, PROCESS_NEW);
+}
+
+/*
+ * Check whether `idx` holds the symbols of the same program as `prev`.
+ * Programs without symbols are taken to be the same.
+ */
+static int __symbols_same(struct symbol_index *prev,
+        struct symbol_index *idx)
+{
+    if (prev == NULL || idx == NULL)
+        return prev == idx;
+
+    return prev->size == idx->size && prev->id_len == idx->id_len &&
+        memcmp(prev->id, idx->id, idx->id_len) == 0;
+}
+
+/*
+ * Take care of the exec of the process that has the focus, which is
+ * left with its leader `pid`. The breakpoints, fast tracepoints and
+ * watchpoints are set again at the same addresses if the new program is
+ * the same, and the breakpoints are disabled otherwise. The history
+ * starts over if the process has the focus for the user, see
+ * `__process_event()`.
+ */
+static void __debugee_exec(struct debugger *dbg, pid_t pid, int focused)
+{
+    char path[64], exe[PATH_MAX];
+    struct breakpoint_batch batch;
+    struct symbol_index *idx;
+    struct hash_slot *slot;
+    struct breakpoint *bp;
+    unsigned long failed;
+    ssize_t n;
+    int same;
+
+    snprintf(path, sizeof(path), "/proc/%d/exe", pid);
+    idx = symbol_index_open(path);
+    same = __symbols_same(dbg->symbols, idx);
+
+    /* The blocks were the ones of the old program */
+    __coverage_done(dbg, 1);
+
+    if (thread_table_reset(&dbg->threads, pid) < 0)
+        printf("Couldn't keep track of the threads of process %d\n", pid);
+
+    dbg->dbge_pid = pid;
+    dbg->pending_signal = 0;
+    dbg->stopped_bp = NULL;
+    debugger_mem_reset(dbg);
+    debugger_invalidate_regs(dbg);
+    displaced_reset(dbg);
+
+    /* The code they replace is the one of the new program */
+    breakpoint_batch_init(&batch);
+    hash_table_for_each(&dbg->bp_table, slot) {
+        bp = slot->value;
+        if (!breakpoint_is_enabled(bp) ||
+                (same && bp->kind != BREAKPOINT_INT3))
+            continue;
+        __unset_breakpoint_enabled(bp);
+        if (same)
+            breakpoint_batch_add(&batch, bp, BATCH_ENABLE);
+    }
+    failed = breakpoint_batch_commit(dbg, &batch);
+    breakpoint_batch_destroy(&batch);
+
+    hash_table_for_each(&dbg->bp_table, slot) {
+        bp = slot->value;
+        if (failed > 0 && bp->kind == BREAKPOINT_INT3 &&
+                !breakpoint_is_enabled(bp))
+            printf("Couldn't put breakpoint %u back, disabling it\n",
+                    bp->number);
+    }
+    fast_trace_reset(dbg);
+    __watch_reset(dbg);
+    if (focused)
+        __history_reset(dbg);
+
+    n = readlink(path, exe, sizeof(exe) - 1);
+    exe[n < 0 ? 0 : n] = '\0';
+    printf("Process %d is executing new program: %s\n", pid, exe);
+    if (!same && hash_table_count(&dbg->bp_table) > 0)
+        printf("Breakpoints of process %d disabled, the program is "
+                "another one\n", pid);
+    __symbols_replace(dbg, idx, path);
+}
+
+/*
+ * Take care of the fork, vfork, vfork done and exec events of thread
+ * `tid` of the process that has the focus, which is stopped at the
+ * event. Unless `focused` is set, the process only has the focus for
+ * the event, see `__background_event()`: a child it forks does not get
+ * the focus then, and the history is left alone.
+ *
+ * @return - the thread left stopped, which is the child if it gets the
+ *           focus, 0 if `status` is none of these events
+ */
+static pid_t __process_event(struct debugger *dbg, pid_t tid, int status,
+        int focused)
+{
+    pid_t child;
+    int vfork;
+
+    if (!WIFSTOPPED(status))
+        return 0;
+
+    switch (status >> 16) {
+    case PTRACE_EVENT_FORK:
+    case PTRACE_EVENT_VFORK:
+        vfork = status >> 16 == PTRACE_EVENT_VFORK;
+        child = __fork_child(dbg, tid);
+        if (child < 0)
+            return tid;
+        return __process_fork(dbg, tid, child, vfork,
+                focused && dbg->follow_fork == FOLLOW_FORK_CHILD);
+
+    case PTRACE_EVENT_VFORK_DONE:
+        __breakpoints_rewrite(dbg, tid);
+        return tid;
+
+    case PTRACE_EVENT_EXEC:
+        __debugee_exec(dbg, tid, focused);
+        return tid;
+    }
+    return 0;
+}
+
+/*
+ * Find a thread of the debugee with a stop that was not reported yet,
+ * and make it the current thread.
+ *
+ * @return - the wait status of the stop, 0 if there is none
+ */
+static int __threads_pending(struct debugger *dbg)
+{
+    struct hash_slot *slot;
+    struct thread *t;
+    pid_t next;
+    int status;
+
+    hash_table_for_each(&dbg->threads.threads, slot) {
+        t = slot->value;
+        if (t->pending_status == 0)
+            continue;
+
+        status = t->pending_status;
+        t->pending_status = 0;
+
+        /* The threads may have changed, e.g if a child is followed */
+        next = __process_event(dbg, t->tid, status, 1);
+        if (next != 0) {
+            t = thread_get(&dbg->threads, next);
+            if (dbg->non_stop && t != NULL && next != dbg->dbge_pid &&
+                    ptrace(PTRACE_CONT, next, NULL, NULL) == 0)
+                t->state = THREAD_RUNNING;
+            return __threads_pending(dbg);
+        }
+
+        if (WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP &&
+                __trap_is_stale(dbg, t->tid)) {
+            if (dbg->non_stop &&
+                    ptrace(PTRACE_CONT, t->tid, NULL, NULL) == 0)
+                t->state = THREAD_RUNNING;
+            continue;
+        }
+
+        /* Passed on without stopping, see `__thread_event()` */
+        if (WIFSTOPPED(status) && WSTOPSIG(status) == SIGCHLD) {
+            if (dbg->non_stop) {
+                if (ptrace(PTRACE_CONT, t->tid, NULL, SIGCHLD) == 0)
+                    t->state = THREAD_RUNNING;
+            }
+            else if (t->tid == dbg->dbge_pid) {
+                dbg->pending_signal = SIGCHLD;
+            }
+            else {
+                t->pending_signal = SIGCHLD;
+            }
+            continue;
+        }
+
+        __thread_switch(dbg, t);
+        return status;
+    }
+    return 0;
+}
+
+/*
+ * Give the focus to a process put aside with a stop that was not
+ * reported yet, and make the thread that stopped its current thread.
+ * In all-stop mode, its other threads are stopped as well.
+ *
+ * @return - the wait status of the stop, 0 if there is none
+ */
+static int __processes_pending(struct debugger *dbg)
+{
+    struct process *prev = dbg->process, *p;
+    int status;
+
+    /* The internal breakpoints are in the set of the focused process */
+    if (dbg->step.nbps > 0)
+        return 0;
+
+    while ((p = process_take_pending(&dbg->procs)) != NULL) {
+        if (p == prev)
+            continue;
+
+        __process_switch(dbg, p);
+        status = __threads_pending(dbg);
+        if (status != 0) {
+            if (!dbg->non_stop)
+                __threads_stop(dbg, 0);
+            return status;
+        }
+        __process_switch(dbg, prev);
+    }
+    return 0;
+}
+
+/*
+ * Take note that the current thread was just resumed. In all-stop
+ * mode, the other threads are resumed along if `all` is set.
+ */
+static void __threads_run(struct debugger *dbg, int all)
+{
+    struct thread *t;
+
+    t = thread_get(&dbg->threads, dbg->dbge_pid);
+    if (t != NULL)
+        t->state = THREAD_RUNNING;
+    if (all && !dbg->non_stop)
+        __threads_resume(dbg);
+}
+
+/*
+ * Take care of the wait event `status` of thread `pid` of process `p`,
+ * which is put aside and runs on its own, see inc/process.h. The
+ * process has the focus for the time of the event. New threads, new
+ * processes and processes that exit are taken care of, and the threads
+ * with nothing to report are resumed.
+ *
+ * A stop to report gives the process the focus if `report` is set, its
+ * other threads being stopped as well in all-stop mode. It is kept for
+ * later otherwise.
+ *
+ * @return - 1 if the process got the focus for a stop to report, 0
+ *           otherwise
+ */
+static int __background_event(struct debugger *dbg, struct process *p,
+        pid_t pid, int status, int report)
+{
+    struct process *prev = dbg->process;
+    unsigned long msg;
+    struct thread *t;
+    pid_t next;
+
+    __process_switch(dbg, p);
+    t = thread_get(&dbg->threads, pid);
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        /* The leader is the last one to go */
+        if (pid == dbg->threads.leader) {
+            if (WIFEXITED(status))
+                printf("[Process %d exited with code %d]\n", pid,
+                        WEXITSTATUS(status));
+            else
+                printf("[Process %d killed by signal %s]\n", pid,
+                        strsignal(WTERMSIG(status)));
+            __process_exit(dbg, prev);
+            return 0;
+        }
+        thread_remove(&dbg->threads, pid);
+        goto done;
+    }
+
+    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
+        if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg) == 0)
+            __thread_new(dbg, msg, 1);
+        ptrace(PTRACE_CONT, pid, NULL, NULL);
+        goto done;
+    }
+
+    next = __process_event(dbg, pid, status, 0);
+    if (next != 0) {
+        t = thread_get(&dbg->threads, next);
+        if (t != NULL && ptrace(PTRACE_CONT, next, NULL, NULL) == 0)
+            t->state = THREAD_RUNNING;
+        goto done;
+    }
+
+    if (__is_event_stop(status)) {
+        t->stop_requested = 0;
+        ptrace(PTRACE_CONT, pid, NULL, NULL);
+        goto done;
+    }
+
+    if ((WSTOPSIG(status) == SIGTRAP && __trap_is_stale(dbg, pid)) ||
+            WSTOPSIG(status) == SIGCHLD) {
+        ptrace(PTRACE_CONT, pid, NULL,
+                WSTOPSIG(status) == SIGCHLD ? SIGCHLD : 0);
+        goto done;
+    }
+
+    t->state = THREAD_STOPPED;
+    __thread_switch(dbg, t);
+    debugger_invalidate_regs(dbg);
+    if (report) {
+        if (!dbg->non_stop)
+            __threads_stop(dbg, 0);
+        return 1;
+    }
+    t->pending_status = status;
+
+done:
+    __process_switch(dbg, prev);
+    return 0;
+}
+
+/*
+ * Take care of the wait event `status` of thread `pid`, while waiting
+ * for thread `*tid` (-1 for any thread) that was resumed with ptrace
+ * request `*request`. New threads and threads that exit are taken
+ * care of, and the threads with nothing to report are resumed. Events
+ * of the processes put aside are routed to them, see
+ * `__background_event()`.
+ *
+ * A stop to report makes the thread that stops the current thread. In
+ * all-stop mode, the other threads are stopped as well if any thread
+ * was waited for.
+ *
+ * @return - 1 if the event is a stop to report, 0 otherwise
+ */
+static int __thread_event(struct debugger *dbg, pid_t pid, int status,
+        pid_t *tid, int *request)
+{
+    unsigned long msg;
+    struct process *p;
+    struct thread *t;
+    pid_t next;
+
+    t = thread_get(&dbg->threads, pid);
+    if (t == NULL && pid != dbg->threads.leader) {
+        /* Only a debugee continued by the user switches processes */
+        p = process_of(&dbg->procs, pid);
+        if (p != NULL)
+            return __background_event(dbg, p, pid, status,
+                    dbg->running && dbg->step.nbps == 0);
+        __stray_event(dbg, pid, status);
+        return 0;
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        /* The leader is the last one to go */
+        if (pid == dbg->threads.leader) {
+            if (t != NULL)
+                __thread_switch(dbg, t);
+            return 1;
+        }
+        thread_remove(&dbg->threads, pid);
+
+        /* Nothing left to step, let the other threads run */
+        if (pid == *tid) {
+            *tid = -1;
+            *request = PTRACE_CONT;
+            if (!dbg->non_stop)
+                __threads_resume(dbg);
+        }
+        return 0;
+    }
+
+    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
+        if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg) == 0)
+            __thread_new(dbg, msg, *tid == -1 || dbg->non_stop);
+        ptrace(*request, pid, NULL, NULL);
+        return 0;
+    }
+
+    /* The thread to go on with is the child if it gets the focus */
+    next = __process_event(dbg, pid, status, 1);
+    if (next != 0) {
+        if (*tid != -1)
+            *tid = next;
+        t = thread_get(&dbg->threads, next);
+        if (t != NULL && ptrace(*request, next, NULL, NULL) == 0)
+            t->state = THREAD_RUNNING;
+        return 0;
+    }
+
+    /* An interrupt that came after another stop */
+    if (__is_event_stop(status)) {
+        t->stop_requested = 0;
+        ptrace(*request, pid, NULL, NULL);
+        return 0;
+    }
+
+    if (WSTOPSIG(status) == SIGTRAP && __trap_is_stale(dbg, pid)) {
+        ptrace(*request, pid, NULL, NULL);
+        return 0;
+    }
+
+    /* The processes it forks run on their own, they don't stop it */
+    if (WSTOPSIG(status) == SIGCHLD) {
+        ptrace(*request, pid, NULL, SIGCHLD);
+        return 0;
+    }
+
+    t->state = THREAD_STOPPED;
+    if (*tid == -1 && !dbg->non_stop)
+        __threads_stop(dbg, 0);
+    __thread_switch(dbg, t);
+    debugger_invalidate_regs(dbg);
+    return 1;
+}
+
+/*
+ * Wait for the next stop to report of the current thread, which was
+ * just resumed with ptrace request `request`, or of any thread if
+ * `all` is set, see `__thread_event()`.
+ *
+ * In all-stop mode, the other threads are resumed along if `all` is
+ * set, and stopped as well once a thread stops. In non-stop mode, they
+ * are left alone.
+ *
+ * @return - the wait status, -1 if the debugee is gone
+ */
+static int __threads_wait(struct debugger *dbg, int all, int request)
+{
+    pid_t tid = all ? -1 : dbg->dbge_pid, pid;
+    int status;
+
+    __threads_run(dbg, all);
+    do {
+        pid = waitpid(tid, &status, __WALL);
+        if (pid < 0)
+            return -1;
+    } while (!__thread_event(dbg, pid, status, &tid, &request));
+    return status;
+}
+
+/*
+ * Collect the events of the debugee, that was resumed to run on its
+ * own with `__threads_run(dbg, 1)`, without waiting for them.
+ *
+ * @param wait_status - where to store the wait status of the stop
+ * @return            - 1 if a thread stopped, 0 if the debugee goes on
+ *                      running, -1 if it is gone
+ */
+static int __threads_collect(struct debugger *dbg, int *wait_status)
+{
+    int request = PTRACE_CONT;
+    pid_t tid = -1, pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG | __WALL)) > 0) {
+        if (__thread_event(dbg, pid, status, &tid, &request)) {
+            *wait_status = status;
+            return 1;
+        }
+    }
+    return pid < 0 ? -1 : 0;
+}
+
+/*
+ * Take note of the events of the threads that keep running while the
+ * debugger waits for nothing, in non-stop mode or in the processes put
+ * aside: new threads, new processes and threads that exit are taken
+ * care of, stops are kept to be reported by the next
+ * `debugger_resume()`, or the next `continue` for the processes put
+ * aside.
+ *
+ * Note that the events of a debugee running on its own after
+ * `continue` are left to the event loop.
+ */
+static void __threads_poll(struct debugger *dbg)
+{
+    unsigned long msg;
+    struct process *p;
+    struct thread *t;
+    pid_t pid, next;
+    int status;
+
+    if (dbg->running)
+        return;
+
+    while ((pid = waitpid(-1, &status, WNOHANG | __WALL)) > 0) {
+        t = thread_get(&dbg->threads, pid);
+        if (t == NULL) {
+            p = process_of(&dbg->procs, pid);
+            if (p != NULL)
+                __background_event(dbg, p, pid, status, 0);
+            else
+                __stray_event(dbg, pid, status);
+            continue;
+        }
+
+        if ((WIFEXITED(status) || WIFSIGNALED(status)) &&
+                pid != dbg->threads.leader) {
+            thread_remove(&dbg->threads, pid);
+            continue;
+        }
+
+        if (WIFSTOPPED(status) &&
+                status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
+            if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg) == 0)
+                __thread_new(dbg, msg, dbg->non_stop);
+            ptrace(PTRACE_CONT, pid, NULL, NULL);
+            continue;
+        }
+
+        next = __process_event(dbg, pid, status, 1);
+        if (next != 0) {
+            t = thread_get(&dbg->threads, next);
+            if (t != NULL && ptrace(PTRACE_CONT, next, NULL, NULL) == 0)
+                t->state = THREAD_RUNNING;
+            continue;
+        }
+
+        if (WIFSTOPPED(status) && __is_event_stop(status)) {
+            t->stop_requested = 0;
+            ptrace(PTRACE_CONT, pid, NULL, NULL);
+            continue;
+        }
+
+        if (WIFSTOPPED(status) && WSTOPSIG(status) == SIGCHLD) {
+            ptrace(PTRACE_CONT, pid, NULL, SIGCHLD);
+            continue;
+        }
+
+        t->state = THREAD_STOPPED;
+        t->regs_state = REGS_INVALID;
+        t->pending_status = status;
+    }
+}
+
+static int __tid_compare(const void *a, const void *b)
+{
+    return *(const pid_t *)a - *(const pid_t *)b;
+}
+
+/*
+ * List the threads of the debugee in TID order, the current one being
+ * marked with a star.
+ */
+void info_threads(struct debugger *dbg)
+{
+    struct user_regs_struct regs;
+    struct hash_slot *slot;
+    struct thread *t;
+    unsigned long i, n = 0;
+    pid_t *tids;
+    int ret;
+
+    __threads_poll(dbg);
+    if (thread_count(&dbg->threads) == 0) {
+        printf("No threads.\n");
+        return;
+    }
+    tids = malloc(thread_count(&dbg->threads) * sizeof(*tids));
+    if (tids == NULL)
+        return;
+    hash_table_for_each(&dbg->threads.threads, slot)
+        tids[n++] = ((struct thread *)slot->value)->tid;
+    qsort(tids, n, sizeof(*tids), __tid_compare);
+
+    for (i = 0; i < n; i++) {
+        t = thread_get(&dbg->threads, tids[i]);
+        if (t->state == THREAD_RUNNING)
+            ret = -1;
+        else if (t->tid == dbg->dbge_pid)
+            ret = debugger_get_regs(dbg, &regs);
+        else if (t->regs_state != REGS_INVALID) {
+            regs = t->regs;
+            ret = 0;
+        }
+        else
+            ret = ptrace(PTRACE_GETREGS, t->tid, NULL, &regs);
+
+        printf("%c %-8d", t->tid == dbg->dbge_pid ? '*' : ' ', t->tid);
+        if (t->state == THREAD_RUNNING)
+            printf(" (running)");
+        else if (ret == 0)
+            printf(" %p", (void *)regs.rip);
+        if (t->pending_status != 0)
+            printf(" (stop pending)");
+        printf("\n");
+    }
+    free(tids);
+}
+
+/*
+ * Make thread `tid` of the debugee the current thread. A thread still
+ * running in non-stop mode is interrupted.
+ */
+void select_thread(struct debugger *dbg, pid_t tid)
+{
+    struct user_regs_struct regs;
+    struct thread *t;
+
+    __threads_poll(dbg);
+    t = thread_get(&dbg->threads, tid);
+    if (t != NULL && t->state == THREAD_RUNNING) {
+        if (!t->stop_requested &&
+                ptrace(PTRACE_INTERRUPT, tid, NULL, NULL) == 0)
+            t->stop_requested = 1;
+        __thread_wait_stop(dbg, tid);
+        t = thread_get(&dbg->threads, tid);
+    }
+    if (t == NULL) {
+        printf("No thread %d\n", tid);
+        return;
+    }
+
+    __thread_switch(dbg, t);
+    dbg->threads.reported = tid;
+    if (debugger_get_regs(dbg, &regs) == 0)
+        printf("[Switching to thread %d] at %p\n", tid, (void *)regs.rip);
+}
+
+/*
+ * Give the focus to process `p`, see inc/process.h. Its threads are
+ * stopped, every one in all-stop mode and the current one in non-stop
+ * mode, and the history starts over from it.
+ */
+static void __process_select(struct debugger *dbg, struct process *p)
+{
+    struct user_regs_struct regs;
+    struct thread *t;
+
+    /* Only the entry is left of a process that exited */
+    if (p != dbg->process && thread_count(&dbg->threads) == 0)
+        __process_exit(dbg, p);
+    else
+        __process_switch(dbg, p);
+
+    t = thread_get(&dbg->threads, dbg->dbge_pid);
+    if (t == NULL) {
+        t = thread_get(&dbg->threads, dbg->threads.leader);
+        if (t != NULL)
+            __thread_switch(dbg, t);
+    }
+
+    if (!dbg->non_stop) {
+        __threads_stop(dbg, 0);
+    }
+    else if (t != NULL && t->state == THREAD_RUNNING) {
+        if (!t->stop_requested &&
+                ptrace(PTRACE_INTERRUPT, t->tid, NULL, NULL) == 0)
+            t->stop_requested = 1;
+        __thread_wait_stop(dbg, t->tid);
+    }
+    debugger_invalidate_regs(dbg);
+    __history_reset(dbg);
+
+    dbg->procs.reported = p->pid;
+    dbg->threads.reported = dbg->dbge_pid;
+    if (debugger_get_regs(dbg, &regs) == 0)
+        printf("[Switching to process %d] at %p\n", p->pid,
+                (void *)regs.rip);
+}
+
+/*
+ * Handle `process PID`: give the focus to process `pid`, see
+ * `__process_select()`.
+ */
+void select_process(struct debugger *dbg, pid_t pid)
+{
+    struct process *p;
+
+    __threads_poll(dbg);
+    p = process_get(&dbg->procs, pid);
+    if (p == NULL || p->state == PROCESS_NEW) {
+        printf("No process %d\n", pid);
+        return;
+    }
+    __process_select(dbg, p);
+}
+
+/*
+ * List the processes traced in PID order, the one that has the focus
+ * being marked with a star.
+ */
+void info_processes(struct debugger *dbg)
+{
+    struct thread_table *threads;
+    struct hash_slot *slot;
+    struct process *p;
+    unsigned long i, n = 0, count;
+    pid_t *pids;
+
+    __threads_poll(dbg);
+    pids = malloc(hash_table_count(&dbg->procs.procs) * sizeof(*pids));
+    if (pids == NULL)
+        return;
+    hash_table_for_each(&dbg->procs.procs, slot) {
+        p = slot->value;
+        if (p->state != PROCESS_NEW)
+            pids[n++] = p->pid;
+    }
+    qsort(pids, n, sizeof(*pids), __tid_compare);
+
+    for (i = 0; i < n; i++) {
+        p = process_get(&dbg->procs, pids[i]);
+        threads = p == dbg->process ? &dbg->threads : &p->threads;
+        count = thread_count(threads);
+
+        printf("%c %-8d %lu thread%s", p == dbg->process ? '*' : ' ',
+                p->pid, count, count == 1 ? "" : "s");
+        if (count == 0)
+            printf(" (exited)");
+        else if (p->pending)
+            printf(" (stop pending)");
+        printf("\n");
+    }
+    free(pids);
+}
+
+/*
+ * Execute the instruction under breakpoint `bp` by removing the INT3
+ * for the duration of a single step. Used when the instruction cannot
+ * be displaced, and to single step from a breakpoint.
+ *
+ * @return - the wait status of the step, -1 if the debugee is gone
+ */
+int step_over_breakpoint(struct debugger *dbg, struct breakpoint *bp)
+{
+    int wait_status;
+
+    breakpoint_disable(dbg, bp);
+    debugger_flush_regs(dbg);
+    debugger_invalidate_regs(dbg);
+
+    if (ptrace(PTRACE_SINGLESTEP, dbg->dbge_pid, NULL,
+                dbg->pending_signal) < 0)
+        return -1;
+    dbg->pending_signal = 0;
+
+    wait_status = __threads_wait(dbg, 0, PTRACE_SINGLESTEP);
+    if (wait_status < 0)
+        return -1;
+
+    if (WIFSTOPPED(wait_status))
+        breakpoint_enable(dbg, bp);
+    return wait_status;
+}
+
+/*
+ * Execute the instruction under breakpoint `bp` out of line, by single
+ * stepping through its displaced copy until RIP leaves the slot. The
+ * INT3 stays in place for the threads that run meanwhile.
+ *
+ * Note that RIP must already point to the slot.
+ *
+ * @return - the wait status of the last step, -1 if the debugee is gone
+ */
+static int __displaced_step(struct debugger *dbg, struct breakpoint *bp)
+{
+    unsigned long slot = (unsigned long)bp->displaced;
+    struct user_regs_struct regs;
+    int wait_status;
+
+    do {
+        debugger_flush_regs(dbg);
+        debugger_invalidate_regs(dbg);
+        if (ptrace(PTRACE_SINGLESTEP, dbg->dbge_pid, NULL,
+                    dbg->pending_signal) < 0)
+            return -1;
+        dbg->pending_signal = 0;
+
+        wait_status = __threads_wait(dbg, 0, PTRACE_SINGLESTEP);
+        if (wait_status < 0 || !WIFSTOPPED(wait_status) ||
+                WSTOPSIG(wait_status) != SIGTRAP ||
+                debugger_get_regs(dbg, &regs) < 0)
+            return wait_status;
+    } while (regs.rip >= slot && regs.rip < slot + DISPLACED_SLOT_SIZE);
+
+    return wait_status;
+}
+
+/*
+ * Resume the current thread of the debugee according to stepping
+ * policy `how`, without waiting for it to stop. Going over the
+ * breakpoint it is stopped at may have it stop already though.
+ *
+ * @param request     - where to store the ptrace request the thread
+ *                      was resumed with
+ * @param wait_status - where to store the wait status of a stop that
+ *                      happened already
+ * @return            - 0 if the thread is running, 1 if it stopped,
+ *                      -1 if the debugee is gone
+ */
+static int __debugger_start(struct debugger *dbg, int how, int *request,
+        int *wait_status)
+{
+    struct breakpoint *bp = dbg->stopped_bp;
+    struct user_regs_struct regs;
+
+    /* Let a step go through an instruction watched for execution,
+     * which would fire before it is executed, without progress */
+    if (how != RESUME_CONTINUE && dr7_has_exec(dbg->dr7) &&
+            debugger_get_regs(dbg, &regs) == 0) {
+        regs.eflags |= DR_EFLAGS_RF;
+        debugger_set_regs(dbg, &regs);
+    }
+
+    /* The instruction at the breakpoint is about to run */
+    dbg->stopped_bp = NULL;
+    if (bp != NULL && dbg->coverage != NULL) {
+        if (bp->coverage) {
+            __coverage_hit(dbg, bp);
+            bp = NULL;
+        }
+        else {
+            coverage_mark(dbg->coverage, (unsigned long)bp->addr);
+        }
+    }
+
+    if (bp != NULL && how != RESUME_CONTINUE && dbg->non_stop &&
+            displaced_resume(dbg, bp) == 0) {
+        *wait_status = __displaced_step(dbg, bp);
+        return *wait_status < 0 ? -1 : 1;
+    }
+
+    if (bp != NULL && (how != RESUME_CONTINUE ||
+                displaced_resume(dbg, bp) < 0)) {
+        /* Nobody may run past the missing INT3 meanwhile */
+        if (dbg->non_stop)
+            __threads_stop(dbg, 1);
+        *wait_status = step_over_breakpoint(dbg, bp);
+        if (dbg->non_stop)
+            __threads_release(dbg);
+        if (*wait_status < 0)
+            return -1;
+        if (how != RESUME_CONTINUE || !WIFSTOPPED(*wait_status) ||
+                WSTOPSIG(*wait_status) != SIGTRAP)
+            return 1;
+    }
+
+    debugger_flush_regs(dbg);
+    debugger_invalidate_regs(dbg);
+
+    if (how == RESUME_CONTINUE)
+        *request = PTRACE_CONT;
+    else if (how == RESUME_BLOCK)
+        *request = PTRACE_SINGLEBLOCK;
+    else
+        *request = PTRACE_SINGLESTEP;
+
+    /* Not every architecture has block stepping */
+    if (ptrace(*request, dbg->dbge_pid, NULL, dbg->pending_signal) < 0) {
+        if (*request != PTRACE_SINGLEBLOCK || errno != EIO)
+            return -1;
+        *request = PTRACE_SINGLESTEP;
+        if (ptrace(*request, dbg->dbge_pid, NULL, dbg->pending_signal) < 0)
+            return -1;
+    }
+    dbg->pending_signal = 0;
+    return 0;
+}
+
+/*
+ * Resume the debugee according to stepping policy `how`, and wait for
+ * it to stop, see `debugger_resume()`.
+ */
+static int __debugger_resume(struct debugger *dbg, int how)
+{
+    int wait_status, request;
+
+    switch (__debugger_start(dbg, how, &request, &wait_status)) {
+    case 0:
+        /* The other threads only run along when continuing */
+        return __threads_wait(dbg, how == RESUME_CONTINUE, request);
+    case 1:
+        return wait_status;
+    }
+    return -1;
+}
+
+/**
+ * Resume the debugee according to stepping policy `how`, and wait for
+ * it to stop. If the debugee is stopped at a breakpoint, it continues
+ * through the displaced copy of the instruction under the breakpoint,
+ * and steps over the breakpoint otherwise.
+ *
+ * Faults on the pages of software watchpoints that are not hits are
+ * gone over without stopping, and so are the INT3s of the coverage.
+ *
+ * When continuing, all the threads of the debugee run, and the first
+ * one to stop becomes the current thread. Stepping only resumes the
+ * current thread. In non-stop mode, only the current thread is resumed
+ * either way, the others running or staying stopped as they are.
+ *
+ * @param dbg - pointer to debugger structure
+ * @param how - one of the RESUME_* policies
+ * @return    - the wait status, -1 if the debugee is gone
+ */
+int debugger_resume(struct debugger *dbg, int how)
+{
+    int wait_status;
+
+    dbg->soft_hit = NULL;
+
+    /* Threads that stopped while the others were being stopped */
+    if (how == RESUME_CONTINUE &&
+            (wait_status = __threads_pending(dbg)) != 0)
+        return wait_status;
+    do {
+        wait_status = __debugger_resume(dbg, how);
+    } while (wait_status >= 0 && WIFSTOPPED(wait_status) &&
+            ((WSTOPSIG(wait_status) == SIGSEGV &&
+              dbg->soft_watch.count > 0 &&
+              __watch_fault(dbg, how, &wait_status) > 0) ||
+             __coverage_trap(dbg, wait_status)));
+    return wait_status;
+}
+
+/*
+ * Check whether the SIGTRAP the debugee stopped with comes from an
+ * INT3 rather than from stepping.
+ */
+static int __trap_is_int3(struct debugger *dbg)
+{
+    siginfo_t si;
+
+    if (ptrace(PTRACE_GETSIGINFO, dbg->dbge_pid, NULL, &si) < 0)
+        return 0;
+    return si.si_code == SI_KERNEL;
+}
+
+/**
+ * Work out why the debugee stopped, and update the debugger for it.
+ * Nothing is reported to the user.
+ *
+ * @param dbg         - pointer to debugger structure
+ * @param wait_status - as returned by `debugger_resume()`
+ * @param how         - the RESUME_* policy the debugee was resumed with
+ * @param rec         - where to describe the stop
+ */
+void debugger_handle_stop(struct debugger *dbg, int wait_status, int how,
+        struct stop_record *rec)
+{
+    struct user_regs_struct regs;
+    struct breakpoint *bp;
+    struct watchpoint *wp;
+
+    rec->addr = NULL;
+    rec->arg = 0;
+
+    fast_trace_drain(dbg);
+
+    if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+        rec->kind = STOP_EXIT;
+        rec->arg = wait_status;
+        thread_table_clear(&dbg->threads);
+    }
+    else if (WSTOPSIG(wait_status) != SIGTRAP) {
+        /* Delivered when the debugee is resumed */
+        dbg->pending_signal = WSTOPSIG(wait_status);
+        rec->kind = STOP_SIGNAL;
+        rec->arg = dbg->pending_signal;
+    }
+    else if ((dbg->dr7 != 0 || dbg->soft_hit != NULL) &&
+            (wp = __watch_hit(dbg)) != NULL) {
+        rec->kind = STOP_WATCHPOINT;
+        rec->arg = wp->number;
+        if (debugger_get_regs(dbg, &regs) < 0)
+            return;
+
+        /* Data watchpoints fire after the access, maybe right before
+         * a breakpoint */
+        rec->addr = (void *)regs.rip;
+        bp = debugger_breakpoint_at(dbg, rec->addr);
+        if (bp != NULL && breakpoint_has_int3(bp))
+            dbg->stopped_bp = bp;
+    }
+    else if (how == RESUME_STEP ||
+            (how == RESUME_BLOCK && !__trap_is_int3(dbg))) {
+        rec->kind = how == RESUME_STEP ? STOP_STEP : STOP_BLOCK;
+        rec->arg = 1;
+        if (debugger_get_regs(dbg, &regs) < 0)
+            return;
+
+        /* Stepped onto a breakpoint, its INT3 has not been executed */
+        rec->addr = (void *)regs.rip;
+        bp = debugger_breakpoint_at(dbg, rec->addr);
+        if (bp != NULL && breakpoint_has_int3(bp))
+            dbg->stopped_bp = bp;
+    }
+    else if ((bp = handle_sigtrap(dbg)) != NULL) {
+        rec->kind = STOP_BREAKPOINT;
+        rec->addr = bp->addr;
+    }
+    else {
+        rec->kind = STOP_SIGNAL;
+        rec->arg = SIGTRAP;
+    }
+}
+
+/*
+ * Tell the user where the debugee stopped.
+ */
+void report_stop(struct debugger *dbg, struct stop_record *rec)
+{
+    char loc[LOCATION_MAX];
+    int status = rec->arg;
+    struct breakpoint *bp;
+    struct watchpoint *wp;
+
+    if (rec->kind != STOP_EXIT && dbg->threads.leader != dbg->procs.reported)
+        printf("[Switching to process %d]\n", dbg->threads.leader);
+    if (rec->kind != STOP_EXIT && dbg->dbge_pid != dbg->threads.reported)
+        printf("[Switching to thread %d]\n", dbg->dbge_pid);
+    dbg->procs.reported = dbg->threads.leader;
+    dbg->threads.reported = dbg->dbge_pid;
+
+    switch (rec->kind) {
+    case STOP_BREAKPOINT:
+        /* Internal breakpoints are gone by now */
+        bp = debugger_breakpoint_at(dbg, rec->addr);
+        if (bp == NULL)
+            printf("Stopped at %s\n", __location(dbg, rec->addr, loc));
+        else
+            printf("Hit breakpoint %u at %s\n", bp->number,
+                    __location(dbg, rec->addr, loc));
+        break;
+    case STOP_WATCHPOINT:
+        printf("Hit watchpoint %lu, stopped at %s\n", rec->arg,
+                __location(dbg, rec->addr, loc));
+        wp = debugger_watchpoint_get(dbg, rec->arg);
+        if (wp != NULL && wp->type == WATCH_WRITE) {
+            __print_value("Old value", wp->old_value, wp->len);
+            __print_value("New value", wp->value, wp->len);
+        }
+        break;
+    case STOP_SIGNAL:
+        printf("Program received signal %s\n", strsignal(rec->arg));
+        break;
+    case STOP_STEP:
+    case STOP_BLOCK:
+        printf("Stopped at %s\n", __location(dbg, rec->addr, loc));
+        break;
+    case STOP_INTERRUPT:
+        printf("Interrupted at %s\n", __location(dbg, rec->addr, loc));
+        break;
+    case STOP_EXIT:
+        if (WIFEXITED(status))
+            printf("Process %d exited with code %d\n", dbg->threads.leader,
+                    WEXITSTATUS(status));
+        else
+            printf("Process %d killed by signal %s\n", dbg->threads.leader,
+                    strsignal(WTERMSIG(status)));
+        __coverage_done(dbg, 1);
+        break;
+    }
+
+    if (rec->kind != STOP_EXIT && rec->kind != STOP_SIGNAL)
+        __print_source(dbg, rec->addr);
+}
+
+/*
+ * Kill a process we trace, unless it is already gone.
+ */
+static void __process_kill(pid_t pid)
+{
+    /* Exited, or already reaped */
+    if (waitpid(pid, NULL, WNOHANG | __WALL) != 0)
+        return;
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, __WALL);
+}
+
+/*
+ * Kill the debugee, all of its threads.
+ */
+static void __debugee_kill(struct debugger *dbg)
+{
+    pid_t leader = dbg->threads.leader;
+    struct hash_slot *slot;
+    struct thread *t;
+
+    /* Threads exit before the leader can be waited for */
+    if (thread_count(&dbg->threads) > 1) {
+        kill(leader, SIGKILL);
+        hash_table_for_each(&dbg->threads.threads, slot) {
+            t = slot->value;
+            if (t->tid != leader)
+                waitpid(t->tid, NULL, __WALL);
+        }
+    }
+    __process_kill(leader);
+}
+
+/*
+ * Take a checkpoint of the stopped debugee at the current tick of its
+ * history, evicting the oldest checkpoint if the pool is full.
+ *
+ * @return - the checkpoint, or NULL on error
+ */
+static struct checkpoint *__checkpoint_take(struct debugger *dbg)
+{
+    struct checkpoint_pool *pool = &dbg->checkpoints;
+    struct timespec start, end;
+    struct user_regs_struct regs;
+    struct checkpoint *ckpt;
+    pid_t pid;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (debugger_get_regs(dbg, &regs) < 0) {
+        printf("The program is not being run.\n");
+        return NULL;
+    }
+
+    if (checkpoint_pool_full(pool)) {
+        __process_kill(checkpoint_pool_nth(pool, 0)->pid);
+        checkpoint_pool_drop_oldest(pool);
+    }
+    ckpt = checkpoint_pool_add(pool);
+
+    ckpt->bps = __breakpoints_written(dbg, WRITTEN_FAST, &ckpt->nbps);
+    if (ckpt->bps == NULL) {
+        checkpoint_pool_drop_newest(pool);
+        return NULL;
+    }
+
+    pid = __inject_fork(dbg->dbge_pid, debugger_mem_fd(dbg), &regs);
+    if (pid < 0) {
+        printf("Couldn't checkpoint process %d: %s\n", dbg->dbge_pid,
+                strerror(-pid));
+        checkpoint_pool_drop_newest(pool);
+        return NULL;
+    }
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_EXITKILL);
+
+    /* The registers in the debugee are now the ones we passed */
+    if (dbg->regs_state == REGS_DIRTY)
+        dbg->regs_state = REGS_CLEAN;
+
+    ckpt->pid = pid;
+    ckpt->regs = regs;
+    ckpt->pending_signal = dbg->pending_signal;
+    ckpt->tick = dbg->history.count;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ckpt->cost_us = (end.tv_sec - start.tv_sec) * 1e6 +
+        (end.tv_nsec - start.tv_nsec) / 1e3;
+
+    return ckpt;
+}
+
+/*
+ * Start the history over from the current state of the debugee, e.g
+ * because how it got there is not known.
+ */
+static void __history_reset(struct debugger *dbg)
+{
+    dbg->procs.history = dbg->threads.leader;
+    checkpoint_pool_detach(&dbg->checkpoints, 0);
+    history_truncate(&dbg->history, 0);
+    write_index_truncate(&dbg->writes, 0);
+    __checkpoint_take(dbg);
+}
+
+void checkpoint_take(struct debugger *dbg)
+{
+    struct checkpoint *ckpt;
+
+    ckpt = __checkpoint_take(dbg);
+    if (ckpt != NULL)
+        printf("Checkpoint %u at %p\n", ckpt->number, 
+                (void *)ckpt->regs.rip);
+}
+
+/*
+ * Replace the debugee by a fresh copy of checkpoint `ckpt`. The
+ * breakpoints that are currently enabled are written into the new
+ * debugee, the ones that were only enabled when the checkpoint was
+ * taken are removed from it. The history is left alone.
+ *
+ * @return - 0 on success, -1 on error
+ */
+static int __checkpoint_restore(struct debugger *dbg, struct checkpoint *ckpt)
+{
+    struct breakpoint_batch batch;
+    struct hash_slot *slot;
+    struct breakpoint *bp;
+    unsigned int i;
+    pid_t pid;
+
+    pid = __inject_fork(ckpt->pid, MEM_FD_NONE, &ckpt->regs);
+    if (pid < 0) {
+        printf("Couldn't restart checkpoint %u: %s\n", ckpt->number,
+                strerror(-pid));
+        return -1;
+    }
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, DEBUGEE_PTRACE_OPTIONS);
+
+    __debugee_kill(dbg);
+
+    /* Only the thread that took the checkpoint was copied */
+    if (thread_table_reset(&dbg->threads, pid) < 0 ||
+            process_move(&dbg->procs, dbg->process, pid) < 0)
+        printf("Couldn't keep track of the threads of process %d\n", pid);
+
+    dbg->dbge_pid = pid;
+    dbg->pending_signal = ckpt->pending_signal;
+    dbg->stopped_bp = NULL;
+    debugger_mem_reset(dbg);
+    debugger_invalidate_regs(dbg);
+    displaced_reset(dbg);
+
+    /* Fast tracepoints that are still there are kept as they are */
+    for (i = 0; i < ckpt->nbps; i++) {
+        bp = debugger_breakpoint_at(dbg, ckpt->bps[i].addr);
+        if (bp != NULL && fast_trace_present(dbg, bp))
+            continue;
+        patch_code(dbg, ckpt->bps[i].addr, ckpt->bps[i].saved,
+                ckpt->bps[i].len);
+    }
+
+    breakpoint_batch_init(&batch);
+    hash_table_for_each(&dbg->bp_table, slot) {
+        bp = slot->value;
+        bp->pid = pid;
+        breakpoint_batch_add(&batch, bp, BATCH_REWRITE);
+    }
+    breakpoint_batch_commit(dbg, &batch);
+    breakpoint_batch_destroy(&batch);
+    fast_trace_reset(dbg);
+    __watch_reset(dbg);
+
+    /* Stopped on a breakpoint, it has to be stepped over first */
+    bp = debugger_breakpoint_at(dbg, (void *)ckpt->regs.rip);
+    if (bp != NULL && breakpoint_has_int3(bp))
+        dbg->stopped_bp = bp;
+
+    return 0;
+}
+
+/*
+ * Restart checkpoint number `number`. The history goes back to the
+ * checkpoint, or starts over from it if it is not part of the history
+ * anymore.
+ */
+void checkpoint_restart(struct debugger *dbg, unsigned int number)
+{
+    struct checkpoint *ckpt;
+
+    ckpt = checkpoint_pool_get(&dbg->checkpoints, number);
+    if (ckpt == NULL) {
+        printf("No checkpoint number %u\n", number);
+        return;
+    }
+
+    if (__checkpoint_restore(dbg, ckpt) < 0)
+        return;
+
+    if (ckpt->tick == TICK_NONE) {
+        checkpoint_pool_detach(&dbg->checkpoints, 0);
+        ckpt->tick = 0;
+    }
+    history_truncate(&dbg->history, ckpt->tick);
+    checkpoint_pool_detach(&dbg->checkpoints, ckpt->tick + 1);
+    write_index_truncate(&dbg->writes, ckpt->tick);
+
+    printf("Restarted checkpoint %u in process %d at %p\n", number,
+            dbg->dbge_pid, (void *)ckpt->regs.rip);
+}
+
+/*
+ * Read the value of `field` from a /proc/<pid>/ file, e.g a size in kB.
+ *
+ * @return - the value, or -1 if it could not be found
+ */
+static long __proc_field(pid_t pid, const char *file, const char *field)
+{
+    char path[64], line[256];
+    size_t len = strlen(field);
+    long value = -1;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            value = strtol(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+
+    fclose(fp);
+    return value;
+}
+
+/*
+ * List the checkpoints, oldest first, with what they cost. Since the
+ * parked processes share their pages with the debugee until either
+ * writes to them, the memory a checkpoint really costs is its private
+ * memory plus its page tables, and it grows as the debugee runs.
+ */
+void info_checkpoints(struct debugger *dbg)
+{
+    struct checkpoint *ckpt;
+    unsigned int i;
+
+    if (dbg->checkpoints.count == 0) {
+        printf("No checkpoints.\n");
+        return;
+    }
+
+    printf("%-4s %-8s %-8s %-18s %10s %10s %10s %10s\n", "Num", "Pid",
+            "Tick", "Rip", "Time(us)", "Rss(kB)", "Priv(kB)", "PTE(kB)");
+    for (i = 0; i < dbg->checkpoints.count; i++) {
+        ckpt = checkpoint_pool_nth(&dbg->checkpoints, i);
+        if (ckpt->tick == TICK_NONE)
+            printf("%-4u %-8d %-8s ", ckpt->number, ckpt->pid, "-");
+        else
+            printf("%-4u %-8d %-8lu ", ckpt->number, ckpt->pid, ckpt->tick);
+        printf("%-18p %10.1f %10ld %10ld %10ld\n", (void *)ckpt->regs.rip,
+                ckpt->cost_us,
+                __proc_field(ckpt->pid, "smaps_rollup", "Rss"),
+                __proc_field(ckpt->pid, "smaps_rollup", "Private_Dirty"),
+                __proc_field(ckpt->pid, "status", "VmPTE"));
+    }
+}
+
+/*
+ * Append a stop of the debugee to its history. A checkpoint is taken
+ * every CHECKPOINT_INTERVAL stops, which bounds how much of the history
+ * has to be replayed to go back in time.
+ */
+void debugger_record_stop(struct debugger *dbg, struct stop_record *rec)
+{
+    /* The history is the one of a single process */
+    if (rec->kind != STOP_EXIT && dbg->threads.leader != dbg->procs.history)
+        __history_reset(dbg);
+
+    if (history_append(&dbg->history, rec) < 0) {
+        printf("Couldn't record the stop, out of memory\n");
+        return;
+    }
+
+    /* The other threads may be running in non-stop mode. There is no
+     * replaying an interrupt, see inc/history.h */
+    if (rec->kind != STOP_EXIT && !dbg->non_stop &&
+            (rec->kind == STOP_INTERRUPT ||
+             dbg->history.count % CHECKPOINT_INTERVAL == 0))
+        __checkpoint_take(dbg);
+}
+
+static int __decode_at(struct debugger *dbg, unsigned long addr,
+        uint8_t *code, struct x86_insn *insn);
+
+/* Most instructions decoded from the start of a function to find its
+ * frame, and most branch targets remembered meanwhile */
+#define FRAME_SCAN_MAX      512
+#define FRAME_TARGETS       32
+
+/*
+ * Get the immediate operand of `insn`, sign extended.
+ */
+static long __insn_imm(const uint8_t *code, struct x86_insn *insn)
+{
+    if (insn->imm_size == 1)
+        return (int8_t)code[insn->imm_off];
+    return (int32_t)(code[insn->imm_off] | code[insn->imm_off + 1] << 8 |
+            code[insn->imm_off + 2] << 16 |
+            (uint32_t)code[insn->imm_off + 3] << 24);
+}
+
+/*
+ * Work out the frame of the current thread from the code of its
+ * function. The code is decoded from the start of the function up to
+ * RIP, following what is pushed and allocated on the stack. The code
+ * after a jump or a return has the stack of the forward branches to
+ * it. If none was seen, only a frame pointer set up by `push %rbp;
+ * mov %rsp,%rbp` still tells where the frame is.
+ *
+ * @param cfa - where to store the canonical frame address: the stack
+ *              pointer of the caller before the call
+ * @param ret - where to store the return address
+ * @return    - 0 on success, -1 if the frame is not known
+ */
+static int __frame_info(struct debugger *dbg, unsigned long *cfa,
+        unsigned long *ret)
+{
+    unsigned long targets[FRAME_TARGETS], pc, off, target;
+    long pushed = 0, framed = -1, stack[FRAME_TARGETS][2];
+    uint8_t code[X86_MAX_INSN_LEN];
+    struct user_regs_struct regs;
+    unsigned int n, i, ntargets = 0;
+    int known = 1, rex_w, rex_b;
+    struct x86_insn insn;
+    uint8_t op, modrm;
+
+    if (debugger_get_regs(dbg, &regs) < 0)
+        return -1;
+
+    /* About to return, whatever the function did before */
+    if (__decode_at(dbg, regs.rip, code, &insn) == 0 &&
+            insn.kind == X86_INSN_RET) {
+        *cfa = regs.rsp + 8;
+        goto done;
+    }
+
+    if (dbg->symbols == NULL ||
+            symbol_lookup_addr(dbg->symbols, regs.rip, &off) == NULL)
+        return -1;
+
+    for (pc = regs.rip - off, n = 0; pc < regs.rip; pc += insn.len, n++) {
+        for (i = 0; !known && i < ntargets; i++) {
+            if (targets[i] != pc)
+                continue;
+            pushed = stack[i][0];
+            framed = stack[i][1];
+            known = 1;
+        }
+
+        if (n == FRAME_SCAN_MAX || __decode_at(dbg, pc, code, &insn) < 0) {
+            known = 0;
+            break;
+        }
+
+        op = code[insn.opcode_off];
+        modrm = insn.has_modrm ? code[insn.modrm_off] : 0;
+        rex_w = insn.rex & 0x08;
+        rex_b = insn.rex & 0x01;
+
+        if ((op & 0xf8) == 0x50 || op == 0x68 || op == 0x6a) {
+            pushed += 8;
+        }
+        else if ((op & 0xf8) == 0x58) {
+            pushed -= 8;
+            if ((op & 7) == 5 && !rex_b)
+                framed = -1;
+        }
+        else if ((op == 0x83 || op == 0x81) && rex_w && modrm == 0xec) {
+            pushed += __insn_imm(code, &insn);
+        }
+        else if ((op == 0x83 || op == 0x81) && rex_w && modrm == 0xc4) {
+            pushed -= __insn_imm(code, &insn);
+        }
+        else if (rex_w && ((op == 0x89 && modrm == 0xe5) ||
+                    (op == 0x8b && modrm == 0xec))) {
+            framed = known ? pushed : -1;
+        }
+        else if (rex_w && framed >= 0 && ((op == 0x89 && modrm == 0xec) ||
+                    (op == 0x8b && modrm == 0xe5))) {
+            pushed = framed;
+        }
+        else if (op == 0xc9) {
+            pushed = framed - 8;
+            known = known && framed >= 0;
+            framed = -1;
+        }
+
+        switch (insn.kind) {
+        case X86_INSN_JMP_REL:
+        case X86_INSN_JCC_REL:
+        case X86_INSN_LOOP_REL:
+            target = x86_branch_target(code, &insn, pc);
+            if (known && target > pc && ntargets < FRAME_TARGETS) {
+                targets[ntargets] = target;
+                stack[ntargets][0] = pushed;
+                stack[ntargets++][1] = framed;
+            }
+            if (insn.kind == X86_INSN_JMP_REL)
+                known = 0;
+            break;
+        case X86_INSN_JMP_IND:
+        case X86_INSN_RET:
+        case X86_INSN_TRAP:
+            known = 0;
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* %rbp points to the saved %rbp, below the return address */
+    if (framed >= 0)
+        *cfa = regs.rbp + framed + 8;
+    else if (known)
+        *cfa = regs.rsp + pushed + 8;
+    else
+        return -1;
+
+done:
+    if (read_memory(dbg, (void *)(*cfa - 8), ret, sizeof(*ret)) !=
+            sizeof(*ret))
+        return -1;
+    return 0;
+}
+
+/*
+ * Set an internal breakpoint at `addr`, that stops the thread being
+ * stepped in the frames `flags` tells. A breakpoint of the user that
+ * is there already stops it anyway.
+ *
+ * @return - 0 on success, -1 on error, which is reported
+ */
+static int __temp_breakpoint(struct debugger *dbg, unsigned long addr,
+        int flags)
+{
+    struct breakpoint *bp;
+
+    __coverage_take(dbg, (void *)addr);
+    bp = debugger_breakpoint_at(dbg, (void *)addr);
+    if (bp != NULL && bp->temporary) {
+        bp->temporary |= flags;
+        return 0;
+    }
+    if (bp != NULL && breakpoint_has_int3(bp))
+        return 0;
+
+    if (bp == NULL)
+        bp = fast_trace_covering(dbg, (void *)addr);
+    if (bp != NULL) {
+        printf("Can't stop at %#lx, taken by breakpoint %u\n", addr,
+                bp->number);
+        return -1;
+    }
+
+    if (dbg->step.nbps == STEP_MAX_BPS) {
+        printf("Too many places to stop at\n");
+        return -1;
+    }
+
+    bp = breakpoint_alloc(dbg->dbge_pid, (void *)addr);
+    if (bp == NULL)
+        return -1;
+    bp->temporary = flags;
+
+    if (breakpoint_enable(dbg, bp) < 0 ||
+            __debugger_breakpoint_insert(dbg, bp) == ENOBP) {
+        if (breakpoint_is_enabled(bp))
+            breakpoint_disable(dbg, bp);
+        free(bp);
+        return -1;
+    }
+    dbg->step.bps[dbg->step.nbps++] = bp->number;
+    return 0;
+}
+
+/*
+ * Get ready to set the internal breakpoints of a command for the
+ * current thread, in the frame it is in.
+ */
+static void __step_begin(struct debugger *dbg)
+{
+    dbg->step.tid = dbg->dbge_pid;
+    dbg->step.nbps = 0;
+    if (__frame_info(dbg, &dbg->step.cfa, &dbg->step.ret) < 0) {
+        dbg->step.cfa = 0;
+        dbg->step.ret = 0;
+    }
+}
+
+/*
+ * Delete the internal breakpoints, the debugee having stopped. Those of
+ * a debugee that is `gone` are not taken out of its memory.
+ */
+static void __step_done(struct debugger *dbg, int gone)
+{
+    struct breakpoint *bps[STEP_MAX_BPS];
+    struct breakpoint_batch batch;
+    unsigned int i, n = 0;
+
+    breakpoint_batch_init(&batch);
+    for (i = 0; i < dbg->step.nbps; i++) {
+        bps[n] = __debugger_breakpoint_delete(dbg, dbg->step.bps[i]);
+        if (bps[n] == NULL)
+            continue;
+        __breakpoint_forget(dbg, bps[n]);
+        if (!gone && !__coverage_give_back(dbg, bps[n]) &&
+                breakpoint_batch_add(&batch, bps[n], BATCH_DISABLE) < 0)
+            breakpoint_disable(dbg, bps[n]);
+        n++;
+    }
+    breakpoint_batch_commit(dbg, &batch);
+    breakpoint_batch_destroy(&batch);
+
+    for (i = 0; i < n; i++) {
+        displaced_release(dbg, bps[i]);
+        free(bps[i]);
+    }
+    dbg->step.nbps = 0;
+}
+
+/*
+ * Check whether the thread that got to internal breakpoint `bp` is the
+ * one being stepped, in a frame the breakpoint is for rather than e.g
+ * in a recursive call. The frame is not checked if it was not known.
+ */
+static int __step_should_stop(struct debugger *dbg, struct breakpoint *bp)
+{
+    struct user_regs_struct regs;
+    unsigned long cfa, ret;
+
+    if (dbg->dbge_pid != dbg->step.tid)
+        return 0;
+    if (dbg->step.cfa == 0 || debugger_get_regs(dbg, &regs) < 0)
+        return 1;
+
+    /* Back in the caller, the return address popped */
+    if ((bp->temporary & TEMP_RETURN) &&
+            (unsigned long)bp->addr == dbg->step.ret &&
+            regs.rsp >= dbg->step.cfa)
+        return 1;
+    if (!(bp->temporary & TEMP_FRAME))
+        return 0;
+
+    if (__frame_info(dbg, &cfa, &ret) < 0)
+        return 1;
+    return cfa >= dbg->step.cfa;
+}
+
+/*
+ * Check whether the debugee, which got to breakpoint `bp`, should stop
+ * there. Conditions are evaluated from the registers fetched by the
+ * stop handler. A condition that can't be evaluated, e.g because it
+ * reads unmapped memory, stops the debugee.
+ */
+static int __breakpoint_should_stop(struct debugger *dbg,
+        struct breakpoint *bp)
+{
+    struct user_regs_struct regs;
+    int64_t value;
+
+    if (bp->temporary)
+        return __step_should_stop(dbg, bp);
+    if (bp->condition == NULL)
+        return 1;
+
+    if (debugger_get_regs(dbg, &regs) < 0 ||
+            condition_eval(bp->condition, &regs, read_memory_v, dbg,
+                &value) < 0) {
+        printf("Error in the condition of breakpoint %u\n", bp->number);
+        return 1;
+    }
+    return value != 0;
+}
+
+/*
+ * Take care of a stop of the debugee during `continue`. Breakpoints
+ * whose condition does not hold and faults on the pages of software
+ * watchpoints are passed over. The stop record of a breakpoint counts
+ * how many times the debugee went past it that way, so that the stop
+ * can be replayed whatever the condition has become since.
+ *
+ * @return - 1 if the debugee has to be resumed again, 0 if the stop
+ *           was reported
+ */
+static int __continue_stopped(struct debugger *dbg, int wait_status)
+{
+    struct stop_record rec;
+    struct process *p;
+    unsigned long n;
+
+    if (wait_status < 0) {
+        printf("The program is not being run.\n");
+        thread_table_clear(&dbg->threads);
+        hash_table_clear(&dbg->skipped);
+        __step_done(dbg, 1);
+        __coverage_done(dbg, 1);
+        return 0;
+    }
+
+    if (WIFSTOPPED(wait_status) && WSTOPSIG(wait_status) == SIGSEGV &&
+            dbg->soft_watch.count > 0 &&
+            __watch_fault(dbg, RESUME_CONTINUE, &wait_status) > 0)
+        return 1;
+    if (__coverage_trap(dbg, wait_status))
+        return 1;
+
+    debugger_handle_stop(dbg, wait_status, RESUME_CONTINUE, &rec);
+    if (rec.kind == STOP_BREAKPOINT) {
+        n = (uintptr_t)hash_table_lookup(&dbg->skipped,
+                (unsigned long)rec.addr);
+        if (!__breakpoint_should_stop(dbg, dbg->stopped_bp)) {
+            hash_table_insert(&dbg->skipped, (unsigned long)rec.addr,
+                    (void *)(uintptr_t)(n + 1));
+            return 1;
+        }
+        rec.arg = n;
+    }
+
+    hash_table_clear(&dbg->skipped);
+    __step_done(dbg, rec.kind == STOP_EXIT);
+    debugger_record_stop(dbg, &rec);
+    report_stop(dbg, &rec);
+
+    /* The debugger goes on with the parent of a child that exited */
+    if (rec.kind == STOP_EXIT) {
+        p = process_get(&dbg->procs, dbg->process->parent);
+        if (p != NULL && p->state == PROCESS_TRACED)
+            __process_select(dbg, p);
+    }
+    return 0;
+}
+
+/*
+ * Resume the debugee for `continue`, until it runs on its own or a stop
+ * was reported.
+ */
+static void __continue_resume(struct debugger *dbg)
+{
+    int wait_status, request;
+
+    do {
+        dbg->soft_hit = NULL;
+
+        /* Threads that stopped while the others were being stopped */
+        wait_status = __threads_pending(dbg);
+        if (wait_status != 0)
+            continue;
+
+        switch (__debugger_start(dbg, RESUME_CONTINUE, &request,
+                    &wait_status)) {
+        case 0:
+            __threads_run(dbg, 1);
+
+            /* Processes put aside that stopped meanwhile */
+            wait_status = __processes_pending(dbg);
+            if (wait_status != 0)
+                break;
+            dbg->running = 1;
+            if (dbg->ftrace != NULL)
+                event_loop_timer(&dbg->loop, fast_trace_resume(dbg));
+            return;
+        case -1:
+            wait_status = -1;
+            break;
+        }
+    } while (__continue_stopped(dbg, wait_status));
+}
+
+/*
+ * Take care of the events of the debugee that the event loop got, i.e
+ * the stop of a debugee running on its own after `continue`, or the
+ * events of the threads that keep running in non-stop mode.
+ */
+static void __debugee_events(struct debugger *dbg)
+{
+    int wait_status;
+
+    if (!dbg->running) {
+        __threads_poll(dbg);
+        return;
+    }
+
+    switch (__threads_collect(dbg, &wait_status)) {
+    case 0:
+        return;
+    case -1:
+        wait_status = -1;
+        break;
+    }
+
+    dbg->running = 0;
+    event_loop_timer(&dbg->loop, 0);
+    if (__continue_stopped(dbg, wait_status))
+        __continue_resume(dbg);
+}
+
+/**
+ * Interrupt the debugee running on its own after `continue`. Every
+ * thread is stopped in all-stop mode, and only the current one in
+ * non-stop mode. A stop that came first is reported instead.
+ *
+ * @param dbg - pointer to debugger structure
+ */
+void interrupt_execution(struct debugger *dbg)
+{
+    struct user_regs_struct regs;
+    struct stop_record rec;
+    struct thread *t;
+    int wait_status;
+
+    if (!dbg->running) {
+        printf("The program is not running.\n");
+        return;
+    }
+    dbg->running = 0;
+    event_loop_timer(&dbg->loop, 0);
+
+    t = thread_get(&dbg->threads, dbg->dbge_pid);
+    if (dbg->non_stop && t != NULL) {
+        if (!t->stop_requested &&
+                ptrace(PTRACE_INTERRUPT, t->tid, NULL, NULL) == 0)
+            t->stop_requested = 1;
+        __thread_wait_stop(dbg, t->tid);
+    }
+    else {
+        __threads_stop(dbg, 0);
+    }
+
+    /* The debugee gets the SIGINT of Ctrl-C as well, it is the
+     * interrupt and is not passed on */
+    wait_status = __threads_pending(dbg);
+    if (wait_status != 0 && (!WIFSTOPPED(wait_status) ||
+                WSTOPSIG(wait_status) != SIGINT) &&
+            !__continue_stopped(dbg, wait_status))
+        return;
+
+    fast_trace_drain(dbg);
+    rec.kind = STOP_INTERRUPT;
+    rec.addr = NULL;
+    rec.arg = 0;
+    if (debugger_get_regs(dbg, &regs) == 0)
+        rec.addr = (void *)regs.rip;
+
+    hash_table_clear(&dbg->skipped);
+    __step_done(dbg, 0);
+    debugger_record_stop(dbg, &rec);
+    report_stop(dbg, &rec);
+}
+
+/*
+ * Take care of an event of the event loop, other than the input of the
+ * user.
+ */
+static void __debugger_event(struct debugger *dbg, int event)
+{
+    switch (event) {
+    case EVENT_CHILD:
+        __debugee_events(dbg);
+        break;
+    case EVENT_INTERRUPT:
+        if (dbg->running)
+            interrupt_execution(dbg);
+        break;
+    case EVENT_TIMER:
+        if (dbg->running)
+            event_loop_timer(&dbg->loop, fast_trace_tick(dbg));
+        break;
+    }
+}
+
+/**
+ * Continue execution of debugee process.
+ *
+ * The debugee runs on its own, with the event loop waiting for it to
+ * stop. Unless `background` is set, the event loop is run until then,
+ * with the input of the user left aside but for Ctrl-C.
+ *
+ * @param dbg        - pointer to debugger structure
+ * @param background - whether to give the prompt back right away
+ */
+void continue_execution(struct debugger *dbg, int background)
+{
+    int event;
+
+    if (dbg->running) {
+        printf("The program is already running.\n");
+        return;
+    }
+
+    __continue_resume(dbg);
+    if (background || !dbg->running)
+        return;
+
+    event_loop_input(&dbg->loop, 0);
+    while (dbg->running && (event = event_loop_wait(&dbg->loop)) >= 0)
+        __debugger_event(dbg, event);
+    event_loop_input(&dbg->loop, 1);
+}
+
+/**
+ * Execute a single instruction of the debugee.
+ *
+ * @param dbg - pointer to debugger structure
+ */
+void step_instruction(struct debugger *dbg)
+{
+    struct stop_record rec;
+    int wait_status;
+
+    wait_status = debugger_resume(dbg, RESUME_STEP);
+    if (wait_status < 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    debugger_handle_stop(dbg, wait_status, RESUME_STEP, &rec);
+    debugger_record_stop(dbg, &rec);
+    report_stop(dbg, &rec);
+}
+
+/*
+ * Set the internal breakpoints that stop the current thread once it
+ * leaves the code in [start, end): at the targets of the branches out
+ * of it, at its end, and at the return address of its function. Calls
+ * are run through. With `loop`, the code branched back to from within
+ * the function is taken in as well, for the debugee to run through
+ * the loops the code ends.
+ *
+ * @return - 0 on success, -1 on error, which is reported
+ */
+static int __step_plan(struct debugger *dbg, unsigned long start,
+        unsigned long end, int loop)
+{
+    unsigned long pc, target, lo, func = 0, off;
+    uint8_t code[X86_MAX_INSN_LEN];
+    struct x86_insn insn;
+    int set;
+
+    if (loop && dbg->symbols != NULL &&
+            symbol_lookup_addr(dbg->symbols, start, &off) != NULL)
+        func = start - off;
+
+    /* The first pass only looks for code to take in, the last one sets
+     * the breakpoints */
+    for (set = 0; set < 2; set++) {
+        do {
+            lo = start;
+            for (pc = lo; pc < end; pc += insn.len) {
+                if (__decode_at(dbg, pc, code, &insn) < 0) {
+                    printf("Cannot decode the instruction at %#lx\n", pc);
+                    return -1;
+                }
+
+                switch (insn.kind) {
+                case X86_INSN_JMP_REL:
+                case X86_INSN_JCC_REL:
+                case X86_INSN_LOOP_REL:
+                    target = x86_branch_target(code, &insn, pc);
+                    if (target >= lo && target < end)
+                        break;
+                    if (!set && func != 0 && target >= func && target < lo)
+                        start = target;
+                    else if (set && __temp_breakpoint(dbg, target,
+                                TEMP_FRAME) < 0)
+                        return -1;
+                    break;
+                case X86_INSN_RET:
+                    /* Right at it if the frame is not known */
+                    if (set && __temp_breakpoint(dbg, dbg->step.ret != 0 ?
+                                dbg->step.ret : pc, dbg->step.ret != 0 ?
+                                TEMP_RETURN : TEMP_FRAME) < 0)
+                        return -1;
+                    break;
+                case X86_INSN_JMP_IND:
+                    /* Where it goes is only known once there */
+                    if (set && __temp_breakpoint(dbg, pc, TEMP_FRAME) < 0)
+                        return -1;
+                    break;
+                default:
+                    break;
+                }
+            }
+        } while (!set && start < lo);
+    }
+
+    return __temp_breakpoint(dbg, end, TEMP_FRAME);
+}
+
+/**
+ * Run the current thread of the debugee to the next source line of
+ * its function, calls included. Internal breakpoints are set wherever
+ * the code of the current line can go, and the debugee continues: the
+ * stops are as many as the breakpoints of the user that are hit, rather
+ * than as many as the instructions run. Without line information, a
+ * single instruction is gone over.
+ *
+ * @param dbg  - pointer to debugger structure
+ * @param loop - whether to go through the loops the line ends, for
+ *               `until`
+ */
+void step_over(struct debugger *dbg, int loop)
+{
+    uint8_t code[X86_MAX_INSN_LEN];
+    struct user_regs_struct regs;
+    unsigned long start, end;
+    struct x86_insn insn;
+
+    if (debugger_get_regs(dbg, &regs) < 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+    if (__decode_at(dbg, regs.rip, code, &insn) < 0) {
+        printf("Cannot decode the instruction at %#llx\n", regs.rip);
+        return;
+    }
+
+    /* Where an indirect jump goes is only known once it is taken */
+    if (insn.kind == X86_INSN_JMP_IND) {
+        step_instruction(dbg);
+        return;
+    }
+
+    if (dbg->symbols == NULL || symbol_line_range(dbg->symbols, regs.rip,
+                &start, &end) < 0) {
+        start = regs.rip;
+        end = regs.rip + insn.len;
+    }
+
+    __step_begin(dbg);
+    if (__step_plan(dbg, start, end, loop) < 0) {
+        __step_done(dbg, 0);
+        return;
+    }
+    continue_execution(dbg, 0);
+}
+
+/**
+ * Run the current thread of the debugee until the function it is in
+ * returns, with a single internal breakpoint at the return address,
+ * and print the value it returned.
+ *
+ * @param dbg - pointer to debugger structure
+ */
+void finish_frame(struct debugger *dbg)
+{
+    struct user_regs_struct regs;
+    char loc[LOCATION_MAX];
+
+    if (debugger_get_regs(dbg, &regs) < 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    __step_begin(dbg);
+    if (dbg->step.cfa == 0) {
+        printf("Cannot find the return address of this frame\n");
+        return;
+    }
+    printf("Run till exit from %s\n",
+            __location(dbg, (void *)regs.rip, loc));
+    if (__temp_breakpoint(dbg, dbg->step.ret, TEMP_RETURN) < 0) {
+        __step_done(dbg, 0);
+        return;
+    }
+    continue_execution(dbg, 0);
+
+    if (debugger_get_regs(dbg, &regs) == 0 &&
+            dbg->dbge_pid == dbg->step.tid && regs.rip == dbg->step.ret &&
+            regs.rsp >= dbg->step.cfa)
+        printf("Value returned: %lld (%#llx)\n", (long long)regs.rax,
+                regs.rax);
+}
+
+/**
+ * Run the current thread of the debugee until it gets to `addr` in the
+ * current frame or an outer one, or its function returns.
+ *
+ * @param dbg  - pointer to debugger structure
+ * @param addr - where to stop
+ */
+void until_location(struct debugger *dbg, void *addr)
+{
+    struct user_regs_struct regs;
+
+    if (debugger_get_regs(dbg, &regs) < 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    __step_begin(dbg);
+    if (__temp_breakpoint(dbg, (unsigned long)addr, TEMP_FRAME) < 0 ||
+            (dbg->step.ret != 0 &&
+             __temp_breakpoint(dbg, dbg->step.ret, TEMP_RETURN) < 0)) {
+        __step_done(dbg, 0);
+        return;
+    }
+    continue_execution(dbg, 0);
+}
+
+/* How a breakpoint was made available for replay */
+#define REPLAY_BP_ENABLED   0   /* it was there */
+#define REPLAY_BP_DISABLED  1   /* enabled for the replay */
+#define REPLAY_BP_DELETED   2   /* recreated for the replay */
+#define REPLAY_BP_FAST      3   /* a fast tracepoint, INT3 for the replay */
+#define REPLAY_BP_FAST_OFF  4   /* same, but disabled */
+
+/*
+ * Get an enabled breakpoint at `addr` for replaying a stop at it, the
+ * breakpoint may have been disabled or deleted since. The way it was
+ * obtained is stored in `how`, to be given to `__replay_breakpoint_put()`.
+ */
+static struct breakpoint *__replay_breakpoint_get(struct debugger *dbg,
+        void *addr, int *how)
+{
+    struct breakpoint *bp;
+
+    *how = REPLAY_BP_ENABLED;
+    __coverage_take(dbg, addr);
+    bp = debugger_breakpoint_at(dbg, addr);
+    if (bp != NULL && breakpoint_has_int3(bp))
+        return bp;
+
+    if (bp != NULL && bp->kind == BREAKPOINT_FAST) {
+        *how = REPLAY_BP_FAST_OFF;
+        if (breakpoint_is_enabled(bp)) {
+            *how = REPLAY_BP_FAST;
+            breakpoint_disable(dbg, bp);
+        }
+        bp->kind = BREAKPOINT_INT3;
+    }
+    else if (bp != NULL) {
+        *how = REPLAY_BP_DISABLED;
+    }
+    else {
+        bp = breakpoint_alloc(dbg->dbge_pid, addr);
+        if (bp == NULL)
+            return NULL;
+        if (hash_table_insert(&dbg->bp_table, (unsigned long)addr, bp) < 0) {
+            free(bp);
+            return NULL;
+        }
+        *how = REPLAY_BP_DELETED;
+    }
+
+    if (breakpoint_enable(dbg, bp) < 0) {
+        if (*how == REPLAY_BP_DELETED) {
+            hash_table_delete(&dbg->bp_table, (unsigned long)addr);
+            free(bp);
+        }
+        else if (*how == REPLAY_BP_FAST || *how == REPLAY_BP_FAST_OFF) {
+            bp->kind = BREAKPOINT_FAST;
+            if (*how == REPLAY_BP_FAST)
+                breakpoint_enable(dbg, bp);
+        }
+        return NULL;
+    }
+    return bp;
+}
+
+/*
+ * Put a breakpoint obtained with `__replay_breakpoint_get()` back the
+ * way it was.
+ */
+static void __replay_breakpoint_put(struct debugger *dbg, 
+        struct breakpoint *bp, int how)
+{
+    if (how == REPLAY_BP_ENABLED)
+        return;
+
+    __breakpoint_forget(dbg, bp);
+    if (how == REPLAY_BP_DELETED) {
+        hash_table_delete(&dbg->bp_table, (unsigned long)bp->addr);
+        if (!__coverage_give_back(dbg, bp))
+            breakpoint_disable(dbg, bp);
+        displaced_release(dbg, bp);
+        free(bp);
+        return;
+    }
+
+    breakpoint_disable(dbg, bp);
+    if (how == REPLAY_BP_FAST || how == REPLAY_BP_FAST_OFF) {
+        displaced_release(dbg, bp);
+        bp->kind = BREAKPOINT_FAST;
+        if (how == REPLAY_BP_FAST)
+            breakpoint_enable(dbg, bp);
+    }
+}
+
+/*
+ * Run the debugee the way it went in history record `rec`. Stops at
+ * breakpoints that were set since are passed through.
+ *
+ * @return - 0 on success, -1 if the debugee did not stop as recorded
+ */
+static int __replay(struct debugger *dbg, struct stop_record *rec)
+{
+    struct breakpoint *bp = NULL;
+    struct watchpoint *wp = NULL;
+    unsigned long i, skipped;
+    struct stop_record stop;
+    int wait_status, how = REPLAY_BP_ENABLED, resume, armed = 0;
+
+    /* Only reached from a checkpoint taken there */
+    if (rec->kind == STOP_INTERRUPT)
+        return -1;
+
+    if (rec->kind == STOP_STEP || rec->kind == STOP_BLOCK) {
+        resume = rec->kind == STOP_STEP ? RESUME_STEP : RESUME_BLOCK;
+        for (i = 0; i < rec->arg; i++) {
+            wait_status = debugger_resume(dbg, resume);
+            if (wait_status < 0)
+                return -1;
+            debugger_handle_stop(dbg, wait_status, resume, &stop);
+
+            /* The step also hit a watchpoint set since */
+            if (stop.kind != rec->kind && stop.kind != STOP_WATCHPOINT)
+                return -1;
+        }
+        return 0;
+    }
+
+    if (rec->kind == STOP_BREAKPOINT) {
+        bp = __replay_breakpoint_get(dbg, rec->addr, &how);
+        if (bp == NULL)
+            return -1;
+    }
+    else if (rec->kind == STOP_WATCHPOINT) {
+        /* Deleted watchpoints are programmed again for the replay */
+        wp = debugger_watchpoint_get(dbg, rec->arg);
+        if (wp == NULL)
+            return -1;
+        if (!wp->enabled) {
+            if (__watch_arm(dbg, wp) < 0)
+                return -1;
+            armed = 1;
+        }
+    }
+
+    /* Hits of a conditional breakpoint that were passed over, and
+     * stops at breakpoints and watchpoints set since */
+    skipped = 0;
+    do {
+        wait_status = debugger_resume(dbg, RESUME_CONTINUE);
+        if (wait_status < 0)
+            break;
+        debugger_handle_stop(dbg, wait_status, RESUME_CONTINUE, &stop);
+    } while ((stop.kind == STOP_BREAKPOINT || stop.kind == STOP_WATCHPOINT) &&
+            (stop.kind != rec->kind || stop.addr != rec->addr ||
+             (rec->kind == STOP_BREAKPOINT && skipped++ < rec->arg)));
+
+    if (bp != NULL)
+        __replay_breakpoint_put(dbg, bp, how);
+    if (armed)
+        __watch_disarm(dbg, wp);
+
+    if (wait_status < 0 || stop.kind != rec->kind || 
+            stop.addr != rec->addr ||
+            (rec->kind != STOP_BREAKPOINT && stop.arg != rec->arg))
+        return -1;
+    return 0;
+}
+
+/*
+ * Bring the debugee to `tick` of its history by replaying the history
+ * from the closest checkpoint. The history itself is left as it is.
+ *
+ * @return - the tick the debugee got to, before `tick` if it did not
+ *           run as recorded, or -1 if it could not be restored
+ */
+static long __debugger_replay(struct debugger *dbg, unsigned long tick)
+{
+    struct checkpoint *ckpt;
+    unsigned long t;
+
+    ckpt = checkpoint_pool_before(&dbg->checkpoints, tick);
+    if (ckpt == NULL) {
+        printf("No checkpoint to go back to\n");
+        return -1;
+    }
+
+    if (__checkpoint_restore(dbg, ckpt) < 0)
+        return -1;
+
+    for (t = ckpt->tick; t < tick; t++)
+        if (__replay(dbg, history_get(&dbg->history, t)) < 0)
+            break;
+    return t;
+}
+
+/*
+ * Bring the debugee to `tick` of its history and run it further the way
+ * `partial` says, a number of single or block steps, if not NULL. The
+ * history after that point is forgotten.
+ *
+ * @return - 0 on success, -1 on error
+ */
+static int __debugger_goto(struct debugger *dbg, unsigned long tick,
+        struct stop_record *partial)
+{
+    struct user_regs_struct regs;
+    struct stop_record rec;
+    long t;
+
+    t = __debugger_replay(dbg, tick);
+    if (t < 0)
+        return -1;
+
+    history_truncate(&dbg->history, t);
+    checkpoint_pool_detach(&dbg->checkpoints, t + 1);
+    write_index_truncate(&dbg->writes, t);
+    if ((unsigned long)t < tick) {
+        printf("The program did not run as recorded at tick %lu\n", t);
+        return -1;
+    }
+
+    if (partial == NULL || partial->arg == 0)
+        return 0;
+
+    rec = *partial;
+    if (__replay(dbg, &rec) < 0 || debugger_get_regs(dbg, &regs) < 0) {
+        printf("The program did not run as recorded at tick %lu\n", t);
+        return -1;
+    }
+    rec.addr = (void *)regs.rip;
+    return history_append(&dbg->history, &rec);
+}
+
+/*
+ * Single step the debugee until it gets where history record `rec`
+ * took it.
+ *
+ * @return - the number of instructions executed to get there, -1 if
+ *           the debugee never got there
+ */
+static long __count_steps(struct debugger *dbg, struct stop_record *rec)
+{
+    struct stop_record stop;
+    int wait_status;
+    long n = 0;
+
+    for (;;) {
+        wait_status = debugger_resume(dbg, RESUME_STEP);
+        if (wait_status < 0)
+            return -1;
+
+        debugger_handle_stop(dbg, wait_status, RESUME_STEP, &stop);
+        if (stop.kind == STOP_EXIT)
+            /* The last instruction is the one that made it exit */
+            return rec->kind == STOP_EXIT ? n + 1 : -1;
+        if (stop.kind == STOP_SIGNAL)
+            /* The faulting instruction has not been executed */
+            return rec->kind == STOP_SIGNAL && stop.arg == rec->arg ? n : -1;
+
+        n++;
+
+        /* There is no taken branch within a block, so RIP cannot come
+         * back to where it was before the end of the block */
+        if ((rec->kind == STOP_BREAKPOINT || rec->kind == STOP_BLOCK) &&
+                stop.addr == rec->addr)
+            return n;
+        if (rec->kind == STOP_WATCHPOINT && stop.kind == STOP_WATCHPOINT &&
+                stop.arg == rec->arg)
+            return n;
+    }
+}
+
+/*
+ * Tell the user where the debugee is after going back in time.
+ */
+static void __report_position(struct debugger *dbg)
+{
+    struct user_regs_struct regs;
+    struct stop_record *rec;
+
+    rec = history_get(&dbg->history, dbg->history.count - 1);
+    if (rec != NULL && rec->kind != STOP_EXIT) {
+        report_stop(dbg, rec);
+        return;
+    }
+
+    if (debugger_get_regs(dbg, &regs) == 0)
+        printf("Stopped at %p\n", (void *)regs.rip);
+}
+
+/*
+ * Check whether history record `rec` is a stop at one of the current
+ * breakpoints or watchpoints.
+ */
+static int __is_reverse_stop(struct debugger *dbg, struct stop_record *rec)
+{
+    struct breakpoint *bp;
+    struct watchpoint *wp;
+
+    if (rec->kind == STOP_BREAKPOINT) {
+        bp = debugger_breakpoint_at(dbg, rec->addr);
+        return bp != NULL && breakpoint_has_int3(bp);
+    }
+    if (rec->kind == STOP_WATCHPOINT) {
+        wp = debugger_watchpoint_get(dbg, rec->arg);
+        return wp != NULL && wp->enabled;
+    }
+    return 0;
+}
+
+/*
+ * Go back to the latest stop at one of the current breakpoints or
+ * watchpoints.
+ */
+void reverse_continue(struct debugger *dbg)
+{
+    struct stop_record *rec = NULL;
+    struct checkpoint *ckpt;
+    unsigned long t;
+
+    ckpt = checkpoint_pool_earliest(&dbg->checkpoints);
+    if (ckpt == NULL) {
+        printf("No checkpoint to go back to\n");
+        return;
+    }
+
+    /* Stops before the earliest checkpoint cannot be reached */
+    for (t = dbg->history.count; t > 1 && t > ckpt->tick; ) {
+        rec = history_get(&dbg->history, --t - 1);
+        if (__is_reverse_stop(dbg, rec))
+            break;
+    }
+
+    if (rec == NULL || !__is_reverse_stop(dbg, rec)) {
+        printf("No more reverse-execution history.\n");
+        t = ckpt->tick;
+    }
+
+    if (__debugger_goto(dbg, t, NULL) == 0)
+        __report_position(dbg);
+}
+
+/*
+ * Go back one instruction.
+ */
+void reverse_stepi(struct debugger *dbg)
+{
+    unsigned long tick = dbg->history.count;
+    struct stop_record *rec, last;
+    long steps;
+
+    rec = history_get(&dbg->history, tick - 1);
+    if (rec == NULL) {
+        printf("No more reverse-execution history.\n");
+        return;
+    }
+
+    /* Only go back within the last block */
+    if (rec->kind == STOP_BLOCK && rec->arg > 1) {
+        rec->arg--;
+        last = *rec;
+        last.arg = 1;
+        checkpoint_pool_detach(&dbg->checkpoints, tick);
+        write_index_truncate(&dbg->writes, tick - 1);
+        history_append(&dbg->history, &last);
+        tick++;
+    }
+
+    last = *history_get(&dbg->history, tick - 1);
+    if (last.kind == STOP_INTERRUPT) {
+        printf("Can't step back from an interrupt.\n");
+        return;
+    }
+    if (last.kind == STOP_STEP) {
+        steps = last.arg;
+    }
+    else {
+        /* Count the instructions it took to get to the last stop */
+        if (__debugger_goto(dbg, tick - 1, NULL) < 0)
+            return;
+
+        steps = __count_steps(dbg, &last);
+        if (steps < 0) {
+            printf("The program did not run as recorded at tick %lu\n",
+                    tick - 1);
+            return;
+        }
+    }
+
+    last.kind = STOP_STEP;
+    last.arg = steps > 0 ? steps - 1 : 0;
+    if (__debugger_goto(dbg, tick - 1, &last) == 0)
+        __report_position(dbg);
+}
+
+/*
+ * Print the general purpose registers in `regs`.
+ */
+void print_registers(struct user_regs_struct *regs)
+{
+    printf("rip %#18llx  rsp %#18llx  rbp %#18llx  eflags %#llx\n",
+            regs->rip, regs->rsp, regs->rbp, regs->eflags);
+    printf("rax %#18llx  rbx %#18llx  rcx %#18llx  rdx %#18llx\n",
+            regs->rax, regs->rbx, regs->rcx, regs->rdx);
+    printf("rsi %#18llx  rdi %#18llx  r8  %#18llx  r9  %#18llx\n",
+            regs->rsi, regs->rdi, regs->r8, regs->r9);
+    printf("r10 %#18llx  r11 %#18llx  r12 %#18llx  r13 %#18llx\n",
+            regs->r10, regs->r11, regs->r12, regs->r13);
+    printf("r14 %#18llx  r15 %#18llx\n", regs->r14, regs->r15);
+}
+
+/*
+ * Print the x87 and SSE registers in `fpregs`, xmm registers as 128 bit
+ * numbers.
+ */
+void print_fpregs(struct user_fpregs_struct *fpregs)
+{
+    unsigned int *x;
+    long double st;
+    int i;
+
+    printf("fctrl 0x%04x  fstat 0x%04x  ftag 0x%04x  mxcsr 0x%08x\n",
+            fpregs->cwd, fpregs->swd, fpregs->ftw, fpregs->mxcsr);
+    for (i = 0; i < 8; i++) {
+        memcpy(&st, &fpregs->st_space[i * 4], 10);
+        printf("st%d   %-24Lg%s", i, st, i % 2 ? "\n" : "  ");
+    }
+    for (i = 0; i < 16; i++) {
+        x = &fpregs->xmm_space[i * 4];
+        printf("xmm%-2d 0x%08x%08x%08x%08x%s", i, x[3], x[2], x[1], x[0],
+                i % 2 ? "\n" : "  ");
+    }
+}
+
+/*
+ * Handle `registers [float]`: print the registers of the current
+ * thread, the x87 and SSE ones if `float` is given.
+ */
+void show_registers(struct debugger *dbg, char **args)
+{
+    struct user_fpregs_struct fpregs;
+    struct user_regs_struct regs;
+
+    if (args[1] == NULL) {
+        if (debugger_get_regs(dbg, &regs) < 0)
+            perror("ptrace");
+        else
+            print_registers(&regs);
+    }
+    else if (strcmp(args[1], "float") == 0) {
+        if (debugger_get_fpregs(dbg, &fpregs) < 0)
+            perror("ptrace");
+        else
+            print_fpregs(&fpregs);
+    }
+    else {
+        puts("Unknown command\n");
+    }
+}
+
+/*
+ * Tell how many reads of the registers and memory of the debugee were
+ * saved by keeping them for the duration of a stop, which is the number
+ * of hits: a miss costs a system call.
+ */
+void info_stop_cache(struct debugger *dbg)
+{
+    struct stop_stats *st = &dbg->stop.stats;
+
+    printf("%-16s %10s %10s\n", "Cache", "Hits", "Misses");
+    printf("%-16s %10lu %10lu\n", "registers", st->regs_hits,
+            st->regs_misses);
+    printf("%-16s %10lu %10lu\n", "float registers", st->fpregs_hits,
+            st->fpregs_misses);
+    printf("%-16s %10lu %10lu\n", "memory pages", st->mem_hits,
+            st->mem_misses);
+}
+
+/*
+ * Decode the instruction of the debugee at `addr`.
+ *
+ * @return - 0 on success, -1 if it could not be read or decoded
+ */
+static int __decode_at(struct debugger *dbg, unsigned long addr,
+        uint8_t *code, struct x86_insn *insn)
+{
+    return read_insn(dbg, (void *)addr, code, insn);
+}
+
+/*
+ * Check whether `insn` may change the flow of control, and therefore
+ * end a block.
+ */
+static int __insn_is_branch(struct x86_insn *insn)
+{
+    return insn->kind != X86_INSN_OTHER && insn->kind != X86_INSN_SYSCALL &&
+        insn->kind != X86_INSN_TRAP;
+}
+
+/*
+ * A stepping policy for recording: how the debugee is resumed, and
+ * which of the stops are written to the trace.
+ */
+struct record_policy {
+    int         how;
+    uint32_t    trace_flags;
+
+    /* Whether to record the stop at `rip` after the instruction at `prev` */
+    int         (*keep)(struct debugger *dbg, unsigned long prev,
+                    unsigned long rip);
+};
+
+static int __keep_every_stop(struct debugger *dbg, unsigned long prev,
+        unsigned long rip)
+{
+    (void)dbg;
+    (void)prev;
+    (void)rip;
+    return 1;
+}
+
+/*
+ * Keep the steps that took a branch, which emulates block stepping with
+ * single steps.
+ */
+static int __keep_taken_branch(struct debugger *dbg, unsigned long prev,
+        unsigned long rip)
+{
+    uint8_t code[X86_MAX_INSN_LEN];
+    struct x86_insn insn;
+
+    if (__decode_at(dbg, prev, code, &insn) < 0)
+        return 1;
+
+    if (insn.kind == X86_INSN_JCC_REL || insn.kind == X86_INSN_LOOP_REL)
+        return rip != prev + insn.len;
+    return __insn_is_branch(&insn);
+}
+
+static const struct record_policy step_policy = {
+    RESUME_STEP, 0, __keep_every_stop
+};
+
+static const struct record_policy block_policy = {
+    RESUME_BLOCK, TRACE_BLOCKS, __keep_every_stop
+};
+
+static const struct record_policy branch_policy = {
+    RESUME_STEP, TRACE_BLOCKS, __keep_taken_branch
+};
+
+/*
+ * Find out whether block stepping works from a block step from `prev`
+ * to `rip`: if the instruction at `prev` is not a branch and `rip`
+ * follows it, the CPU ignored the branch trap flag and single stepped.
+ */
+static void __check_block_step(struct debugger *dbg, unsigned long prev,
+        unsigned long rip)
+{
+    uint8_t code[X86_MAX_INSN_LEN];
+    struct x86_insn insn;
+
+    if (__decode_at(dbg, prev, code, &insn) < 0 || __insn_is_branch(&insn))
+        return;
+
+    dbg->block_step = rip == prev + insn.len ? BLOCK_STEP_BROKEN :
+        BLOCK_STEP_WORKS;
+}
+
+/* Stops of a recording between two updates of the write index */
+#define WRITE_INDEX_INTERVAL    1024
+
+/*
+ * Bring the write index up to date with the memory of the debugee at
+ * `tick`. Where the kernel tracks soft-dirty pages, only the pages
+ * written to since the last update are read and compared, otherwise
+ * every private writable page is.
+ *
+ * @param record - 0 to only take a copy of the pages, e.g before
+ *                 recording
+ * @return       - 0 on success, -1 on error
+ */
+static int __write_index_scan(struct debugger *dbg, unsigned long tick,
+        int record)
+{
+    int soft_dirty = pagemap_soft_dirty_works();
+    uint64_t entries[PAGEMAP_BATCH];
+    uint8_t page[PAGE_SIZE];
+    struct mem_region *regions;
+    unsigned long addr, i;
+    int nregions, r, fd = -1, ret = 0;
+    ssize_t n;
+
+    nregions = pagemap_regions(dbg->dbge_pid, &regions, 1);
+    if (nregions < 0)
+        return -1;
+
+    if (record && soft_dirty) {
+        fd = pagemap_open(dbg->dbge_pid);
+        if (fd < 0)
+            ret = -1;
+    }
+
+    for (r = 0; r < nregions && ret == 0; r++) {
+        for (addr = regions[r].start; addr < regions[r].end;
+                addr += n * PAGE_SIZE) {
+            n = (regions[r].end - addr) / PAGE_SIZE;
+            if (n > PAGEMAP_BATCH)
+                n = PAGEMAP_BATCH;
+            if (fd >= 0 && (n = pagemap_read(fd, addr, n, entries)) <= 0)
+                break;
+
+            for (i = 0; i < (unsigned long)n; i++) {
+                if (fd >= 0 && !(entries[i] & PM_SOFT_DIRTY))
+                    continue;
+                if (read_memory(dbg, (void *)(addr + i * PAGE_SIZE), page,
+                            PAGE_SIZE) != PAGE_SIZE)
+                    continue;
+                if (write_index_update(&dbg->writes, addr + i * PAGE_SIZE,
+                            page, tick, record) < 0)
+                    ret = -1;
+            }
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+    if (soft_dirty && pagemap_clear_soft_dirty(dbg->dbge_pid) < 0)
+        ret = -1;
+
+    /* The next snapshot can't tell what changed from the bits anymore */
+    dbg->snapshot_pid = 0;
+    free(regions);
+    return ret;
+}
+
+/*
+ * Put the stops of a recording since the last call into the history,
+ * and index the memory they wrote to unless the debugee is gone.
+ */
+static void __record_interval(struct debugger *dbg, struct stop_record *stops,
+        int exited)
+{
+    debugger_record_stop(dbg, stops);
+    if (!exited && __write_index_scan(dbg, dbg->history.count, 1) < 0)
+        printf("Couldn't index the memory written by the program\n");
+    stops->arg = 0;
+}
+
+/*
+ * Run the debugee with stepping policy `policy` and write its registers
+ * to the trace file `path` at the stops the policy keeps, until it gets
+ * to a breakpoint, receives a signal, exits, or `max` records were
+ * written. The first record is the state of the debugee before it is
+ * resumed.
+ */
+static void __record(struct debugger *dbg, const char *path,
+        unsigned long max, const struct record_policy *policy)
+{
+    struct stop_record rec, stops;
+    struct user_regs_struct regs;
+    struct trace_writer *w;
+    unsigned long n = 1, total = 0, prev;
+    int wait_status, probe;
+    long size;
+
+    if (debugger_get_regs(dbg, &regs) < 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    w = trace_writer_open(path, 1, policy->trace_flags);
+    if (w == NULL || trace_writer_append(w, &regs) < 0) {
+        printf("Couldn't write %s: %s\n", path, strerror(errno));
+        if (w != NULL)
+            trace_writer_close(w);
+        return;
+    }
+
+    if (__write_index_scan(dbg, dbg->history.count, 0) < 0)
+        printf("Couldn't index the memory written by the program\n");
+
+    stops.kind = policy->how == RESUME_STEP ? STOP_STEP : STOP_BLOCK;
+    stops.addr = (void *)regs.rip;
+    stops.arg = 0;
+    rec.kind = stops.kind;
+
+    while (n < max) {
+        prev = regs.rip;
+        probe = policy->how == RESUME_BLOCK && dbg->stopped_bp == NULL &&
+            dbg->block_step == BLOCK_STEP_UNKNOWN;
+
+        wait_status = debugger_resume(dbg, policy->how);
+        if (wait_status < 0)
+            break;
+
+        debugger_handle_stop(dbg, wait_status, policy->how, &rec);
+        if (rec.kind != stops.kind || debugger_get_regs(dbg, &regs) < 0)
+            break;
+        stops.addr = (void *)regs.rip;
+        stops.arg++;
+        total++;
+
+        if (probe) {
+            __check_block_step(dbg, prev, regs.rip);
+
+            /* Every block step so far was in fact a single step */
+            if (dbg->block_step == BLOCK_STEP_BROKEN) {
+                policy = &branch_policy;
+                stops.kind = STOP_STEP;
+            }
+        }
+
+        if (policy->keep(dbg, prev, regs.rip)) {
+            if (trace_writer_append(w, &regs) < 0) {
+                printf("Couldn't write %s: %s\n", path, strerror(errno));
+                break;
+            }
+            n++;
+        }
+
+        if (dbg->stopped_bp != NULL &&
+                __breakpoint_should_stop(dbg, dbg->stopped_bp))
+            break;
+
+        if (stops.arg == WRITE_INDEX_INTERVAL)
+            __record_interval(dbg, &stops, 0);
+    }
+
+    size = trace_writer_close(w);
+    if (size < 0)
+        printf("Couldn't write %s: %s\n", path, strerror(errno));
+    else
+        printf("Recorded %lu records in %lu stops to %s, %ld bytes\n", n,
+                total, path, size);
+
+    /* The stops go into the history WRITE_INDEX_INTERVAL at a time */
+    if (stops.arg > 0)
+        __record_interval(dbg, &stops, rec.kind == STOP_EXIT);
+
+    if (rec.kind != STOP_STEP && rec.kind != STOP_BLOCK) {
+        debugger_record_stop(dbg, &rec);
+        report_stop(dbg, &rec);
+    }
+    else if (total > 0) {
+        report_stop(dbg, history_get(&dbg->history,
+                    dbg->history.count - 1));
+    }
+}
+
+/*
+ * Record every single step of the debugee to `path`.
+ */
+void trace_record(struct debugger *dbg, const char *path, unsigned long max)
+{
+    __record(dbg, path, max, &step_policy);
+}
+
+/*
+ * Record the debugee to `path` one block at a time: only the states
+ * after a taken branch are written, the instructions in between can be
+ * recovered from the code with `trace insns`. Block stepping stops the
+ * debugee once per block instead of once per instruction; where it does
+ * not work, single steps that did not take a branch are left out.
+ */
+void record_blocks(struct debugger *dbg, const char *path, unsigned long max)
+{
+    if (dbg->block_step == BLOCK_STEP_BROKEN)
+        __record(dbg, path, max, &branch_policy);
+    else
+        __record(dbg, path, max, &block_policy);
+}
+
+/*
+ * Run the debugee through history record `rec`, a number of single or
+ * block steps, watching the byte at `addr`.
+ *
+ * @param rip - where to store the address of the step that changed the
+ *              byte last
+ * @return    - how many steps into `rec` the byte changed for the last
+ *              time, 0 if it did not, -1 on error
+ */
+static long __find_last_write(struct debugger *dbg, struct stop_record *rec,
+        void *addr, unsigned long *rip)
+{
+    struct user_regs_struct regs;
+    struct stop_record stop;
+    int wait_status, how;
+    uint8_t before, after;
+    unsigned long i;
+    long last = 0;
+
+    if (read_memory(dbg, addr, &before, 1) != 1 ||
+            debugger_get_regs(dbg, &regs) < 0)
+        return -1;
+
+    how = rec->kind == STOP_STEP ? RESUME_STEP : RESUME_BLOCK;
+    for (i = 1; i <= rec->arg; i++) {
+        wait_status = debugger_resume(dbg, how);
+        if (wait_status < 0)
+            return -1;
+
+        debugger_handle_stop(dbg, wait_status, how, &stop);
+        if ((stop.kind != rec->kind && stop.kind != STOP_WATCHPOINT) ||
+                read_memory(dbg, addr, &after, 1) != 1)
+            return -1;
+
+        if (after != before) {
+            *rip = regs.rip;
+            last = i;
+            before = after;
+        }
+        if (debugger_get_regs(dbg, &regs) < 0)
+            return -1;
+    }
+    return last;
+}
+
+/*
+ * Go back to right after the last recorded write to the byte at `addr`.
+ *
+ * The write index gives the latest recorded interval that changed the
+ * word around `addr`, only that interval is replayed to find the step
+ * that wrote the byte. When it was another byte of the word, the search
+ * goes on with the interval before. Writes that stored the value that
+ * was already there are not found.
+ */
+void last_write(struct debugger *dbg, void *addr)
+{
+    unsigned long tick = dbg->history.count, rip = 0, total;
+    struct stop_record *rec = NULL, part;
+    struct write_entry *e;
+    long steps = 0;
+
+    for (e = write_index_last(&dbg->writes, addr, tick); e != NULL;
+            e = write_index_last(&dbg->writes, addr, e->tick - 1)) {
+        rec = history_get(&dbg->history, e->tick - 1);
+        if (rec == NULL || (rec->kind != STOP_STEP &&
+                    rec->kind != STOP_BLOCK))
+            continue;
+
+        if (__debugger_replay(dbg, e->tick - 1) != (long)e->tick - 1)
+            break;
+
+        steps = __find_last_write(dbg, rec, addr, &rip);
+        if (steps != 0)
+            break;
+    }
+
+    if (e == NULL || steps <= 0) {
+        if (e != NULL)
+            printf("The program did not run as recorded at tick %lu\n",
+                    e->tick - 1);
+        else
+            printf("No recorded write to %p\n", addr);
+
+        /* Back to where we were */
+        if (__debugger_replay(dbg, tick) != (long)tick)
+            printf("The program did not run as recorded\n");
+        return;
+    }
+
+    /* `rec` is overwritten by the partial record */
+    part = *rec;
+    total = rec->arg;
+    part.arg = steps;
+    if (__debugger_goto(dbg, e->tick - 1, &part) < 0)
+        return;
+
+    printf("%p was last written at tick %lu, %s %ld of %lu, by %p\n", addr,
+            e->tick - 1, part.kind == STOP_STEP ? "step" : "block", steps,
+            total, (void *)rip);
+    __report_position(dbg);
+}
+
+void trace_open(struct debugger *dbg, const char *path)
+{
+    struct trace_reader *r;
+
+    r = trace_reader_open(path);
+    if (r == NULL) {
+        printf("Couldn't open %s: not a trace file\n", path);
+        return;
+    }
+
+    if (dbg->trace != NULL)
+        trace_reader_close(dbg->trace);
+    dbg->trace = r;
+
+    printf("%s: %llu records in %llu chunks, %zu bytes", path,
+            (unsigned long long)r->hdr.nrecords,
+            (unsigned long long)r->hdr.nchunks, r->size);
+    if (r->hdr.nrecords > 0)
+        printf(" (%.2f bytes per record)", (double)r->size / r->hdr.nrecords);
+    printf("\n");
+}
+
+void trace_show(struct debugger *dbg, unsigned long n)
+{
+    struct user_regs_struct regs;
+
+    if (dbg->trace == NULL) {
+        printf("No trace file open.\n");
+        return;
+    }
+
+    if (trace_read(dbg->trace, n, &regs) < 0) {
+        printf("No record number %lu\n", n);
+        return;
+    }
+    print_registers(&regs);
+}
+
+/* Instructions shown at most by `trace insns` */
+#define TRACE_MAX_BLOCK_INSNS   256
+
+/*
+ * List the instructions executed between record `n` of the open trace
+ * and the next one. For block traces, the straight-line code from the
+ * start of the block is decoded up to the branch that goes to the next
+ * record. The code is read from the debugee, which must therefore have
+ * the code the trace was recorded with.
+ */
+void trace_insns(struct debugger *dbg, unsigned long n)
+{
+    unsigned long addr[TRACE_MAX_BLOCK_INSNS], target, end = 0;
+    uint8_t code[TRACE_MAX_BLOCK_INSNS][X86_MAX_INSN_LEN];
+    struct x86_insn insn[TRACE_MAX_BLOCK_INSNS];
+    struct user_regs_struct regs, next;
+    int count, has_next, i, j;
+
+    if (dbg->trace == NULL) {
+        printf("No trace file open.\n");
+        return;
+    }
+
+    if (trace_read(dbg->trace, n, &regs) < 0) {
+        printf("No record number %lu\n", n);
+        return;
+    }
+    has_next = trace_read(dbg->trace, n + 1, &next) == 0;
+
+    addr[0] = regs.rip;
+    for (count = 0; count < TRACE_MAX_BLOCK_INSNS; count++) {
+        if (count > 0)
+            addr[count] = addr[count - 1] + insn[count - 1].len;
+
+        if (__decode_at(dbg, addr[count], code[count], &insn[count]) < 0) {
+            printf("Cannot decode the code at %#lx\n", addr[count--]);
+            break;
+        }
+
+        if (!(dbg->trace->hdr.flags & TRACE_BLOCKS)) {
+            end = addr[count] + insn[count].len;
+            break;
+        }
+
+        /* A block of one instruction, after a breakpoint */
+        if (end == 0 && has_next && 
+                addr[count] + insn[count].len == next.rip)
+            end = next.rip;
+
+        if (!__insn_is_branch(&insn[count]))
+            continue;
+
+        /* Indirect branches are assumed to go to the next record */
+        target = 0;
+        if (insn[count].kind != X86_INSN_CALL_IND &&
+                insn[count].kind != X86_INSN_JMP_IND &&
+                insn[count].kind != X86_INSN_RET)
+            target = x86_branch_target(code[count], &insn[count],
+                    addr[count]);
+
+        if (!has_next || target == 0 || target == next.rip) {
+            end = addr[count] + insn[count].len;
+            break;
+        }
+
+        /* A jump elsewhere, the block ended earlier */
+        if (insn[count].kind != X86_INSN_JCC_REL &&
+                insn[count].kind != X86_INSN_LOOP_REL)
+            break;
+    }
+
+    /* `count` is the last instruction decoded */
+    for (i = 0; i <= count && i < TRACE_MAX_BLOCK_INSNS && addr[i] < end; 
+            i++) {
+        printf("%#lx: ", addr[i]);
+        for (j = 0; j < insn[i].len; j++)
+            printf(" %02x", code[i][j]);
+        printf("\n");
+    }
+}
+
+/*
+ * Handle the `trace` commands:
+ *
+ *   trace record <file> [max]  - record single steps to a file
+ *   trace open <file>          - open a trace file
+ *   trace regs <n>             - show record `n` of the open trace
+ *   trace insns <n>            - show the instructions after record `n`
+ *   trace close                - close the open trace
+ */
+void handle_trace_command(struct debugger *dbg, char **args)
+{
+    char *sub = args[1];
+
+    if (sub == NULL) {
+        puts("Unknown command\n");
+    }
+    else if (is_prefix(sub, "record") && args[2] != NULL) {
+        trace_record(dbg, args[2], args[3] != NULL ? 
+                strtoul(args[3], NULL, 10) : (unsigned long)-1);
+    }
+    else if (is_prefix(sub, "open") && args[2] != NULL) {
+        trace_open(dbg, args[2]);
+    }
+    else if (is_prefix(sub, "regs") && args[2] != NULL) {
+        trace_show(dbg, strtoul(args[2], NULL, 10));
+    }
+    else if (is_prefix(sub, "insns") && args[2] != NULL) {
+        trace_insns(dbg, strtoul(args[2], NULL, 10));
+    }
+    else if (is_prefix(sub, "close") && dbg->trace != NULL) {
+        trace_reader_close(dbg->trace);
+        dbg->trace = NULL;
+    }
+    else {
+        puts("Unknown command\n");
+    }
+}
+
+/*
+ * Save the registers and private writable pages of the debugee to
+ * `path`. After the first snapshot, only the pages that changed since
+ * the previous one are saved. Those are the soft-dirty pages where the
+ * kernel tracks them, otherwise every page is compared with the
+ * previous snapshot.
+ */
+void snapshot_save(struct debugger *dbg, const char *path)
+{
+    int soft_dirty = pagemap_soft_dirty_works(), fd = -1, nregions, r;
+    unsigned long addr, i, saved = 0, total = 0;
+    struct snapshot *base = dbg->snapshot, *s;
+    uint64_t entries[PAGEMAP_BATCH];
+    struct user_regs_struct regs;
+    struct snapshot_writer *w;
+    struct mem_region *regions;
+    uint8_t page[PAGE_SIZE];
+    const uint8_t *old;
+    ssize_t n;
+    long size;
+
+    if (debugger_get_regs(dbg, &regs) < 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    if (snapshot_in_chain(base, path)) {
+        printf("Can't overwrite %s, the last snapshot depends on it\n",
+                path);
+        return;
+    }
+
+    nregions = pagemap_regions(dbg->dbge_pid, &regions, 1);
+    if (nregions < 0) {
+        printf("Couldn't read the mappings of process %d\n", dbg->dbge_pid);
+        return;
+    }
+
+    w = snapshot_writer_open(path, base != NULL ? base->path : NULL, &regs,
+            dbg->pending_signal);
+    if (w == NULL) {
+        printf("Couldn't write %s: %s\n", path, strerror(errno));
+        free(regions);
+        return;
+    }
+
+    if (base != NULL && soft_dirty &&
+            dbg->snapshot_pid == dbg->threads.leader)
+        fd = pagemap_open(dbg->dbge_pid);
+
+    for (r = 0; r < nregions && w != NULL; r++) {
+        for (addr = regions[r].start; addr < regions[r].end;
+                addr += n * PAGE_SIZE) {
+            n = (regions[r].end - addr) / PAGE_SIZE;
+            if (n > PAGEMAP_BATCH)
+                n = PAGEMAP_BATCH;
+            if (fd >= 0 && (n = pagemap_read(fd, addr, n, entries)) <= 0)
+                break;
+            total += n;
+
+            for (i = 0; i < (unsigned long)n; i++) {
+                if (fd >= 0 && !(entries[i] & PM_SOFT_DIRTY))
+                    continue;
+                if (read_memory(dbg, (void *)(addr + i * PAGE_SIZE), page,
+                            PAGE_SIZE) != PAGE_SIZE)
+                    continue;
+
+                old = fd < 0 ? snapshot_page(base, addr + i * PAGE_SIZE) :
+                    NULL;
+                if (old != NULL && memcmp(old, page, PAGE_SIZE) == 0)
+                    continue;
+
+                if (snapshot_writer_add(w, addr + i * PAGE_SIZE, page) < 0)
+                    goto out;
+                saved++;
+            }
+        }
+    }
+
+out:
+    if (fd >= 0)
+        close(fd);
+    free(regions);
+
+    size = snapshot_writer_close(w);
+    if (size < 0 || (s = snapshot_open(path)) == NULL) {
+        printf("Couldn't write %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    if (soft_dirty && pagemap_clear_soft_dirty(dbg->dbge_pid) == 0)
+        dbg->snapshot_pid = dbg->threads.leader;
+    if (base != NULL)
+        snapshot_close(base);
+    dbg->snapshot = s;
+
+    printf("Saved %lu of %lu pages to %s, %ld bytes\n", saved, total, path,
+            size);
+}
+
+/*
+ * Write the snapshot `path`, or the last one saved or restored if NULL,
+ * back into the debugee. The mappings of the debugee are not restored:
+ * pages that are not mapped anymore are left out. The history starts
+ * over from the restored state.
+ */
+void snapshot_restore(struct debugger *dbg, const char *path)
+{
+    struct snapshot *s = dbg->snapshot;
+    unsigned long addr, restored = 0;
+    struct mem_region *regions;
+    struct breakpoint *bp;
+    const uint8_t *data;
+    int nregions, r;
+
+    if (path != NULL)
+        s = snapshot_open(path);
+    if (s == NULL) {
+        if (path != NULL)
+            printf("Couldn't open %s: not a snapshot file\n", path);
+        else
+            printf("No snapshot saved.\n");
+        return;
+    }
+
+    nregions = pagemap_regions(dbg->dbge_pid, &regions, 1);
+    if (nregions < 0) {
+        printf("The program is not being run.\n");
+        if (s != dbg->snapshot)
+            snapshot_close(s);
+        return;
+    }
+
+    for (r = 0; r < nregions; r++) {
+        for (addr = regions[r].start; addr < regions[r].end;
+                addr += PAGE_SIZE) {
+            data = snapshot_page(s, addr);
+            if (data != NULL &&
+                    write_memory(dbg, (void *)addr, data, PAGE_SIZE) ==
+                    PAGE_SIZE)
+                restored++;
+        }
+    }
+    free(regions);
+
+    debugger_set_regs(dbg, &s->hdr.regs);
+    dbg->pending_signal = s->hdr.pending_signal;
+    dbg->stopped_bp = NULL;
+    bp = debugger_breakpoint_at(dbg, (void *)s->hdr.regs.rip);
+    if (bp != NULL && breakpoint_has_int3(bp))
+        dbg->stopped_bp = bp;
+
+    if (pagemap_soft_dirty_works() &&
+            pagemap_clear_soft_dirty(dbg->dbge_pid) == 0)
+        dbg->snapshot_pid = dbg->threads.leader;
+    if (s != dbg->snapshot) {
+        if (dbg->snapshot != NULL)
+            snapshot_close(dbg->snapshot);
+        dbg->snapshot = s;
+    }
+
+    __history_reset(dbg);
+
+    printf("Restored %lu pages from %s at %p\n", restored, s->path,
+            (void *)s->hdr.regs.rip);
+}
+
+/*
+ * Handle the `ftrace` commands:
+ *
+ *   ftrace <addr>          - set a fast tracepoint
+ *   ftrace log [<file>]    - log the hits to a trace file, or stop
+ */
+void handle_ftrace_command(struct debugger *dbg, char **args)
+{
+    char *sub = args[1];
+    void *addr;
+
+    if (sub == NULL) {
+        puts("Unknown command\n");
+    }
+    else if (is_prefix(sub, "log")) {
+        fast_trace_log(dbg, args[2]);
+    }
+    else if (__parse_location(dbg, sub, &addr) == 0) {
+        set_fast_tracepoint(dbg, addr);
+    }
+}
+
+void handle_snapshot_command(struct debugger *dbg, char **args)
+{
+    char *sub = args[1];
+
+    if (sub == NULL) {
+        puts("Unknown command\n");
+    }
+    else if (is_prefix(sub, "save") && args[2] != NULL) {
+        snapshot_save(dbg, args[2]);
+    }
+    else if (is_prefix(sub, "restore")) {
+        snapshot_restore(dbg, args[2]);
+    }
+    else {
+        puts("Unknown command\n");
+    }
+}
+
+/*
+ * Handle `watch <addr> <len> [r|w|x]`: watch for writes by default,
+ * for reads and writes with `r`, or for execution with `x`.
+ */
+void handle_watch_command(struct debugger *dbg, char **args)
+{
+    char *type = args[3];
+
+    if (type == NULL || strcmp(type, "w") == 0)
+        set_watchpoint(dbg, (void *)strtoul(args[1], NULL, 16),
+                strtoul(args[2], NULL, 0), WATCH_WRITE);
+    else if (strcmp(type, "r") == 0)
+        set_watchpoint(dbg, (void *)strtoul(args[1], NULL, 16),
+                strtoul(args[2], NULL, 0), WATCH_ACCESS);
+    else if (strcmp(type, "x") == 0)
+        set_watchpoint(dbg, (void *)strtoul(args[1], NULL, 16),
+                strtoul(args[2], NULL, 0), WATCH_EXEC);
+    else
+        puts("Unknown command\n");
+}
+
+/*
+ * Handle `non-stop [on|off]`: tell or change whether only the thread
+ * that stops does. Going back to all-stop stops every thread.
+ */
+void handle_non_stop_command(struct debugger *dbg, char **args)
+{
+    char *mode = args[1];
+
+    if (mode == NULL) {
+        printf("Non-stop mode is %s\n", dbg->non_stop ? "on" : "off");
+    }
+    else if (strcmp(mode, "on") == 0) {
+        dbg->non_stop = 1;
+    }
+    else if (strcmp(mode, "off") == 0) {
+        if (dbg->non_stop) {
+            __threads_poll(dbg);
+            __threads_stop(dbg, 0);
+        }
+        dbg->non_stop = 0;
+    }
+    else {
+        puts("Unknown command\n");
+    }
+}
+
+/*
+ * Handle `follow-fork-mode [parent|child]`: tell or change which
+ * process gets the focus when the process that has it forks, see
+ * inc/process.h. Both are traced either way.
+ */
+void handle_follow_fork_command(struct debugger *dbg, char **args)
+{
+    char *mode = args[1];
+
+    if (mode == NULL) {
+        printf("Follow fork mode is %s\n",
+                dbg->follow_fork == FOLLOW_FORK_CHILD ? "child" : "parent");
+    }
+    else if (strcmp(mode, "parent") == 0) {
+        dbg->follow_fork = FOLLOW_FORK_PARENT;
+    }
+    else if (strcmp(mode, "child") == 0) {
+        dbg->follow_fork = FOLLOW_FORK_CHILD;
+    }
+    else {
+        puts("Unknown command\n");
+    }
+}
+
+#define MAX_LINE_ARGS 64
+#define MAX_LINE_LEN  4096
+
+/* Commands that do not need the debugee to be stopped */
+static const char *running_commands[] = {
+    "interrupt", "break", "delete", "info", "threads", "processes", "quit",
+    NULL
+};
+
+/*
+ * Check whether `command` can be used while the debugee runs on its
+ * own after `continue`.
+ */
+static int __can_run_while_running(char *command)
+{
+    int i;
+
+    for (i = 0; running_commands[i] != NULL; i++)
+        if (is_prefix(command, running_commands[i]))
+            return 1;
+    return 0;
+}
+
+/*
+ * Find the condition of `break <location> if <condition>`, which is the
+ * rest of the line from the token after the location, spaces included.
+ * `if` may be glued to the condition, as in `if$rdi==1`.
+ *
+ * @return - 0 with `*condition` NULL when there is none, -1 if the line
+ *           does not end in a condition
+ */
+static int __break_condition(char *line, char **args, char **condition)
+{
+    char *rest;
+
+    *condition = NULL;
+    if (args[2] == NULL)
+        return 0;
+
+    /* The tokens point in a copy of the line, which starts at the same
+     * offset once the leading spaces are skipped */
+    rest = line + strspn(line, " ") + (args[2] - args[0]);
+    if (strncmp(rest, "if", 2) != 0 || isalnum((unsigned char)rest[2]) ||
+            rest[2] == '_') {
+        printf("Junk at the end of the location: %s\n", rest);
+        return -1;
+    }
+
+    rest += strspn(rest + 2, " ") + 2;
+    if (*rest == '\0') {
+        printf("Argument required (condition after if).\n");
+        return -1;
+    }
+    *condition = rest;
+    return 0;
+}
+
+/*
+ * Handle input
+ */
+void handle_command(struct debugger *dbg, char *line)
+{
+    char **args = split(line, "  ", MAX_LINE_ARGS);
+    char *command = args[0];
+
+    if (command == NULL) {
+        /* Empty line */
+    }
+    else if (dbg->running && !__can_run_while_running(command)) {
+        printf("The program is running, interrupt it first.\n");
+    }
+    else if (is_prefix(command, "continue")) {
+        continue_execution(dbg, args[1] != NULL &&
+                strcmp(args[1], "&") == 0);
+    }
+    else if (is_prefix(command, "interrupt")) {
+        interrupt_execution(dbg);
+    }
+    else if (is_prefix(command, "break") && args[1] != NULL) {
+        char *condition = NULL;
+        void *addr;
+
+        if (__break_condition(line, args, &condition) == 0 &&
+                __parse_location(dbg, args[1], &addr) == 0)
+            set_breakpoint_at_address(dbg, addr, condition);
+    }
+    else if (is_prefix(command, "ftrace")) {
+        handle_ftrace_command(dbg, args);
+    }
+    else if (is_prefix(command, "watch") && args[1] != NULL &&
+            args[2] != NULL) {
+        handle_watch_command(dbg, args);
+    }
+    else if (is_prefix(command, "unwatch") && args[1] != NULL) {
+        delete_watchpoint(dbg, strtoul(args[1], NULL, 10));
+    }
+    else if (is_prefix(command, "delete") && args[1] != NULL) {
+        delete_breakpoints(dbg, args + 1);
+    }
+    else if (is_prefix(command, "stepi")) {
+        step_instruction(dbg);
+    }
+    else if (is_prefix(command, "next")) {
+        step_over(dbg, 0);
+    }
+    else if (is_prefix(command, "finish")) {
+        finish_frame(dbg);
+    }
+    else if (is_prefix(command, "until")) {
+        void *addr;
+
+        if (args[1] == NULL)
+            step_over(dbg, 1);
+        else if (__parse_location(dbg, args[1], &addr) == 0)
+            until_location(dbg, addr);
+    }
+    else if (is_prefix(command, "reverse-continue")) {
+        reverse_continue(dbg);
+    }
+    else if (is_prefix(command, "reverse-stepi")) {
+        reverse_stepi(dbg);
+    }
+    else if (is_prefix(command, "last-write") && args[1] != NULL) {
+        last_write(dbg, (void *)strtoul(args[1], NULL, 16));
+    }
+    else if (is_prefix(command, "coverage")) {
+        handle_coverage_command(dbg, args);
+    }
+    else if (is_prefix(command, "checkpoint")) {
+        checkpoint_take(dbg);
+    }
+    else if (is_prefix(command, "checkpoints")) {
+        info_checkpoints(dbg);
+    }
+    else if (is_prefix(command, "restart") && args[1] != NULL) {
+        checkpoint_restart(dbg, strtoul(args[1], NULL, 10));
+    }
+    else if (is_prefix(command, "record") && args[1] != NULL) {
+        record_blocks(dbg, args[1], args[2] != NULL ? 
+                strtoul(args[2], NULL, 10) : (unsigned long)-1);
+    }
+    else if (is_prefix(command, "snapshot")) {
+        handle_snapshot_command(dbg, args);
+    }
+    else if (is_prefix(command, "trace")) {
+        handle_trace_command(dbg, args);
+    }
+    else if (is_prefix(command, "non-stop")) {
+        handle_non_stop_command(dbg, args);
+    }
+    else if (is_prefix(command, "follow-fork-mode")) {
+        handle_follow_fork_command(dbg, args);
+    }
+    else if (is_prefix(command, "threads")) {
+        info_threads(dbg);
+    }
+    else if (is_prefix(command, "thread") && args[1] != NULL) {
+        select_thread(dbg, strtol(args[1], NULL, 10));
+    }
+    else if (is_prefix(command, "processes")) {
+        info_processes(dbg);
+    }
+    else if (is_prefix(command, "process") && args[1] != NULL) {
+        select_process(dbg, strtol(args[1], NULL, 10));
+    }
+    else if (is_prefix(command, "registers")) {
+        show_registers(dbg, args);
+    }
+    else if (is_prefix(command, "info") && args[1] != NULL &&
+            strcmp(args[1], "cache") == 0) {
+        info_stop_cache(dbg);
+    }
+    else if (is_prefix(command, "info")) {
+        info_breakpoints(dbg);
+        info_watchpoints(dbg);
+    }
+    else if (is_prefix(command, "quit")) {
+        __symbols_save(dbg);
+        exit(0);
+    }
+    else {
+        puts("Unknown command\n");
+    }
+}
+
+/*
+ * Attach to the debugee, which stopped itself right before executing
+ * the program, and let it go as far as the exec. Unlike with
+ * PTRACE_TRACEME, the threads of a debugee attached with PTRACE_SEIZE
+ * can be stopped with PTRACE_INTERRUPT.
+ *
+ * @return - 0 once the debugee is stopped after the exec, -1 on error
+ */
+static int __debugee_seize(struct debugger *dbg)
+{
+    pid_t pid = dbg->dbge_pid;
+    int status;
+
+    if (waitpid(pid, &status, WSTOPPED) < 0 ||
+            ptrace(PTRACE_SEIZE, pid, NULL, DEBUGEE_PTRACE_OPTIONS) < 0)
+        return -1;
+    kill(pid, SIGCONT);
+
+    /* The group-stop and SIGCONT come first, SIGCONT is not passed on */
+    while (waitpid(pid, &status, __WALL) == pid && WIFSTOPPED(status)) {
+        if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXEC << 8)))
+            return 0;
+        ptrace(PTRACE_CONT, pid, NULL, NULL);
+    }
+    return -1;
+}
+
+/*
+ * Launch the debugger by initiating the debugger loop
+ *
+ * The prompt is edited through the multiplexed API of linenoise, for
+ * the event loop to take care of the debugee while the user types.
+ *
+ * @param dbg - pointer to debugger structure
+ */
+void debugger_launch(struct debugger *dbg)
+{
+    int event, tty, editing = 0, hidden;
+    struct linenoiseState ls;
+    char buf[MAX_LINE_LEN];
+    char *line;
+
+    if (__debugee_seize(dbg) < 0) {
+        printf("Couldn't trace %s\n", dbg->dbge_path);
+        return;
+    }
+    __symbols_load(dbg, dbg->dbge_path);
+
+    if (event_loop_init(&dbg->loop, STDIN_FILENO) < 0) {
+        printf("Couldn't set up the event loop\n");
+        return;
+    }
+
+    /* Where reverse execution goes back to at the latest */
+    __checkpoint_take(dbg);
+
+    /* Without a terminal, linenoise reads lines with stdio. Nothing
+     * may wait in the buffer of stdin while epoll sees no input */
+    tty = isatty(STDIN_FILENO);
+    if (!tty)
+        setvbuf(stdin, NULL, _IONBF, 0);
+
+    for (;;) {
+        if (tty && !editing) {
+            if (linenoiseEditStart(&ls, -1, -1, buf, sizeof(buf),
+                        "retrobugr> ") < 0)
+                break;
+            editing = 1;
+        }
+
+        event = event_loop_wait(&dbg->loop);
+        if (event < 0)
+            break;
+
+        /* The prompt is put aside while a stop is reported */
+        if (event != EVENT_INPUT) {
+            hidden = editing;
+            if (hidden)
+                linenoiseHide(&ls);
+            __debugger_event(dbg, event);
+            if (hidden)
+                linenoiseShow(&ls);
+            continue;
+        }
+
+        if (tty) {
+            line = linenoiseEditFeed(&ls);
+            if (line == linenoiseEditMore)
+                continue;
+            linenoiseEditStop(&ls);
+            editing = 0;
+
+            /* Ctrl-C, which does not raise SIGINT while editing */
+            if (line == NULL && errno == EAGAIN) {
+                if (dbg->running)
+                    interrupt_execution(dbg);
+                continue;
+            }
+        }
+        else {
+            line = linenoise("retrobugr> ");
+        }
+
+        if (line == NULL) {
+            __symbols_save(dbg);
+            break;
+        }
+        handle_command(dbg, line);
+        linenoiseHistoryAdd(line);
+        linenoiseFree(line);
+    }
+}
+
+int main(int argc, char **argv) 
+{
+    struct debugger *dbg;
+    char *program;
+    pid_t pid;
+
+    if (argc < 2) {
+        printf("Please specify target program.\n");
+        return -1;
+    }
+    program = argv[1];
+
+    dbg = debugger_alloc();
+    if (!dbg) {
+        printf("Couldn't allocate debugger\n");
+        return -1;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        printf("Child started.\n");
+        personality(ADDR_NO_RANDOMIZE);
+
+        /* Wait to be seized by the parent */
+        raise(SIGSTOP);
+        execl(program, program, NULL);
+    }
+    else if (pid >= 1) {
+        printf("Parent process.\n");
+        if (debugger_init(dbg, program, pid) < 0) {
+            printf("Couldn't initialize debugger\n");
+            return -1;
+        }
+        debugger_launch(dbg);
+    }
+
+    return 0;
+}
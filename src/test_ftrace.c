@@ -0,0 +1,177 @@
+/*
+ * Test of the draining of the ring of the fast tracepoints.
+ *
+ * The debugee is this very program, whose threads call `hot()` a fixed
+ * number of times each, a couple of microseconds apart, with a fast
+ * tracepoint on it. Once they are done, `done()` is called, where the
+ * debugger stops: the tracepoint must have counted every hit, without
+ * any record of the ring lost.
+ *
+ * Usage: ./test_ftrace [debugger]
+ */
+#define _GNU_SOURCE
+
+#include <sys/wait.h>
+
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Set in the environment of the debugee */
+#define TEST_DEBUGEE_ENV    "RETROBUGR_TEST_DEBUGEE"
+
+#define TEST_THREADS        2
+#define TEST_HITS           20000
+
+/* Time between two hits of a thread */
+#define TEST_GAP_NS         2000
+
+#define TEST_TIMEOUT_SEC    20
+
+static volatile unsigned long counter;
+
+__attribute__((noinline)) void hot(void)
+{
+    counter++;
+}
+
+__attribute__((noinline)) void done(void)
+{
+    __asm__ volatile("" ::: "memory");
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+    double next;
+    int i;
+
+    (void)arg;
+    next = now_sec();
+    for (i = 0; i < TEST_HITS; i++) {
+        hot();
+        next += TEST_GAP_NS / 1e9;
+        while (now_sec() < next)
+            ;
+    }
+    return NULL;
+}
+
+static int debugee(void)
+{
+    pthread_t threads[TEST_THREADS];
+    int i;
+
+    for (i = 0; i < TEST_THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (i = 0; i < TEST_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    done();
+    return 0;
+}
+
+/*
+ * Run `debugger` on this program with `commands` as its input, and
+ * keep what it prints in `out`.
+ *
+ * @return - 0 if the debugger quit in time, -1 otherwise
+ */
+static int run(const char *debugger, const char *commands, char *out,
+        size_t size)
+{
+    int in[2], res[2], status;
+    char self[PATH_MAX];
+    size_t len = 0;
+    ssize_t n;
+    pid_t pid;
+    double t0;
+
+    n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n < 0 || pipe(in) < 0 || pipe(res) < 0)
+        return -1;
+    self[n] = '\0';
+
+    pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(res[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(res[0]);
+        close(res[1]);
+        setenv(TEST_DEBUGEE_ENV, "1", 1);
+        execl(debugger, debugger, self, NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(res[1]);
+    if (write(in[1], commands, strlen(commands)) < 0)
+        printf("error: commands not written\n");
+    close(in[1]);
+
+    t0 = now_sec();
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (now_sec() - t0 > TEST_TIMEOUT_SEC) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            close(res[0]);
+            return -1;
+        }
+        usleep(10000);
+    }
+
+    while (len < size - 1 && (n = read(res[0], out + len,
+                    size - 1 - len)) > 0)
+        len += n;
+    out[len] = '\0';
+    close(res[0]);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *debugger = argc > 1 ? argv[1] : "./retrobugr";
+    unsigned long hits = 0, lost = 0;
+    static char out[65536];
+    char *p;
+
+    if (getenv(TEST_DEBUGEE_ENV) != NULL)
+        return debugee();
+
+    if (run(debugger, "ftrace hot\nbreak done\ncontinue\ninfo\nquit\n",
+                out, sizeof(out)) < 0) {
+        printf("ftrace     FAIL: still running after %d s\n",
+                TEST_TIMEOUT_SEC);
+        return 1;
+    }
+
+    p = strstr(out, "fast, ");
+    if (p != NULL)
+        hits = strtoul(p + strlen("fast, "), NULL, 10);
+    p = strstr(out, " tracepoint hits lost");
+    if (p != NULL) {
+        while (p > out && p[-1] != '\n')
+            p--;
+        lost = strtoul(p, NULL, 10);
+    }
+
+    if (hits != TEST_THREADS * TEST_HITS || lost != 0) {
+        printf("ftrace     FAIL: %lu of %d hits, %lu lost\n", hits,
+                TEST_THREADS * TEST_HITS, lost);
+        return 1;
+    }
+    printf("ftrace     ok: %lu hits, none lost\n", hits);
+    return 0;
+}
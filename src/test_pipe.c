@@ -0,0 +1,161 @@
+/*
+ * Test of the debugger driven from a pipe that is closed.
+ *
+ * The commands are written to the input of the debugger all at once,
+ * and the pipe is closed right away, the way a script piped into it
+ * ends. The debugee is this very program, which runs for a while with
+ * a few threads calling `hot()`. The debugger must get to the end of
+ * the commands and quit, without spinning on the closed input while
+ * the debugee runs.
+ *
+ * Usage: ./test_pipe [debugger]
+ */
+#define _GNU_SOURCE
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Set in the environment of the debugee */
+#define TEST_DEBUGEE_ENV    "RETROBUGR_TEST_DEBUGEE"
+
+/* How long the debugee runs, and how long the debugger may take */
+#define TEST_RUN_MS         1000
+#define TEST_TIMEOUT_SEC    20
+
+/* CPU time the debugger may use while the debugee runs */
+#define TEST_MAX_CPU_SEC    0.5
+
+#define TEST_THREADS        2
+
+static volatile unsigned long counter;
+
+__attribute__((noinline)) void hot(void)
+{
+    counter++;
+}
+
+static void *worker(void *arg)
+{
+    int i;
+
+    (void)arg;
+    for (i = 0; i < TEST_RUN_MS; i++) {
+        hot();
+        usleep(1000);
+    }
+    return NULL;
+}
+
+static int debugee(void)
+{
+    pthread_t threads[TEST_THREADS];
+    int i;
+
+    for (i = 0; i < TEST_THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (i = 0; i < TEST_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    return 0;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Run `debugger` on this program with `commands` as its input, and
+ * check that it quits in time without spinning.
+ *
+ * @return - 0 if the test passed, -1 otherwise
+ */
+static int run(const char *name, const char *debugger, const char *commands)
+{
+    char self[PATH_MAX];
+    struct rusage ru;
+    int fds[2], status, null;
+    double t0, cpu;
+    ssize_t len;
+    pid_t pid;
+
+    len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0 || pipe(fds) < 0)
+        return -1;
+    self[len] = '\0';
+
+    pid = fork();
+    if (pid == 0) {
+        null = open("/dev/null", O_WRONLY);
+        dup2(fds[0], STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        setenv(TEST_DEBUGEE_ENV, "1", 1);
+        execl(debugger, debugger, self, NULL);
+        _exit(127);
+    }
+    close(fds[0]);
+    if (write(fds[1], commands, strlen(commands)) < 0)
+        printf("error: commands not written\n");
+    close(fds[1]);
+
+    t0 = now_sec();
+    while (wait4(pid, &status, WNOHANG, &ru) == 0) {
+        if (now_sec() - t0 > TEST_TIMEOUT_SEC) {
+            kill(pid, SIGKILL);
+            wait4(pid, &status, 0, &ru);
+            printf("%-10s FAIL: still running after %d s\n", name,
+                    TEST_TIMEOUT_SEC);
+            return -1;
+        }
+        usleep(10000);
+    }
+
+    cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+        ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        printf("%-10s FAIL: debugger did not run (%#x)\n", name, status);
+        return -1;
+    }
+    if (cpu > TEST_MAX_CPU_SEC) {
+        printf("%-10s FAIL: %.2f s of CPU in %.2f s\n", name, cpu,
+                now_sec() - t0);
+        return -1;
+    }
+    printf("%-10s ok: %.2f s of CPU in %.2f s\n", name, cpu, now_sec() - t0);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *debugger = argc > 1 ? argv[1] : "./retrobugr";
+    int failed = 0;
+
+    if (getenv(TEST_DEBUGEE_ENV) != NULL)
+        return debugee();
+
+    failed |= run("continue", debugger, "continue\n");
+    failed |= run("non-stop", debugger,
+            "non-stop on\n"
+            "break hot\n"
+            "continue\n"
+            "threads\n"
+            "continue\n"
+            "threads\n"
+            "delete 1\n"
+            "continue\n");
+    return failed ? 1 : 0;
+}